@@ -0,0 +1,52 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#ifdef __linux__
+    #define _POSIX_C_SOURCE 200112L  // for clock_gettime
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "jstarconf.h"
+
+#if defined(JSTAR_WINDOWS)
+    #include <Windows.h>
+#else
+    #include <time.h>
+#endif
+
+// Helpers shared by the benchmark programs
+
+// Wall clock time in seconds, from an arbitrary point in the past
+static inline double benchTime(void) {
+#if defined(JSTAR_WINDOWS)
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+// Parse the optional positive integer argument `argv[i]`, returning `def` if it's missing
+static inline size_t benchArg(int argc, char** argv, int i, size_t def) {
+    if(i >= argc) return def;
+    char* end;
+    long long n = strtoll(argv[i], &end, 10);
+    if(*end != '\0' || n <= 0) {
+        fprintf(stderr, "Invalid argument '%s', expected a positive integer\n", argv[i]);
+        exit(EXIT_FAILURE);
+    }
+    return (size_t)n;
+}
+
+// Print a line of results: the time taken by `ops` operations, and the resulting throughput
+static inline void benchReport(const char* name, size_t ops, double secs) {
+    printf("%-32s %10zu ops %9.3f s %12.2f Mops/s\n", name, ops, secs, ops / secs / 1e6);
+}
+
+#endif
@@ -0,0 +1,119 @@
+// Benchmark of string hashing and interning: the throughput of `hashString` over keys of
+// different lengths, of `copyString` creating new strings and looking up interned ones, and of
+// insertion of string and number keys in a J* Table.
+// Usage: bench_hash [keys]
+
+#include "bench.h"
+
+#include <string.h>
+
+#include "hash.h"
+#include "jstar.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+#define DEFAULT_KEYS 1000000
+#define HASHED_BYTES (64 * 1024 * 1024)
+#define KEY_SIZE     32  // Fits a prefix followed by the digits of any size_t
+
+#define LENGTHS_COUNT 6
+static const size_t keyLengths[LENGTHS_COUNT] = {8, 16, 64, 256, 4096, 1024 * 1024};
+
+static void benchHashString(void) {
+    size_t maxLen = keyLengths[LENGTHS_COUNT - 1];
+    char* data = malloc(maxLen);
+    for(size_t i = 0; i < maxLen; i++) {
+        data[i] = (char)('a' + i % 26);
+    }
+
+    for(int i = 0; i < LENGTHS_COUNT; i++) {
+        size_t len = keyLengths[i], count = HASHED_BYTES / len;
+
+        // Accumulate the hashes so that the calls can't be optimized away
+        volatile uint32_t sink = 0;
+        double start = benchTime();
+        for(size_t j = 0; j < count; j++) {
+            data[0] = (char)j;
+            sink ^= hashString(data, len);
+        }
+        double secs = benchTime() - start;
+
+        char name[64];
+        snprintf(name, sizeof(name), "hashString (%zu bytes)", len);
+        printf("%-32s %10zu ops %9.3f s %12.2f GiB/s\n", name, count, secs,
+               HASHED_BYTES / secs / (1024.0 * 1024 * 1024));
+        (void)sink;
+    }
+
+    free(data);
+}
+
+static void benchCopyString(JStarVM* vm, size_t count) {
+    char* keys = malloc(count * KEY_SIZE);
+    for(size_t i = 0; i < count; i++) {
+        snprintf(keys + i * KEY_SIZE, KEY_SIZE, "key%zu", i);
+    }
+
+    // Keep the strings in a list on the stack, so that they stay interned
+    ObjList* strings = newList(vm, count);
+    push(vm, OBJ_VAL(strings));
+
+    double start = benchTime();
+    for(size_t i = 0; i < count; i++) {
+        const char* key = keys + i * KEY_SIZE;
+        listAppend(vm, strings, OBJ_VAL(copyString(vm, key, strlen(key))));
+    }
+    benchReport("copyString (new)", count, benchTime() - start);
+
+    start = benchTime();
+    for(size_t i = 0; i < count; i++) {
+        const char* key = keys + i * KEY_SIZE;
+        copyString(vm, key, strlen(key));
+    }
+    benchReport("copyString (interned)", count, benchTime() - start);
+
+    pop(vm);
+    free(keys);
+}
+
+static bool evaluate(JStarVM* vm, const char* src) {
+    return jsrEvaluateModule(vm, "<bench>", "bench", src) == JSR_EVAL_SUCCESS;
+}
+
+static bool benchTable(JStarVM* vm, size_t count) {
+    char src[512];
+
+    // Create the keys beforehand, so that only the insertions are measured
+    snprintf(src, sizeof(src),
+             "var keys = []\n"
+             "for var i = 0; i < %zu; i += 1 do keys.add('key%%s' %% (i,)) end\n"
+             "var numbers = []\n"
+             "for var i = 0; i < %zu; i += 1 do numbers.add(i * 1.5) end\n",
+             count, count);
+    if(!evaluate(vm, src)) return false;
+
+    double start = benchTime();
+    if(!evaluate(vm, "var t = {}\nfor var k in keys do t[k] = true end\n")) return false;
+    benchReport("Table insert (String keys)", count, benchTime() - start);
+
+    start = benchTime();
+    if(!evaluate(vm, "var n = {}\nfor var k in numbers do n[k] = true end\n")) return false;
+    benchReport("Table insert (Number keys)", count, benchTime() - start);
+
+    return true;
+}
+
+int main(int argc, char** argv) {
+    size_t keys = benchArg(argc, argv, 1, DEFAULT_KEYS);
+
+    JStarConf conf = jsrGetConf();
+    JStarVM* vm = jsrNewVM(&conf);
+
+    benchHashString();
+    benchCopyString(vm, keys);
+    bool ok = benchTable(vm, keys);
+
+    jsrFreeVM(vm);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
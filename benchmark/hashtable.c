@@ -0,0 +1,161 @@
+// Benchmark of the HashTable used for globals, fields, methods and the string pool. Runs puts,
+// hits and misses, deletes, and random mixes of get/put/delete on a table of interned keys,
+// printing the throughput of each. The mixes keep deleting and reinserting keys, so they also
+// measure the cost of deleted slots on lookups.
+// Usage: bench_hashtable [keys] [ops]
+
+#include "bench.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "hashtable.h"
+#include "jstar.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+#define DEFAULT_KEYS 100000
+#define DEFAULT_OPS  10000000
+#define KEY_SIZE     32  // Fits a prefix followed by the digits of any size_t
+
+typedef struct Mix {
+    const char* name;
+    int get, put;  // Percentage of gets and puts, the rest are deletes
+} Mix;
+
+static const Mix mixes[] = {
+    {"mix 90/5/5 get/put/del", 90, 5},
+    {"mix 50/25/25 get/put/del", 50, 25},
+    {"mix 10/45/45 get/put/del", 10, 45},
+};
+
+static uint64_t nextRandom(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// Create `count` interned strings starting with `prefix`, keeping them alive in a list on the
+// stack. Returns their array
+static ObjString** makeKeys(JStarVM* vm, const char* prefix, size_t count) {
+    ObjList* lst = newList(vm, count);
+    push(vm, OBJ_VAL(lst));
+
+    ObjString** keys = malloc(sizeof(ObjString*) * count);
+    for(size_t i = 0; i < count; i++) {
+        char key[KEY_SIZE];
+        int len = snprintf(key, sizeof(key), "%s%zu", prefix, i);
+        keys[i] = copyString(vm, key, len);
+        listAppend(vm, lst, OBJ_VAL(keys[i]));
+    }
+
+    return keys;
+}
+
+static void benchOps(ObjString** keys, ObjString** missing, size_t count, size_t ops) {
+    HashTable t;
+    initHashTable(&t);
+
+    double start = benchTime();
+    for(size_t i = 0; i < count; i++) {
+        hashTablePut(&t, keys[i], NUM_VAL(i));
+    }
+    benchReport("put (growing)", count, benchTime() - start);
+
+    size_t found = 0;
+    Value val;
+
+    start = benchTime();
+    for(size_t i = 0; i < ops; i++) {
+        found += hashTableGet(&t, keys[i % count], &val);
+    }
+    benchReport("get (hit)", ops, benchTime() - start);
+
+    start = benchTime();
+    for(size_t i = 0; i < ops; i++) {
+        found += hashTableGet(&t, missing[i % count], &val);
+    }
+    benchReport("get (miss)", ops, benchTime() - start);
+
+    start = benchTime();
+    for(size_t i = 0; i < ops; i++) {
+        hashTablePut(&t, keys[i % count], NUM_VAL(i));
+    }
+    benchReport("put (overwrite)", ops, benchTime() - start);
+
+    start = benchTime();
+    for(size_t i = 0; i < count; i++) {
+        hashTableDel(&t, keys[i]);
+    }
+    benchReport("delete", count, benchTime() - start);
+
+    if(found != ops) {
+        fprintf(stderr, "Unexpected number of keys found: %zu instead of %zu\n", found, ops);
+        exit(EXIT_FAILURE);
+    }
+
+    freeHashTable(&t);
+}
+
+static void benchMix(const Mix* mix, ObjString** keys, size_t count, size_t ops) {
+    HashTable t;
+    initHashTable(&t);
+
+    // Start half full, so that the mix finds both present and missing keys
+    for(size_t i = 0; i < count; i += 2) {
+        hashTablePut(&t, keys[i], NUM_VAL(i));
+    }
+
+    uint64_t state = UINT64_C(0x9e3779b97f4a7c15);
+    size_t found = 0;
+    Value val;
+
+    double start = benchTime();
+    for(size_t i = 0; i < ops; i++) {
+        uint64_t r = nextRandom(&state);
+        ObjString* key = keys[(r >> 8) % count];
+        int op = r % 100;
+
+        if(op < mix->get) {
+            found += hashTableGet(&t, key, &val);
+        } else if(op < mix->get + mix->put) {
+            hashTablePut(&t, key, NUM_VAL(i));
+        } else {
+            hashTableDel(&t, key);
+        }
+    }
+    double secs = benchTime() - start;
+
+    benchReport(mix->name, ops, secs);
+    printf("%-32s %zu gets hit, %zu entries left\n", "", found, t.count);
+
+    freeHashTable(&t);
+}
+
+int main(int argc, char** argv) {
+    size_t count = benchArg(argc, argv, 1, DEFAULT_KEYS);
+    size_t ops = benchArg(argc, argv, 2, DEFAULT_OPS);
+
+    JStarConf conf = jsrGetConf();
+    JStarVM* vm = jsrNewVM(&conf);
+
+    ObjString** keys = makeKeys(vm, "key", count);
+    ObjString** missing = makeKeys(vm, "missing", count);
+
+    printf("%zu keys\n", count);
+    benchOps(keys, missing, count, ops);
+    for(size_t i = 0; i < sizeof(mixes) / sizeof(mixes[0]); i++) {
+        benchMix(&mixes[i], keys, count, ops);
+    }
+
+    pop(vm);
+    pop(vm);
+    free(keys);
+    free(missing);
+
+    jsrFreeVM(vm);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,169 @@
+// Scaling benchmark of the 'parallel' module. Runs parallel.map over inputs whose items cost from
+// a few to thousands of J* operations, with the same total amount of work, and compares it with a
+// sequential loop. It then varies the chunk size, and measures parallel.reduce on a large input of
+// cheap items, where the cost of transferring the chunks dominates.
+// The pool of the module has a worker per processor, so the speedup depends on the machine.
+// Usage: bench_parallel [total operations]
+
+#include "bench.h"
+
+#include "jstar.h"
+#include "sync.h"
+
+#define DEFAULT_TOTAL_OPS 4000000
+
+static const char* SOURCE =
+    "import parallel\n"
+    "\n"
+    "fun makeWork(n)\n"
+    "    fun work(x)\n"
+    "        var sum = 0\n"
+    "        for var i = 0; i < n; i += 1 do\n"
+    "            sum += x * i\n"
+    "        end\n"
+    "        return sum\n"
+    "    end\n"
+    "    return work\n"
+    "end\n"
+    "\n"
+    "fun range(n)\n"
+    "    return List(n, |i| => i)\n"
+    "end\n"
+    "\n"
+    "fun add(a, b)\n"
+    "    return a + b\n"
+    "end\n"
+    "\n"
+    "fun addLength(acc, str)\n"
+    "    return acc + #str\n"
+    "end\n"
+    "\n"
+    "fun sequentialMap(fn, items)\n"
+    "    var results = []\n"
+    "    for var x in items do\n"
+    "        results.add(fn(x))\n"
+    "    end\n"
+    "    return results\n"
+    "end\n"
+    "\n"
+    "fun sequentialReduce(fn, items, init)\n"
+    "    var acc = init\n"
+    "    for var x in items do\n"
+    "        acc = fn(acc, x)\n"
+    "    end\n"
+    "    return acc\n"
+    "end\n"
+    "\n"
+    "fun check(results, expected)\n"
+    "    if #results != #expected then\n"
+    "        raise Exception('Expected %s results, got %s' % (#expected, #results))\n"
+    "    end\n"
+    "    for var i = 0; i < #results; i += 1 do\n"
+    "        if results[i] != expected[i] then\n"
+    "            raise Exception('Wrong result at index %s' % (i,))\n"
+    "        end\n"
+    "    end\n"
+    "end\n";
+
+static const size_t itemCosts[] = {1, 10, 100, 1000, 10000};
+static const size_t chunkSizes[] = {1, 16, 256, 4096};
+
+static bool evaluate(JStarVM* vm, const char* src) {
+    return jsrEvaluateModule(vm, "<bench>", "bench", src) == JSR_EVAL_SUCCESS;
+}
+
+// Evaluate `src` returning the time taken, or a negative number on error
+static double timeEvaluate(JStarVM* vm, const char* src) {
+    double start = benchTime();
+    if(!evaluate(vm, src)) return -1;
+    return benchTime() - start;
+}
+
+static bool setup(JStarVM* vm, size_t items, size_t cost) {
+    char src[256];
+    snprintf(src, sizeof(src),
+             "var work = makeWork(%zu)\n"
+             "var items = range(%zu)\n"
+             "var frozen = freeze(items)\n",
+             cost, items);
+    return evaluate(vm, src);
+}
+
+static bool benchMap(JStarVM* vm, size_t totalOps) {
+    printf("%10s %10s %12s %12s %12s %8s\n", "items", "cost", "sequential", "map",
+           "map frozen", "speedup");
+
+    for(size_t i = 0; i < sizeof(itemCosts) / sizeof(itemCosts[0]); i++) {
+        size_t cost = itemCosts[i], items = totalOps / cost;
+        if(!setup(vm, items, cost)) return false;
+
+        double seq = timeEvaluate(vm, "var expected = sequentialMap(work, items)");
+        double map = timeEvaluate(vm, "var results = parallel.map(work, items)");
+        if(seq < 0 || map < 0 || !evaluate(vm, "check(results, expected)")) return false;
+        double frozen = timeEvaluate(vm, "results = parallel.map(work, frozen)");
+        if(frozen < 0 || !evaluate(vm, "check(results, expected)")) return false;
+
+        printf("%10zu %10zu %11.3fs %11.3fs %11.3fs %7.2fx\n", items, cost, seq, map, frozen,
+               seq / map);
+    }
+
+    return true;
+}
+
+static bool benchChunks(JStarVM* vm, size_t totalOps) {
+    size_t cost = itemCosts[2], items = totalOps / cost;
+    if(!setup(vm, items, cost)) return false;
+    if(!evaluate(vm, "var expected = sequentialMap(work, items)")) return false;
+
+    printf("\n%10s %10s %12s\n", "items", "chunk", "map");
+    for(size_t i = 0; i < sizeof(chunkSizes) / sizeof(chunkSizes[0]); i++) {
+        char src[128];
+        snprintf(src, sizeof(src), "var results = parallel.map(work, items, %zu)", chunkSizes[i]);
+
+        double secs = timeEvaluate(vm, src);
+        if(secs < 0 || !evaluate(vm, "check(results, expected)")) return false;
+        printf("%10zu %10zu %11.3fs\n", items, chunkSizes[i], secs);
+    }
+
+    return true;
+}
+
+static bool benchReduce(JStarVM* vm, size_t totalOps) {
+    if(!setup(vm, totalOps, 1)) return false;
+
+    double seq = timeEvaluate(vm, "var expected = sequentialReduce(add, items, 0)");
+    double reduce = timeEvaluate(vm, "var result = parallel.reduce(add, items, 0)");
+    double frozen = timeEvaluate(vm, "var resultFrozen = parallel.reduce(add, frozen, 0)");
+    if(seq < 0 || reduce < 0 || frozen < 0) return false;
+    if(!evaluate(vm, "check([result, resultFrozen], [expected, expected])")) return false;
+
+    // Every chunk is folded from `init`, so the result must not depend on the chunk size, nor on
+    // a fold changing the type of the accumulator when a combine function is given
+    if(!evaluate(vm,
+                 "var names = List(1000, |i| => 'item%s' % (i,))\n"
+                 "check([parallel.reduce(add, items, 0, 1000),\n"
+                 "       parallel.reduce(addLength, names, 0, 10, add)],\n"
+                 "      [expected, sequentialReduce(addLength, names, 0)])\n")) {
+        return false;
+    }
+
+    printf("\n%10s %12s %12s %14s\n", "items", "sequential", "reduce", "reduce frozen");
+    printf("%10zu %11.3fs %11.3fs %13.3fs\n", totalOps, seq, reduce, frozen);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    size_t totalOps = benchArg(argc, argv, 1, DEFAULT_TOTAL_OPS);
+
+    JStarConf conf = jsrGetConf();
+    JStarVM* vm = jsrNewVM(&conf);
+
+    printf("%d processors, %zu total operations\n", processorCount(), totalOps);
+
+    // Start the pool of the module before measuring
+    bool ok = evaluate(vm, SOURCE) && evaluate(vm, "parallel.reduce(add, [1, 2], 0)");
+    ok = ok && benchMap(vm, totalOps) && benchChunks(vm, totalOps) && benchReduce(vm, totalOps);
+
+    jsrFreeVM(vm);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
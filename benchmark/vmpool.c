@@ -0,0 +1,109 @@
+// Throughput benchmark of JStarVMPool. Runs the same batch of short jobs on pools of 1 to 64
+// workers, printing the jobs completed per second along with the queue and latency metrics of
+// the pool. The first line is the same batch run on a single VM without a pool, as a baseline.
+// Usage: bench_vmpool [jobs] [iterations per job]
+
+#include "bench.h"
+
+#include "jstar.h"
+
+#define DEFAULT_JOBS       20000
+#define DEFAULT_ITERATIONS 1000
+
+static const char* MODULE = "bench";
+static const char* FUNCTION = "work";
+
+static const char* SOURCE =
+    "fun work(n)\n"
+    "    var sum = 0\n"
+    "    for var i = 0; i < n; i += 1 do\n"
+    "        sum += i\n"
+    "    end\n"
+    "    return sum\n"
+    "end\n";
+
+static const int threadCounts[] = {1, 2, 4, 8, 16, 32, 64};
+
+static bool initVM(JStarVM* vm, void* userData) {
+    return jsrEvaluateModule(vm, "<bench>", MODULE, SOURCE) == JSR_EVAL_SUCCESS;
+}
+
+static int pushArgs(JStarVM* vm, void* data) {
+    jsrPushNumber(vm, *(size_t*)data);
+    return 1;
+}
+
+static bool benchSingleVM(size_t jobs, size_t iterations) {
+    JStarConf conf = jsrGetConf();
+    JStarVM* vm = jsrNewVM(&conf);
+
+    bool ok = initVM(vm, NULL);
+    double start = benchTime();
+    for(size_t i = 0; ok && i < jobs; i++) {
+        jsrGetGlobal(vm, MODULE, FUNCTION);
+        pushArgs(vm, &iterations);
+        ok = jsrCall(vm, 1) == JSR_EVAL_SUCCESS;
+        jsrPop(vm);
+    }
+    double secs = benchTime() - start;
+
+    jsrFreeVM(vm);
+    if(ok) printf("%8s %12.0f\n", "no pool", jobs / secs);
+    return ok;
+}
+
+static bool benchPool(int threads, size_t jobs, size_t iterations) {
+    JStarPoolConf conf = jsrGetPoolConf();
+    conf.threads = threads;
+    conf.initVM = &initVM;
+
+    double start = benchTime();
+    JStarVMPool* pool = jsrNewVMPool(&conf);
+    if(pool == NULL) {
+        fprintf(stderr, "Cannot create a pool of %d threads\n", threads);
+        return false;
+    }
+    double startup = benchTime() - start;
+
+    JStarJob job = {0};
+    job.module = MODULE;
+    job.function = FUNCTION;
+    job.pushArgs = &pushArgs;
+    job.data = &iterations;
+
+    start = benchTime();
+    for(size_t i = 0; i < jobs; i++) {
+        jsrPoolSubmit(pool, &job);
+    }
+    jsrPoolWait(pool);
+    double secs = benchTime() - start;
+
+    JStarPoolStats stats;
+    jsrPoolGetStats(pool, &stats);
+    jsrFreeVMPool(pool);
+
+    printf("%8d %12.0f %12.3f %10zu %10zu %16.3f\n", threads, jobs / secs, startup * 1e3,
+           stats.stolen, stats.maxQueueDepth, stats.avgLatency * 1e3);
+
+    if(stats.failed != 0) {
+        fprintf(stderr, "%zu jobs failed\n", stats.failed);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    size_t jobs = benchArg(argc, argv, 1, DEFAULT_JOBS);
+    size_t iterations = benchArg(argc, argv, 2, DEFAULT_ITERATIONS);
+
+    printf("%zu jobs of %zu iterations\n", jobs, iterations);
+    printf("%8s %12s %12s %10s %10s %16s\n", "threads", "jobs/s", "startup (ms)", "stolen",
+           "max queue", "avg latency (ms)");
+
+    if(!benchSingleVM(jobs, iterations)) return EXIT_FAILURE;
+    for(size_t i = 0; i < sizeof(threadCounts) / sizeof(threadCounts[0]); i++) {
+        if(!benchPool(threadCounts[i], jobs, iterations)) return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
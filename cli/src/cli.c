@@ -10,7 +10,10 @@
 #include "jstar/parse/parser.h"
 #include "linenoise.h"
 
-#define JSTARPATH "JSTARPATH"
+#define JSTARPATH    "JSTARPATH"
+#define JSTARNOCACHE "JSTARNOCACHE"
+#define SOURCE_EXT   ".jsr"
+#define COMPILED_EXT ".jsc"
 
 static JStarVM* vm;
 
@@ -20,13 +23,16 @@ typedef struct CLIOpts {
     bool skipVersion;
     bool interactive;
     bool ignoreEnv;
+    bool compile;
+    bool prefetch;
     char* execStmt;
     const char** args;
     int argsCount;
 } CLIOpts;
 
-static void initVM(void) {
+static void initVM(bool ignoreEnv) {
     JStarConf conf = jsrGetConf();
+    conf.moduleCache = ignoreEnv || getenv(JSTARNOCACHE) == NULL;
     vm = jsrNewVM(&conf);
 }
 
@@ -35,6 +41,11 @@ static void exitFree(int code) {
     exit(code);
 }
 
+static bool hasExtension(const char* path, const char* ext) {
+    size_t pathLen = strlen(path), extLen = strlen(ext);
+    return pathLen >= extLen && strcmp(path + pathLen - extLen, ext) == 0;
+}
+
 // -----------------------------------------------------------------------------
 // REPL
 // -----------------------------------------------------------------------------
@@ -158,7 +169,7 @@ static void doRepl(CLIOpts* opts) {
 // -----------------------------------------------------------------------------
 
 static JStarResult execScript(const char* script, int argsCount, const char** args,
-                              bool ignoreEnv) {
+                              bool ignoreEnv, bool prefetch) {
     jsrInitCommandLineArgs(vm, argsCount, args);
 
     // set base import path to script's directory
@@ -173,18 +184,68 @@ static JStarResult execScript(const char* script, int argsCount, const char** ar
         initImportPaths("./", ignoreEnv);
     }
 
-    char* src = jsrReadFile(script);
+    size_t len;
+    char* src = jsrReadFileSz(script, &len);
     if(src == NULL) {
         fprintf(stderr, "Error reading script ");
         perror(script);
         exitFree(EXIT_FAILURE);
     }
 
-    JStarResult res = jsrEvaluate(vm, script, src);
+    JStarResult res;
+    if(hasExtension(script, COMPILED_EXT)) {
+        res = jsrLoadBytecode(vm, script, src, len);
+    } else {
+        if(prefetch) jsrPrefetchImports(vm, script, src);
+        res = jsrEvaluate(vm, script, src);
+    }
+
     free(src);
     return res;
 }
 
+// -----------------------------------------------------------------------------
+// SCRIPT COMPILATION
+// -----------------------------------------------------------------------------
+
+// Compile `script` to bytecode, writing it in a file with the same name and the .jsc extension
+static JStarResult compileScript(const char* script) {
+    char* src = jsrReadFile(script);
+    if(src == NULL) {
+        fprintf(stderr, "Error reading script ");
+        perror(script);
+        exitFree(EXIT_FAILURE);
+    }
+
+    JStarBuffer compiled;
+    JStarResult res = jsrSerialize(vm, script, src, &compiled);
+    free(src);
+
+    if(res != JSR_EVAL_SUCCESS) return res;
+
+    size_t nameLen = strlen(script);
+    if(hasExtension(script, SOURCE_EXT)) nameLen -= strlen(SOURCE_EXT);
+
+    char* outPath = malloc(nameLen + strlen(COMPILED_EXT) + 1);
+    memcpy(outPath, script, nameLen);
+    strcpy(outPath + nameLen, COMPILED_EXT);
+
+    FILE* out = fopen(outPath, "wb");
+    if(out == NULL || fwrite(compiled.data, 1, compiled.len, out) != compiled.len) {
+        fprintf(stderr, "Error writing compiled file ");
+        perror(outPath);
+        if(out) fclose(out);
+        free(outPath);
+        jsrBufferFree(&compiled);
+        exitFree(EXIT_FAILURE);
+    }
+
+    fclose(out);
+    free(outPath);
+    jsrBufferFree(&compiled);
+    return JSR_EVAL_SUCCESS;
+}
+
 // -----------------------------------------------------------------------------
 // MAIN FUNCTION AND ARGUMENT PARSE
 // -----------------------------------------------------------------------------
@@ -205,7 +266,14 @@ static CLIOpts parseArguments(int argc, const char** argv) {
         OPT_BOOLEAN('i', "interactive", &opts.interactive,
                     "Enter the REPL after executing 'script' and/or '-e' statement", NULL, 0, 0),
         OPT_BOOLEAN('E', "ignore-env", &opts.ignoreEnv,
-                    "Ignore environment variables such as JSTARPATH", NULL, 0, 0),
+                    "Ignore environment variables such as JSTARPATH and JSTARNOCACHE", NULL, 0,
+                    0),
+        OPT_BOOLEAN('c', "compile", &opts.compile,
+                    "Compile 'script' to bytecode, writing it to a .jsc file, and exit", NULL, 0,
+                    0),
+        OPT_BOOLEAN('p', "prefetch", &opts.prefetch,
+                    "Parse the modules imported by 'script' in parallel before executing it",
+                    NULL, 0, 0),
         OPT_END(),
     };
 
@@ -236,18 +304,27 @@ int main(int argc, const char** argv) {
         exit(EXIT_SUCCESS);
     }
 
-    initVM();
+    initVM(opts.ignoreEnv);
+
+    if(opts.compile) {
+        if(!opts.script) {
+            fprintf(stderr, "No script to compile\n");
+            exitFree(EXIT_FAILURE);
+        }
+        exitFree(compileScript(opts.script));
+    }
 
     if(opts.execStmt) {
         JStarResult res = jsrEvaluate(vm, "<string>", opts.execStmt);
         if(opts.script && res == JSR_EVAL_SUCCESS) {
-            res = execScript(opts.script, opts.argsCount, opts.args, opts.ignoreEnv);
+            res = execScript(opts.script, opts.argsCount, opts.args, opts.ignoreEnv, opts.prefetch);
         }
         if(!opts.interactive) exitFree(res);
     }
 
     if(opts.script && !opts.execStmt) {
-        JStarResult res = execScript(opts.script, opts.argsCount, opts.args, opts.ignoreEnv);
+        JStarResult res = execScript(opts.script, opts.argsCount, opts.args, opts.ignoreEnv,
+                                     opts.prefetch);
         if(!opts.interactive) exitFree(res);
     }
 
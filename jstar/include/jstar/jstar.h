@@ -39,11 +39,18 @@
 // The J* virtual machine
 typedef struct JStarVM JStarVM;
 
+// Dynamic buffer, see JSTARBUFFER API below
+typedef struct JStarBuffer JStarBuffer;
+
+// A name interned with jsrInternName, see REFERENCES AND NAMES below
+typedef struct JStarName JStarName;
+
 typedef enum JStarResult {
-    JSR_EVAL_SUCCESS,  // The VM successfully executed the code
-    JSR_SYNTAX_ERR,    // A syntax error has been encountered in parsing
-    JSR_COMPILE_ERR,   // An error has been encountered during compilation
-    JSR_RUNTIME_ERR,   // An unhandled exception has reached the top of the stack
+    JSR_EVAL_SUCCESS,     // The VM successfully executed the code
+    JSR_SYNTAX_ERR,       // A syntax error has been encountered in parsing
+    JSR_COMPILE_ERR,      // An error has been encountered during compilation
+    JSR_RUNTIME_ERR,      // An unhandled exception has reached the top of the stack
+    JSR_DESERIALIZE_ERR,  // Compiled code is malformed or was produced by another J* version
 } JStarResult;
 
 // J* error function callback. Called when syntax or compilation errors are encountered.
@@ -59,6 +66,8 @@ typedef struct JstarConf {
     size_t initGC;               // first GC threshold point
     int heapGrowRate;            // The rate at which the heap will grow after a succesful GC
     JStarErrorCB errorCallback;  // Error callback
+    bool moduleCache;            // Cache compiled modules in a __jscache__ directory beside them
+    bool shareCode;              // Share compiled module bytecode with the other VMs of the process
 } JStarConf;
 
 // Retuns a JStarConf initialized with default values
@@ -69,6 +78,26 @@ JSTAR_API JStarVM* jsrNewVM(JStarConf* conf);
 // Free a previously obtained VM along with all the state
 JSTAR_API void jsrFreeVM(JStarVM* vm);
 
+// Create a new VM by deep-copying the heap of an initialized one, used as a template. The clone
+// gets its own copy of all loaded modules, classes, interned strings and globals, so that the two
+// VMs are fully independent. Cloning a VM is much faster than creating a new one and importing
+// the same modules again. Compiled bytecode is immutable, and thus shared between the VMs.
+// The template must not be executing code. It's never modified, so it can be cloned concurrently
+// by multiple threads. Native extension libraries loaded by the template stay owned by it, so it
+// must outlive its clones if it loaded any.
+// References (jsrRef), interned names (jsrInternName) and scripts (jsrCompile) of the template
+// are not carried over: they can only be used with the VM that created them, so they must be
+// created again on the clone if needed.
+// Returns NULL if the heap contains Userdata with a finalizer, that cannot be safely copied, or
+// if hashing a Table key raised an exception.
+JSTAR_API JStarVM* jsrCloneVM(JStarVM* vm);
+
+// Release the process wide cache of compiled module code used by VMs created with
+// `conf.shareCode` set. VMs that imported modules from the cache remain valid, as they keep a
+// reference to the bytecode they're using. Safe to call while other threads are importing
+// modules: entries in use are freed once they're done with them.
+JSTAR_API void jsrClearCodeCache(void);
+
 // Evaluate J* code in the context of module (or __main__ in jsrEvaluate)
 // as top level <main> function.
 // VM_EVAL_SUCCSESS will be returned if the execution completed normally.
@@ -79,6 +108,40 @@ JSTAR_API JStarResult jsrEvaluate(JStarVM* vm, const char* path, const char* src
 JSTAR_API JStarResult jsrEvaluateModule(JStarVM* vm, const char* path, const char* name,
                                         const char* src);
 
+// Compile J* code and serialize the resulting bytecode in `out`, that gets initialized by this
+// function. The serialized code can be stored (conventionally in a .jsc file) and later executed
+// with jsrLoadBytecode, skipping parsing and compilation. Compiled files are also picked up by
+// `import`, that prefers them over .jsr ones unless the source has been modified after them.
+// As with jsrLoadBytecode their code is not verified, so import paths must only contain trusted
+// compiled files.
+// Returns JSR_EVAL_SUCCESS on success, JSR_SYNTAX_ERR or JSR_COMPILE_ERR on error. On success
+// the caller must free `out` with jsrBufferFree.
+JSTAR_API JStarResult jsrSerialize(JStarVM* vm, const char* path, const char* src,
+                                   JStarBuffer* out);
+
+// Execute code serialized with jsrSerialize in the context of module (or __main__ in
+// jsrLoadBytecode). Same as jsrEvaluate, but returns JSR_DESERIALIZE_ERR if `code` is malformed
+// or has been produced by an incompatible version of J*. The bytecode is not verified, so only
+// trusted code should be loaded.
+JSTAR_API JStarResult jsrLoadBytecode(JStarVM* vm, const char* path, const char* code, size_t len);
+JSTAR_API JStarResult jsrLoadBytecodeModule(JStarVM* vm, const char* path, const char* name,
+                                            const char* code, size_t len);
+
+// J* code compiled once by jsrCompile, that can be executed many times with jsrExecute
+typedef struct JStarScript JStarScript;
+
+// Compile J* code without executing it. Returns NULL in case of syntax or compilation errors,
+// that are forwarded to the error callback.
+// The script is pinned: the VM keeps its code alive across garbage collections until the script
+// is freed with jsrFreeScript. Scripts that are not freed are released along with their VM
+JSTAR_API JStarScript* jsrCompile(JStarVM* vm, const char* path, const char* src);
+// Execute a script in the context of module, that gets created if it doesn't exist. Returns the
+// same results as jsrEvaluateModule, without parsing nor compiling the code again. The first
+// execution in a module other than __main__ binds a copy of the script to it, that shares the
+// bytecode of the original
+JSTAR_API JStarResult jsrExecute(JStarVM* vm, JStarScript* script, const char* module);
+JSTAR_API void jsrFreeScript(JStarVM* vm, JStarScript* script);
+
 // Call a function (or method with name "name") that sits on the top of the stack
 // along with its arguments. The state of the stack when calling should be:
 //  ... [callable][arg1][arg2]...[argn] $top
@@ -94,6 +157,7 @@ JSTAR_API JStarResult jsrEvaluateModule(JStarVM* vm, const char* path, const cha
 // The exception will be placed on top of the stack as a result.
 JSTAR_API JStarResult jsrCall(JStarVM* vm, uint8_t argc);
 JSTAR_API JStarResult jsrCallMethod(JStarVM* vm, const char* name, uint8_t argc);
+JSTAR_API JStarResult jsrCallMethodH(JStarVM* vm, JStarName* name, uint8_t argc);
 
 // Prints the the stacktrace of the exception at slot 'slot'. If the value at 'slot' is not an
 // Exception, or is a non-yet-raised Exception, it doesn't print anything ad returns successfully
@@ -107,6 +171,15 @@ JSTAR_API void jsrGetStacktrace(JStarVM* vm, int slot);
 JSTAR_API void jsrInitCommandLineArgs(JStarVM* vm, int argc, const char** argv);
 // Add a path to be searched during module imports
 JSTAR_API void jsrAddImportPath(JStarVM* vm, const char* path);
+// The VM caches the listings of the directories searched for imports. New modules are found, as
+// a listing is refreshed when its directory changes, but removed ones are only forgotten once the
+// listings are discarded by calling this
+JSTAR_API void jsrInvalidateImportCache(JStarVM* vm);
+// Find the modules transitively imported by the J* code `src` and parse them in parallel on a
+// pool of threads, so that their import only needs to compile them. Blocks until done. Should be
+// called before executing `src`, after setting up the import paths. Modules that fail to parse
+// are skipped, and their errors get reported by the import itself.
+JSTAR_API void jsrPrefetchImports(JStarVM* vm, const char* path, const char* src);
 
 // Raises the axception at 'slot'. If the object at 'slot' is not an exception instance it
 // raises a type exception
@@ -117,6 +190,68 @@ JSTAR_API void jsrRaiseException(JStarVM* vm, int slot);
 // If "cls" cannot be found in current module a NameException is raised instead.
 JSTAR_API void jsrRaise(JStarVM* vm, const char* cls, const char* err, ...);
 
+// -----------------------------------------------------------------------------
+// VM POOL
+// -----------------------------------------------------------------------------
+
+// A pool of worker threads, each one owning a VM, that run jobs submitted by the embedder.
+// All the VMs are cloned from a template VM initialized once with `JStarPoolConf.initVM`.
+// Jobs are spread over the per-worker queues, and idle workers steal jobs queued on busy ones.
+typedef struct JStarVMPool JStarVMPool;
+
+typedef struct JStarPoolConf {
+    int threads;        // Number of workers (and VMs), 0 to use one per processor
+    int jobsPerVM;      // Jobs a VM runs before being replaced by a fresh clone, 0 to never replace
+    JStarConf vmConf;   // Configuration of the template VM
+    // Called on the template VM before cloning it. Use it to add import paths and to import the
+    // modules needed by the jobs, so that they don't have to be imported again by every VM.
+    // References, names and scripts created here don't reach the workers (see jsrCloneVM).
+    // Returning false makes jsrNewVMPool fail. Can be NULL
+    bool (*initVM)(JStarVM* vm, void* userData);
+    void* userData;
+} JStarPoolConf;
+
+// A call of the global function `function` of `module`, imported if needed
+typedef struct JStarJob {
+    const char* module;
+    const char* function;
+    // Push the arguments of the call on the stack of `vm`, returning their number. Can be NULL
+    int (*pushArgs)(JStarVM* vm, void* data);
+    // Called on the worker thread once the call completes, with its result (or the exception in
+    // case of JSR_RUNTIME_ERR) on top of the stack of `vm`. Can be NULL
+    void (*done)(JStarVM* vm, JStarResult res, void* data);
+    void* data;
+} JStarJob;
+
+typedef struct JStarPoolStats {
+    size_t submitted;       // Jobs submitted since the creation of the pool
+    size_t completed;       // Jobs completed, failed ones included
+    size_t failed;          // Jobs that didn't return JSR_EVAL_SUCCESS
+    size_t stolen;          // Jobs run by a worker other than the one they were queued on
+    size_t queueDepth;      // Jobs currently waiting for a worker
+    size_t maxQueueDepth;   // Highest queueDepth reached
+    double avgWait, maxWait;        // Seconds between the submission and the start of a job
+    double avgLatency, maxLatency;  // Seconds between the submission and the completion of a job
+} JStarPoolStats;
+
+// Retuns a JStarPoolConf initialized with default values
+JSTAR_API JStarPoolConf jsrGetPoolConf(void);
+
+// Create the template VM and the workers of the pool. Returns NULL if the template couldn't be
+// initialized or cloned (see jsrCloneVM). If threads aren't supported jobs run on the submitting
+// thread, in jsrPoolSubmit.
+JSTAR_API JStarVMPool* jsrNewVMPool(const JStarPoolConf* conf);
+// Wait for all submitted jobs to complete, then free the pool along with its VMs
+JSTAR_API void jsrFreeVMPool(JStarVMPool* pool);
+
+// Queue a job on the pool. The strings of the job must stay valid until it completes.
+// Can be called from any thread, including the workers from the `done` callback.
+JSTAR_API void jsrPoolSubmit(JStarVMPool* pool, const JStarJob* job);
+// Block until all submitted jobs have completed
+JSTAR_API void jsrPoolWait(JStarVMPool* pool);
+// Get a snapshot of the metrics of the pool
+JSTAR_API void jsrPoolGetStats(JStarVMPool* pool, JStarPoolStats* stats);
+
 // -----------------------------------------------------------------------------
 // UTILITY FUNCTIONS AND DEFINITIONS
 // -----------------------------------------------------------------------------
@@ -148,6 +283,8 @@ typedef bool (*JStarNative)(JStarVM* vm);
 // Read a whole file. The returned buffer is malloc'd, so the user should free() it when done.
 // On error returns NULL and sets errno to the appropriate error.
 JSTAR_API char* jsrReadFile(const char* path);
+// Same as jsrReadFile, but also returns the size of the file in `size`. Useful for binary files
+JSTAR_API char* jsrReadFileSz(const char* path, size_t* size);
 
 // -----------------------------------------------------------------------------
 // NATIVE REGISTRY
@@ -223,6 +360,27 @@ JSTAR_API bool jsrNext(JStarVM* vm, int iterable, int res);
         jsrPop(vm);                              \
     }
 
+// -----------------------------------------------------------------------------
+// REFERENCES AND NAMES
+// -----------------------------------------------------------------------------
+
+// A persistent reference to a value, that keeps it alive across garbage collections. Use it to
+// hold on J* values (for example callbacks) from C code between calls into the VM
+typedef struct JStarRef JStarRef;
+
+// Create a reference to the value at 'slot'. The reference is valid until jsrUnref is called on
+// it, or the VM is freed
+JSTAR_API JStarRef* jsrRef(JStarVM* vm, int slot);
+JSTAR_API void jsrUnref(JStarVM* vm, JStarRef* ref);
+// Push the referenced value on top of the stack
+JSTAR_API void jsrPushRef(JStarVM* vm, JStarRef* ref);
+
+// Intern 'name' once, returning a token that can be passed to the *H variants of the field,
+// global and method call functions. These are the same as the plain ones, but skip the hashing
+// and interning of the name on every call.
+// The token is valid for the lifetime of the VM, and can only be used with the VM that created it
+JSTAR_API JStarName* jsrInternName(JStarVM* vm, const char* name);
+
 // -----------------------------------------------------------------------------
 // C TO J* CONVERTING FUNCTIONS
 // -----------------------------------------------------------------------------
@@ -238,6 +396,11 @@ JSTAR_API void jsrPushNull(JStarVM* vm);
 JSTAR_API void jsrPushList(JStarVM* vm);
 JSTAR_API void jsrPushTuple(JStarVM* vm, size_t size);
 JSTAR_API void jsrPushTable(JStarVM* vm);
+// Push a List of `count` Numbers or Strings, presized to hold them
+JSTAR_API void jsrPushNumberList(JStarVM* vm, const double* numbers, size_t count);
+JSTAR_API void jsrPushStringList(JStarVM* vm, const char** strings, size_t count);
+// Push a Tuple of the `count` values starting at 'slot', without popping them
+JSTAR_API void jsrTupleFromSlots(JStarVM* vm, int slot, size_t count);
 JSTAR_API void jsrPushValue(JStarVM* vm, int slot);
 JSTAR_API void* jsrPushUserdata(JStarVM* vm, size_t size, void (*finalize)(void*));
 JSTAR_API void jsrPushNative(JStarVM* vm, const char* module, const char* name, JStarNative nat,
@@ -279,6 +442,10 @@ JSTAR_API void jsrListInsert(JStarVM* vm, size_t i, int slot);
 JSTAR_API void jsrListRemove(JStarVM* vm, size_t i, int slot);
 JSTAR_API void jsrListGet(JStarVM* vm, size_t i, int slot);
 JSTAR_API size_t jsrListGetLength(JStarVM* vm, int slot);
+// Copy the elements of the List at 'slot' in `out`, that must have room for jsrListGetLength
+// doubles. Returns false, leaving a TypeException on top of the stack, if an element is not a
+// Number. In that case `out` is left partially written
+JSTAR_API bool jsrListToDoubles(JStarVM* vm, int slot, double* out);
 
 // -----------------------------------------------------------------------------
 // TUPLE MANIPULATION FUNCTIONS
@@ -298,12 +465,14 @@ JSTAR_API size_t jsrTupleGetLength(JStarVM* vm, int slot);
 // Returns true in case of success, false otherwise leaving an
 // exception on top of the stack
 JSTAR_API bool jsrSetField(JStarVM* vm, int slot, const char* name);
+JSTAR_API bool jsrSetFieldH(JStarVM* vm, int slot, JStarName* name);
 
 // Get the field "name" of the value at "slot".
 // Returns true in case of success leaving the result on
 // top of the stack, false otherwise leaving an exception
 // on top of the stack.
 JSTAR_API bool jsrGetField(JStarVM* vm, int slot, const char* name);
+JSTAR_API bool jsrGetFieldH(JStarVM* vm, int slot, JStarName* name);
 
 // -----------------------------------------------------------------------------
 // MODULE MANIPULATION FUNCTIONS
@@ -314,6 +483,7 @@ JSTAR_API bool jsrGetField(JStarVM* vm, int slot, const char* name);
 // If calling inside a native function module can be NULL, and
 // the used module will be the current one
 JSTAR_API void jsrSetGlobal(JStarVM* vm, const char* module, const char* name);
+JSTAR_API void jsrSetGlobalH(JStarVM* vm, JStarName* module, JStarName* name);
 
 // Get the global "name" of the module "mname".
 // Returns true in case of success leaving the result on the
@@ -322,6 +492,7 @@ JSTAR_API void jsrSetGlobal(JStarVM* vm, const char* module, const char* name);
 // If calling inside a native function module can be NULL, and
 // the used module will be the current one
 JSTAR_API bool jsrGetGlobal(JStarVM* vm, const char* module, const char* name);
+JSTAR_API bool jsrGetGlobalH(JStarVM* vm, JStarName* module, JStarName* name);
 
 // -----------------------------------------------------------------------------
 // CLASS MANIPULATION FUNCTIONS
@@ -389,12 +560,12 @@ JSTAR_API size_t jsrCheckIndexNum(JStarVM* vm, double num, size_t max);
 // This memory is owned by J*, but cannot be collected until the buffer
 // is pushed on the stack using the jsrBufferPush method.
 // Used for efficient creation of Strings in the native API.
-typedef struct JStarBuffer {
+struct JStarBuffer {
     JStarVM* vm;
     size_t size;
     size_t len;
     char* data;
-} JStarBuffer;
+};
 
 JSTAR_API void jsrBufferInit(JStarVM* vm, JStarBuffer* b);
 JSTAR_API void jsrBufferInitSz(JStarVM* vm, JStarBuffer* b, size_t size);
@@ -40,6 +40,7 @@ typedef enum JStarExprType {
     JSR_TERNARY,
     JSR_COMPUND_ASS,
     JSR_FUNC_LIT,
+    JSR_YIELD,
 } JStarExprType;
 
 struct JStarExpr {
@@ -103,6 +104,9 @@ struct JStarExpr {
             JStarIdentifier name;
             JStarExpr* args;
         } sup;
+        struct {
+            JStarExpr* expr;
+        } yield;
         double num;
         bool boolean;
         Vector list;
@@ -131,6 +135,7 @@ JSTAR_API JStarExpr* jsrTupleLiteral(int line, JStarExpr* exprs);
 JSTAR_API JStarExpr* jsrArrLiteral(int line, JStarExpr* exprs);
 JSTAR_API JStarExpr* jsrNumLiteral(int line, double num);
 JSTAR_API JStarExpr* jsrNullLiteral(int line);
+JSTAR_API JStarExpr* jsrYieldExpr(int line, JStarExpr* expr);
 JSTAR_API void jsrExprFree(JStarExpr* e);
 
 typedef enum StmtType {
@@ -191,6 +196,7 @@ struct JStarStmt {
             JStarIdentifier id;
             Vector formalArgs, defArgs;
             bool isVararg;
+            bool isGenerator;
             JStarStmt* body;
         } funcDecl;
         struct {
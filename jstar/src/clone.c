@@ -0,0 +1,477 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "code.h"
+#include "frozen.h"
+#include "gc.h"
+#include "hash.h"
+#include "hashtable.h"
+#include "jstar.h"
+#include "object.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+
+/**
+ * Implementation of jsrCloneVM.
+ * The heap reachable from the roots of the template VM is copied to a new VM, much like a
+ * copying garbage collector would do. Copied objects are recorded in a forwarding table, mapping
+ * every object of the template to its copy, so that cycles and shared references are preserved.
+ * Copies are first created as verbatim copies of the originals, and then fixed up by copying the
+ * arrays they own and by replacing all the references they hold with the forwarded ones.
+ * The template is never modified, so multiple threads can clone it at the same time.
+ */
+
+typedef struct Forward {
+    Obj* from;
+    Obj* to;
+} Forward;
+
+typedef struct Cloner {
+    JStarVM *vm, *clone;
+    // Forwarding table, an open addressing hash table of template objects
+    Forward* forwards;
+    size_t forwardsMask;
+    // Template objects whose copy hasn't been fixed up yet
+    Obj** pending;
+    size_t pendingCount, pendingCapacity;
+    // Cloned tables whose keys need to be rehashed once the heap is copied
+    ObjTable** rehash;
+    size_t rehashCount, rehashCapacity;
+    // Whether an object that cannot be cloned has been found
+    bool failed;
+} Cloner;
+
+static Obj* forward(Cloner* c, Obj* o);
+
+static Value forwardValue(Cloner* c, Value v) {
+    return IS_OBJ(v) ? OBJ_VAL(forward(c, AS_OBJ(v))) : v;
+}
+
+#define FORWARD(c, o) ((void*)forward(c, (Obj*)(o)))
+
+static void appendPtr(void*** arr, size_t* count, size_t* capacity, void* ptr) {
+    if(*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        *arr = realloc(*arr, sizeof(void*) * *capacity);
+    }
+    (*arr)[(*count)++] = ptr;
+}
+
+// -----------------------------------------------------------------------------
+// OBJECT COPYING
+// -----------------------------------------------------------------------------
+
+static size_t objectSize(Obj* o) {
+    switch(o->type) {
+    case OBJ_STRING:
+        return sizeof(ObjString);
+    case OBJ_NATIVE:
+        return sizeof(ObjNative);
+    case OBJ_FUNCTION:
+        return sizeof(ObjFunction);
+    case OBJ_CLASS:
+        return sizeof(ObjClass);
+    case OBJ_INST:
+        return sizeof(ObjInstance);
+    case OBJ_MODULE:
+        return sizeof(ObjModule);
+    case OBJ_LIST:
+        return sizeof(ObjList);
+    case OBJ_BOUND_METHOD:
+        return sizeof(ObjBoundMethod);
+    case OBJ_STACK_TRACE:
+        return sizeof(ObjStackTrace);
+    case OBJ_CLOSURE:
+        return sizeof(ObjClosure) + sizeof(ObjUpvalue*) * ((ObjClosure*)o)->upvalueCount;
+    case OBJ_UPVALUE:
+        return sizeof(ObjUpvalue);
+    case OBJ_TUPLE:
+        return sizeof(ObjTuple) + sizeof(Value) * ((ObjTuple*)o)->size;
+    case OBJ_TABLE:
+        return sizeof(ObjTable);
+    case OBJ_USERDATA:
+        return sizeof(ObjUserdata) + ((ObjUserdata*)o)->size;
+    case OBJ_WEAK_REF:
+        return sizeof(ObjWeakRef);
+    case OBJ_GENERATOR:
+        return sizeof(ObjGenerator);
+    case OBJ_FIBER:
+        return sizeof(ObjFiber);
+    }
+    UNREACHABLE();
+    return 0;
+}
+
+// Create a verbatim copy of `o` in the clone, and schedule it for fix up
+static Obj* copyObject(Cloner* c, Obj* o) {
+    size_t size = objectSize(o);
+    Obj* copy = GC_ALLOC(c->clone, size);
+    memcpy(copy, o, size);
+    copy->reached = false;
+    copy->next = c->clone->objects;
+    c->clone->objects = copy;
+
+    appendPtr((void***)&c->pending, &c->pendingCount, &c->pendingCapacity, o);
+    return copy;
+}
+
+static Obj* forward(Cloner* c, Obj* o) {
+    if(o == NULL) return NULL;
+
+    // Frozen objects are shared, the clone only needs a reference to their region
+    if(o->frozen) {
+        frozenSetAdd(&c->clone->frozen, frozenRegion(o));
+        return o;
+    }
+
+    size_t i = (size_t)hash64((uint64_t)(uintptr_t)o) & c->forwardsMask;
+    for(;;) {
+        Forward* f = &c->forwards[i];
+        if(f->from == o) return f->to;
+        if(f->from == NULL) {
+            f->from = o;
+            f->to = copyObject(c, o);
+            return f->to;
+        }
+        i = (i + 1) & c->forwardsMask;
+    }
+}
+
+static void forwardEntry(Entry* e, void* ctx) {
+    Cloner* c = ctx;
+    e->key = FORWARD(c, e->key);
+    e->value = forwardValue(c, e->value);
+}
+
+static Value* copyValues(Cloner* c, Value* values, size_t count, size_t capacity) {
+    if(values == NULL) return NULL;
+    Value* copy = GC_ALLOC(c->clone, sizeof(Value) * capacity);
+    for(size_t i = 0; i < count; i++) {
+        copy[i] = forwardValue(c, values[i]);
+    }
+    return copy;
+}
+
+static void fixCommon(Cloner* c, FnCommon* copy, FnCommon* fn) {
+    copy->defaults = copyValues(c, fn->defaults, fn->defaultc, fn->defaultc);
+    copy->module = FORWARD(c, fn->module);
+    copy->name = FORWARD(c, fn->name);
+}
+
+static void fixFunction(Cloner* c, ObjFunction* copy, ObjFunction* fn) {
+    fixCommon(c, &copy->c, &fn->c);
+
+    // Bytecode is immutable, share it with the template
+    shareCode(&copy->code, &fn->code);
+
+    ValueArray *consts = &fn->code.consts, *constsCopy = &copy->code.consts;
+    if(consts->count == 0) return;
+
+    constsCopy->arr = malloc(sizeof(Value) * consts->count);
+    constsCopy->size = constsCopy->count = consts->count;
+    for(int i = 0; i < consts->count; i++) {
+        constsCopy->arr[i] = forwardValue(c, consts->arr[i]);
+    }
+}
+
+static void fixTable(Cloner* c, ObjTable* copy, ObjTable* t) {
+    if(t->entries == NULL) return;
+
+    size_t indexSize = t->sizeMask + 1;
+    size_t blockSize = tableBlockSize(indexSize, t->capacity);
+    size_t indexBytes = indexSize * tableIndexWidth(indexSize);
+
+    copy->index = GC_ALLOC(c->clone, blockSize);
+    memcpy(copy->index, t->index, blockSize);
+    copy->entries = (TableEntry*)((char*)copy->index + indexBytes);
+
+    bool rehash = false;
+    for(size_t i = 0; i < copy->numEntries; i++) {
+        TableEntry* e = &copy->entries[i];
+        if(IS_NULL(e->key)) continue;
+
+        // Only Strings, Numbers, Booleans and immutable Tuples are guaranteed to keep their hash,
+        // all other keys could be hashed by identity
+        Value key = e->key;
+        if(IS_OBJ(key) && !IS_STRING(key) && !(IS_TUPLE(key) && AS_TUPLE(key)->hash != 0)) {
+            rehash = true;
+        }
+
+        e->key = forwardValue(c, key);
+        e->val = forwardValue(c, e->val);
+    }
+
+    if(rehash) {
+        appendPtr((void***)&c->rehash, &c->rehashCount, &c->rehashCapacity, copy);
+    }
+}
+
+static void fixObject(Cloner* c, Obj* o) {
+    Obj* copy = forward(c, o);
+    copy->cls = FORWARD(c, o->cls);
+
+    switch(o->type) {
+    case OBJ_STRING: {
+        ObjString *s = (ObjString*)o, *sc = (ObjString*)copy;
+        sc->data = GC_ALLOC(c->clone, s->length + 1);
+        memcpy(sc->data, s->data, s->length + 1);
+        break;
+    }
+    case OBJ_NATIVE: {
+        fixCommon(c, &((ObjNative*)copy)->c, &((ObjNative*)o)->c);
+        break;
+    }
+    case OBJ_FUNCTION: {
+        fixFunction(c, (ObjFunction*)copy, (ObjFunction*)o);
+        break;
+    }
+    case OBJ_CLASS: {
+        ObjClass *cls = (ObjClass*)o, *cc = (ObjClass*)copy;
+        cc->name = FORWARD(c, cls->name);
+        cc->superCls = FORWARD(c, cls->superCls);
+        hashTableCopy(&cc->methods, &cls->methods, forwardEntry, c);
+        break;
+    }
+    case OBJ_INST: {
+        hashTableCopy(&((ObjInstance*)copy)->fields, &((ObjInstance*)o)->fields, forwardEntry, c);
+        break;
+    }
+    case OBJ_MODULE: {
+        ObjModule *m = (ObjModule*)o, *mc = (ObjModule*)copy;
+        mc->name = FORWARD(c, m->name);
+        hashTableCopy(&mc->globals, &m->globals, forwardEntry, c);
+        // The native library stays owned by the template, only its registry is shared
+        mc->natives.dynlib = NULL;
+        mc->natives.index = NULL;
+        break;
+    }
+    case OBJ_LIST: {
+        ObjList *l = (ObjList*)o, *lc = (ObjList*)copy;
+        lc->arr = copyValues(c, l->arr, l->count, l->size);
+        break;
+    }
+    case OBJ_BOUND_METHOD: {
+        ObjBoundMethod *b = (ObjBoundMethod*)o, *bc = (ObjBoundMethod*)copy;
+        bc->bound = forwardValue(c, b->bound);
+        bc->method = forward(c, b->method);
+        break;
+    }
+    case OBJ_STACK_TRACE: {
+        ObjStackTrace *st = (ObjStackTrace*)o, *stc = (ObjStackTrace*)copy;
+        if(st->records == NULL) break;
+        stc->records = GC_ALLOC(c->clone, sizeof(FrameRecord) * st->recordSize);
+        for(int i = 0; i < st->recordCount; i++) {
+            stc->records[i].line = st->records[i].line;
+            stc->records[i].moduleName = FORWARD(c, st->records[i].moduleName);
+            stc->records[i].funcName = FORWARD(c, st->records[i].funcName);
+        }
+        break;
+    }
+    case OBJ_CLOSURE: {
+        ObjClosure *cl = (ObjClosure*)o, *clc = (ObjClosure*)copy;
+        clc->fn = FORWARD(c, cl->fn);
+        for(int i = 0; i < cl->upvalueCount; i++) {
+            clc->upvalues[i] = FORWARD(c, cl->upvalues[i]);
+        }
+        break;
+    }
+    case OBJ_UPVALUE: {
+        // The template is not executing, so all of its upvalues are closed
+        ObjUpvalue *u = (ObjUpvalue*)o, *uc = (ObjUpvalue*)copy;
+        ASSERT(u->addr == &u->closed, "Cannot clone open upvalue");
+        uc->closed = forwardValue(c, u->closed);
+        uc->addr = &uc->closed;
+        uc->next = NULL;
+        break;
+    }
+    case OBJ_TUPLE: {
+        ObjTuple *t = (ObjTuple*)o, *tc = (ObjTuple*)copy;
+        for(size_t i = 0; i < t->size; i++) {
+            tc->arr[i] = forwardValue(c, t->arr[i]);
+        }
+        break;
+    }
+    case OBJ_TABLE: {
+        fixTable(c, (ObjTable*)copy, (ObjTable*)o);
+        break;
+    }
+    case OBJ_USERDATA: {
+        // The data is opaque: running the finalizer on both copies would free it twice
+        ObjUserdata* uc = (ObjUserdata*)copy;
+        if(uc->finalize != NULL) {
+            uc->finalize = NULL;
+            c->failed = true;
+        }
+        break;
+    }
+    case OBJ_WEAK_REF: {
+        ((ObjWeakRef*)copy)->referent = forwardValue(c, ((ObjWeakRef*)o)->referent);
+        break;
+    }
+    case OBJ_GENERATOR: {
+        // The template is not executing, so no generator is running. Its instruction pointers
+        // stay valid, as the bytecode is shared with the template
+        ObjGenerator *gen = (ObjGenerator*)o, *genc = (ObjGenerator*)copy;
+        ASSERT(gen->state != GEN_RUNNING, "Cannot clone running generator");
+        genc->closure = FORWARD(c, gen->closure);
+        genc->lastYield = forwardValue(c, gen->lastYield);
+        genc->stack = copyValues(c, gen->stack, gen->stackCount, gen->stackSize);
+        if(gen->upvalues != NULL) {
+            genc->upvalues = GC_ALLOC(c->clone, sizeof(SavedUpvalue) * gen->upvalueSize);
+            for(size_t i = 0; i < gen->upvalueCount; i++) {
+                genc->upvalues[i].upvalue = FORWARD(c, gen->upvalues[i].upvalue);
+                genc->upvalues[i].slot = gen->upvalues[i].slot;
+            }
+        }
+        break;
+    }
+    case OBJ_FIBER: {
+        // The stacks of a suspended fiber hold pointers into themselves and to the C stack of
+        // the eval loop that will resume them, so only fibers not executing can be cloned
+        ObjFiber *f = (ObjFiber*)o, *fc = (ObjFiber*)copy;
+        if(f->state != FIBER_NEW && f->state != FIBER_DONE && f != c->vm->fiber) {
+            c->failed = true;
+        }
+        fc->fn = forwardValue(c, f->fn);
+        fc->caller = NULL;
+        fc->stackSz = 0;
+        fc->stack = fc->sp = fc->apiStack = NULL;
+        fc->frames = NULL;
+        fc->frameSz = fc->frameCount = 0;
+        fc->upvalues = NULL;
+        fc->module = NULL;
+        fc->next = NULL;
+        break;
+    }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// VM CLONING
+// -----------------------------------------------------------------------------
+
+static void initCloner(Cloner* c, JStarVM* vm, JStarVM* clone) {
+    size_t objCount = 0;
+    for(Obj* o = vm->objects; o != NULL; o = o->next) {
+        objCount++;
+    }
+
+    // Keep the forwarding table at most half full
+    size_t capacity = 16;
+    while(capacity < objCount * 2) {
+        capacity *= 2;
+    }
+
+    c->vm = vm;
+    c->clone = clone;
+    c->forwards = calloc(capacity, sizeof(Forward));
+    c->forwardsMask = capacity - 1;
+    c->pending = NULL;
+    c->pendingCount = c->pendingCapacity = 0;
+    c->rehash = NULL;
+    c->rehashCount = c->rehashCapacity = 0;
+    c->failed = false;
+}
+
+static void freeCloner(Cloner* c) {
+    free(c->forwards);
+    free(c->pending);
+    free(c->rehash);
+}
+
+static void cloneRoots(Cloner* c) {
+    JStarVM *vm = c->vm, *clone = c->clone;
+
+    // Interned strings, including unreachable ones, are copied along with the string pool
+    hashTableCopy(&clone->strings, &vm->strings, forwardEntry, c);
+    hashTableCopy(&clone->modules, &vm->modules, forwardEntry, c);
+
+    clone->importpaths = FORWARD(c, vm->importpaths);
+    clone->argv = FORWARD(c, vm->argv);
+    clone->emptyTup = FORWARD(c, vm->emptyTup);
+    clone->core = FORWARD(c, vm->core);
+
+    clone->clsClass = FORWARD(c, vm->clsClass);
+    clone->objClass = FORWARD(c, vm->objClass);
+    clone->strClass = FORWARD(c, vm->strClass);
+    clone->boolClass = FORWARD(c, vm->boolClass);
+    clone->lstClass = FORWARD(c, vm->lstClass);
+    clone->numClass = FORWARD(c, vm->numClass);
+    clone->funClass = FORWARD(c, vm->funClass);
+    clone->modClass = FORWARD(c, vm->modClass);
+    clone->nullClass = FORWARD(c, vm->nullClass);
+    clone->stClass = FORWARD(c, vm->stClass);
+    clone->tupClass = FORWARD(c, vm->tupClass);
+    clone->excClass = FORWARD(c, vm->excClass);
+    clone->tableClass = FORWARD(c, vm->tableClass);
+    clone->udataClass = FORWARD(c, vm->udataClass);
+    clone->weakRefClass = FORWARD(c, vm->weakRefClass);
+    clone->weakTableClass = FORWARD(c, vm->weakTableClass);
+    clone->genClass = FORWARD(c, vm->genClass);
+    clone->fiberClass = FORWARD(c, vm->fiberClass);
+    clone->mainFiber = FORWARD(c, vm->mainFiber);
+    clone->fiber = FORWARD(c, vm->fiber);
+
+    clone->ctor = FORWARD(c, vm->ctor);
+    clone->stacktrace = FORWARD(c, vm->stacktrace);
+    clone->excError = FORWARD(c, vm->excError);
+    clone->next = FORWARD(c, vm->next);
+    clone->iter = FORWARD(c, vm->iter);
+    for(int i = 0; i < OVERLOAD_SENTINEL; i++) {
+        clone->overloads[i] = FORWARD(c, vm->overloads[i]);
+    }
+
+    // Values left on the stack by the embedder
+    for(Value* v = vm->stack; v < vm->sp; v++) {
+        push(clone, forwardValue(c, *v));
+    }
+}
+
+JStarVM* jsrCloneVM(JStarVM* vm) {
+    ASSERT(vm->frameCount == 0 && vm->currCompiler == NULL, "Cannot clone an executing VM");
+    ASSERT(vm->upvalues == NULL, "Cannot clone a VM with open upvalues");
+    ASSERT(vm->fiber == vm->mainFiber, "Cannot clone a VM from within a fiber");
+
+    JStarConf conf = jsrGetConf();
+    conf.stackSize = vm->stackSz;
+    conf.initGC = vm->nextGC;
+    conf.heapGrowRate = vm->heapGrowRate;
+    conf.errorCallback = vm->errorCallback;
+    conf.moduleCache = vm->moduleCache;
+    conf.shareCode = vm->shareCode;
+
+    JStarVM* clone = allocateVM(&conf);
+    jsrEnsureStack(clone, vm->sp - vm->stack);
+
+    Cloner c;
+    initCloner(&c, vm, clone);
+
+    // Objects are not reachable from the clone's roots until they are fixed up
+    clone->disableGC = true;
+
+    cloneRoots(&c);
+    while(c.pendingCount > 0) {
+        fixObject(&c, c.pending[--c.pendingCount]);
+    }
+
+    clone->disableGC = false;
+
+    bool ok = !c.failed;
+    for(size_t i = 0; ok && i < c.rehashCount; i++) {
+        push(clone, OBJ_VAL(c.rehash[i]));
+        ok = tableRehash(clone, c.rehash[i]);
+        pop(clone);
+    }
+
+    freeCloner(&c);
+
+    if(!ok) {
+        jsrFreeVM(clone);
+        return NULL;
+    }
+
+    return clone;
+}
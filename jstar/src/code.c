@@ -1,8 +1,63 @@
 #include "code.h"
 
+#if defined(_MSC_VER)
+    #include <Windows.h>
+#endif
+
 #define CODE_DEF_SIZE  8
 #define CODE_GROW_FACT 2
 
+// -----------------------------------------------------------------------------
+// ATOMIC REFERENCE COUNTING
+// -----------------------------------------------------------------------------
+
+// Shared code can be freed by VMs running on different threads, so reference counts and the
+// lazy allocation of the counter are updated atomically
+
+static uint32_t* loadRefs(uint32_t** refs) {
+#if defined(_MSC_VER)
+    return InterlockedCompareExchangePointer((void**)refs, NULL, NULL);
+#else
+    return __atomic_load_n(refs, __ATOMIC_ACQUIRE);
+#endif
+}
+
+// Set `refs` to `newRefs` if it is NULL. Returns the counter installed in `refs`
+static uint32_t* installRefs(uint32_t** refs, uint32_t* newRefs) {
+#if defined(_MSC_VER)
+    uint32_t* old = InterlockedCompareExchangePointer((void**)refs, newRefs, NULL);
+    return old != NULL ? old : newRefs;
+#else
+    uint32_t* expected = NULL;
+    if(__atomic_compare_exchange_n(refs, &expected, newRefs, false, __ATOMIC_ACQ_REL,
+                                   __ATOMIC_ACQUIRE)) {
+        return newRefs;
+    }
+    return expected;
+#endif
+}
+
+static void incrementRefs(uint32_t* refs) {
+#if defined(_MSC_VER)
+    InterlockedIncrement((volatile LONG*)refs);
+#else
+    __atomic_add_fetch(refs, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+// Returns the updated count
+static uint32_t decrementRefs(uint32_t* refs) {
+#if defined(_MSC_VER)
+    return (uint32_t)InterlockedDecrement((volatile LONG*)refs);
+#else
+    return __atomic_sub_fetch(refs, 1, __ATOMIC_ACQ_REL);
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// CODE
+// -----------------------------------------------------------------------------
+
 void initCode(Code* c) {
     c->size = 0;
     c->linesSize = 0;
@@ -10,6 +65,7 @@ void initCode(Code* c) {
     c->linesCount = 0;
     c->bytecode = NULL;
     c->lines = NULL;
+    c->refs = NULL;
     initValueArray(&c->consts);
 }
 
@@ -18,11 +74,35 @@ void freeCode(Code* c) {
     c->count = 0;
     c->linesSize = 0;
     c->linesCount = 0;
-    free(c->bytecode);
-    free(c->lines);
+    if(c->refs == NULL || decrementRefs(c->refs) == 0) {
+        free(c->bytecode);
+        free(c->lines);
+        free(c->refs);
+    }
     freeValueArray(&c->consts);
 }
 
+void shareCode(Code* dest, Code* src) {
+    uint32_t* refs = loadRefs(&src->refs);
+    if(refs == NULL) {
+        uint32_t* newRefs = malloc(sizeof(*newRefs));
+        *newRefs = 1;
+        refs = installRefs(&src->refs, newRefs);
+        if(refs != newRefs) free(newRefs);
+    }
+
+    incrementRefs(refs);
+
+    dest->size = src->size;
+    dest->count = src->count;
+    dest->bytecode = src->bytecode;
+    dest->linesSize = src->linesSize;
+    dest->linesCount = src->linesCount;
+    dest->lines = src->lines;
+    dest->refs = refs;
+    initValueArray(&dest->consts);
+}
+
 static void growCode(Code* c) {
     c->size = c->size == 0 ? CODE_DEF_SIZE : c->size * CODE_GROW_FACT;
     c->bytecode = realloc(c->bytecode, c->size * sizeof(uint8_t));
@@ -12,10 +12,17 @@ typedef struct Code {
     size_t linesSize, linesCount;
     int* lines;
     ValueArray consts;
+    // Reference count of the bytecode and lines arrays, allocated when they get shared with
+    // another Code (possibly of another VM, see shareCode). NULL if they are exclusively owned
+    uint32_t* refs;
 } Code;
 
 void initCode(Code* c);
 void freeCode(Code* c);
+// Make `dest` share the bytecode and lines of `src`, that must not be modified afterwards.
+// Constants are not shared, as they belong to the VM of the Code: `dest->consts` is left empty.
+// Safe to call concurrently from multiple threads with the same `src`.
+void shareCode(Code* dest, Code* src);
 size_t writeByte(Code* c, uint8_t b, int line);
 int addConstant(Code* c, Value constant);
 int getBytecodeSrcLine(Code* c, size_t index);
@@ -0,0 +1,147 @@
+#include "codecache.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "code.h"
+#include "hash.h"
+#include "serialize.h"
+#include "vm.h"
+
+#if defined(JSTAR_POSIX)
+    #include <pthread.h>
+#elif defined(JSTAR_WINDOWS)
+    #include <Windows.h>
+#endif
+
+#define BUCKETS 64
+
+typedef struct CacheEntry {
+    struct CacheEntry* next;
+    uint32_t refs;  // References from the cache and from the VMs using the entry, under the lock
+    uint64_t hash;
+    char* src;  // Copy of the code the module was loaded from, compared on lookup
+    size_t srcLen;
+    char* code;  // Serialized code, used to recreate the constants of the module in other VMs
+    size_t codeLen;
+    Code* shared;  // Code of all the functions of the module, in serialization order
+    size_t sharedCount;
+} CacheEntry;
+
+// Entries are never modified once inserted, so they can be used after releasing the lock as long
+// as a reference to them is held. jsrClearCodeCache only drops the references of the cache
+static CacheEntry* buckets[BUCKETS];
+
+// -----------------------------------------------------------------------------
+// LOCKING
+// -----------------------------------------------------------------------------
+
+#if defined(JSTAR_POSIX)
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+    #define LOCK()   pthread_mutex_lock(&cacheLock)
+    #define UNLOCK() pthread_mutex_unlock(&cacheLock)
+#elif defined(JSTAR_WINDOWS)
+static SRWLOCK cacheLock = SRWLOCK_INIT;
+    #define LOCK()   AcquireSRWLockExclusive(&cacheLock)
+    #define UNLOCK() ReleaseSRWLockExclusive(&cacheLock)
+#else
+    // No threading support, VMs can only be used from a single thread
+    #define LOCK()
+    #define UNLOCK()
+#endif
+
+// -----------------------------------------------------------------------------
+// CACHE
+// -----------------------------------------------------------------------------
+
+static CacheEntry* findEntry(uint64_t hash, const char* src, size_t srcLen) {
+    for(CacheEntry* e = buckets[hash % BUCKETS]; e != NULL; e = e->next) {
+        if(e->hash == hash && e->srcLen == srcLen && memcmp(e->src, src, srcLen) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void freeEntry(CacheEntry* e) {
+    for(size_t i = 0; i < e->sharedCount; i++) {
+        freeCode(&e->shared[i]);
+    }
+    free(e->shared);
+    free(e->code);
+    free(e->src);
+    free(e);
+}
+
+// Must be called with the lock held
+static void releaseEntry(CacheEntry* e) {
+    if(--e->refs == 0) freeEntry(e);
+}
+
+ObjFunction* loadSharedCode(JStarVM* vm, ObjModule* module, const char* src, size_t len) {
+    if(!vm->shareCode) return NULL;
+
+    uint64_t hash = hashBytes(src, len);
+
+    LOCK();
+    CacheEntry* e = findEntry(hash, src, len);
+    if(e != NULL) e->refs++;
+    UNLOCK();
+
+    if(e == NULL) return NULL;
+
+    // The deserialized function holds its own references to the shared code
+    const char* error;
+    ObjFunction* fn = deserializeShared(vm, module, e->code, e->codeLen, e->shared,
+                                        e->sharedCount, &error);
+
+    LOCK();
+    releaseEntry(e);
+    UNLOCK();
+
+    return fn;
+}
+
+void shareModuleCode(JStarVM* vm, ObjFunction* fn, const char* src, size_t len, const char* code,
+                     size_t codeLen) {
+    if(!vm->shareCode) return;
+
+    CacheEntry* e = malloc(sizeof(*e));
+    e->refs = 1;
+    e->hash = hashBytes(src, len);
+    e->src = malloc(len);
+    e->srcLen = len;
+    memcpy(e->src, src, len);
+
+    e->code = malloc(codeLen);
+    e->codeLen = codeLen;
+    memcpy(e->code, code, codeLen);
+
+    e->sharedCount = shareSerializedCode(fn, &e->shared);
+
+    LOCK();
+    // Another VM may have added the same module in the meantime
+    bool found = findEntry(e->hash, src, len) != NULL;
+    if(!found) {
+        e->next = buckets[e->hash % BUCKETS];
+        buckets[e->hash % BUCKETS] = e;
+    }
+    UNLOCK();
+
+    if(found) freeEntry(e);
+}
+
+void jsrClearCodeCache(void) {
+    LOCK();
+    for(int i = 0; i < BUCKETS; i++) {
+        CacheEntry* e = buckets[i];
+        while(e != NULL) {
+            CacheEntry* next = e->next;
+            releaseEntry(e);
+            e = next;
+        }
+        buckets[i] = NULL;
+    }
+    UNLOCK();
+}
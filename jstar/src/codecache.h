@@ -0,0 +1,24 @@
+#ifndef CODECACHE_H
+#define CODECACHE_H
+
+#include <stddef.h>
+
+#include "jstar.h"
+#include "object.h"
+
+// Process wide cache of compiled module code, used to share bytecode between VMs.
+// Entries are keyed by the code a module has been loaded from, be it source or serialized code,
+// that is hashed and then compared in full, so a VM loading the same module as another one skips
+// its compilation and reuses the bytecode and line tables of the first. Constants and all other
+// objects are instead recreated in every VM, since they're owned by its garbage collector.
+
+// Returns the function of a module loaded from `src` by some VM of the process, instantiated in
+// `module` and sharing its bytecode. Returns NULL if the module is not in the cache.
+ObjFunction* loadSharedCode(JStarVM* vm, ObjModule* module, const char* src, size_t len);
+
+// Add `fn`, the function of a module loaded from `src`, to the cache. `code` is the serialized
+// code of `fn`.
+void shareModuleCode(JStarVM* vm, ObjFunction* fn, const char* src, size_t len, const char* code,
+                     size_t codeLen);
+
+#endif
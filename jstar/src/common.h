@@ -14,7 +14,10 @@
 #define STACK_SZ        (FRAME_SZ) * (MAX_LOCALS + 1)  // Deafult starting stack size
 #define INIT_GC         (1024 * 1024 * 10)             // 10MiB - First GC collection point
 #define HEAP_GROW_RATE  2                              // The heap growing rate
+#define INIT_LARGE_GC   (1024 * 1024 * 64)             // 64MiB - First GC point for large objects
 #define HANDLER_MAX     10                             // Max number of try-excepts for a frame
+#define FIBER_STACK_SZ  512                            // Starting stack size of fibers
+#define FIBER_FRAME_SZ  8                              // Starting frame size of fibers
 
 // -----------------------------------------------------------------------------
 // COMPILER CONSTANTS
@@ -33,7 +36,9 @@
 #define ARGV_STR     "argv"
 #define EXC_ERR      "_err"
 #define EXC_TRACE    "_stacktrace"
-#define PACKAGE_FILE "__package__.jsr"
+#define PACKAGE_FILE "__package__"
+#define JSR_EXT      ".jsr"
+#define JSC_EXT      ".jsc"
 
 #ifdef __unix__
     #define DL_PREFIX "lib"
@@ -100,16 +105,6 @@ static inline int powerOf2Ceil(int n) {
     return n;
 }
 
-// Hash a string
-static inline uint32_t hashString(const char* str, size_t length) {
-    uint32_t hash = 2166136261u;
-    for(size_t i = 0; i < length; i++) {
-        hash ^= str[i];
-        hash *= 16777619;
-    }
-    return hash;
-}
-
 static inline size_t roundUp(size_t num, size_t multiple) {
     return ((num + multiple - 1) / multiple) * multiple;
 }
@@ -816,6 +816,23 @@ static void compileTableLit(Compiler* c, JStarExpr* e) {
     }
 }
 
+static void compileYield(Compiler* c, JStarExpr* e) {
+    if(c->prev == NULL) {
+        error(c, e->line, "Cannot use yield in global scope.");
+    }
+    if(c->type == TYPE_CTOR) {
+        error(c, e->line, "Cannot use yield in constructor.");
+    }
+
+    if(e->as.yield.expr != NULL) {
+        compileExpr(c, e->as.yield.expr);
+    } else {
+        emitBytecode(c, OP_NULL, e->line);
+    }
+
+    emitBytecode(c, OP_YIELD, e->line);
+}
+
 static void emitValueConst(Compiler* c, Value val, int line) {
     emitBytecode(c, OP_GET_CONST, line);
     emitShort(c, createConst(c, val, line), line);
@@ -887,6 +904,9 @@ static void compileExpr(Compiler* c, JStarExpr* e) {
     case JSR_FUNC_LIT:
         compileFunLiteral(c, NULL, e);
         break;
+    case JSR_YIELD:
+        compileYield(c, e);
+        break;
     }
 }
 
@@ -1364,6 +1384,15 @@ static void compileLoopExitStmt(Compiler* c, JStarStmt* s) {
     emitShort(c, 0, 0);
 }
 
+// Calling a generator function returns a generator saving the frame just set up, without running
+// the body. Every resume pushes the value sent to the generator, that is discarded the first time
+static void generatorPrologue(Compiler* c, JStarStmt* s) {
+    if(s->as.funcDecl.isGenerator && c->type != TYPE_CTOR) {
+        emitBytecode(c, OP_GENERATOR, s->line);
+        emitBytecode(c, OP_POP, s->line);
+    }
+}
+
 static ObjFunction* function(Compiler* c, ObjModule* module, JStarStmt* s) {
     size_t defaults = vecSize(&s->as.funcDecl.defArgs);
     size_t arity = vecSize(&s->as.funcDecl.formalArgs);
@@ -1392,6 +1421,8 @@ static ObjFunction* function(Compiler* c, ObjModule* module, JStarStmt* s) {
         defineVar(c, &args, s->line);
     }
 
+    generatorPrologue(c, s);
+
     JStarStmt* body = s->as.funcDecl.body;
     compileStatements(c, &body->as.blockStmt.stmts);
 
@@ -1446,6 +1477,8 @@ static ObjFunction* method(Compiler* c, ObjModule* module, JStarIdentifier* clas
         defineVar(c, &args, s->line);
     }
 
+    generatorPrologue(c, s);
+
     JStarStmt* body = s->as.funcDecl.body;
     compileStatements(c, &body->as.blockStmt.stmts);
 
@@ -0,0 +1,526 @@
+#include "frozen.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "vm.h"
+
+#if defined(_MSC_VER)
+    #include <Windows.h>
+#endif
+
+#define CHUNK_SIZE  (64 * 1024)
+#define LARGE_ALLOC (CHUNK_SIZE / 4)
+#define ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+// A block of memory of a region, from which frozen objects are bump allocated
+typedef struct Chunk {
+    struct Chunk* next;
+    size_t used, size;
+    uint64_t data[];
+} Chunk;
+
+struct FrozenRegion {
+    uint32_t refs;
+    Chunk* chunks;
+    // Other regions referenced by the objects of this one
+    FrozenRegion** deps;
+    size_t depCount, depCapacity;
+};
+
+// -----------------------------------------------------------------------------
+// REGIONS
+// -----------------------------------------------------------------------------
+
+// Regions are released by VMs running on different threads, so reference counts are updated
+// atomically
+
+static void incrementRefs(uint32_t* refs) {
+#if defined(_MSC_VER)
+    InterlockedIncrement((volatile LONG*)refs);
+#else
+    __atomic_add_fetch(refs, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+// Returns the updated count
+static uint32_t decrementRefs(uint32_t* refs) {
+#if defined(_MSC_VER)
+    return (uint32_t)InterlockedDecrement((volatile LONG*)refs);
+#else
+    return __atomic_sub_fetch(refs, 1, __ATOMIC_ACQ_REL);
+#endif
+}
+
+static FrozenRegion* newRegion(void) {
+    FrozenRegion* r = malloc(sizeof(*r));
+    r->refs = 0;
+    r->chunks = NULL;
+    r->deps = NULL;
+    r->depCount = r->depCapacity = 0;
+    return r;
+}
+
+static void freeRegion(FrozenRegion* r) {
+    for(size_t i = 0; i < r->depCount; i++) {
+        releaseRegion(r->deps[i]);
+    }
+    free(r->deps);
+
+    Chunk* chunk = r->chunks;
+    while(chunk != NULL) {
+        Chunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(r);
+}
+
+static void* regionAlloc(FrozenRegion* r, size_t size) {
+    size = ALIGN(size);
+
+    Chunk* curr = r->chunks;
+    if(curr != NULL && curr->size - curr->used >= size) {
+        void* mem = (char*)curr->data + curr->used;
+        curr->used += size;
+        return mem;
+    }
+
+    size_t chunkSize = size > LARGE_ALLOC ? size : CHUNK_SIZE;
+    Chunk* chunk = malloc(sizeof(Chunk) + chunkSize);
+    if(!chunk) {
+        perror("Error while allocating memory");
+        abort();
+    }
+
+    chunk->size = chunkSize;
+    chunk->used = size;
+
+    // Large allocations get a chunk of their own, so that the current one keeps being filled
+    if(size > LARGE_ALLOC && curr != NULL) {
+        chunk->next = curr->next;
+        curr->next = chunk;
+    } else {
+        chunk->next = curr;
+        r->chunks = chunk;
+    }
+
+    return chunk->data;
+}
+
+static void addDependency(FrozenRegion* r, FrozenRegion* dep) {
+    for(size_t i = 0; i < r->depCount; i++) {
+        if(r->deps[i] == dep) return;
+    }
+    if(r->depCount == r->depCapacity) {
+        r->depCapacity = r->depCapacity ? r->depCapacity * 2 : 4;
+        r->deps = realloc(r->deps, sizeof(FrozenRegion*) * r->depCapacity);
+    }
+    retainRegion(dep);
+    r->deps[r->depCount++] = dep;
+}
+
+// The `next` field of frozen objects, unused as they're not part of a VM's list of objects,
+// points to their region
+FrozenRegion* frozenRegion(Obj* o) {
+    ASSERT(o->frozen, "Object is not frozen");
+    return (FrozenRegion*)o->next;
+}
+
+void retainRegion(FrozenRegion* r) {
+    incrementRefs(&r->refs);
+}
+
+void releaseRegion(FrozenRegion* r) {
+    if(decrementRefs(&r->refs) == 0) {
+        freeRegion(r);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// FROZEN SET
+// -----------------------------------------------------------------------------
+
+void initFrozenSet(FrozenSet* s) {
+    s->refs = NULL;
+    s->count = 0;
+    s->sizeMask = 0;
+}
+
+void freeFrozenSet(FrozenSet* s) {
+    if(s->refs != NULL) {
+        for(size_t i = 0; i <= s->sizeMask; i++) {
+            if(s->refs[i].region != NULL) releaseRegion(s->refs[i].region);
+        }
+    }
+    free(s->refs);
+    initFrozenSet(s);
+}
+
+static FrozenRef* findRef(FrozenRef* refs, size_t sizeMask, FrozenRegion* r) {
+    size_t i = (size_t)hash64((uint64_t)(uintptr_t)r) & sizeMask;
+    while(refs[i].region != NULL && refs[i].region != r) {
+        i = (i + 1) & sizeMask;
+    }
+    return &refs[i];
+}
+
+// Rebuild the set with a capacity of `size`. If `sweep` is true the regions not reached by the
+// last GC are released, and the reached flags of the others are cleared
+static void rebuildSet(FrozenSet* s, size_t size, bool sweep) {
+    FrozenRef* refs = calloc(size, sizeof(FrozenRef));
+    size_t count = 0;
+
+    if(s->refs != NULL) {
+        for(size_t i = 0; i <= s->sizeMask; i++) {
+            FrozenRef* ref = &s->refs[i];
+            if(ref->region == NULL) continue;
+
+            if(sweep && !ref->reached) {
+                releaseRegion(ref->region);
+                continue;
+            }
+
+            FrozenRef* dest = findRef(refs, size - 1, ref->region);
+            dest->region = ref->region;
+            dest->reached = !sweep && ref->reached;
+            count++;
+        }
+    }
+
+    free(s->refs);
+    s->refs = refs;
+    s->count = count;
+    s->sizeMask = size - 1;
+}
+
+static FrozenRef* addRef(FrozenSet* s, FrozenRegion* r) {
+    if(s->refs == NULL || (s->count + 1) * 2 > s->sizeMask + 1) {
+        rebuildSet(s, s->refs ? (s->sizeMask + 1) * 2 : 8, false);
+    }
+
+    FrozenRef* ref = findRef(s->refs, s->sizeMask, r);
+    if(ref->region == NULL) {
+        retainRegion(r);
+        ref->region = r;
+        ref->reached = false;
+        s->count++;
+    }
+    return ref;
+}
+
+void frozenSetAdd(FrozenSet* s, FrozenRegion* r) {
+    addRef(s, r);
+}
+
+void reachFrozen(FrozenSet* s, Obj* o) {
+    // The object may belong to a region referenced only by another region of the set, e.g. an
+    // element of a frozen List obtained by indexing it. The region is alive, and gets added
+    addRef(s, frozenRegion(o))->reached = true;
+}
+
+void sweepFrozenSet(FrozenSet* s) {
+    if(s->refs == NULL) return;
+    rebuildSet(s, s->sizeMask + 1, true);
+}
+
+// -----------------------------------------------------------------------------
+// FREEZING
+// -----------------------------------------------------------------------------
+
+typedef struct Forward {
+    Obj* from;
+    Obj* to;
+} Forward;
+
+typedef struct Freezer {
+    JStarVM* vm;
+    FrozenRegion* region;
+    // Forwarding table, mapping the objects already copied to their frozen copy
+    Forward* forwards;
+    size_t forwardsCount, forwardsMask;
+    // Copies whose references haven't been frozen yet
+    Forward* pending;
+    size_t pendingCount, pendingCapacity;
+    // The first value that couldn't be frozen, if any
+    bool failed, badKey;
+    Value badValue;
+} Freezer;
+
+static void initFreezer(Freezer* f, JStarVM* vm) {
+    f->vm = vm;
+    f->region = newRegion();
+    f->forwardsCount = 0;
+    f->forwardsMask = 63;
+    f->forwards = calloc(f->forwardsMask + 1, sizeof(Forward));
+    f->pending = NULL;
+    f->pendingCount = f->pendingCapacity = 0;
+    f->failed = f->badKey = false;
+    f->badValue = NULL_VAL;
+}
+
+static void freeFreezer(Freezer* f) {
+    free(f->forwards);
+    free(f->pending);
+}
+
+static void fail(Freezer* f, Value v, bool key) {
+    if(f->failed) return;
+    f->failed = true;
+    f->badKey = key;
+    f->badValue = v;
+}
+
+static Forward* findForward(Forward* forwards, size_t mask, Obj* o) {
+    size_t i = (size_t)hash64((uint64_t)(uintptr_t)o) & mask;
+    while(forwards[i].from != NULL && forwards[i].from != o) {
+        i = (i + 1) & mask;
+    }
+    return &forwards[i];
+}
+
+static void growForwards(Freezer* f) {
+    size_t newMask = (f->forwardsMask + 1) * 2 - 1;
+    Forward* forwards = calloc(newMask + 1, sizeof(Forward));
+    for(size_t i = 0; i <= f->forwardsMask; i++) {
+        if(f->forwards[i].from != NULL) {
+            *findForward(forwards, newMask, f->forwards[i].from) = f->forwards[i];
+        }
+    }
+    free(f->forwards);
+    f->forwards = forwards;
+    f->forwardsMask = newMask;
+}
+
+static void initFrozenObj(Freezer* f, Obj* o, ObjType type) {
+    o->type = type;
+    o->reached = false;
+    o->frozen = true;
+    o->cls = NULL;
+    o->next = (Obj*)f->region;
+}
+
+// Create the frozen copy of `o`. The references of Lists, Tuples and Tables are frozen later on
+static Obj* copyObject(Freezer* f, Obj* o) {
+    FrozenRegion* r = f->region;
+
+    switch(o->type) {
+    case OBJ_STRING: {
+        ObjString* s = (ObjString*)o;
+        ObjString* copy = regionAlloc(r, sizeof(ObjString) + s->length + 1);
+        initFrozenObj(f, (Obj*)copy, OBJ_STRING);
+        copy->length = s->length;
+        copy->hash = STRING_GET_HASH(s);
+        copy->interned = false;
+        copy->data = (char*)(copy + 1);
+        memcpy(copy->data, s->data, s->length + 1);
+        return (Obj*)copy;
+    }
+    case OBJ_LIST: {
+        ObjList* l = (ObjList*)o;
+        ObjList* copy = regionAlloc(r, sizeof(ObjList));
+        initFrozenObj(f, (Obj*)copy, OBJ_LIST);
+        copy->size = copy->count = l->count;
+        copy->arr = l->count ? regionAlloc(r, sizeof(Value) * l->count) : NULL;
+        return (Obj*)copy;
+    }
+    case OBJ_TUPLE: {
+        ObjTuple* t = (ObjTuple*)o;
+        ObjTuple* copy = regionAlloc(r, sizeof(ObjTuple) + sizeof(Value) * t->size);
+        initFrozenObj(f, (Obj*)copy, OBJ_TUPLE);
+        copy->size = t->size;
+        copy->hash = 0;
+        return (Obj*)copy;
+    }
+    case OBJ_TABLE: {
+        ObjTable* t = (ObjTable*)o;
+        ObjTable* copy = regionAlloc(r, sizeof(ObjTable));
+        *copy = *t;
+        initFrozenObj(f, (Obj*)copy, OBJ_TABLE);
+        copy->weak = false;
+
+        if(t->entries != NULL) {
+            size_t indexSize = t->sizeMask + 1;
+            size_t blockSize = tableBlockSize(indexSize, t->capacity);
+            copy->index = regionAlloc(r, blockSize);
+            memcpy(copy->index, t->index, blockSize);
+            copy->entries = (TableEntry*)((char*)copy->index +
+                                          indexSize * tableIndexWidth(indexSize));
+        }
+        return (Obj*)copy;
+    }
+    default:
+        fail(f, OBJ_VAL(o), false);
+        return NULL;
+    }
+}
+
+static Obj* forward(Freezer* f, Obj* o) {
+    if(o->frozen) {
+        addDependency(f->region, frozenRegion(o));
+        return o;
+    }
+
+    if((f->forwardsCount + 1) * 2 > f->forwardsMask + 1) {
+        growForwards(f);
+    }
+
+    Forward* fwd = findForward(f->forwards, f->forwardsMask, o);
+    if(fwd->from != NULL) return fwd->to;
+
+    Obj* copy = copyObject(f, o);
+    if(copy == NULL) return NULL;
+
+    fwd->from = o;
+    fwd->to = copy;
+    f->forwardsCount++;
+
+    if(o->type != OBJ_STRING) {
+        if(f->pendingCount == f->pendingCapacity) {
+            f->pendingCapacity = f->pendingCapacity ? f->pendingCapacity * 2 : 64;
+            f->pending = realloc(f->pending, sizeof(Forward) * f->pendingCapacity);
+        }
+        f->pending[f->pendingCount++] = *fwd;
+    }
+
+    return copy;
+}
+
+static Value forwardValue(Freezer* f, Value v) {
+    if(!IS_OBJ(v)) return v;
+    Obj* o = forward(f, AS_OBJ(v));
+    return o ? OBJ_VAL(o) : NULL_VAL;
+}
+
+// Keys that are hashed natively, and thus get the same hash in all VMs
+static bool isStableKey(Value key) {
+    if(IS_STRING(key) || IS_NUM(key) || IS_BOOL(key)) return true;
+    if(!IS_TUPLE(key)) return false;
+
+    ObjTuple* t = AS_TUPLE(key);
+    for(size_t i = 0; i < t->size; i++) {
+        if(!isStableKey(t->arr[i])) return false;
+    }
+    return true;
+}
+
+static void freezeReferences(Freezer* f, Forward* fwd) {
+    switch(fwd->from->type) {
+    case OBJ_LIST: {
+        ObjList *l = (ObjList*)fwd->from, *copy = (ObjList*)fwd->to;
+        for(size_t i = 0; i < copy->count; i++) {
+            copy->arr[i] = forwardValue(f, l->arr[i]);
+        }
+        break;
+    }
+    case OBJ_TUPLE: {
+        ObjTuple *t = (ObjTuple*)fwd->from, *copy = (ObjTuple*)fwd->to;
+        for(size_t i = 0; i < copy->size; i++) {
+            copy->arr[i] = forwardValue(f, t->arr[i]);
+        }
+        break;
+    }
+    case OBJ_TABLE: {
+        ObjTable* copy = (ObjTable*)fwd->to;
+        if(copy->entries == NULL) break;
+
+        for(size_t i = 0; i < copy->numEntries; i++) {
+            TableEntry* e = &copy->entries[i];
+            if(IS_NULL(e->key)) continue;
+            if(!isStableKey(e->key)) {
+                fail(f, e->key, true);
+                return;
+            }
+            e->key = forwardValue(f, e->key);
+            e->val = forwardValue(f, e->val);
+        }
+        break;
+    }
+    default:
+        UNREACHABLE();
+        break;
+    }
+}
+
+// Memoize the hash of a frozen Tuple, computing it like the Table does. Doing it beforehand
+// avoids the write of the memoized hash on the first lookup, that could race with other threads
+static void hashFrozenTuple(ObjTuple* t) {
+    if(t->hash != 0) return;
+
+    uint32_t h = 1;
+    for(size_t i = 0; i < t->size; i++) {
+        Value e = t->arr[i];
+
+        uint32_t elemHash;
+        if(IS_STRING(e)) {
+            elemHash = AS_STRING(e)->hash;
+        } else if(IS_NUM(e)) {
+            elemHash = hashNumber(AS_NUM(e));
+        } else if(IS_BOOL(e)) {
+            elemHash = AS_BOOL(e);
+        } else if(IS_TUPLE(e)) {
+            hashFrozenTuple(AS_TUPLE(e));
+            elemHash = AS_TUPLE(e)->hash;
+            if(elemHash == 0) return;
+        } else {
+            return;
+        }
+
+        h = 31 * h + elemHash;
+    }
+
+    t->hash = h;
+}
+
+bool checkMutable(JStarVM* vm, Obj* o) {
+    if(!o->frozen) return true;
+    jsrRaise(vm, "TypeException", "Cannot modify a frozen %s.", getObjClass(vm, o)->name->data);
+    return false;
+}
+
+bool freezeValue(JStarVM* vm, Value v, Value* out) {
+    if(!IS_OBJ(v) || AS_OBJ(v)->frozen) {
+        *out = v;
+        return true;
+    }
+
+    Freezer f;
+    initFreezer(&f, vm);
+
+    Obj* frozen = forward(&f, AS_OBJ(v));
+    while(!f.failed && f.pendingCount > 0) {
+        freezeReferences(&f, &f.pending[--f.pendingCount]);
+    }
+
+    if(f.failed) {
+        ObjClass* cls = getClass(vm, f.badValue);
+        if(f.badKey) {
+            jsrRaise(vm, "TypeException",
+                     "Cannot freeze a Table with a key of type %s, keys must be Strings, Numbers, "
+                     "Booleans or Tuples of them.",
+                     cls->name->data);
+        } else {
+            jsrRaise(vm, "TypeException", "Cannot freeze a value of type %s.", cls->name->data);
+        }
+        freeRegion(f.region);
+        freeFreezer(&f);
+        return false;
+    }
+
+    for(size_t i = 0; i <= f.forwardsMask; i++) {
+        Obj* copy = f.forwards[i].to;
+        if(copy != NULL && copy->type == OBJ_TUPLE) {
+            hashFrozenTuple((ObjTuple*)copy);
+        }
+    }
+
+    frozenSetAdd(&vm->frozen, f.region);
+    freeFreezer(&f);
+
+    *out = OBJ_VAL(frozen);
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef FROZEN_H
+#define FROZEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "jstar.h"
+#include "object.h"
+#include "value.h"
+
+/**
+ * Frozen values, deeply immutable and shared by all the VMs of the process without copying.
+ * Freezing a value copies it, along with all the values it references, into a FrozenRegion: a
+ * reference counted arena allocated outside of any VM's heap. Frozen objects only reference
+ * other frozen objects, and they're never modified after creation, so they can be read by many
+ * threads at the same time.
+ * VMs never trace nor collect frozen objects. Each VM keeps a set of the regions it references:
+ * reaching a frozen object during a GC marks its region in the set, and the regions left
+ * unmarked at the end of the collection are released.
+ */
+
+typedef struct FrozenRegion FrozenRegion;
+
+typedef struct FrozenRef {
+    FrozenRegion* region;
+    bool reached;
+} FrozenRef;
+
+// The regions referenced by a VM, an open addressing hash set
+typedef struct FrozenSet {
+    FrozenRef* refs;
+    size_t count, sizeMask;
+} FrozenSet;
+
+void initFrozenSet(FrozenSet* s);
+// Release all the regions of the set
+void freeFrozenSet(FrozenSet* s);
+// Add a reference to `r`, if the set doesn't reference it already
+void frozenSetAdd(FrozenSet* s, FrozenRegion* r);
+// Mark the region of the frozen object `o` as reached by the current GC
+void reachFrozen(FrozenSet* s, Obj* o);
+// Release the regions not reached since the last sweep
+void sweepFrozenSet(FrozenSet* s);
+
+FrozenRegion* frozenRegion(Obj* o);
+void retainRegion(FrozenRegion* r);
+void releaseRegion(FrozenRegion* r);
+
+// Set `out` to a frozen copy of `v`. Strings, Lists, Tuples and Tables are copied, while Numbers,
+// Booleans, null and already frozen objects are returned as is. Returns false and raises a
+// TypeException if `v` references values of other types, or Table keys that aren't Strings,
+// Numbers, Booleans or Tuples of them, as these would be hashed differently by each VM
+bool freezeValue(JStarVM* vm, Value v, Value* out);
+
+// Returns false and raises a TypeException if `o` is frozen, to be called before modifying it
+bool checkMutable(JStarVM* vm, Obj* o);
+
+#endif
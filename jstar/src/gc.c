@@ -2,39 +2,90 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "code.h"
+#include "common.h"
 #include "compiler.h"
 #include "dynload.h"
+#include "frozen.h"
 #include "hashtable.h"
+#include "los.h"
+#include "nativeindex.h"
 #include "object.h"
+#include "ref.h"
+#include "script.h"
 #include "vm.h"
 
 #define REACHED_DEFAULT_SZ 16
 #define REACHED_GROW_RATE  2
 
 void* GCallocate(JStarVM* vm, void* ptr, size_t oldsize, size_t size) {
-    vm->allocated += size - oldsize;
+    bool wasLarge = isLargeAlloc(oldsize), isLarge = isLargeAlloc(size);
+
+    if(wasLarge) {
+        vm->los.allocated -= oldsize;
+    } else {
+        vm->allocated -= oldsize;
+    }
+
+    if(isLarge) {
+        vm->los.allocated += size;
+    } else {
+        vm->allocated += size;
+    }
+
     if(size > oldsize && !vm->disableGC) {
 #ifdef JSTAR_DBG_STRESS_GC
         garbageCollect(vm);
 #endif
-        if(vm->allocated > vm->nextGC) {
+        if(vm->allocated > vm->nextGC || vm->los.allocated > vm->los.nextGC) {
             garbageCollect(vm);
         }
     }
 
+    if(wasLarge && isLarge) {
+        return losReallocate(&vm->los, ptr, oldsize, size);
+    }
+
+    if(!wasLarge && !isLarge) {
+        if(size == 0) {
+            free(ptr);
+            return NULL;
+        }
+
+        void* mem = realloc(ptr, size);
+        if(!mem) {
+            perror("Error while allocating memory");
+            abort();
+        }
+
+        return mem;
+    }
+
+    // The allocation is moving in or out of the large object space
     if(size == 0) {
-        free(ptr);
+        losFree(&vm->los, ptr, oldsize);
         return NULL;
     }
 
-    void* mem = realloc(ptr, size);
+    void* mem = isLarge ? losAllocate(&vm->los, size) : malloc(size);
     if(!mem) {
         perror("Error while allocating memory");
         abort();
     }
 
+    if(ptr != NULL) {
+        memcpy(mem, ptr, oldsize < size ? oldsize : size);
+    }
+
+    if(wasLarge) {
+        losFree(&vm->los, ptr, oldsize);
+    } else {
+        free(ptr);
+    }
+
     return mem;
 }
 
@@ -74,6 +125,10 @@ static void freeObject(JStarVM* vm, Obj* o) {
     case OBJ_MODULE: {
         ObjModule* m = (ObjModule*)o;
         freeHashTable(&m->globals);
+        if(m->natives.index) {
+            freeNativeIndex(m->natives.index);
+            free(m->natives.index);
+        }
         if(m->natives.dynlib) dynfree(m->natives.dynlib);
         GC_FREE(vm, ObjModule, m);
         break;
@@ -97,7 +152,7 @@ static void freeObject(JStarVM* vm, Obj* o) {
     case OBJ_TABLE: {
         ObjTable* t = (ObjTable*)o;
         if(t->entries != NULL) {
-            GC_FREE_ARRAY(vm, TableEntry, t->entries, t->sizeMask + 1);
+            GC_FREE_ARRAY(vm, uint8_t, t->index, tableBlockSize(t->sizeMask + 1, t->capacity));
         }
         GC_FREE(vm, ObjTable, t);
         break;
@@ -126,6 +181,28 @@ static void freeObject(JStarVM* vm, Obj* o) {
         GC_FREE_VAR(vm, ObjUserdata, uint8_t, udata->size, udata);
         break;
     }
+    case OBJ_WEAK_REF: {
+        ObjWeakRef* ref = (ObjWeakRef*)o;
+        GC_FREE(vm, ObjWeakRef, ref);
+        break;
+    }
+    case OBJ_GENERATOR: {
+        ObjGenerator* gen = (ObjGenerator*)o;
+        GC_FREE_ARRAY(vm, Value, gen->stack, gen->stackSize);
+        GC_FREE_ARRAY(vm, SavedUpvalue, gen->upvalues, gen->upvalueSize);
+        GC_FREE(vm, ObjGenerator, gen);
+        break;
+    }
+    case OBJ_FIBER: {
+        // The stacks of the running fiber are the VM's, freed along with it
+        ObjFiber* fiber = (ObjFiber*)o;
+        if(fiber != vm->fiber) {
+            free(fiber->stack);
+            free(fiber->frames);
+        }
+        GC_FREE(vm, ObjFiber, fiber);
+        break;
+    }
     }
 }
 
@@ -164,9 +241,31 @@ static void addReachedObject(JStarVM* vm, Obj* o) {
     vm->reachedStack[vm->reachedCount++] = o;
 }
 
+static void addWeakObject(JStarVM* vm, Obj* o) {
+    if(vm->weakCount + 1 > vm->weakCapacity) {
+        vm->weakCapacity = vm->weakCapacity ? vm->weakCapacity * REACHED_GROW_RATE
+                                            : REACHED_DEFAULT_SZ;
+        vm->weakObjs = realloc(vm->weakObjs, sizeof(Obj*) * vm->weakCapacity);
+    }
+    vm->weakObjs[vm->weakCount++] = o;
+}
+
+// Strings, Numbers and Booleans are treated as values: they never get cleared from weak tables.
+// Neither do frozen objects, that are never collected by the VM
+static bool isWeakKey(Value key) {
+    return IS_OBJ(key) && !IS_STRING(key) && !AS_OBJ(key)->frozen;
+}
+
 void reachObject(JStarVM* vm, Obj* o) {
     if(o == NULL || o->reached) return;
 
+    // Frozen objects are shared with other VMs, and only reference other frozen objects:
+    // instead of marking and tracing them, their region is marked as used by this VM
+    if(o->frozen) {
+        reachFrozen(&vm->frozen, o);
+        return;
+    }
+
 #ifdef JSTAR_DBG_PRINT_GC
     printf("REACHED: Object %p type: %s repr: ", (void*)o, ObjTypeNames[o->type]);
     printObj(o);
@@ -248,8 +347,11 @@ static void recursevelyReach(JStarVM* vm, Obj* o) {
     }
     case OBJ_TABLE: {
         ObjTable* t = (ObjTable*)o;
+        if(t->weak) addWeakObject(vm, o);
         if(t->entries != NULL) {
-            for(size_t i = 0; i < t->sizeMask + 1; i++) {
+            for(size_t i = 0; i < t->numEntries; i++) {
+                // Entries with weak keys are reached later on by reachEphemerons
+                if(t->weak && isWeakKey(t->entries[i].key)) continue;
                 reachValue(vm, t->entries[i].key);
                 reachValue(vm, t->entries[i].val);
             }
@@ -283,12 +385,135 @@ static void recursevelyReach(JStarVM* vm, Obj* o) {
         }
         break;
     }
+    case OBJ_WEAK_REF: {
+        // Frozen objects are never collected while referenced, so weak references to them are
+        // treated as strong ones
+        ObjWeakRef* ref = (ObjWeakRef*)o;
+        if(IS_OBJ(ref->referent) && AS_OBJ(ref->referent)->frozen) {
+            reachValue(vm, ref->referent);
+        } else {
+            addWeakObject(vm, o);
+        }
+        break;
+    }
+    case OBJ_GENERATOR: {
+        ObjGenerator* gen = (ObjGenerator*)o;
+        reachObject(vm, (Obj*)gen->closure);
+        reachValue(vm, gen->lastYield);
+        for(size_t i = 0; i < gen->stackCount; i++) {
+            reachValue(vm, gen->stack[i]);
+        }
+        for(size_t i = 0; i < gen->upvalueCount; i++) {
+            reachObject(vm, (Obj*)gen->upvalues[i].upvalue);
+        }
+        break;
+    }
+    case OBJ_FIBER: {
+        ObjFiber* fiber = (ObjFiber*)o;
+        reachValue(vm, fiber->fn);
+        reachObject(vm, (Obj*)fiber->caller);
+
+        // The stacks of the running fiber are the VM's, reached as roots
+        if(fiber == vm->fiber || fiber->stack == NULL) break;
+
+        reachObject(vm, (Obj*)fiber->module);
+        for(Value* v = fiber->stack; v < fiber->sp; v++) {
+            reachValue(vm, *v);
+        }
+        for(int i = 0; i < fiber->frameCount; i++) {
+            reachObject(vm, fiber->frames[i].fn);
+            reachObject(vm, (Obj*)fiber->frames[i].gen);
+        }
+        for(ObjUpvalue* upvalue = fiber->upvalues; upvalue != NULL; upvalue = upvalue->next) {
+            reachObject(vm, (Obj*)upvalue);
+        }
+        break;
+    }
     case OBJ_USERDATA:
     case OBJ_STRING:
         break;
     }
 }
 
+static void reachObjects(JStarVM* vm) {
+    while(vm->reachedCount != 0) {
+        recursevelyReach(vm, vm->reachedStack[--vm->reachedCount]);
+    }
+}
+
+// The entries of a weak table are ephemerons: a value is reachable only if its key is.
+// Reach the values of all entries with a reached key, until no more objects get reached.
+static void reachEphemerons(JStarVM* vm) {
+    bool reached;
+    do {
+        reached = false;
+        for(size_t i = 0; i < vm->weakCount; i++) {
+            Obj* o = vm->weakObjs[i];
+            if(o->type != OBJ_TABLE || ((ObjTable*)o)->entries == NULL) continue;
+
+            ObjTable* t = (ObjTable*)o;
+            for(size_t j = 0; j < t->numEntries; j++) {
+                TableEntry* e = &t->entries[j];
+                if(!isWeakKey(e->key) || !AS_OBJ(e->key)->reached) continue;
+                if(!IS_OBJ(e->val) || AS_OBJ(e->val)->reached) continue;
+
+                reachValue(vm, e->val);
+
+                // Frozen objects never get marked as reached, reaching them only marks their
+                // region: they can't lead to other objects of the heap
+                if(!AS_OBJ(e->val)->frozen) reached = true;
+            }
+        }
+        reachObjects(vm);
+    } while(reached);
+}
+
+// Clear weak references and weak table entries pointing to unreached objects
+static void clearWeakObjects(JStarVM* vm) {
+    for(size_t i = 0; i < vm->weakCount; i++) {
+        Obj* o = vm->weakObjs[i];
+        if(o->type == OBJ_WEAK_REF) {
+            ObjWeakRef* ref = (ObjWeakRef*)o;
+            if(IS_OBJ(ref->referent) && !AS_OBJ(ref->referent)->reached) {
+                ref->referent = NULL_VAL;
+            }
+        } else {
+            ObjTable* t = (ObjTable*)o;
+            if(t->entries == NULL) continue;
+            for(size_t j = 0; j < t->numEntries; j++) {
+                TableEntry* e = &t->entries[j];
+                if(isWeakKey(e->key) && !AS_OBJ(e->key)->reached) {
+                    e->key = NULL_VAL;
+                    e->val = NULL_VAL;
+                    t->count--;
+                }
+            }
+        }
+    }
+}
+
+// Remove unreached and completed fibers from the list of started fibers.
+// Closures that outlive an unreached fiber can still reference the upvalues open on its stack,
+// so these get closed before the stack is freed
+static void releaseFibers(JStarVM* vm) {
+    ObjFiber** head = &vm->fibers;
+    while(*head != NULL) {
+        ObjFiber* fiber = *head;
+        if(fiber->base.reached && fiber->state != FIBER_DONE) {
+            head = &fiber->next;
+            continue;
+        }
+
+        for(ObjUpvalue* upvalue = fiber->upvalues; upvalue != NULL; upvalue = upvalue->next) {
+            upvalue->closed = *upvalue->addr;
+            upvalue->addr = &upvalue->closed;
+        }
+
+        fiber->upvalues = NULL;
+        *head = fiber->next;
+    }
+}
+
 void garbageCollect(JStarVM* vm) {
 #ifdef JSTAR_DBG_PRINT_GC
     size_t prevAlloc = vm->allocated;
@@ -316,6 +541,14 @@ void garbageCollect(JStarVM* vm) {
     reachObject(vm, (Obj*)vm->excClass);
     reachObject(vm, (Obj*)vm->tableClass);
     reachObject(vm, (Obj*)vm->udataClass);
+    reachObject(vm, (Obj*)vm->weakRefClass);
+    reachObject(vm, (Obj*)vm->weakTableClass);
+    reachObject(vm, (Obj*)vm->genClass);
+    reachObject(vm, (Obj*)vm->fiberClass);
+
+    // reach the running and main fibers
+    reachObject(vm, (Obj*)vm->fiber);
+    reachObject(vm, (Obj*)vm->mainFiber);
 
     // reach script argument llist
     reachObject(vm, (Obj*)vm->argv);
@@ -337,6 +570,11 @@ void garbageCollect(JStarVM* vm) {
     // reach loaded modules
     reachHashTable(vm, &vm->modules);
 
+    // reach pinned scripts, references and names
+    reachScripts(vm);
+    reachRefs(vm);
+    reachHashTable(vm, &vm->names);
+
     // reach elements on the stack
     for(Value* v = vm->stack; v < vm->sp; v++) {
         reachValue(vm, *v);
@@ -345,6 +583,7 @@ void garbageCollect(JStarVM* vm) {
     // reach elements on the frame stack
     for(int i = 0; i < vm->frameCount; i++) {
         reachObject(vm, vm->frames[i].fn);
+        reachObject(vm, (Obj*)vm->frames[i].gen);
     }
 
     // reach open upvalues
@@ -356,13 +595,17 @@ void garbageCollect(JStarVM* vm) {
     reachCompilerRoots(vm, vm->currCompiler);
 
     // recursevely reach objects held by other reached objects
-    while(vm->reachedCount != 0) {
-        recursevelyReach(vm, vm->reachedStack[--vm->reachedCount]);
-    }
+    reachObjects(vm);
+    reachEphemerons(vm);
+
+    // clear weak references to objects that are about to be freed
+    clearWeakObjects(vm);
+    releaseFibers(vm);
 
     // free unreached objects
     removeUnreachedStrings(&vm->strings);
     freeObjects(vm);
+    sweepFrozenSet(&vm->frozen);
 
     // free the reached objects stack
     free(vm->reachedStack);
@@ -370,8 +613,16 @@ void garbageCollect(JStarVM* vm) {
     vm->reachedCapacity = 0;
     vm->reachedCount = 0;
 
+    free(vm->weakObjs);
+    vm->weakObjs = NULL;
+    vm->weakCapacity = 0;
+    vm->weakCount = 0;
+
     vm->nextGC = vm->allocated * vm->heapGrowRate;
 
+    vm->los.nextGC = vm->los.allocated * vm->heapGrowRate;
+    if(vm->los.nextGC < INIT_LARGE_GC) vm->los.nextGC = INIT_LARGE_GC;
+
 #ifdef JSTAR_DBG_PRINT_GC
     size_t curr = prevAlloc - vm->allocated;
     printf(
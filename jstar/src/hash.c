@@ -0,0 +1,145 @@
+#include "hash.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "jstarconf.h"
+
+#define P0 UINT64_C(0xa0761d6478bd642f)
+#define P1 UINT64_C(0xe7037ed1a0b428db)
+#define P2 UINT64_C(0x8ebc6af09c88c6e3)
+#define P3 UINT64_C(0x589965cc75374cc3)
+
+static uint64_t hashSeed;
+static uint64_t seedCounter;
+
+static uint64_t randomSeed(void) {
+    uint64_t seed = 0;
+
+#ifdef JSTAR_POSIX
+    FILE* urandom = fopen("/dev/urandom", "rb");
+    if(urandom != NULL) {
+        if(fread(&seed, sizeof(seed), 1, urandom) != 1) seed = 0;
+        fclose(urandom);
+    }
+#endif
+
+    // Fallback on time and addresses (randomized by ASLR on most systems)
+    if(seed == 0) {
+        seed = hash64((uint64_t)time(NULL)) ^ hash64((uint64_t)clock());
+        seed ^= hash64((uint64_t)(uintptr_t)&seed) ^ hash64((uint64_t)(uintptr_t)&randomSeed);
+    }
+
+    return seed ? seed : P0;
+}
+
+void initHashSeed(void) {
+#if defined(__GNUC__)
+    if(__atomic_load_n(&hashSeed, __ATOMIC_ACQUIRE) != 0) return;
+    uint64_t expected = 0;
+    __atomic_compare_exchange_n(&hashSeed, &expected, randomSeed(), false, __ATOMIC_ACQ_REL,
+                                __ATOMIC_ACQUIRE);
+#else
+    if(hashSeed == 0) hashSeed = randomSeed();
+#endif
+}
+
+uint64_t uniqueSeed(void) {
+#if defined(__GNUC__)
+    uint64_t n = __atomic_add_fetch(&seedCounter, 1, __ATOMIC_RELAXED);
+#else
+    uint64_t n = ++seedCounter;
+#endif
+    return hash64(hashSeed ^ hash64(n));
+}
+
+// Multiply two 64 bit integers, and fold the 128 bit result
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    return lo ^ hi;
+#endif
+}
+
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Read 1 to 3 bytes
+static inline uint64_t readSmall(const uint8_t* p, size_t len) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+}
+
+static inline uint64_t hashWithKey(const char* str, size_t length, uint64_t key) {
+    const uint8_t* p = (const uint8_t*)str;
+    uint64_t seed = key ^ mix(key ^ P0, P1);
+    uint64_t a, b;
+
+    if(length <= 16) {
+        if(length >= 4) {
+            size_t off = (length >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + off);
+            b = (read32(p + length - 4) << 32) | read32(p + length - 4 - off);
+        } else if(length > 0) {
+            a = readSmall(p, length);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = length;
+        if(i > 48) {
+            uint64_t s1 = seed, s2 = seed;
+            do {
+                seed = mix(read64(p) ^ P1, read64(p + 8) ^ seed);
+                s1 = mix(read64(p + 16) ^ P2, read64(p + 24) ^ s1);
+                s2 = mix(read64(p + 32) ^ P3, read64(p + 40) ^ s2);
+                p += 48, i -= 48;
+            } while(i > 48);
+            seed ^= s1 ^ s2;
+        }
+        while(i > 16) {
+            seed = mix(read64(p) ^ P1, read64(p + 8) ^ seed);
+            p += 16, i -= 16;
+        }
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+
+    return mix(P1 ^ length, mix(a ^ P1, b ^ seed));
+}
+
+uint32_t hashString(const char* str, size_t length) {
+    return (uint32_t)hashWithKey(str, length, hashSeed);
+}
+
+uint64_t hashBytes(const char* data, size_t length) {
+    return hashWithKey(data, length, 0);
+}
+
+uint32_t hashNumber(double num) {
+    if(num == -0) num = 0;
+    union {
+        double d;
+        uint64_t r;
+    } c = {.d = num};
+    return (uint32_t)mix(c.r ^ hashSeed, P1);
+}
@@ -0,0 +1,35 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Initialize the random seed used by the keyed hash functions below.
+// The seed is generated once per process, so that it remains valid for all the strings (and
+// thus the hashes cached in them) of all the VMs. Only the first call has any effect.
+void initHashSeed(void);
+
+// Returns a different random seed on every call, derived from the per-process hash seed.
+// Safe to call concurrently, `initHashSeed` must have been called before
+uint64_t uniqueSeed(void);
+
+// Keyed, word-at-a-time hash of a string. Since the key is random and unknown to the user,
+// it makes it impractical to craft colliding keys to attack the VM's hash tables
+uint32_t hashString(const char* str, size_t length);
+
+// Unkeyed 64 bit hash of a sequence of bytes. Unlike `hashString` the result is stable across
+// processes (on the same machine), so it can be used to validate persistent data
+uint64_t hashBytes(const char* data, size_t length);
+
+// Keyed hash of a Number
+uint32_t hashNumber(double num);
+
+// Mix the bits of a 64 bit integer (unkeyed)
+static inline uint64_t hash64(uint64_t x) {
+    x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+    x = x ^ (x >> 31);
+    return x;
+}
+
+#endif
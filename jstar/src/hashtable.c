@@ -6,109 +6,334 @@
 #include "gc.h"
 #include "object.h"
 
-#define MAX_LOAD_FACTOR  0.75
-#define GROW_FACTOR      2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define HT_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define HT_NEON
+#endif
+
 #define INITIAL_CAPACITY 8
+#define GROW_FACTOR      2
 
-void initHashTable(HashTable* t) {
-    t->sizeMask = 0;
-    t->numEntries = 0;
-    t->entries = NULL;
+// Control bytes values. A full slot stores the lower 7 bits of its key's hash instead.
+// Sentinels pad the control bytes of tables smaller than a group, and never match.
+#define CTRL_EMPTY    ((uint8_t)0x80)
+#define CTRL_DELETED  ((uint8_t)0xFE)
+#define CTRL_SENTINEL ((uint8_t)0xFF)
+
+#define IS_FULL(c) ((c) < 0x80)
+#define H1(hash)   ((hash) >> 7)
+#define H2(hash)   ((uint8_t)((hash)&0x7F))
+
+// Max load factor of 7/8, including deleted slots
+#define MAX_LOAD(cap) ((cap) - (cap) / 8)
+// Deleted slots ratio (1/n of the capacity) above which the string pool is rehashed after a GC
+#define MAX_DELETED_RATIO 4
+
+// -----------------------------------------------------------------------------
+// GROUP OPERATIONS
+// -----------------------------------------------------------------------------
+
+// A group is a run of GROUP_WIDTH control bytes that gets probed at once. Matching a group
+// returns a bitmask with a set bit for every matching slot: iterate it with `bitmaskNext`.
+#ifdef HT_SSE2
+
+    #define GROUP_WIDTH   16
+    #define BITMASK_SHIFT 0
+
+typedef uint32_t BitMask;
+
+static inline BitMask groupMatch(const uint8_t* g, uint8_t h2) {
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)g);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8((char)h2), ctrl));
 }
 
-void freeHashTable(HashTable* t) {
-    free(t->entries);
+static inline BitMask groupMatchEmpty(const uint8_t* g) {
+    return groupMatch(g, CTRL_EMPTY);
+}
+
+static inline BitMask groupMatchEmptyOrDeleted(const uint8_t* g) {
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)g);
+    return _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8((char)CTRL_SENTINEL), ctrl));
+}
+
+#else
+
+    #define GROUP_WIDTH   8
+    #define BITMASK_SHIFT 3
+    #define LSBS          UINT64_C(0x0101010101010101)
+    #define MSBS          UINT64_C(0x8080808080808080)
+
+typedef uint64_t BitMask;
+
+static inline uint64_t groupLoad(const uint8_t* g) {
+    uint64_t ctrl;
+    memcpy(&ctrl, g, sizeof(ctrl));
+    return ctrl;
+}
+
+    #ifdef HT_NEON
+
+static inline BitMask groupMatch(const uint8_t* g, uint8_t h2) {
+    uint8x8_t m = vceq_u8(vld1_u8(g), vdup_n_u8(h2));
+    return vget_lane_u64(vreinterpret_u64_u8(m), 0) & MSBS;
+}
+
+static inline BitMask groupMatchEmptyOrDeleted(const uint8_t* g) {
+    uint8x8_t m = vclt_s8(vreinterpret_s8_u8(vld1_u8(g)), vdup_n_s8((int8_t)CTRL_SENTINEL));
+    return vget_lane_u64(vreinterpret_u64_u8(m), 0) & MSBS;
 }
 
-static Entry* findEntry(Entry* entries, size_t sizeMask, ObjString* key) {
-    size_t i = STRING_GET_HASH(key) & sizeMask;
-    Entry* tomb = NULL;
+    #else
+
+// May report false positives for bytes following a real match: they are filtered out by the
+// key comparison anyway
+static inline BitMask groupMatch(const uint8_t* g, uint8_t h2) {
+    uint64_t x = groupLoad(g) ^ (LSBS * h2);
+    return (x - LSBS) & ~x & MSBS;
+}
+
+static inline BitMask groupMatchEmptyOrDeleted(const uint8_t* g) {
+    uint64_t ctrl = groupLoad(g);
+    return ctrl & (~ctrl << 7) & MSBS;
+}
+
+    #endif
+
+static inline BitMask groupMatchEmpty(const uint8_t* g) {
+    uint64_t ctrl = groupLoad(g);
+    return ctrl & (~ctrl << 6) & MSBS;
+}
+
+#endif
+
+static inline int countTrailingZeros(BitMask mask) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(mask);
+#else
+    int n = 0;
+    while(!(mask & 1)) mask >>= 1, n++;
+    return n;
+#endif
+}
 
-    for(;;) {
-        Entry* e = &entries[i];
-        if(e->key == NULL) {
-            if(IS_NULL(e->value)) {
-                return tomb ? tomb : e;
-            } else if(!tomb) {
-                tomb = e;
+static inline size_t bitmaskNext(BitMask* mask) {
+    size_t i = countTrailingZeros(*mask) >> BITMASK_SHIFT;
+    *mask &= *mask - 1;
+    return i;
+}
+
+// -----------------------------------------------------------------------------
+// PROBING
+// -----------------------------------------------------------------------------
+
+static size_t numGroups(size_t capacity) {
+    return capacity < GROUP_WIDTH ? 1 : capacity / GROUP_WIDTH;
+}
+
+static size_t ctrlSize(size_t capacity) {
+    return capacity < GROUP_WIDTH ? GROUP_WIDTH : capacity;
+}
+
+// Triangular probing over the groups. Since the number of groups is a power of two, it
+// is guaranteed to visit all of them
+#define PROBE_FOREACH(t, hash, group)                                              \
+    for(size_t group##Mask_ = numGroups((t)->sizeMask + 1) - 1,                    \
+               group = H1(hash) & group##Mask_, group##Step_ = 0;                  \
+        ;                                                                          \
+        group = (group + ++group##Step_) & group##Mask_)
+
+static Entry* findEntry(HashTable* t, ObjString* key, uint32_t hash) {
+    uint8_t h2 = H2(hash);
+    PROBE_FOREACH(t, hash, g) {
+        const uint8_t* group = t->ctrl + g * GROUP_WIDTH;
+
+        BitMask match = groupMatch(group, h2);
+        while(match) {
+            Entry* e = &t->entries[g * GROUP_WIDTH + bitmaskNext(&match)];
+            if(e->key == key || STRING_EQUALS(e->key, key)) {
+                return e;
             }
-        } else if(STRING_EQUALS(e->key, key)) {
-            return e;
         }
-        i = (i + 1) & sizeMask;
+
+        if(groupMatchEmpty(group)) return NULL;
     }
 }
 
-static void growEntries(HashTable* t) {
-    size_t newSize = t->sizeMask ? (t->sizeMask + 1) * GROW_FACTOR : INITIAL_CAPACITY;
-    Entry* newEntries = malloc(sizeof(Entry) * newSize);
-    for(size_t i = 0; i < newSize; i++) {
-        newEntries[i].key = NULL;
-        newEntries[i].value = NULL_VAL;
+// Find a free slot for a key not present in the table
+static size_t findInsertSlot(HashTable* t, uint32_t hash) {
+    PROBE_FOREACH(t, hash, g) {
+        BitMask free = groupMatchEmptyOrDeleted(t->ctrl + g * GROUP_WIDTH);
+        if(free) return g * GROUP_WIDTH + bitmaskNext(&free);
     }
+}
 
+static void allocateEntries(HashTable* t, size_t capacity) {
+    size_t ctrlSz = ctrlSize(capacity);
+    t->entries = malloc(sizeof(Entry) * capacity + ctrlSz);
+    t->ctrl = (uint8_t*)(t->entries + capacity);
+    memset(t->ctrl, CTRL_EMPTY, capacity);
+    memset(t->ctrl + capacity, CTRL_SENTINEL, ctrlSz - capacity);
+    t->sizeMask = capacity - 1;
     t->numEntries = 0;
-    if(t->sizeMask != 0) {
-        for(size_t i = 0; i <= t->sizeMask; i++) {
-            Entry* e = &t->entries[i];
-            if(e->key == NULL) continue;
+    t->count = 0;
+}
+
+// Rehash all entries at the same capacity without allocating, reclaiming all deleted slots.
+// Full slots are first marked as deleted and deleted ones as empty, then every entry still
+// marked as deleted is moved to the first free slot of its probe sequence. If the target holds
+// another entry yet to be processed, the two are swapped and the current slot is processed again
+static void rehashInPlace(HashTable* t) {
+    size_t capacity = t->sizeMask + 1;
+
+    for(size_t i = 0; i < capacity; i++) {
+        t->ctrl[i] = IS_FULL(t->ctrl[i]) ? CTRL_DELETED : CTRL_EMPTY;
+    }
+
+    for(size_t i = 0; i < capacity; i++) {
+        if(t->ctrl[i] != CTRL_DELETED) continue;
+
+        uint32_t hash = STRING_GET_HASH(t->entries[i].key);
+        size_t target = findInsertSlot(t, hash);
+
+        // Groups are aligned, so if the target is in the same group as the current slot the
+        // entry is already found by the first probe that reaches it
+        if(target / GROUP_WIDTH == i / GROUP_WIDTH) {
+            t->ctrl[i] = H2(hash);
+            continue;
+        }
+
+        if(t->ctrl[target] == CTRL_EMPTY) {
+            t->entries[target] = t->entries[i];
+            t->ctrl[target] = H2(hash);
+            t->ctrl[i] = CTRL_EMPTY;
+        } else {
+            Entry tmp = t->entries[target];
+            t->entries[target] = t->entries[i];
+            t->entries[i] = tmp;
+            t->ctrl[target] = H2(hash);
+            i--;
+        }
+    }
+
+    t->numEntries = t->count;
+}
 
-            Entry* dest = findEntry(newEntries, newSize - 1, e->key);
-            dest->key = e->key;
-            dest->value = e->value;
-            t->numEntries++;
+// Rehash all entries in a new entries array. If there are enough deleted slots, the
+// table is rehashed in place instead of growing
+static void rehash(HashTable* t) {
+    size_t oldCapacity = t->entries ? t->sizeMask + 1 : 0;
+    size_t capacity = INITIAL_CAPACITY;
+    if(oldCapacity != 0) {
+        if(t->count + 1 <= MAX_LOAD(oldCapacity) / 2) {
+            rehashInPlace(t);
+            return;
         }
+        capacity = oldCapacity * GROW_FACTOR;
     }
 
+    Entry* oldEntries = t->entries;
+    uint8_t* oldCtrl = t->ctrl;
+
+    allocateEntries(t, capacity);
+
+    for(size_t i = 0; i < oldCapacity; i++) {
+        if(!IS_FULL(oldCtrl[i])) continue;
+        Entry* e = &oldEntries[i];
+        uint32_t hash = STRING_GET_HASH(e->key);
+        size_t slot = findInsertSlot(t, hash);
+        t->ctrl[slot] = H2(hash);
+        t->entries[slot] = *e;
+        t->numEntries++, t->count++;
+    }
+
+    free(oldEntries);
+}
+
+static void removeSlot(HashTable* t, size_t slot) {
+    // If the slot's group has an empty slot, no probe sequence could have continued past it,
+    // and thus the slot can be marked as empty instead of deleted
+    size_t groupStart = slot & ~(size_t)(GROUP_WIDTH - 1);
+    if(groupMatchEmpty(t->ctrl + groupStart)) {
+        t->ctrl[slot] = CTRL_EMPTY;
+        t->numEntries--;
+    } else {
+        t->ctrl[slot] = CTRL_DELETED;
+    }
+    t->entries[slot].key = NULL;
+    t->entries[slot].value = NULL_VAL;
+    t->count--;
+}
+
+// -----------------------------------------------------------------------------
+// API
+// -----------------------------------------------------------------------------
+
+void initHashTable(HashTable* t) {
+    t->sizeMask = 0;
+    t->numEntries = 0;
+    t->count = 0;
+    t->ctrl = NULL;
+    t->entries = NULL;
+}
+
+void freeHashTable(HashTable* t) {
     free(t->entries);
-    t->entries = newEntries;
-    t->sizeMask = newSize - 1;
 }
 
 bool hashTablePut(HashTable* t, ObjString* key, Value val) {
-    if(t->numEntries + 1 > (t->sizeMask + 1) * MAX_LOAD_FACTOR) {
-        growEntries(t);
+    uint32_t hash = STRING_GET_HASH(key);
+
+    if(t->entries != NULL) {
+        Entry* e = findEntry(t, key, hash);
+        if(e != NULL) {
+            e->value = val;
+            return false;
+        }
     }
 
-    Entry* e = findEntry(t->entries, t->sizeMask, key);
-    bool isNew = e->key == NULL;
-    if(isNew && IS_NULL(e->value)) {
-        t->numEntries++;
+    if(t->entries == NULL || t->numEntries + 1 > MAX_LOAD(t->sizeMask + 1)) {
+        rehash(t);
     }
 
-    e->key = key;
-    e->value = val;
-    return isNew;
+    size_t slot = findInsertSlot(t, hash);
+    if(t->ctrl[slot] == CTRL_EMPTY) t->numEntries++;
+    t->ctrl[slot] = H2(hash);
+    t->entries[slot].key = key;
+    t->entries[slot].value = val;
+    t->count++;
+
+    return true;
 }
 
 bool hashTableGet(HashTable* t, ObjString* key, Value* res) {
     if(t->entries == NULL) return false;
-    Entry* e = findEntry(t->entries, t->sizeMask, key);
-    if(e->key == NULL) return false;
+    Entry* e = findEntry(t, key, STRING_GET_HASH(key));
+    if(e == NULL) return false;
     *res = e->value;
     return true;
 }
 
 bool hashTableContainsKey(HashTable* t, ObjString* key) {
     if(t->entries == NULL) return false;
-    return findEntry(t->entries, t->sizeMask, key)->key != NULL;
+    return findEntry(t, key, STRING_GET_HASH(key)) != NULL;
 }
 
 bool hashTableDel(HashTable* t, ObjString* key) {
-    if(t->numEntries == 0) return false;
-    Entry* e = findEntry(t->entries, t->sizeMask, key);
-    if(e->key == NULL) return false;
-    e->key = NULL;
-    e->value = TRUE_VAL;
+    if(t->count == 0) return false;
+    Entry* e = findEntry(t, key, STRING_GET_HASH(key));
+    if(e == NULL) return false;
+    removeSlot(t, e - t->entries);
     return true;
 }
 
 void hashTableMerge(HashTable* t, HashTable* o) {
     if(o->entries == NULL) return;
     for(size_t i = 0; i <= o->sizeMask; i++) {
-        Entry* e = &o->entries[i];
-        if(e->key != NULL) {
-            hashTablePut(t, e->key, e->value);
+        if(IS_FULL(o->ctrl[i])) {
+            hashTablePut(t, o->entries[i].key, o->entries[i].value);
         }
     }
 }
@@ -117,42 +342,74 @@ void hashTableImportNames(HashTable* t, HashTable* o) {
     if(o->entries == NULL) return;
     for(size_t i = 0; i <= o->sizeMask; i++) {
         Entry* e = &o->entries[i];
-        if(e->key != NULL && e->key->data[0] != '_') {
+        if(IS_FULL(o->ctrl[i]) && e->key->data[0] != '_') {
             hashTablePut(t, e->key, e->value);
         }
     }
 }
 
+void hashTableCopy(HashTable* t, HashTable* o, void (*map)(Entry* e, void* ctx), void* ctx) {
+    initHashTable(t);
+    if(o->entries == NULL) return;
+
+    size_t capacity = o->sizeMask + 1;
+    size_t size = sizeof(Entry) * capacity + ctrlSize(capacity);
+    t->entries = malloc(size);
+    memcpy(t->entries, o->entries, size);
+    t->ctrl = (uint8_t*)(t->entries + capacity);
+    t->sizeMask = o->sizeMask;
+    t->numEntries = o->numEntries;
+    t->count = o->count;
+
+    for(size_t i = 0; i < capacity; i++) {
+        if(IS_FULL(t->ctrl[i])) {
+            map(&t->entries[i], ctx);
+        }
+    }
+}
+
 ObjString* hashTableGetString(HashTable* t, const char* str, size_t length, uint32_t hash) {
     if(t->entries == NULL) return NULL;
-    size_t i = hash & t->sizeMask;
-    for(;;) {
-        Entry* e = &t->entries[i];
-        if(e->key == NULL) {
-            if(IS_NULL(e->value)) return NULL;
-        } else if(STRING_GET_HASH(e->key) == hash && e->key->length == length &&
-                  memcmp(e->key->data, str, length) == 0) {
-            return e->key;
+    uint8_t h2 = H2(hash);
+    PROBE_FOREACH(t, hash, g) {
+        const uint8_t* group = t->ctrl + g * GROUP_WIDTH;
+
+        BitMask match = groupMatch(group, h2);
+        while(match) {
+            ObjString* key = t->entries[g * GROUP_WIDTH + bitmaskNext(&match)].key;
+            if(key->hash == hash && key->length == length &&
+               memcmp(key->data, str, length) == 0) {
+                return key;
+            }
         }
-        i = (i + 1) & t->sizeMask;
+
+        if(groupMatchEmpty(group)) return NULL;
     }
 }
 
 void reachHashTable(JStarVM* vm, HashTable* t) {
     if(t->entries == NULL) return;
     for(size_t i = 0; i <= t->sizeMask; i++) {
-        Entry* e = &t->entries[i];
-        reachObject(vm, (Obj*)e->key);
-        reachValue(vm, e->value);
+        if(IS_FULL(t->ctrl[i])) {
+            Entry* e = &t->entries[i];
+            reachObject(vm, (Obj*)e->key);
+            reachValue(vm, e->value);
+        }
     }
 }
 
 void removeUnreachedStrings(HashTable* t) {
     if(t->entries == NULL) return;
     for(size_t i = 0; i <= t->sizeMask; i++) {
-        Entry* e = &t->entries[i];
-        if(e->key != NULL && !e->key->base.reached) {
-            hashTableDel(t, e->key);
+        if(IS_FULL(t->ctrl[i]) && !t->entries[i].key->base.reached) {
+            removeSlot(t, i);
         }
     }
+
+    // Deleted slots lengthen probe sequences and would otherwise only be reclaimed when the
+    // table grows, so get rid of them now if they take up a significant part of the table
+    size_t deleted = t->numEntries - t->count;
+    if(deleted > (t->sizeMask + 1) / MAX_DELETED_RATIO) {
+        rehashInPlace(t);
+    }
 }
@@ -13,9 +13,16 @@ typedef struct Entry {
     Value value;
 } Entry;
 
+// Open addressing hashtable with a Swiss table layout. Every slot of the entries array has an
+// associated control byte, storing the slot state (empty, deleted or full) and, when full, 7 bits
+// of the key's hash. Lookups probe a group of control bytes at a time (with SSE2/NEON, if
+// available) and only compare the keys of the slots whose hash fragment matches.
 typedef struct HashTable {
-    size_t sizeMask, numEntries;
-    Entry* entries;
+    size_t sizeMask;    // The size of the entries array minus one
+    size_t numEntries;  // Number of used slots, including deleted ones
+    size_t count;       // Number of actual entries
+    uint8_t* ctrl;      // Control bytes
+    Entry* entries;     // Entries array. Control bytes are allocated right after it
 } HashTable;
 
 // Initialize the hashtable
@@ -34,10 +41,16 @@ bool hashTableDel(HashTable* t, ObjString* key);
 void hashTableMerge(HashTable* t, HashTable* o);
 // Similar to merge, but doesn't add entries with a key starting with an underscore.
 void hashTableImportNames(HashTable* t, HashTable* o);
+// Copy `o` into the uninitialized hashtable `t`, calling `map` on every copied entry so that it can
+// replace its key and value. Since the layout of `o` is copied as is, keys must only be replaced
+// by strings with the same hash
+void hashTableCopy(HashTable* t, HashTable* o, void (*map)(Entry* e, void* ctx), void* ctx);
 // Gets a ObjString* given a C string and its hash (used to implement a string pool)
 ObjString* hashTableGetString(HashTable* t, const char* str, size_t length, uint32_t hash);
 
 void reachHashTable(JStarVM* vm, HashTable* t);
+// Removes all unreached strings from a string pool, rehashing it in place if it
+// has accumulated too many deleted slots
 void removeUnreachedStrings(HashTable* t);
 
 #endif
@@ -3,18 +3,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
+#include "codecache.h"
 #include "common.h"
 #include "compiler.h"
 #include "dynload.h"
 #include "hashtable.h"
 #include "jstar.h"
+#include "modcache.h"
 #include "parse/parser.h"
+#include "prefetch.h"
+#include "serialize.h"
 #include "std/modules.h"
 #include "value.h"
 #include "vm.h"
 
-ObjFunction* compileWithModule(JStarVM* vm, const char* fileName, ObjString* name, JStarStmt* program) {
+ObjModule* getOrCreateModule(JStarVM* vm, ObjString* name) {
     ObjModule* module = getModule(vm, name);
 
     if(module == NULL) {
@@ -29,6 +34,12 @@ ObjFunction* compileWithModule(JStarVM* vm, const char* fileName, ObjString* nam
         setModule(vm, name, module);
     }
 
+    return module;
+}
+
+ObjFunction* compileWithModule(JStarVM* vm, const char* fileName, ObjString* name, JStarStmt* program) {
+    ObjModule* module = getOrCreateModule(vm, name);
+
     if(program != NULL) {
         ObjFunction* fn = compile(vm, fileName, module, program);
         return fn;
@@ -37,6 +48,26 @@ ObjFunction* compileWithModule(JStarVM* vm, const char* fileName, ObjString* nam
     return NULL;
 }
 
+ObjFunction* deserializeWithModule(JStarVM* vm, const char* path, ObjString* name, const char* code,
+                                   size_t len) {
+    ObjModule* module = getOrCreateModule(vm, name);
+
+    ObjFunction* fn = loadSharedCode(vm, module, code, len);
+    if(fn != NULL) {
+        return fn;
+    }
+
+    const char* error = NULL;
+    fn = deserialize(vm, module, code, len, &error);
+    if(fn == NULL) {
+        vm->errorCallback(path, 0, error);
+        return NULL;
+    }
+
+    shareModuleCode(vm, fn, code, len, code, len);
+    return fn;
+}
+
 void setModule(JStarVM* vm, ObjString* name, ObjModule* module) {
     push(vm, OBJ_VAL(module));
     push(vm, OBJ_VAL(name));
@@ -67,6 +98,10 @@ static void tryNativeLib(JStarVM* vm, JStarBuffer* modulePath, ObjString* module
     jsrBufferTrunc(modulePath, rootPath - modulePath->data);
     jsrBufferAppendf(modulePath, "/" DL_PREFIX "%s" DL_SUFFIX, simpleName);
 
+    if(!importPathExists(&vm->importCache, modulePath->data)) {
+        return;
+    }
+
     void* dynlib = dynload(modulePath->data);
     if(dynlib != NULL) {
         // Reuse modulepath to create open function name
@@ -87,21 +122,66 @@ static void tryNativeLib(JStarVM* vm, JStarBuffer* modulePath, ObjString* module
     }
 }
 
-static bool importWithSource(JStarVM* vm, const char* path, ObjString* name, const char* source) {
-    JStarStmt* program = jsrParse(path, source, vm->errorCallback);
+// Compile a module, parsing `source` unless it has already been parsed in `program`
+static ObjFunction* compileSource(JStarVM* vm, const char* path, ObjString* name,
+                                  const char* source, JStarStmt* program) {
+    if(program != NULL) {
+        return compileWithModule(vm, path, name, program);
+    }
+
+    program = jsrParse(path, source, vm->errorCallback);
 
     if(program == NULL) {
-        return false;
+        return NULL;
     }
 
     ObjFunction* moduleFun = compileWithModule(vm, path, name, program);
     jsrStmtFree(program);
 
+    return moduleFun;
+}
+
+// Import a module from source, reusing its code if another VM of the process already loaded it.
+// If `useCache` is true, its compiled code is also looked up in (and written to) the module cache.
+// `program` is the already parsed source, or NULL
+static bool importWithSource(JStarVM* vm, const char* path, ObjString* name, const char* source,
+                             size_t len, bool useCache, JStarStmt* program) {
+    ObjModule* module = getOrCreateModule(vm, name);
+
+    ObjFunction* moduleFun = loadSharedCode(vm, module, source, len);
+    if(moduleFun != NULL) {
+        push(vm, OBJ_VAL(moduleFun));
+        return true;
+    }
+
+    // Serialized code of the module, shared by the module cache and the other VMs
+    JStarBuffer code = {0};
+
+    bool cached = false;
+    if(useCache) {
+        moduleFun = loadCachedModule(vm, module, path, source, len, &code);
+        cached = moduleFun != NULL;
+    }
+
     if(moduleFun == NULL) {
-        return false;
+        moduleFun = compileSource(vm, path, name, source, program);
+        if(moduleFun == NULL) {
+            return false;
+        }
     }
 
     push(vm, OBJ_VAL(moduleFun));
+
+    if(!cached && (useCache || vm->shareCode)) {
+        code = serialize(vm, moduleFun);
+    }
+
+    if(useCache && !cached) {
+        cacheModule(vm, path, source, len, code.data, code.len);
+    }
+
+    shareModuleCode(vm, moduleFun, source, len, code.data, code.len);
+    jsrBufferFree(&code);
     return true;
 }
 
@@ -111,13 +191,49 @@ typedef enum ImportResult {
     IMPORT_NOT_FOUND,
 } ImportResult;
 
+static bool importWithCompiledCode(JStarVM* vm, const char* path, ObjString* name,
+                                   const char* code, size_t len) {
+    ObjFunction* moduleFun = deserializeWithModule(vm, path, name, code, len);
+    if(moduleFun == NULL) {
+        return false;
+    }
+
+    push(vm, OBJ_VAL(moduleFun));
+    return true;
+}
+
 static ImportResult importFromPath(JStarVM* vm, JStarBuffer* path, ObjString* name) {
-    char* source = jsrReadFile(path->data);
+    // The module may have already been read and parsed by jsrPrefetchImports
+    PrefetchedModule prefetched = {0};
+    if(takePrefetchedModule(&vm->prefetched, path->data, &prefetched)) {
+        bool imported = importWithSource(vm, path->data, name, prefetched.src, prefetched.len,
+                                         vm->moduleCache, prefetched.program);
+        freePrefetchedModule(&prefetched);
+
+        if(!imported) {
+            return IMPORT_ERR;
+        }
+
+        tryNativeLib(vm, path, name);
+        return IMPORT_OK;
+    }
+
+    if(!importPathExists(&vm->importCache, path->data)) {
+        return IMPORT_NOT_FOUND;
+    }
+
+    size_t len;
+    char* source = jsrReadFileSz(path->data, &len);
     if(source == NULL) {
         return IMPORT_NOT_FOUND;
     }
 
-    bool imported = importWithSource(vm, path->data, name, source);
+    bool imported;
+    if(isCompiledCode(source, len)) {
+        imported = importWithCompiledCode(vm, path->data, name, source, len);
+    } else {
+        imported = importWithSource(vm, path->data, name, source, len, vm->moduleCache, NULL);
+    }
     free(source);
 
     if(!imported) {
@@ -128,7 +244,43 @@ static ImportResult importFromPath(JStarVM* vm, JStarBuffer* path, ObjString* na
     return IMPORT_OK;
 }
 
-static bool importModuleOrPackage(JStarVM* vm, ObjString* name) {
+// Returns whether the compiled module at `path` is older than its source. `len` is the length of
+// the path without extension
+static bool isOutdated(JStarVM* vm, JStarBuffer* path, size_t len) {
+    struct stat compiledStat, sourceStat;
+    if(stat(path->data, &compiledStat) != 0) return false;
+
+    jsrBufferTrunc(path, len);
+    jsrBufferAppendstr(path, JSR_EXT);
+    bool outdated = importPathExists(&vm->importCache, path->data) &&
+                    stat(path->data, &sourceStat) == 0 &&
+                    sourceStat.st_mtime > compiledStat.st_mtime;
+
+    jsrBufferTrunc(path, len);
+    jsrBufferAppendstr(path, JSC_EXT);
+    return outdated;
+}
+
+// Try to import a module from a compiled (.jsc) file first, and then from a source (.jsr) one.
+// The compiled file is skipped if it's older than the source, so that a stale .jsc never shadows
+// the edits made to a module. `path` should contain the path of the module without extension
+static ImportResult importFromPathWithExt(JStarVM* vm, JStarBuffer* path, ObjString* name) {
+    size_t len = path->len;
+
+    jsrBufferAppendstr(path, JSC_EXT);
+    if(importPathExists(&vm->importCache, path->data) && !isOutdated(vm, path, len)) {
+        ImportResult res = importFromPath(vm, path, name);
+        if(res != IMPORT_NOT_FOUND) {
+            return res;
+        }
+    }
+
+    jsrBufferTrunc(path, len);
+    jsrBufferAppendstr(path, JSR_EXT);
+    return importFromPath(vm, path, name);
+}
+
+static ImportResult importModuleOrPackage(JStarVM* vm, ObjString* name) {
     ObjList* paths = vm->importpaths;
 
     JStarBuffer fullPath;
@@ -150,29 +302,73 @@ static bool importModuleOrPackage(JStarVM* vm, ObjString* name) {
 
         ImportResult res;
 
-        // try to load a package (__package__.jsr file in a directory)
+        // try to load a package (__package__.jsc or __package__.jsr file in a directory)
         jsrBufferAppendstr(&fullPath, "/" PACKAGE_FILE);
-        res = importFromPath(vm, &fullPath, name);
+        res = importFromPathWithExt(vm, &fullPath, name);
 
         if(res != IMPORT_NOT_FOUND) {
             jsrBufferFree(&fullPath);
-            return res == IMPORT_OK;
+            return res;
         }
 
-        // if there is no package try to load module (i.e. normal .jsr file)
+        // if there is no package try to load module (i.e. normal .jsc or .jsr file)
         jsrBufferTrunc(&fullPath, moduleEnd);
-        jsrBufferAppendstr(&fullPath, ".jsr");
-        res = importFromPath(vm, &fullPath, name);
+        res = importFromPathWithExt(vm, &fullPath, name);
 
         if(res != IMPORT_NOT_FOUND) {
             jsrBufferFree(&fullPath);
-            return res == IMPORT_OK;
+            return res;
         }
 
         jsrBufferClear(&fullPath);
     }
 
     jsrBufferFree(&fullPath);
+    return IMPORT_NOT_FOUND;
+}
+
+// Try the candidate files of a module in `path` (that contains the module's path without
+// extension) in the same order used by `importFromPathWithExt`
+static bool findModuleFile(JStarVM* vm, JStarBuffer* path) {
+    size_t len = path->len;
+
+    jsrBufferAppendstr(path, JSC_EXT);
+    if(importPathExists(&vm->importCache, path->data)) return true;
+
+    jsrBufferTrunc(path, len);
+    jsrBufferAppendstr(path, JSR_EXT);
+    if(importPathExists(&vm->importCache, path->data)) return true;
+
+    jsrBufferTrunc(path, len);
+    return false;
+}
+
+bool resolveModulePath(JStarVM* vm, const char* name, JStarBuffer* path) {
+    ObjList* paths = vm->importpaths;
+
+    for(size_t i = 0; i < paths->count + 1; i++) {
+        jsrBufferClear(path);
+
+        if(i < paths->count) {
+            if(!IS_STRING(paths->arr[i])) continue;
+            jsrBufferAppendstr(path, AS_STRING(paths->arr[i])->data);
+            if(path->len > 0 && path->data[path->len - 1] != '/') {
+                jsrBufferAppendChar(path, '/');
+            }
+        }
+
+        size_t moduleStart = path->len;
+        size_t moduleEnd = moduleStart + strlen(name);
+        jsrBufferAppendstr(path, name);
+        jsrBufferReplaceChar(path, moduleStart, '.', '/');
+
+        jsrBufferAppendstr(path, "/" PACKAGE_FILE);
+        if(findModuleFile(vm, path)) return true;
+
+        jsrBufferTrunc(path, moduleEnd);
+        if(findModuleFile(vm, path)) return true;
+    }
+
     return false;
 }
 
@@ -199,12 +395,18 @@ bool importModule(JStarVM* vm, ObjString* name) {
         return true;
     }
 
+    size_t codeLen;
+    const char* builtinCode = readBuiltInModuleCode(name->data, &codeLen);
+    if(builtinCode != NULL) {
+        return importWithCompiledCode(vm, name->data, name, builtinCode, codeLen);
+    }
+
     const char* builtinSrc = readBuiltInModule(name->data);
     if(builtinSrc != NULL) {
-        return importWithSource(vm, name->data, name, builtinSrc);
+        return importWithSource(vm, name->data, name, builtinSrc, strlen(builtinSrc), false, NULL);
     }
 
-    if(!importModuleOrPackage(vm, name)) {
+    if(importModuleOrPackage(vm, name) != IMPORT_OK) {
         return false;
     }
 
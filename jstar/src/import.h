@@ -9,8 +9,15 @@
 #include "value.h"
 
 ObjFunction* compileWithModule(JStarVM* vm, const char* fileName, ObjString* name, JStarStmt* program);
+ObjFunction* deserializeWithModule(JStarVM* vm, const char* path, ObjString* name, const char* code,
+                                   size_t len);
 void setModule(JStarVM* vm, ObjString* name, ObjModule* module);
 ObjModule* getModule(JStarVM* vm, ObjString* name);
+// Get the module `name`, creating it if it doesn't exist
+ObjModule* getOrCreateModule(JStarVM* vm, ObjString* name);
 bool importModule(JStarVM* vm, ObjString* name);
+// Find the file that `importModule` would load the module `name` from, storing its path in `path`.
+// Returns false if the module couldn't be found in the import paths
+bool resolveModulePath(JStarVM* vm, const char* name, JStarBuffer* path);
 
 #endif
@@ -0,0 +1,306 @@
+#include "importcache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "jstarconf.h"
+
+#if defined(JSTAR_POSIX)
+    #include <dirent.h>
+    #include <errno.h>
+    #include <sys/stat.h>
+#elif defined(JSTAR_WINDOWS)
+    #include <Windows.h>
+    #include <sys/stat.h>
+#endif
+
+// File systems of these platforms are case insensitive by default
+#if defined(JSTAR_WINDOWS) || defined(JSTAR_MACOS)
+    #define FOLD_CASE
+#endif
+
+#define TABLE_DEF_SIZE 16
+
+// -----------------------------------------------------------------------------
+// PATH TABLE
+// -----------------------------------------------------------------------------
+
+static char foldChar(char c) {
+#ifdef FOLD_CASE
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+#else
+    return c;
+#endif
+}
+
+static uint32_t hashPath(const char* path, size_t len) {
+#ifdef FOLD_CASE
+    char buf[256];
+    if(len <= sizeof(buf)) {
+        for(size_t i = 0; i < len; i++) buf[i] = foldChar(path[i]);
+        return hashString(buf, len);
+    }
+    // Long paths are hashed on their length only, and get resolved by `pathEquals`
+    return (uint32_t)len;
+#else
+    return hashString(path, len);
+#endif
+}
+
+static bool pathEquals(const char* p1, const char* p2, size_t len) {
+    for(size_t i = 0; i < len; i++) {
+        if(foldChar(p1[i]) != foldChar(p2[i])) return false;
+    }
+    return p1[len] == '\0';
+}
+
+static void initPathTable(PathTable* t) {
+    t->count = 0;
+    t->mask = 0;
+    t->entries = NULL;
+}
+
+static void freePathTable(PathTable* t) {
+    for(size_t i = 0; t->entries != NULL && i <= t->mask; i++) {
+        free(t->entries[i].path);
+    }
+    free(t->entries);
+    initPathTable(t);
+}
+
+static PathEntry* findEntry(PathEntry* entries, size_t mask, const char* path, size_t len,
+                            uint32_t hash) {
+    for(size_t i = hash & mask;; i = (i + 1) & mask) {
+        PathEntry* e = &entries[i];
+        if(e->path == NULL) return e;
+        if(e->hash == hash && pathEquals(e->path, path, len)) return e;
+    }
+}
+
+static void growPathTable(PathTable* t) {
+    size_t size = t->entries ? (t->mask + 1) * 2 : TABLE_DEF_SIZE;
+    PathEntry* entries = calloc(size, sizeof(PathEntry));
+
+    for(size_t i = 0; t->entries != NULL && i <= t->mask; i++) {
+        PathEntry* e = &t->entries[i];
+        if(e->path != NULL) {
+            *findEntry(entries, size - 1, e->path, strlen(e->path), e->hash) = *e;
+        }
+    }
+
+    free(t->entries);
+    t->entries = entries;
+    t->mask = size - 1;
+}
+
+static PathEntry* pathTableGet(PathTable* t, const char* path, size_t len) {
+    if(t->entries == NULL) return NULL;
+    PathEntry* e = findEntry(t->entries, t->mask, path, len, hashPath(path, len));
+    return e->path != NULL ? e : NULL;
+}
+
+static PathEntry* pathTablePut(PathTable* t, const char* path, size_t len, PathState state) {
+    if(t->entries == NULL || (t->count + 1) * 2 > t->mask + 1) {
+        growPathTable(t);
+    }
+
+    uint32_t hash = hashPath(path, len);
+    PathEntry* e = findEntry(t->entries, t->mask, path, len, hash);
+    if(e->path == NULL) {
+        e->path = malloc(len + 1);
+        memcpy(e->path, path, len);
+        e->path[len] = '\0';
+        e->hash = hash;
+        t->count++;
+    }
+    e->state = state;
+    return e;
+}
+
+// -----------------------------------------------------------------------------
+// DIRECTORY LISTING
+// -----------------------------------------------------------------------------
+
+static void addDirEntry(ImportCache* c, char* buf, size_t dirLen, const char* name) {
+    size_t nameLen = strlen(name);
+    if(nameLen == 0 || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) return;
+
+    memcpy(buf + dirLen, name, nameLen);
+    pathTablePut(&c->files, buf, dirLen + nameLen, FILE_PRESENT);
+}
+
+// List the directory `dir` of `len` bytes (the current directory if empty), adding the paths
+// of its entries to the files table. Returns the resulting state of the directory
+static PathState listDir(ImportCache* c, const char* dir, size_t len) {
+#if defined(JSTAR_POSIX) || defined(JSTAR_WINDOWS)
+    char* dirPath = malloc(len + 1);
+    memcpy(dirPath, dir, len);
+    dirPath[len] = '\0';
+
+    // Entries are stored as `dir/name`, so that they can be looked up by the full path
+    char* buf = malloc(len + 2 + FILENAME_MAX);
+    memcpy(buf, dir, len);
+
+    size_t prefixLen = len;
+    if(len > 0 && dir[len - 1] != '/') buf[prefixLen++] = '/';
+
+    PathState state = DIR_LISTED;
+
+    #if defined(JSTAR_POSIX)
+    DIR* d = opendir(len > 0 ? dirPath : ".");
+    if(d == NULL) {
+        state = (errno == ENOENT || errno == ENOTDIR) ? DIR_MISSING : DIR_UNLISTABLE;
+    } else {
+        struct dirent* ent;
+        while((ent = readdir(d)) != NULL) {
+            if(strlen(ent->d_name) < FILENAME_MAX) addDirEntry(c, buf, prefixLen, ent->d_name);
+        }
+        closedir(d);
+    }
+    #else
+    memcpy(buf + prefixLen, "*", 2);
+    WIN32_FIND_DATAA data;
+    HANDLE h = FindFirstFileA(buf, &data);
+    if(h == INVALID_HANDLE_VALUE) {
+        DWORD err = GetLastError();
+        bool missing = err == ERROR_PATH_NOT_FOUND || err == ERROR_FILE_NOT_FOUND;
+        state = missing ? DIR_MISSING : DIR_UNLISTABLE;
+    } else {
+        do {
+            if(strlen(data.cFileName) < FILENAME_MAX) {
+                addDirEntry(c, buf, prefixLen, data.cFileName);
+            }
+        } while(FindNextFileA(h, &data));
+        FindClose(h);
+    }
+    #endif
+
+    free(buf);
+    free(dirPath);
+    return state;
+#else
+    // Directory listing not supported
+    return DIR_UNLISTABLE;
+#endif
+}
+
+#if defined(JSTAR_POSIX) || defined(JSTAR_WINDOWS)
+static bool statPath(const char* path, size_t len, struct stat* st) {
+    char* pathStr = malloc(len + 1);
+    memcpy(pathStr, path, len);
+    pathStr[len] = '\0';
+
+    bool exists = stat(len > 0 ? pathStr : ".", st) == 0;
+
+    free(pathStr);
+    return exists;
+}
+#endif
+
+static bool statExists(const char* path, size_t len) {
+#if defined(JSTAR_POSIX) || defined(JSTAR_WINDOWS)
+    struct stat st;
+    return statPath(path, len, &st);
+#else
+    // Assume the file exists, and let the caller find out by opening it
+    return true;
+#endif
+}
+
+// Get the modification time of the directory `dir`. Returns false if it doesn't exist
+static bool dirModTime(const char* dir, size_t len, time_t* mtime) {
+#if defined(JSTAR_POSIX) || defined(JSTAR_WINDOWS)
+    struct stat st;
+    if(!statPath(dir, len, &st)) return false;
+    *mtime = st.st_mtime;
+    return true;
+#else
+    return false;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// IMPORT CACHE
+// -----------------------------------------------------------------------------
+
+void initImportCache(ImportCache* c) {
+    initPathTable(&c->dirs);
+    initPathTable(&c->files);
+}
+
+void freeImportCache(ImportCache* c) {
+    freePathTable(&c->dirs);
+    freePathTable(&c->files);
+}
+
+static bool isSeparator(char c) {
+#ifdef JSTAR_WINDOWS
+    return c == '/' || c == '\\';
+#else
+    return c == '/';
+#endif
+}
+
+// Returns the length of `path` up to and including its last separator, 0 if there is none
+static size_t dirPrefixLength(const char* path, size_t len) {
+    while(len > 0 && !isSeparator(path[len - 1])) len--;
+    return len;
+}
+
+// List the directory `dir` (unless it's known to be missing) and cache its state
+static PathEntry* cacheDir(ImportCache* c, const char* dir, size_t len, bool missing) {
+    time_t mtime = 0;
+    bool hasTime = !missing && dirModTime(dir, len, &mtime);
+    PathState state = missing ? DIR_MISSING : listDir(c, dir, len);
+
+    PathEntry* e = pathTablePut(&c->dirs, dir, len, state);
+    e->mtime = mtime;
+    // Modification times have a resolution of a second, so entries created in the same second
+    // of the listing may go unnoticed. Such a listing is refreshed on every miss until then
+    e->racy = !hasTime || mtime >= time(NULL);
+    return e;
+}
+
+// Returns whether the directory may have gained entries since it was cached
+static bool dirChanged(PathEntry* dir, size_t len) {
+    if(dir->state == DIR_UNLISTABLE) return false;
+    time_t mtime;
+    if(!dirModTime(dir->path, len, &mtime)) return false;
+    return dir->state == DIR_MISSING || dir->racy || mtime != dir->mtime;
+}
+
+static bool dirContains(ImportCache* c, PathEntry* dir, const char* path, size_t len) {
+    switch(dir->state) {
+    case DIR_LISTED:
+        return pathTableGet(&c->files, path, len) != NULL;
+    case DIR_MISSING:
+        return false;
+    default:
+        return statExists(path, len);
+    }
+}
+
+static bool pathExists(ImportCache* c, const char* path, size_t len) {
+    size_t sep = dirPrefixLength(path, len);
+
+    // Exclude the separator, unless it's the one of the root directory
+    size_t dirLen = sep > 1 ? sep - 1 : sep;
+
+    PathEntry* dir = pathTableGet(&c->dirs, path, dirLen);
+    if(dir == NULL) {
+        // A directory missing from the listing of its parent doesn't need to be listed
+        bool missing = dirLen > 1 && dirPrefixLength(path, dirLen) > 0 &&
+                       !pathExists(c, path, dirLen);
+        dir = cacheDir(c, path, dirLen, missing);
+    } else if(!dirContains(c, dir, path, len) && dirChanged(dir, dirLen)) {
+        dir = cacheDir(c, path, dirLen, false);
+    }
+
+    return dirContains(c, dir, path, len);
+}
+
+bool importPathExists(ImportCache* c, const char* path) {
+    return pathExists(c, path, strlen(path));
+}
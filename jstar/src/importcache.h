@@ -0,0 +1,46 @@
+#ifndef IMPORTCACHE_H
+#define IMPORTCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef enum PathState {
+    DIR_LISTED,      // The directory has been listed, its entries are in the `files` table
+    DIR_MISSING,     // The directory doesn't exist, so neither do its entries
+    DIR_UNLISTABLE,  // The directory couldn't be listed, its entries are checked with stat()
+    FILE_PRESENT,    // An entry (file or directory) of a listed directory
+} PathState;
+
+typedef struct PathEntry {
+    char* path;
+    uint32_t hash;
+    PathState state;
+    time_t mtime;  // For directories, the modification time they had when listed
+    bool racy;     // For directories, whether they may have changed without updating `mtime`
+} PathEntry;
+
+typedef struct PathTable {
+    size_t count, mask;
+    PathEntry* entries;
+} PathTable;
+
+// Cache of the directory listings of the import paths, used to know which modules exist without
+// trying to open every candidate file. Directories are listed on first use, so a single readdir
+// replaces the failed opens of all the modules looked up in it. Missing directories are cached as
+// well, so that import paths that don't exist cost nothing after the first lookup.
+// When a path isn't found its directory is stat()ed, and listed again if it was created or
+// modified since its last listing, so that files created after a failed lookup are found.
+// Removed files are only forgotten once the cache is invalidated (see jsrInvalidateImportCache).
+typedef struct ImportCache {
+    PathTable dirs;
+    PathTable files;
+} ImportCache;
+
+void initImportCache(ImportCache* c);
+void freeImportCache(ImportCache* c);
+// Returns whether the file (or directory) at `path` exists, listing its directory if needed
+bool importPathExists(ImportCache* c, const char* path);
+
+#endif
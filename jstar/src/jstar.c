@@ -11,6 +11,7 @@
 #include "object.h"
 #include "parse/ast.h"
 #include "parse/parser.h"
+#include "serialize.h"
 #include "value.h"
 #include "vm.h"
 
@@ -33,6 +34,8 @@ JStarConf jsrGetConf() {
     conf.initGC = INIT_GC;
     conf.heapGrowRate = HEAP_GROW_RATE;
     conf.errorCallback = &jsrPrintErrorCB;
+    conf.moduleCache = true;
+    conf.shareCode = true;
     return conf;
 }
 
@@ -40,6 +43,22 @@ JStarResult jsrEvaluate(JStarVM* vm, const char* path, const char* src) {
     return jsrEvaluateModule(vm, path, JSR_MAIN_MODULE, src);
 }
 
+static JStarResult evaluateModuleFunction(JStarVM* vm, ObjFunction* fn) {
+    push(vm, OBJ_VAL(fn));
+    ObjClosure* closure = newClosure(vm, fn);
+    pop(vm);
+
+    push(vm, OBJ_VAL(closure));
+
+    JStarResult res;
+    if((res = jsrCall(vm, 0)) != JSR_EVAL_SUCCESS) {
+        jsrPrintStacktrace(vm, -1);
+    }
+
+    pop(vm);
+    return res;
+}
+
 JStarResult jsrEvaluateModule(JStarVM* vm, const char* path, const char* module, const char* src) {
     JStarStmt* program = jsrParse(path, src, vm->errorCallback);
     if(program == NULL) return JSR_SYNTAX_ERR;
@@ -50,25 +69,48 @@ JStarResult jsrEvaluateModule(JStarVM* vm, const char* path, const char* module,
 
     if(fn == NULL) return JSR_COMPILE_ERR;
 
+    return evaluateModuleFunction(vm, fn);
+}
+
+JStarResult jsrSerialize(JStarVM* vm, const char* path, const char* src, JStarBuffer* out) {
+    JStarStmt* program = jsrParse(path, src, vm->errorCallback);
+    if(program == NULL) return JSR_SYNTAX_ERR;
+
+    ObjString* name = copyString(vm, JSR_MAIN_MODULE, strlen(JSR_MAIN_MODULE));
+    ObjFunction* fn = compileWithModule(vm, path, name, program);
+    jsrStmtFree(program);
+
+    if(fn == NULL) return JSR_COMPILE_ERR;
+
     push(vm, OBJ_VAL(fn));
-    ObjClosure* closure = newClosure(vm, fn);
+    *out = serialize(vm, fn);
     pop(vm);
 
-    push(vm, OBJ_VAL(closure));
+    return JSR_EVAL_SUCCESS;
+}
 
-    JStarResult res;
-    if((res = jsrCall(vm, 0)) != JSR_EVAL_SUCCESS) {
-        jsrPrintStacktrace(vm, -1);
-    }
+JStarResult jsrLoadBytecode(JStarVM* vm, const char* path, const char* code, size_t len) {
+    return jsrLoadBytecodeModule(vm, path, JSR_MAIN_MODULE, code, len);
+}
 
-    pop(vm);
-    return res;
+JStarResult jsrLoadBytecodeModule(JStarVM* vm, const char* path, const char* module,
+                                  const char* code, size_t len) {
+    ObjString* name = copyString(vm, module, strlen(module));
+    ObjFunction* fn = deserializeWithModule(vm, path, name, code, len);
+    if(fn == NULL) return JSR_DESERIALIZE_ERR;
+    return evaluateModuleFunction(vm, fn);
 }
 
 static JStarResult finishCall(JStarVM* vm, int depth, size_t offSp) {
     if(vm->frameCount <= depth) return JSR_EVAL_SUCCESS;
+
     // Evaluate frame if present
-    if(!runEval(vm, depth)) {
+    int evalDepth = vm->evalDepth;
+    vm->evalDepth = vm->callDepth;
+    bool ok = runEval(vm, depth);
+    vm->evalDepth = evalDepth;
+
+    if(!ok) {
         // Exception was thrown, push it as result
         Value exc = pop(vm);
         vm->sp = vm->stack + offSp;
@@ -91,25 +133,41 @@ static void callError(JStarVM* vm, int depth, size_t offsp) {
 JStarResult jsrCall(JStarVM* vm, uint8_t argc) {
     size_t offsp = vm->sp - vm->stack - argc - 1;
     int depth = vm->frameCount;
+    JStarResult res = JSR_RUNTIME_ERR;
 
-    if(!callValue(vm, peekn(vm, argc), argc)) {
+    vm->callDepth++;
+    if(callValue(vm, peekn(vm, argc), argc)) {
+        res = finishCall(vm, depth, offsp);
+    } else {
         callError(vm, depth, offsp);
-        return JSR_RUNTIME_ERR;
     }
+    vm->callDepth--;
 
-    return finishCall(vm, depth, offsp);
+    return res;
 }
 
 JStarResult jsrCallMethod(JStarVM* vm, const char* name, uint8_t argc) {
+    return callMethodByName(vm, copyString(vm, name, strlen(name)), argc);
+}
+
+JStarResult jsrCallMethodH(JStarVM* vm, JStarName* name, uint8_t argc) {
+    return callMethodByName(vm, (ObjString*)name, argc);
+}
+
+JStarResult callMethodByName(JStarVM* vm, ObjString* name, uint8_t argc) {
     size_t offsp = vm->sp - vm->stack - argc - 1;
     int depth = vm->frameCount;
+    JStarResult res = JSR_RUNTIME_ERR;
 
-    if(!invokeValue(vm, copyString(vm, name, strlen(name)), argc)) {
+    vm->callDepth++;
+    if(invokeValue(vm, name, argc)) {
+        res = finishCall(vm, depth, offsp);
+    } else {
         callError(vm, depth, offsp);
-        return JSR_RUNTIME_ERR;
     }
+    vm->callDepth--;
 
-    return finishCall(vm, depth, offsp);
+    return res;
 }
 
 void jsrPrintStacktrace(JStarVM* vm, int slot) {
@@ -170,7 +228,7 @@ void jsrInitCommandLineArgs(JStarVM* vm, int argc, const char** argv) {
     ObjList* argvList = vm->argv;
     argvList->count = 0;
     for(int i = 0; i < argc; i++) {
-        Value arg = OBJ_VAL(copyString(vm, argv[i], strlen(argv[i])));
+        Value arg = OBJ_VAL(newString(vm, argv[i], strlen(argv[i])));
         push(vm, arg);
         listAppend(vm, argvList, arg);
         pop(vm);
@@ -178,7 +236,11 @@ void jsrInitCommandLineArgs(JStarVM* vm, int argc, const char** argv) {
 }
 
 void jsrAddImportPath(JStarVM* vm, const char* path) {
-    listAppend(vm, vm->importpaths, OBJ_VAL(copyString(vm, path, strlen(path))));
+    listAppend(vm, vm->importpaths, OBJ_VAL(newString(vm, path, strlen(path))));
+}
+
+void jsrInvalidateImportCache(JStarVM* vm) {
+    freeImportCache(&vm->importCache);
 }
 
 void jsrEnsureStack(JStarVM* vm, size_t needed) {
@@ -186,7 +248,7 @@ void jsrEnsureStack(JStarVM* vm, size_t needed) {
 
     Value* oldStack = vm->stack;
 
-    vm->stackSz = powerOf2Ceil(vm->stackSz);
+    vm->stackSz = powerOf2Ceil(vm->sp - vm->stack + needed + 1);
     vm->stack = realloc(vm->stack, sizeof(Value) * vm->stackSz);
 
     if(vm->stack != oldStack) {
@@ -214,6 +276,11 @@ void jsrEnsureStack(JStarVM* vm, size_t needed) {
 }
 
 char* jsrReadFile(const char* path) {
+    size_t size;
+    return jsrReadFileSz(path, &size);
+}
+
+char* jsrReadFileSz(const char* path, size_t* size) {
     FILE* srcFile = fopen(path, "rb");
     if(srcFile == NULL || errno == EISDIR) {
         if(srcFile) fclose(srcFile);
@@ -221,17 +288,17 @@ char* jsrReadFile(const char* path) {
     }
 
     fseek(srcFile, 0, SEEK_END);
-    size_t size = ftell(srcFile);
+    *size = ftell(srcFile);
     rewind(srcFile);
 
-    char* src = malloc(size + 1);
+    char* src = malloc(*size + 1);
     if(src == NULL) {
         fclose(srcFile);
         return NULL;
     }
 
-    size_t read = fread(src, sizeof(char), size, srcFile);
-    if(read < size) {
+    size_t read = fread(src, sizeof(char), *size, srcFile);
+    if(read < *size) {
         free(src);
         fclose(srcFile);
         return NULL;
@@ -242,10 +309,6 @@ char* jsrReadFile(const char* path) {
     return src;
 }
 
-static void validateStack(JStarVM* vm) {
-    ASSERT((size_t)(vm->sp - vm->stack) <= vm->stackSz, "Stack overflow");
-}
-
 bool jsrRawEquals(JStarVM* vm, int slot1, int slot2) {
     Value v1 = apiStackSlot(vm, slot1);
     Value v2 = apiStackSlot(vm, slot2);
@@ -320,7 +383,7 @@ void jsrPushBoolean(JStarVM* vm, bool boolean) {
 
 void jsrPushStringSz(JStarVM* vm, const char* string, size_t length) {
     validateStack(vm);
-    push(vm, OBJ_VAL(copyString(vm, string, length)));
+    push(vm, OBJ_VAL(newString(vm, string, length)));
 }
 
 void jsrPushString(JStarVM* vm, const char* string) {
@@ -351,6 +414,46 @@ void jsrPushTuple(JStarVM* vm, size_t size) {
     push(vm, OBJ_VAL(tup));
 }
 
+void jsrPushNumberList(JStarVM* vm, const double* numbers, size_t count) {
+    validateStack(vm);
+    ObjList* lst = newList(vm, count);
+#ifdef JSTAR_NAN_TAGGING
+    // Numbers are stored as raw doubles, copy them as they are
+    if(count > 0) {
+        memcpy(lst->arr, numbers, sizeof(double) * count);
+    }
+#else
+    for(size_t i = 0; i < count; i++) {
+        lst->arr[i] = NUM_VAL(numbers[i]);
+    }
+#endif
+    lst->count = count;
+    push(vm, OBJ_VAL(lst));
+}
+
+void jsrPushStringList(JStarVM* vm, const char** strings, size_t count) {
+    validateStack(vm);
+    ObjList* lst = newList(vm, count);
+    push(vm, OBJ_VAL(lst));
+    for(size_t i = 0; i < count; i++) {
+        // Keep the list consistent, as allocating the string can trigger a GC
+        ObjString* str = newString(vm, strings[i], strlen(strings[i]));
+        lst->arr[lst->count++] = OBJ_VAL(str);
+    }
+}
+
+void jsrTupleFromSlots(JStarVM* vm, int slot, size_t count) {
+    validateStack(vm);
+    ObjTuple* tup = newTuple(vm, count);
+    if(count > 0) {
+        // Validate both ends of the range, as done for single slots
+        int first = apiStackIndex(vm, slot);
+        int last = apiStackIndex(vm, first + (int)count - 1);
+        memcpy(tup->arr, &vm->apiStack[first], sizeof(Value) * (last - first + 1));
+    }
+    push(vm, OBJ_VAL(tup));
+}
+
 void jsrPushTable(JStarVM* vm) {
     validateStack(vm);
     push(vm, OBJ_VAL(newTable(vm)));
@@ -393,15 +496,30 @@ int jsrTop(JStarVM* vm) {
     return apiStackIndex(vm, -1);
 }
 
-void jsrSetGlobal(JStarVM* vm, const char* module, const char* name) {
-    ObjModule* mod = module ? getModule(vm, copyString(vm, module, strlen(module))) : vm->module;
+static ObjModule* getGlobalModule(JStarVM* vm, ObjString* module) {
+    ObjModule* mod = module ? getModule(vm, module) : vm->module;
     ASSERT(mod, "Module doesn't exist");
-    hashTablePut(&mod->globals, copyString(vm, name, strlen(name)), peek(vm));
+    return mod;
+}
+
+static void setGlobal(JStarVM* vm, ObjString* module, ObjString* name) {
+    ObjModule* mod = getGlobalModule(vm, module);
+    hashTablePut(&mod->globals, name, peek(vm));
+}
+
+void jsrSetGlobal(JStarVM* vm, const char* module, const char* name) {
+    ObjString* modStr = module ? copyString(vm, module, strlen(module)) : NULL;
+    setGlobal(vm, modStr, copyString(vm, name, strlen(name)));
+}
+
+void jsrSetGlobalH(JStarVM* vm, JStarName* module, JStarName* name) {
+    setGlobal(vm, (ObjString*)module, (ObjString*)name);
 }
 
 void jsrListAppend(JStarVM* vm, int slot) {
     Value lst = apiStackSlot(vm, slot);
     ASSERT(IS_LIST(lst), "Not a list");
+    ASSERT(!AS_OBJ(lst)->frozen, "List is frozen");
     listAppend(vm, AS_LIST(lst), peek(vm));
 }
 
@@ -409,6 +527,7 @@ void jsrListInsert(JStarVM* vm, size_t i, int slot) {
     Value lstVal = apiStackSlot(vm, slot);
     ASSERT(IS_LIST(lstVal), "Not a list");
     ObjList* lst = AS_LIST(lstVal);
+    ASSERT(!lst->base.frozen, "List is frozen");
     ASSERT(i < lst->count, "Out of bounds");
     listInsert(vm, lst, (size_t)i, peek(vm));
 }
@@ -417,6 +536,7 @@ void jsrListRemove(JStarVM* vm, size_t i, int slot) {
     Value lstVal = apiStackSlot(vm, slot);
     ASSERT(IS_LIST(lstVal), "Not a list");
     ObjList* lst = AS_LIST(lstVal);
+    ASSERT(!lst->base.frozen, "List is frozen");
     ASSERT(i < lst->count, "Out of bounds");
     listRemove(vm, lst, (size_t)i);
 }
@@ -435,6 +555,21 @@ size_t jsrListGetLength(JStarVM* vm, int slot) {
     return AS_LIST(lst)->count;
 }
 
+bool jsrListToDoubles(JStarVM* vm, int slot, double* out) {
+    Value lstVal = apiStackSlot(vm, slot);
+    ASSERT(IS_LIST(lstVal), "Not a list");
+    ObjList* lst = AS_LIST(lstVal);
+    for(size_t i = 0; i < lst->count; i++) {
+        Value v = lst->arr[i];
+        if(!IS_NUM(v)) {
+            JSR_RAISE(vm, "TypeException", "List element %zu must be a Number, got %s.", i,
+                      getClass(vm, v)->name->data);
+        }
+        out[i] = AS_NUM(v);
+    }
+    return true;
+}
+
 void jsrTupleGet(JStarVM* vm, size_t i, int slot) {
     Value tupVal = apiStackSlot(vm, slot);
     ASSERT(IS_TUPLE(tupVal), "Not a tuple");
@@ -454,19 +589,28 @@ bool jsrSetField(JStarVM* vm, int slot, const char* name) {
     return setFieldOfValue(vm, copyString(vm, name, strlen(name)));
 }
 
+bool jsrSetFieldH(JStarVM* vm, int slot, JStarName* name) {
+    push(vm, apiStackSlot(vm, slot));
+    return setFieldOfValue(vm, (ObjString*)name);
+}
+
 bool jsrGetField(JStarVM* vm, int slot, const char* name) {
     push(vm, apiStackSlot(vm, slot));
     return getFieldFromValue(vm, copyString(vm, name, strlen(name)));
 }
 
-bool jsrGetGlobal(JStarVM* vm, const char* module, const char* name) {
-    ObjModule* mod = module ? getModule(vm, copyString(vm, module, strlen(module))) : vm->module;
-    ASSERT(mod, "Module doesn't exist");
+bool jsrGetFieldH(JStarVM* vm, int slot, JStarName* name) {
+    push(vm, apiStackSlot(vm, slot));
+    return getFieldFromValue(vm, (ObjString*)name);
+}
+
+static bool getGlobal(JStarVM* vm, ObjString* module, ObjString* name) {
+    ObjModule* mod = getGlobalModule(vm, module);
 
     Value res;
-    ObjString* nameStr = copyString(vm, name, strlen(name));
-    if(!hashTableGet(&mod->globals, nameStr, &res)) {
-        jsrRaise(vm, "NameException", "Name %s not definied in module %s.", name, module);
+    if(!hashTableGet(&mod->globals, name, &res)) {
+        jsrRaise(vm, "NameException", "Name %s not definied in module %s.", name->data,
+                 mod->name->data);
         return false;
     }
 
@@ -474,6 +618,23 @@ bool jsrGetGlobal(JStarVM* vm, const char* module, const char* name) {
     return true;
 }
 
+bool jsrGetGlobal(JStarVM* vm, const char* module, const char* name) {
+    ObjString* modStr = module ? copyString(vm, module, strlen(module)) : NULL;
+    return getGlobal(vm, modStr, copyString(vm, name, strlen(name)));
+}
+
+bool jsrGetGlobalH(JStarVM* vm, JStarName* module, JStarName* name) {
+    return getGlobal(vm, (ObjString*)module, (ObjString*)name);
+}
+
+JStarName* jsrInternName(JStarVM* vm, const char* name) {
+    ObjString* str = copyString(vm, name, strlen(name));
+    push(vm, OBJ_VAL(str));
+    hashTablePut(&vm->names, str, BOOL_VAL(true));
+    pop(vm);
+    return (JStarName*)str;
+}
+
 void jsrBindNative(JStarVM* vm, int clsSlot, int natSlot) {
     Value cls = apiStackSlot(vm, clsSlot);
     Value nat = apiStackSlot(vm, natSlot);
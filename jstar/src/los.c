@@ -0,0 +1,136 @@
+#ifdef __linux__
+    #define _GNU_SOURCE  // for mremap
+#endif
+
+#include "los.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jstarconf.h"
+
+#ifdef JSTAR_POSIX
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+static void outOfMemory(void) {
+    perror("Error while allocating memory");
+    abort();
+}
+
+void initLargeObjSpace(LargeObjSpace* los, size_t initGC) {
+    los->allocated = 0;
+    los->nextGC = initGC;
+    los->cacheCount = 0;
+#ifdef JSTAR_POSIX
+    los->pageSize = (size_t)sysconf(_SC_PAGESIZE);
+#else
+    los->pageSize = 1;
+#endif
+}
+
+#ifdef JSTAR_POSIX
+
+static size_t mappingSize(LargeObjSpace* los, size_t size) {
+    return (size + los->pageSize - 1) & ~(los->pageSize - 1);
+}
+
+void freeLargeObjSpace(LargeObjSpace* los) {
+    for(int i = 0; i < los->cacheCount; i++) {
+        munmap(los->cache[i].mem, los->cache[i].size);
+    }
+    los->cacheCount = 0;
+}
+
+// Take the smallest cached mapping that can hold `size` bytes, trimming its excess pages
+static void* takeCached(LargeObjSpace* los, size_t size) {
+    int best = -1;
+    for(int i = 0; i < los->cacheCount; i++) {
+        if(los->cache[i].size >= size &&
+           (best == -1 || los->cache[i].size < los->cache[best].size)) {
+            best = i;
+        }
+    }
+    if(best == -1) return NULL;
+
+    char* mem = los->cache[best].mem;
+    if(los->cache[best].size > size) {
+        munmap(mem + size, los->cache[best].size - size);
+    }
+    los->cache[best] = los->cache[--los->cacheCount];
+    return mem;
+}
+
+void* losAllocate(LargeObjSpace* los, size_t size) {
+    size_t mapSize = mappingSize(los, size);
+
+    void* mem = takeCached(los, mapSize);
+    if(mem != NULL) return mem;
+
+    mem = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED) outOfMemory();
+    return mem;
+}
+
+void losFree(LargeObjSpace* los, void* ptr, size_t size) {
+    size_t mapSize = mappingSize(los, size);
+    if(los->cacheCount < LOS_CACHE_SZ) {
+        madvise(ptr, mapSize, MADV_DONTNEED);
+        los->cache[los->cacheCount].mem = ptr;
+        los->cache[los->cacheCount].size = mapSize;
+        los->cacheCount++;
+    } else {
+        munmap(ptr, mapSize);
+    }
+}
+
+void* losReallocate(LargeObjSpace* los, void* ptr, size_t oldsize, size_t size) {
+    size_t oldMapSize = mappingSize(los, oldsize);
+    size_t newMapSize = mappingSize(los, size);
+    if(oldMapSize == newMapSize) return ptr;
+
+    if(newMapSize < oldMapSize) {
+        munmap((char*)ptr + newMapSize, oldMapSize - newMapSize);
+        return ptr;
+    }
+
+    #ifdef JSTAR_LINUX
+    void* mem = mremap(ptr, oldMapSize, newMapSize, MREMAP_MAYMOVE);
+    if(mem == MAP_FAILED) outOfMemory();
+    return mem;
+    #else
+    void* mem = losAllocate(los, size);
+    memcpy(mem, ptr, oldsize);
+    munmap(ptr, oldMapSize);
+    return mem;
+    #endif
+}
+
+#else
+
+void freeLargeObjSpace(LargeObjSpace* los) {
+    (void)los;
+}
+
+void* losAllocate(LargeObjSpace* los, size_t size) {
+    (void)los;
+    void* mem = malloc(size);
+    if(!mem) outOfMemory();
+    return mem;
+}
+
+void losFree(LargeObjSpace* los, void* ptr, size_t size) {
+    (void)los, (void)size;
+    free(ptr);
+}
+
+void* losReallocate(LargeObjSpace* los, void* ptr, size_t oldsize, size_t size) {
+    (void)los, (void)oldsize;
+    void* mem = realloc(ptr, size);
+    if(!mem) outOfMemory();
+    return mem;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef LOS_H
+#define LOS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Allocations at or above this size are served by the large object space
+#define LOS_THRESHOLD (1024 * 128)
+// Number of freed mappings kept around for reuse
+#define LOS_CACHE_SZ 4
+
+// The large object space (LOS) serves big, growable allocations (list arrays, table entries,
+// long strings, ...) directly from the operating system, bypassing the general purpose allocator.
+// On POSIX systems every large allocation is an independent anonymous mapping. This allows us to
+// return memory to the OS as soon as it's freed, and to grow an allocation in place (via mremap)
+// on systems that support it. Memory held in the LOS is accounted separately from the rest of
+// the heap, so that big allocations don't inflate the small objects GC threshold.
+typedef struct LargeObjSpace {
+    size_t allocated;  // Bytes currently allocated in the LOS
+    size_t nextGC;     // LOS bytes at which the next GC will be triggered
+    size_t pageSize;
+    // Cache of freed mappings. Their pages are released with MADV_DONTNEED, but the address
+    // space is kept so that it can be reused by later large allocations without a new mmap
+    struct {
+        void* mem;
+        size_t size;
+    } cache[LOS_CACHE_SZ];
+    int cacheCount;
+} LargeObjSpace;
+
+void initLargeObjSpace(LargeObjSpace* los, size_t initGC);
+void freeLargeObjSpace(LargeObjSpace* los);
+
+static inline bool isLargeAlloc(size_t size) {
+    return size >= LOS_THRESHOLD;
+}
+
+void* losAllocate(LargeObjSpace* los, size_t size);
+void* losReallocate(LargeObjSpace* los, void* ptr, size_t oldsize, size_t size);
+void losFree(LargeObjSpace* los, void* ptr, size_t size);
+
+#endif
@@ -0,0 +1,215 @@
+#include "modcache.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "common.h"
+#include "hash.h"
+#include "serialize.h"
+#include "vm.h"
+
+#if defined(JSTAR_POSIX)
+    #include <unistd.h>
+#elif defined(JSTAR_WINDOWS)
+    #include <Windows.h>
+    #include <direct.h>
+    #include <process.h>
+#endif
+
+// A cache entry is made of a header describing the source it was compiled from, followed by the
+// serialized code of the module:
+//  mtime (8 bytes), size (8 bytes), hash (8 bytes), serialized code
+#define ENTRY_HEADER_SIZE (3 * sizeof(uint64_t))
+
+// Suffix of cache entries. Including the version makes entries of different J* versions coexist
+#define CACHE_SUFFIX ".jstar-" JSTAR_VERSION_STRING JSC_EXT
+
+typedef struct SourceInfo {
+    uint64_t mtime, size, hash;
+} SourceInfo;
+
+// -----------------------------------------------------------------------------
+// PLATFORM SPECIFIC FUNCTIONS
+// -----------------------------------------------------------------------------
+
+#if defined(JSTAR_POSIX) || defined(JSTAR_WINDOWS)
+    #define CACHE_SUPPORTED
+#endif
+
+#ifdef CACHE_SUPPORTED
+
+static void makeDir(const char* path) {
+    #if defined(JSTAR_POSIX)
+    mkdir(path, 0777);
+    #else
+    _mkdir(path);
+    #endif
+}
+
+static unsigned long processId(void) {
+    #if defined(JSTAR_POSIX)
+    return (unsigned long)getpid();
+    #else
+    return (unsigned long)_getpid();
+    #endif
+}
+
+// Atomically replace `dest` with `src`
+static bool replaceFile(const char* src, const char* dest) {
+    #if defined(JSTAR_POSIX)
+    return rename(src, dest) == 0;
+    #else
+    return MoveFileExA(src, dest, MOVEFILE_REPLACE_EXISTING) != 0;
+    #endif
+}
+
+// -----------------------------------------------------------------------------
+// CACHE ENTRIES
+// -----------------------------------------------------------------------------
+
+static bool getSourceInfo(const char* path, const char* src, size_t len, SourceInfo* info) {
+    struct stat st;
+    if(stat(path, &st) != 0) return false;
+    info->mtime = (uint64_t)st.st_mtime;
+    info->size = len;
+    info->hash = hashBytes(src, len);
+    return true;
+}
+
+static void storeUint64(uint8_t* dest, uint64_t n) {
+    for(int i = 0; i < 8; i++) {
+        dest[i] = (uint8_t)(n >> (56 - i * 8));
+    }
+}
+
+static uint64_t loadUint64(const uint8_t* src) {
+    uint64_t n = 0;
+    for(int i = 0; i < 8; i++) {
+        n = n << 8 | src[i];
+    }
+    return n;
+}
+
+// Append the path of the cache directory of the module at `path` to `buf`.
+// Returns a pointer to the file name of the module inside `path`
+static const char* appendCacheDir(JStarBuffer* buf, const char* path) {
+    const char* fileName = strrchr(path, '/');
+    #ifdef JSTAR_WINDOWS
+    const char* backslash = strrchr(path, '\\');
+    if(backslash > fileName) fileName = backslash;
+    #endif
+
+    fileName = fileName ? fileName + 1 : path;
+    jsrBufferAppend(buf, path, fileName - path);
+    jsrBufferAppendstr(buf, MODULE_CACHE_DIR);
+    return fileName;
+}
+
+// Append the path of the cache entry of the module at `path` to `buf`
+static void appendCachePath(JStarBuffer* buf, const char* path) {
+    const char* fileName = appendCacheDir(buf, path);
+
+    size_t nameLen = strlen(fileName), extLen = strlen(JSR_EXT);
+    if(nameLen > extLen && strcmp(fileName + nameLen - extLen, JSR_EXT) == 0) {
+        nameLen -= extLen;
+    }
+
+    jsrBufferAppendChar(buf, '/');
+    jsrBufferAppend(buf, fileName, nameLen);
+    jsrBufferAppendstr(buf, CACHE_SUFFIX);
+}
+
+ObjFunction* loadCachedModule(JStarVM* vm, ObjModule* module, const char* path, const char* src,
+                              size_t len, JStarBuffer* code) {
+    SourceInfo info;
+    if(!getSourceInfo(path, src, len, &info)) return NULL;
+
+    JStarBuffer cachePath;
+    jsrBufferInit(vm, &cachePath);
+    appendCachePath(&cachePath, path);
+
+    size_t entryLen;
+    char* entry = jsrReadFileSz(cachePath.data, &entryLen);
+    jsrBufferFree(&cachePath);
+
+    if(entry == NULL) return NULL;
+
+    ObjFunction* fn = NULL;
+    const uint8_t* header = (const uint8_t*)entry;
+
+    if(entryLen >= ENTRY_HEADER_SIZE && loadUint64(header) == info.mtime &&
+       loadUint64(header + 8) == info.size && loadUint64(header + 16) == info.hash) {
+        // A malformed or out of date entry is not an error, it simply gets overwritten
+        const char* error;
+        const char* entryCode = entry + ENTRY_HEADER_SIZE;
+        size_t codeLen = entryLen - ENTRY_HEADER_SIZE;
+        fn = deserialize(vm, module, entryCode, codeLen, &error);
+
+        if(fn != NULL) {
+            push(vm, OBJ_VAL(fn));
+            jsrBufferInitSz(vm, code, codeLen);
+            jsrBufferAppend(code, entryCode, codeLen);
+            pop(vm);
+        }
+    }
+
+    free(entry);
+    return fn;
+}
+
+void cacheModule(JStarVM* vm, const char* path, const char* src, size_t len, const char* code,
+                 size_t codeLen) {
+    SourceInfo info;
+    if(!getSourceInfo(path, src, len, &info)) return;
+
+    JStarBuffer cachePath;
+    jsrBufferInit(vm, &cachePath);
+    appendCacheDir(&cachePath, path);
+    makeDir(cachePath.data);
+
+    jsrBufferClear(&cachePath);
+    appendCachePath(&cachePath, path);
+
+    // Unique per process and per VM, so that concurrent writers never share a temporary file
+    JStarBuffer tmpPath;
+    jsrBufferInit(vm, &tmpPath);
+    jsrBufferAppendf(&tmpPath, "%s.%lu.%p.tmp", cachePath.data, processId(), (void*)vm);
+
+    uint8_t header[ENTRY_HEADER_SIZE];
+    storeUint64(header, info.mtime);
+    storeUint64(header + 8, info.size);
+    storeUint64(header + 16, info.hash);
+
+    FILE* out = fopen(tmpPath.data, "wb");
+    if(out != NULL) {
+        bool written = fwrite(header, 1, sizeof(header), out) == sizeof(header) &&
+                       fwrite(code, 1, codeLen, out) == codeLen;
+        written = fclose(out) == 0 && written;
+
+        if(!written || !replaceFile(tmpPath.data, cachePath.data)) {
+            remove(tmpPath.data);
+        }
+    }
+
+    jsrBufferFree(&tmpPath);
+    jsrBufferFree(&cachePath);
+}
+
+#else
+
+ObjFunction* loadCachedModule(JStarVM* vm, ObjModule* module, const char* path, const char* src,
+                              size_t len, JStarBuffer* code) {
+    // Module caching not supported
+    return NULL;
+}
+
+void cacheModule(JStarVM* vm, const char* path, const char* src, size_t len, const char* code,
+                 size_t codeLen) {
+    // Module caching not supported
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef MODCACHE_H
+#define MODCACHE_H
+
+#include <stddef.h>
+
+#include "jstar.h"
+#include "object.h"
+
+// Directory, placed beside the source of a module, where its compiled code is cached
+#define MODULE_CACHE_DIR "__jscache__"
+
+// Load the cached compiled code of the module whose source is `src`, read from `path`.
+// The cache entry is considered valid only if the modification time, size and hash of the
+// source match the ones recorded when it was written.
+// Returns NULL if there is no valid entry, in which case the module should be compiled from source.
+// On success `code` is initialized with the serialized code read from the entry.
+ObjFunction* loadCachedModule(JStarVM* vm, ObjModule* module, const char* path, const char* src,
+                              size_t len, JStarBuffer* code);
+
+// Write `code`, the serialized code of the module whose source is `src`, to its cache.
+// The entry is first written to a temporary file and then renamed, so that concurrent processes
+// never observe a partially written entry. Failures are silently ignored.
+void cacheModule(JStarVM* vm, const char* path, const char* src, size_t len, const char* code,
+                 size_t codeLen);
+
+#endif
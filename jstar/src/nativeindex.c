@@ -0,0 +1,83 @@
+#include "nativeindex.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+
+static bool strEqual(const char* s1, const char* s2) {
+    if(s1 == NULL || s2 == NULL) return s1 == s2;
+    return strcmp(s1, s2) == 0;
+}
+
+static uint32_t hashKey(const char* module, const char* cls, const char* name) {
+    uint64_t h = hashString(name, strlen(name));
+    if(cls != NULL) h = hash64(h ^ (uint64_t)hashString(cls, strlen(cls)) << 32);
+    if(module != NULL) h = hash64(h ^ (uint64_t)hashString(module, strlen(module)) << 16);
+    return (uint32_t)h;
+}
+
+void initNativeIndex(NativeIndex* idx, size_t count) {
+    // Keep the load factor under 50%, so that probe sequences stay short
+    size_t size = 8;
+    while(size < count * 2) size *= 2;
+    idx->mask = size - 1;
+    idx->entries = calloc(size, sizeof(NativeIndexEntry));
+}
+
+void freeNativeIndex(NativeIndex* idx) {
+    free(idx->entries);
+    idx->entries = NULL;
+    idx->mask = 0;
+}
+
+static NativeIndexEntry* findEntry(const NativeIndex* idx, uint32_t hash, const char* module,
+                                   const char* cls, const char* name) {
+    for(size_t i = hash & idx->mask;; i = (i + 1) & idx->mask) {
+        NativeIndexEntry* e = &idx->entries[i];
+        if(e->name == NULL) return e;
+        if(e->hash == hash && strcmp(e->name, name) == 0 && strEqual(e->cls, cls) &&
+           strEqual(e->module, module)) {
+            return e;
+        }
+    }
+}
+
+void nativeIndexAdd(NativeIndex* idx, const char* module, const char* cls, const char* name,
+                    JStarNative fn) {
+    uint32_t hash = hashKey(module, cls, name);
+    NativeIndexEntry* e = findEntry(idx, hash, module, cls, name);
+    if(e->name != NULL) return;
+
+    e->hash = hash;
+    e->module = module;
+    e->cls = cls;
+    e->name = name;
+    e->fn = fn;
+}
+
+JStarNative nativeIndexGet(const NativeIndex* idx, const char* module, const char* cls,
+                           const char* name) {
+    uint32_t hash = hashKey(module, cls, name);
+    return findEntry(idx, hash, module, cls, name)->fn;
+}
+
+NativeIndex* indexNativeRegistry(JStarNativeReg* reg) {
+    size_t count = 0;
+    while(reg[count].type != REG_SENTINEL) count++;
+
+    NativeIndex* idx = malloc(sizeof(*idx));
+    initNativeIndex(idx, count);
+
+    for(size_t i = 0; i < count; i++) {
+        if(reg[i].type == REG_METHOD) {
+            const char* cls = reg[i].as.method.cls;
+            nativeIndexAdd(idx, NULL, cls, reg[i].as.method.name, reg[i].as.method.meth);
+        } else {
+            nativeIndexAdd(idx, NULL, NULL, reg[i].as.function.name, reg[i].as.function.fun);
+        }
+    }
+
+    return idx;
+}
@@ -0,0 +1,40 @@
+#ifndef NATIVEINDEX_H
+#define NATIVEINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "jstar.h"
+
+typedef struct NativeIndexEntry {
+    uint32_t hash;
+    const char* module;  // NULL for indices of a single module
+    const char* cls;     // NULL for functions
+    const char* name;
+    JStarNative fn;
+} NativeIndexEntry;
+
+// Open addressing hash index of native functions and methods, used to resolve `native`
+// declarations without scanning linearly the tables they're registered in. Keys are
+// (module, class, name) triples, and names are not copied: they must outlive the index.
+typedef struct NativeIndex {
+    size_t mask;
+    NativeIndexEntry* entries;
+} NativeIndex;
+
+// Initialize an index able to hold `count` natives
+void initNativeIndex(NativeIndex* idx, size_t count);
+void freeNativeIndex(NativeIndex* idx);
+
+// Add a native to the index. If a native with the same key is already present the new one is
+// ignored, matching the first-wins behaviour of a linear scan.
+void nativeIndexAdd(NativeIndex* idx, const char* module, const char* cls, const char* name,
+                    JStarNative fn);
+JStarNative nativeIndexGet(const NativeIndex* idx, const char* module, const char* cls,
+                           const char* name);
+
+// Build an index over an extension registry, as returned by the `jsr_open_*` function of a native
+// library. Returns a malloc'd index that should be freed with `freeNativeIndex` and `free`.
+NativeIndex* indexNativeRegistry(JStarNativeReg* reg);
+
+#endif
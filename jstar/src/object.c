@@ -13,6 +13,7 @@ static Obj* newObj(JStarVM* vm, size_t size, ObjClass* cls, ObjType type) {
     o->cls = cls;
     o->type = type;
     o->reached = false;
+    o->frozen = false;
     o->next = vm->objects;
     vm->objects = o;
     return o;
@@ -88,6 +89,7 @@ ObjModule* newModule(JStarVM* vm, ObjString* name) {
     initHashTable(&module->globals);
     module->natives.dynlib = NULL;
     module->natives.registry = NULL;
+    module->natives.index = NULL;
     return module;
 }
 
@@ -111,7 +113,8 @@ ObjTuple* newTuple(JStarVM* vm, size_t size) {
     ObjTuple* tuple =
         (ObjTuple*)newVarObj(vm, sizeof(*tuple), sizeof(Value), size, vm->tupClass, OBJ_TUPLE);
     tuple->size = size;
-    for(uint8_t i = 0; i < tuple->size; i++) {
+    tuple->hash = 0;
+    for(size_t i = 0; i < tuple->size; i++) {
         tuple->arr[i] = NULL_VAL;
     }
     return tuple;
@@ -232,13 +235,52 @@ void listRemove(JStarVM* vm, ObjList* lst, size_t index) {
 
 ObjTable* newTable(JStarVM* vm) {
     ObjTable* table = (ObjTable*)newObj(vm, sizeof(*table), vm->tableClass, OBJ_TABLE);
+    table->weak = false;
     table->sizeMask = 0;
+    table->capacity = 0;
     table->numEntries = 0;
     table->count = 0;
+    table->index = NULL;
     table->entries = NULL;
     return table;
 }
 
+ObjWeakRef* newWeakRef(JStarVM* vm, Value referent) {
+    ObjWeakRef* ref = (ObjWeakRef*)newObj(vm, sizeof(*ref), vm->weakRefClass, OBJ_WEAK_REF);
+    ref->referent = referent;
+    return ref;
+}
+
+ObjGenerator* newGenerator(JStarVM* vm, ObjClosure* closure) {
+    ObjGenerator* gen = (ObjGenerator*)newObj(vm, sizeof(*gen), vm->genClass, OBJ_GENERATOR);
+    gen->state = GEN_STARTED;
+    gen->closure = closure;
+    gen->ip = NULL;
+    gen->handlerc = 0;
+    gen->lastYield = NULL_VAL;
+    gen->stackCount = gen->stackSize = 0;
+    gen->stack = NULL;
+    gen->upvalueCount = gen->upvalueSize = 0;
+    gen->upvalues = NULL;
+    return gen;
+}
+
+ObjFiber* newFiber(JStarVM* vm, Value fn) {
+    ObjFiber* fiber = (ObjFiber*)newObj(vm, sizeof(*fiber), vm->fiberClass, OBJ_FIBER);
+    fiber->state = FIBER_NEW;
+    fiber->fn = fn;
+    fiber->caller = NULL;
+    fiber->evalDepth = 0;
+    fiber->stackSz = 0;
+    fiber->stack = fiber->sp = fiber->apiStack = NULL;
+    fiber->frames = NULL;
+    fiber->frameSz = fiber->frameCount = 0;
+    fiber->upvalues = NULL;
+    fiber->module = NULL;
+    fiber->next = NULL;
+    return fiber;
+}
+
 ObjString* allocateString(JStarVM* vm, size_t length) {
     char* data = GC_ALLOC(vm, length + 1);
     ObjString* str = (ObjString*)newObj(vm, sizeof(*str), vm->strClass, OBJ_STRING);
@@ -263,6 +305,15 @@ ObjString* copyString(JStarVM* vm, const char* str, size_t length) {
     return internedString;
 }
 
+ObjString* newString(JStarVM* vm, const char* str, size_t length) {
+    // There are only a few distinct single character strings, and they are created
+    // all the time (e.g. by iterating strings): interning them avoids the allocation
+    if(length <= 1) return copyString(vm, str, length);
+    ObjString* string = allocateString(vm, length);
+    memcpy(string->data, str, length);
+    return string;
+}
+
 // -----------------------------------------------------------------------------
 // API - JStarBuffer function implementation
 // -----------------------------------------------------------------------------
@@ -483,7 +534,7 @@ void printObj(Obj* o) {
         ObjTable* t = (ObjTable*)o;
         printf("{");
         if(t->entries != NULL) {
-            for(size_t i = 0; i < t->sizeMask + 1; i++) {
+            for(size_t i = 0; i < t->numEntries; i++) {
                 if(!IS_NULL(t->entries[i].key)) {
                     printValue(t->entries[i].key);
                     printf(" : ");
@@ -522,5 +573,14 @@ void printObj(Obj* o) {
     case OBJ_USERDATA:
         printf("<userdata %p", (void*)o);
         break;
+    case OBJ_WEAK_REF:
+        printf("<weakref %p>", (void*)o);
+        break;
+    case OBJ_GENERATOR:
+        printf("<generator %p>", (void*)o);
+        break;
+    case OBJ_FIBER:
+        printf("<fiber %p>", (void*)o);
+        break;
     }
 }
@@ -4,9 +4,11 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "code.h"
 #include "common.h"
+#include "hash.h"
 #include "hashtable.h"
 #include "jstar.h"
 #include "value.h"
@@ -48,6 +50,9 @@ extern const char* ObjTypeNames[];
 #define IS_STACK_TRACE(o)  (IS_OBJ(o) && OBJ_TYPE(o) == OBJ_STACK_TRACE)
 #define IS_TABLE(o)        (IS_OBJ(o) && OBJ_TYPE(o) == OBJ_TABLE)
 #define IS_USERDATA(o)     (IS_OBJ(o) && OBJ_TYPE(o) == OBJ_USERDATA)
+#define IS_WEAK_REF(o)     (IS_OBJ(o) && OBJ_TYPE(o) == OBJ_WEAK_REF)
+#define IS_GENERATOR(o)    (IS_OBJ(o) && OBJ_TYPE(o) == OBJ_GENERATOR)
+#define IS_FIBER(o)        (IS_OBJ(o) && OBJ_TYPE(o) == OBJ_FIBER)
 
 #define AS_BOUND_METHOD(o) ((ObjBoundMethod*)AS_OBJ(o))
 #define AS_LIST(o)         ((ObjList*)AS_OBJ(o))
@@ -62,10 +67,15 @@ extern const char* ObjTypeNames[];
 #define AS_STACK_TRACE(o)  ((ObjStackTrace*)AS_OBJ(o))
 #define AS_TABLE(o)        ((ObjTable*)AS_OBJ(o))
 #define AS_USERDATA(o)     ((ObjUserdata*)AS_OBJ(o))
+#define AS_WEAK_REF(o)     ((ObjWeakRef*)AS_OBJ(o))
+#define AS_GENERATOR(o)    ((ObjGenerator*)AS_OBJ(o))
+#define AS_FIBER(o)        ((ObjFiber*)AS_OBJ(o))
 
 #define STRING_GET_HASH(s) (s->hash == 0 ? s->hash = hashString(s->data, s->length) : s->hash)
-#define STRING_EQUALS(s1, s2) \
-    (s1->interned && s2->interned ? s1 == s2 : strcmp(s1->data, s2->data) == 0)
+#define STRING_EQUALS(s1, s2)                                 \
+    (s1->interned && s2->interned ? s1 == s2                  \
+                                  : s1->length == s2->length && \
+                                        memcmp(s1->data, s2->data, s1->length) == 0)
 
 // -----------------------------------------------------------------------------
 // OBJECT DEFINITONS
@@ -90,7 +100,10 @@ extern const char* ObjTypeNames[];
     X(OBJ_UPVALUE)      \
     X(OBJ_TUPLE)        \
     X(OBJ_TABLE)        \
-    X(OBJ_USERDATA)
+    X(OBJ_USERDATA)     \
+    X(OBJ_WEAK_REF)     \
+    X(OBJ_GENERATOR)    \
+    X(OBJ_FIBER)
 
 typedef enum ObjType {
 #define ENUM_ELEM(elem) elem,
@@ -104,9 +117,12 @@ typedef enum ObjType {
 // flag (used to test when an object is reachable, and thus not collectable)
 // and the next pointer, that points to the next object in the global linked
 // list of all allocated objects (set up by the allocator in gc.c).
+// Frozen objects (see frozen.h) are shared by all VMs: they have no class, as the class
+// depends on the VM (see getClass in vm.h), and their next pointer points to their region.
 struct Obj {
     ObjType type;          // The type of the object
     bool reached;          // Flag used to signal that an object is reachable during a GC
+    bool frozen;           // Whether the object is immutable and shared between VMs
     struct ObjClass* cls;  // The class of the Object
     struct Obj* next;      // Next object in the linked list of all allocated objects
 };
@@ -128,6 +144,7 @@ struct ObjString {
 typedef struct NativeExt {
     void* dynlib;
     JStarNativeReg* registry;
+    struct NativeIndex* index;  // Hash index over `registry`, built on first use
 } NativeExt;
 
 typedef struct ObjModule {
@@ -184,23 +201,44 @@ typedef struct ObjList {
 
 typedef struct ObjTuple {
     Obj base;
-    size_t size;  // Number of elements of the tuple
-    Value arr[];  // Tuple elements (flexible array)
+    size_t size;    // Number of elements of the tuple
+    uint32_t hash;  // Memoized hash of the tuple (0 if not yet computed or not memoizable)
+    Value arr[];    // Tuple elements (flexible array)
 } ObjTuple;
 
 typedef struct {
-    Value key;  // The key of the entry
-    Value val;  // The actual value
+    Value key;      // The key of the entry (null if the entry has been deleted)
+    Value val;      // The actual value
+    uint32_t hash;  // The hash of the key
 } TableEntry;
 
+// A J* Table. Entries are stored densely, in insertion order, in the entries array. Lookups go
+// through the index array, an open addressing hash table of positions in the entries array.
+// The size of an index element depends on the size of the Table (see tableIndexWidth).
 typedef struct ObjTable {
     Obj base;
-    size_t sizeMask;      // The size of the entries array
-    size_t numEntries;    // The number of entries in the Table (including tombstones)
-    size_t count;         // The number of actual entries in the Table (i.e. excluding tombstones)
+    bool weak;            // Whether the Table holds its keys weakly (see WeakTable in core)
+    size_t sizeMask;      // The size of the index array minus one
+    size_t capacity;      // The size of the entries array
+    size_t numEntries;    // The number of used entries (including deleted ones)
+    size_t count;         // The number of actual entries in the Table (i.e. excluding deleted)
+    void* index;          // The index array. The entries array is allocated in the same block
     TableEntry* entries;  // The actual array of entries
 } ObjTable;
 
+// Size in bytes of an element of a Table's index array
+static inline size_t tableIndexWidth(size_t indexSize) {
+    if(indexSize <= INT8_MAX) return sizeof(int8_t);
+    if(indexSize <= INT16_MAX) return sizeof(int16_t);
+    if(indexSize <= INT32_MAX) return sizeof(int32_t);
+    return sizeof(int64_t);
+}
+
+// Size in bytes of the block holding the index and entries arrays of a Table
+static inline size_t tableBlockSize(size_t indexSize, size_t capacity) {
+    return indexSize * tableIndexWidth(indexSize) + sizeof(TableEntry) * capacity;
+}
+
 // A bound method. It contains a method with an associated target.
 typedef struct ObjBoundMethod {
     Obj base;
@@ -256,6 +294,80 @@ typedef struct ObjUserdata {
     uint8_t data[];           // The data
 } ObjUserdata;
 
+// A weak reference. It doesn't keep its referent alive: if the referent is only
+// reachable through weak references, it gets collected and the reference cleared
+typedef struct ObjWeakRef {
+    Obj base;
+    Value referent;  // The referenced value, or null if it has been collected
+} ObjWeakRef;
+
+typedef enum GenState {
+    GEN_STARTED,    // Created, but its body hasn't started executing yet
+    GEN_SUSPENDED,  // Suspended at a `yield`
+    GEN_RUNNING,    // Currently executing
+    GEN_DONE,       // Returned or raised an exception, cannot be resumed anymore
+} GenState;
+
+// An exception handler of a suspended generator. The stack pointer to restore is saved as an
+// offset from the base of the generator's stack, as the stack gets moved on every resume
+typedef struct SavedHandler {
+    uint8_t type;
+    uint8_t* address;
+    size_t savesp;
+} SavedHandler;
+
+// An upvalue that was open in the frame of a suspended generator. It gets closed on suspension,
+// and reopened on the stack slot `slot` when the generator resumes
+typedef struct SavedUpvalue {
+    ObjUpvalue* upvalue;
+    size_t slot;
+} SavedUpvalue;
+
+// A generator, i.e. the suspended execution of a function containing `yield`.
+// Calling such a function creates a generator saving the function's frame, including its stack
+// window. Every resume copies the saved stack back on the VM's stack and continues execution from
+// the saved instruction pointer, until the next `yield` saves it again
+typedef struct ObjGenerator {
+    Obj base;
+    GenState state;                      // The state of the generator
+    ObjClosure* closure;                 // The function executing in the generator
+    uint8_t* ip;                         // Instruction pointer to resume execution from
+    SavedHandler handlers[HANDLER_MAX];  // Exception handlers active at suspension
+    uint8_t handlerc;                    // Exception handlers count
+    Value lastYield;                     // The last value yielded or returned by the generator
+    size_t stackCount, stackSize;        // Number of saved stack values and capacity of `stack`
+    Value* stack;                        // The saved stack window of the generator's frame
+    size_t upvalueCount, upvalueSize;    // Number of saved upvalues and capacity of `upvalues`
+    SavedUpvalue* upvalues;              // Upvalues to reopen on resume
+} ObjGenerator;
+
+typedef enum FiberState {
+    FIBER_NEW,        // Created, but never resumed
+    FIBER_SUSPENDED,  // Suspended in a yield or transfer, can be resumed
+    FIBER_WAITING,    // Resumed another fiber, and waits for it to yield or return
+    FIBER_RUNNING,    // Currently executing
+    FIBER_DONE,       // Returned or raised an exception, cannot be resumed anymore
+} FiberState;
+
+// A fiber, i.e. a stackful coroutine. Every fiber owns its own value stack, frame stack and list
+// of open upvalues. While a fiber runs these live in the VM, and are saved back in the fiber when
+// it gets suspended. Switching fibers only exchanges the pointers, so it never copies the stacks.
+// The stacks are allocated on the first resume and released as soon as the fiber completes
+typedef struct ObjFiber {
+    Obj base;
+    FiberState state;          // The state of the fiber
+    Value fn;                  // The function executed by the fiber (null for the main fiber)
+    struct ObjFiber* caller;   // The fiber that resumed this one, switched back to on yield
+    int evalDepth;             // Nesting of the eval loop the fiber got switched in
+    size_t stackSz;            // Saved VM state, valid while the fiber is not running
+    Value *stack, *sp, *apiStack;
+    struct Frame* frames;
+    int frameSz, frameCount;
+    ObjUpvalue* upvalues;
+    ObjModule* module;
+    struct ObjFiber* next;  // Next started fiber, used by the GC to release unreachable ones
+} ObjFiber;
+
 // -----------------------------------------------------------------------------
 // OBJECT ALLOCATION FUNCTIONS
 // -----------------------------------------------------------------------------
@@ -276,9 +388,17 @@ ObjList* newList(JStarVM* vm, size_t startSize);
 ObjTuple* newTuple(JStarVM* vm, size_t size);
 ObjStackTrace* newStackTrace(JStarVM* vm);
 ObjTable* newTable(JStarVM* vm);
+ObjWeakRef* newWeakRef(JStarVM* vm, Value referent);
+ObjGenerator* newGenerator(JStarVM* vm, ObjClosure* closure);
+ObjFiber* newFiber(JStarVM* vm, Value fn);
 
 ObjString* allocateString(JStarVM* vm, size_t length);
+// Create an interned string. Used for identifiers, constants and all strings likely to be
+// compared or looked up many times (method and field names, module names, ...)
 ObjString* copyString(JStarVM* vm, const char* str, size_t length);
+// Create a non-interned string, skipping the string pool lookup. Used for data strings
+// (i.e. strings produced at runtime) whose identity is not relevant
+ObjString* newString(JStarVM* vm, const char* str, size_t length);
 
 // -----------------------------------------------------------------------------
 // OBJECT MANIPULATION FUNCTIONS
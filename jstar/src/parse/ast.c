@@ -153,6 +153,12 @@ JStarExpr* jsrFuncLiteral(int line, Vector* args, Vector* defArgs, bool vararg,
     return e;
 }
 
+JStarExpr* jsrYieldExpr(int line, JStarExpr* expr) {
+    JStarExpr* e = newExpr(line, JSR_YIELD);
+    e->as.yield.expr = expr;
+    return e;
+}
+
 JStarExpr* jsrSuperLiteral(int line, JStarTok* name, JStarExpr* args) {
     JStarExpr* e = newExpr(line, JSR_SUPER);
     e->as.sup.name.name = name->lexeme;
@@ -224,6 +230,9 @@ void jsrExprFree(JStarExpr* e) {
     case JSR_SUPER:
         jsrExprFree(e->as.sup.args);
         break;
+    case JSR_YIELD:
+        jsrExprFree(e->as.yield.expr);
+        break;
     default:
         break;
     }
@@ -250,6 +259,7 @@ JStarStmt* jsrFuncDecl(int line, JStarTok* name, Vector* args, Vector* defArgs,
     f->as.funcDecl.formalArgs = vecMove(args);
     f->as.funcDecl.defArgs = vecMove(defArgs);
     f->as.funcDecl.isVararg = vararg;
+    f->as.funcDecl.isGenerator = false;
     f->as.funcDecl.body = body;
     return f;
 }
@@ -17,7 +17,7 @@ typedef struct {
 
 // clang-format off
 
-static Keyword keywords[] = {
+static const Keyword keywords[] = {
     {"and",      3, TOK_AND},
     {"class",    5, TOK_CLASS},
     {"else",     4, TOK_ELSE},
@@ -49,6 +49,7 @@ static Keyword keywords[] = {
     {"with",     4, TOK_WITH},
     {"continue", 8, TOK_CONTINUE},
     {"break",    5, TOK_BREAK},
+    {"yield",    5, TOK_YIELD},
     // sentinel
     {NULL,       0, TOK_EOF}
 };
@@ -221,7 +222,7 @@ static void identifier(JStarLex* lex, JStarTok* tok) {
 
     // See if the identifier is a reserved word.
     size_t length = lex->current - lex->tokenStart;
-    for(Keyword* keyword = keywords; keyword->name != NULL; keyword++) {
+    for(const Keyword* keyword = keywords; keyword->name != NULL; keyword++) {
         if(length == keyword->length && memcmp(lex->tokenStart, keyword->name, length) == 0) {
             type = keyword->type;
             break;
@@ -20,11 +20,13 @@ typedef struct Parser {
     const char* lineStart;
     ParseErrorCB errorCallback;
     bool panic, hadError;
+    bool hasYield;  // Whether the function being parsed contains a `yield`
 } Parser;
 
 static void initParser(Parser* p, const char* path, const char* src, ParseErrorCB errorCallback) {
     p->panic = false;
     p->hadError = false;
+    p->hasYield = false;
     p->path = path;
     p->errorCallback = errorCallback;
     jsrInitLexer(&p->lex, src);
@@ -284,6 +286,20 @@ static void requireStmtEnd(Parser* p) {
 // STATEMENTS PARSE
 // -----------------------------------------------------------------------------
 
+// Start parsing the body of a function. Returns whether the enclosing function contains a `yield`
+static bool enterFunction(Parser* p) {
+    bool enclosingYield = p->hasYield;
+    p->hasYield = false;
+    return enclosingYield;
+}
+
+// Finish parsing the function `func`, marking it as a generator if its body contains a `yield`
+static JStarStmt* exitFunction(Parser* p, JStarStmt* func, bool enclosingYield) {
+    func->as.funcDecl.isGenerator = p->hasYield;
+    p->hasYield = enclosingYield;
+    return func;
+}
+
 static JStarExpr* expression(Parser* p, bool tuple);
 static JStarExpr* literal(Parser* p);
 
@@ -630,11 +646,14 @@ static JStarStmt* funcDecl(Parser* p) {
     JStarTok funcName = require(p, TOK_IDENTIFIER);
     skipNewLines(p);
 
+    bool enclosingYield = enterFunction(p);
     FormalArgs args = formalArgs(p, TOK_LPAREN, TOK_RPAREN);
     JStarStmt* body = blockStmt(p);
     require(p, TOK_END);
 
-    return jsrFuncDecl(line, &funcName, &args.arguments, &args.defaults, args.isVararg, body);
+    JStarStmt* func = jsrFuncDecl(line, &funcName, &args.arguments, &args.defaults, args.isVararg,
+                                  body);
+    return exitFunction(p, func, enclosingYield);
 }
 
 static JStarStmt* nativeDecl(Parser* p) {
@@ -1058,14 +1077,18 @@ static JStarExpr* funcLiteral(Parser* p) {
         require(p, TOK_FUN);
         skipNewLines(p);
 
+        bool enclosingYield = enterFunction(p);
         FormalArgs args = formalArgs(p, TOK_LPAREN, TOK_RPAREN);
         JStarStmt* body = blockStmt(p);
         require(p, TOK_END);
 
-        return jsrFuncLiteral(line, &args.arguments, &args.defaults, args.isVararg, body);
+        JStarExpr* lit = jsrFuncLiteral(line, &args.arguments, &args.defaults, args.isVararg, body);
+        exitFunction(p, lit->as.funLit.func, enclosingYield);
+        return lit;
     }
     if(match(p, TOK_PIPE)) {
         int line = p->peek.line;
+        bool enclosingYield = enterFunction(p);
         FormalArgs args = formalArgs(p, TOK_PIPE, TOK_PIPE);
         skipNewLines(p);
 
@@ -1077,7 +1100,9 @@ static JStarExpr* funcLiteral(Parser* p) {
         vecPush(&anonFuncStmts, jsrReturnStmt(line, e));
         JStarStmt* body = jsrBlockStmt(line, &anonFuncStmts);
 
-        return jsrFuncLiteral(line, &args.arguments, &args.defaults, args.isVararg, body);
+        JStarExpr* lit = jsrFuncLiteral(line, &args.arguments, &args.defaults, args.isVararg, body);
+        exitFunction(p, lit->as.funLit.func, enclosingYield);
+        return lit;
     }
     return ternaryExpr(p);
 }
@@ -1102,7 +1127,24 @@ static JStarExpr* tupleLiteral(Parser* p) {
     return e;
 }
 
+static JStarExpr* yieldExpr(Parser* p, bool parseTuple) {
+    int line = p->peek.line;
+    require(p, TOK_YIELD);
+    p->hasYield = true;
+
+    JStarExpr* e = NULL;
+    if(isExpressionStart(&p->peek) || match(p, TOK_PIPE)) {
+        e = expression(p, parseTuple);
+    }
+
+    return jsrYieldExpr(line, e);
+}
+
 static JStarExpr* expression(Parser* p, bool parseTuple) {
+    if(match(p, TOK_YIELD)) {
+        return yieldExpr(p, parseTuple);
+    }
+
     JStarExpr* l = parseTuple ? tupleLiteral(p) : funcLiteral(p);
 
     if(isAssign(&p->peek)) {
@@ -0,0 +1,358 @@
+#include "prefetch.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "import.h"
+#include "parse/parser.h"
+#include "std/modules.h"
+#include "sync.h"
+#include "vm.h"
+
+#define MAX_PREFETCH_THREADS 16
+
+// -----------------------------------------------------------------------------
+// PREFETCH CACHE
+// -----------------------------------------------------------------------------
+
+void initPrefetchCache(PrefetchCache* c) {
+    c->count = 0;
+    c->size = 0;
+    c->modules = NULL;
+}
+
+void freePrefetchCache(PrefetchCache* c) {
+    for(size_t i = 0; i < c->count; i++) {
+        freePrefetchedModule(&c->modules[i]);
+    }
+    free(c->modules);
+    initPrefetchCache(c);
+}
+
+void freePrefetchedModule(PrefetchedModule* m) {
+    jsrStmtFree(m->program);
+    free(m->src);
+    free(m->path);
+}
+
+static PrefetchedModule* findModule(PrefetchCache* c, const char* path, uint32_t hash) {
+    for(size_t i = 0; i < c->count; i++) {
+        PrefetchedModule* m = &c->modules[i];
+        if(m->hash == hash && strcmp(m->path, path) == 0) return m;
+    }
+    return NULL;
+}
+
+static void addModule(PrefetchCache* c, PrefetchedModule* m) {
+    PrefetchedModule* old = findModule(c, m->path, m->hash);
+    if(old != NULL) {
+        freePrefetchedModule(old);
+        *old = *m;
+        return;
+    }
+
+    if(c->count == c->size) {
+        c->size = c->size ? c->size * 2 : 8;
+        c->modules = realloc(c->modules, c->size * sizeof(PrefetchedModule));
+    }
+    c->modules[c->count++] = *m;
+}
+
+bool takePrefetchedModule(PrefetchCache* c, const char* path, PrefetchedModule* out) {
+    if(c->count == 0) return false;
+
+    PrefetchedModule* m = findModule(c, path, hashString(path, strlen(path)));
+    if(m == NULL) return false;
+
+    *out = *m;
+    *m = c->modules[--c->count];
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// IMPORT SCANNING
+// -----------------------------------------------------------------------------
+
+typedef struct NameList {
+    size_t count, size;
+    char** names;
+} NameList;
+
+static void addName(NameList* l, const char* name, size_t len) {
+    if(l->count == l->size) {
+        l->size = l->size ? l->size * 2 : 8;
+        l->names = realloc(l->names, l->size * sizeof(char*));
+    }
+    char* copy = malloc(len + 1);
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+    l->names[l->count++] = copy;
+}
+
+static void freeNameList(NameList* l) {
+    for(size_t i = 0; i < l->count; i++) {
+        free(l->names[i]);
+    }
+    free(l->names);
+}
+
+static void scanImports(JStarStmt* s, NameList* names);
+
+static void scanImportsVec(Vector* stmts, NameList* names) {
+    vecForeach(JStarStmt(**it), *stmts) {
+        scanImports(*it, names);
+    }
+}
+
+// Collect the names of the modules imported by `s`. Only statements are scanned, so imports in
+// the body of function literals are missed, but that only means they won't be prefetched
+static void scanImports(JStarStmt* s, NameList* names) {
+    if(s == NULL) return;
+
+    switch(s->type) {
+    case JSR_IF:
+        scanImports(s->as.ifStmt.thenStmt, names);
+        scanImports(s->as.ifStmt.elseStmt, names);
+        break;
+    case JSR_FOR:
+        scanImports(s->as.forStmt.init, names);
+        scanImports(s->as.forStmt.body, names);
+        break;
+    case JSR_FOREACH:
+        scanImports(s->as.forEach.body, names);
+        break;
+    case JSR_WHILE:
+        scanImports(s->as.whileStmt.body, names);
+        break;
+    case JSR_BLOCK:
+        scanImportsVec(&s->as.blockStmt.stmts, names);
+        break;
+    case JSR_FUNCDECL:
+        scanImports(s->as.funcDecl.body, names);
+        break;
+    case JSR_CLASSDECL:
+        scanImportsVec(&s->as.classDecl.methods, names);
+        break;
+    case JSR_TRY:
+        scanImports(s->as.tryStmt.block, names);
+        scanImportsVec(&s->as.tryStmt.excs, names);
+        scanImports(s->as.tryStmt.ensure, names);
+        break;
+    case JSR_EXCEPT:
+        scanImports(s->as.excStmt.block, names);
+        break;
+    case JSR_WITH:
+        scanImports(s->as.withStmt.block, names);
+        break;
+    case JSR_IMPORT: {
+        // Importing `a.b.c` also imports `a` and `a.b`
+        char name[512];
+        size_t len = 0;
+        vecForeach(JStarIdentifier(**it), s->as.importStmt.modules) {
+            JStarIdentifier* id = *it;
+            if(len + id->length + 1 >= sizeof(name)) break;
+            if(len > 0) name[len++] = '.';
+            memcpy(name + len, id->name, id->length);
+            len += id->length;
+            addName(names, name, len);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// PARALLEL PARSING
+// -----------------------------------------------------------------------------
+
+typedef struct Job {
+    PrefetchedModule module;
+    NameList imports;
+} Job;
+
+typedef struct JobList {
+    size_t count, size;
+    Job* jobs;
+} JobList;
+
+static void pushJob(JobList* l, Job* job) {
+    if(l->count == l->size) {
+        l->size = l->size ? l->size * 2 : 8;
+        l->jobs = realloc(l->jobs, l->size * sizeof(Job));
+    }
+    l->jobs[l->count++] = *job;
+}
+
+typedef struct Prefetcher {
+    Mutex lock;
+    CondVar jobsReady, resultsReady;
+    JobList queue, results;
+    bool stop;
+} Prefetcher;
+
+// Read and parse a module, collecting its imports. Doesn't touch the VM, so it's safe to call
+// from any thread
+static void runJob(Job* job) {
+    PrefetchedModule* m = &job->module;
+    m->src = jsrReadFileSz(m->path, &m->len);
+    if(m->src == NULL) return;
+
+    // Errors are not reported here, but when the module gets parsed again by its import
+    m->program = jsrParse(m->path, m->src, NULL);
+    if(m->program != NULL) {
+        scanImports(m->program, &job->imports);
+    }
+}
+
+static void worker(void* arg) {
+    Prefetcher* p = arg;
+
+    lockMutex(&p->lock);
+    for(;;) {
+        while(p->queue.count == 0 && !p->stop) {
+            waitCondVar(&p->jobsReady, &p->lock);
+        }
+        if(p->queue.count == 0) break;
+
+        Job job = p->queue.jobs[--p->queue.count];
+        unlockMutex(&p->lock);
+
+        runJob(&job);
+
+        lockMutex(&p->lock);
+        pushJob(&p->results, &job);
+        signalCondVar(&p->resultsReady);
+    }
+    unlockMutex(&p->lock);
+}
+
+static bool isImported(JStarVM* vm, const char* name) {
+    if(readBuiltInModule(name) != NULL) return true;
+    size_t codeLen;
+    if(readBuiltInModuleCode(name, &codeLen) != NULL) return true;
+    return getModule(vm, copyString(vm, name, strlen(name))) != NULL;
+}
+
+// Resolve the modules in `names` not seen yet, adding a job to `jobs` for the ones to parse
+static void queueImports(JStarVM* vm, JobList* jobs, NameList* names, NameList* seen) {
+    JStarBuffer path;
+    jsrBufferInit(vm, &path);
+
+    for(size_t i = 0; i < names->count; i++) {
+        const char* name = names->names[i];
+
+        bool isSeen = false;
+        for(size_t j = 0; j < seen->count && !isSeen; j++) {
+            isSeen = strcmp(seen->names[j], name) == 0;
+        }
+        if(isSeen) continue;
+        addName(seen, name, strlen(name));
+
+        if(isImported(vm, name) || !resolveModulePath(vm, name, &path)) continue;
+
+        // Compiled modules don't need parsing
+        if(path.len < strlen(JSR_EXT) || strcmp(path.data + path.len - strlen(JSR_EXT), JSR_EXT)) {
+            continue;
+        }
+
+        Job job = {0};
+        job.module.path = malloc(path.len + 1);
+        memcpy(job.module.path, path.data, path.len + 1);
+        job.module.hash = hashString(path.data, path.len);
+        pushJob(jobs, &job);
+    }
+
+    jsrBufferFree(&path);
+}
+
+// Store the result of a job in the VM, adding the jobs for the modules it imports to `jobs`
+static void completeJob(JStarVM* vm, JobList* jobs, Job* job, NameList* seen) {
+    queueImports(vm, jobs, &job->imports, seen);
+    freeNameList(&job->imports);
+
+    if(job->module.program != NULL) {
+        addModule(&vm->prefetched, &job->module);
+    } else {
+        freePrefetchedModule(&job->module);
+    }
+}
+
+void jsrPrefetchImports(JStarVM* vm, const char* path, const char* src) {
+    JStarStmt* program = jsrParse(path, src, NULL);
+    if(program == NULL) return;
+
+    NameList imports = {0}, seen = {0};
+    scanImports(program, &imports);
+    jsrStmtFree(program);
+
+    Prefetcher p = {0};
+    initMutex(&p.lock);
+    initCondVar(&p.jobsReady);
+    initCondVar(&p.resultsReady);
+
+    queueImports(vm, &p.queue, &imports, &seen);
+    freeNameList(&imports);
+
+    size_t pending = p.queue.count;
+
+    int threadCount = processorCount();
+    if(threadCount > MAX_PREFETCH_THREADS) threadCount = MAX_PREFETCH_THREADS;
+
+    Thread threads[MAX_PREFETCH_THREADS];
+    int started = 0;
+    while(pending > 0 && started < threadCount && startThread(&threads[started], &worker, &p)) {
+        started++;
+    }
+
+    // Resolving imports uses the VM, so it's only done by this thread, while workers parse
+    lockMutex(&p.lock);
+    while(pending > 0) {
+        if(started == 0) {
+            // No threads available, parse on the calling thread
+            Job job = p.queue.jobs[--p.queue.count];
+            runJob(&job);
+            pushJob(&p.results, &job);
+        }
+
+        while(p.results.count == 0) {
+            waitCondVar(&p.resultsReady, &p.lock);
+        }
+
+        JobList done = p.results, newJobs = {0};
+        p.results = (JobList){0};
+        unlockMutex(&p.lock);
+
+        for(size_t i = 0; i < done.count; i++) {
+            completeJob(vm, &newJobs, &done.jobs[i], &seen);
+        }
+        pending -= done.count;
+        free(done.jobs);
+
+        lockMutex(&p.lock);
+        for(size_t i = 0; i < newJobs.count; i++) {
+            pushJob(&p.queue, &newJobs.jobs[i]);
+        }
+        pending += newJobs.count;
+        if(newJobs.count > 0) broadcastCondVar(&p.jobsReady);
+        free(newJobs.jobs);
+    }
+
+    p.stop = true;
+    broadcastCondVar(&p.jobsReady);
+    unlockMutex(&p.lock);
+
+    for(int i = 0; i < started; i++) {
+        joinThread(threads[i]);
+    }
+
+    freeCondVar(&p.resultsReady);
+    freeCondVar(&p.jobsReady);
+    freeMutex(&p.lock);
+    free(p.queue.jobs);
+    free(p.results.jobs);
+    freeNameList(&seen);
+}
@@ -0,0 +1,33 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "jstar.h"
+#include "parse/ast.h"
+
+// A module parsed ahead of its import. `program` points into `src`, so they're freed together
+typedef struct PrefetchedModule {
+    char* path;
+    uint32_t hash;
+    char* src;
+    size_t len;
+    JStarStmt* program;
+} PrefetchedModule;
+
+// Modules parsed by jsrPrefetchImports, waiting to be imported
+typedef struct PrefetchCache {
+    size_t count, size;
+    PrefetchedModule* modules;
+} PrefetchCache;
+
+void initPrefetchCache(PrefetchCache* c);
+void freePrefetchCache(PrefetchCache* c);
+void freePrefetchedModule(PrefetchedModule* m);
+
+// Remove the module prefetched from `path` from the cache, moving it in `out`.
+// Returns false if the module at `path` hasn't been prefetched.
+bool takePrefetchedModule(PrefetchCache* c, const char* path, PrefetchedModule* out);
+
+#endif
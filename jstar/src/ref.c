@@ -0,0 +1,57 @@
+#include "ref.h"
+
+#include <stdlib.h>
+
+#include "gc.h"
+#include "value.h"
+#include "vm.h"
+
+/**
+ * Persistent references to values, created with jsrRef.
+ * References are allocated outside of the heap and linked in a list of the VM, that the GC treats
+ * as a root. Embedders hold a pointer to them, so reading a referenced value costs a single
+ * indirection.
+ */
+
+struct JStarRef {
+    JStarRef *prev, *next;
+    Value value;
+};
+
+void reachRefs(JStarVM* vm) {
+    for(JStarRef* r = vm->refs; r != NULL; r = r->next) {
+        reachValue(vm, r->value);
+    }
+}
+
+void freeRefs(JStarVM* vm) {
+    JStarRef* r = vm->refs;
+    while(r != NULL) {
+        JStarRef* next = r->next;
+        free(r);
+        r = next;
+    }
+    vm->refs = NULL;
+}
+
+JStarRef* jsrRef(JStarVM* vm, int slot) {
+    JStarRef* r = malloc(sizeof(*r));
+    r->value = apiStackSlot(vm, slot);
+    r->prev = NULL;
+    r->next = vm->refs;
+    if(vm->refs != NULL) vm->refs->prev = r;
+    vm->refs = r;
+    return r;
+}
+
+void jsrUnref(JStarVM* vm, JStarRef* ref) {
+    if(ref->prev != NULL) ref->prev->next = ref->next;
+    else vm->refs = ref->next;
+    if(ref->next != NULL) ref->next->prev = ref->prev;
+    free(ref);
+}
+
+void jsrPushRef(JStarVM* vm, JStarRef* ref) {
+    validateStack(vm);
+    push(vm, ref->value);
+}
@@ -0,0 +1,11 @@
+#ifndef REF_H
+#define REF_H
+
+#include "jstar.h"
+
+// Reach the values referenced with jsrRef, that stay alive until jsrUnref
+void reachRefs(JStarVM* vm);
+// Free all the references created in `vm`
+void freeRefs(JStarVM* vm);
+
+#endif
@@ -0,0 +1,190 @@
+#include "script.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "code.h"
+#include "gc.h"
+#include "import.h"
+#include "object.h"
+#include "parse/ast.h"
+#include "parse/parser.h"
+#include "value.h"
+#include "vm.h"
+
+/**
+ * Scripts compiled once with jsrCompile and executed many times with jsrExecute.
+ * Compiled code is bound to a module, the one its globals are resolved in. A script is compiled
+ * in the main module, and the first time it's executed in another one it gets a copy of its
+ * functions bound to that module. The copies share the bytecode of the original (see shareCode),
+ * so only their constants get duplicated.
+ * Scripts are allocated outside of the heap and linked in a list of the VM, that the GC treats as
+ * a root: this pins their code until they're freed.
+ */
+
+// The code of a script bound to a module
+typedef struct Binding {
+    ObjModule* module;
+    ObjClosure* closure;
+} Binding;
+
+struct JStarScript {
+    JStarScript *prev, *next;
+    size_t count, size;
+    Binding* bindings;
+};
+
+static void addBinding(JStarScript* s, ObjModule* module, ObjClosure* closure) {
+    if(s->count + 1 > s->size) {
+        s->size = s->size == 0 ? 4 : s->size * 2;
+        s->bindings = realloc(s->bindings, sizeof(Binding) * s->size);
+    }
+    s->bindings[s->count++] = (Binding){module, closure};
+}
+
+static ObjClosure* findBinding(JStarScript* s, ObjModule* module) {
+    for(size_t i = 0; i < s->count; i++) {
+        if(s->bindings[i].module == module) return s->bindings[i].closure;
+    }
+    return NULL;
+}
+
+static void linkScript(JStarVM* vm, JStarScript* s) {
+    s->prev = NULL;
+    s->next = vm->scripts;
+    if(vm->scripts != NULL) vm->scripts->prev = s;
+    vm->scripts = s;
+}
+
+static void unlinkScript(JStarVM* vm, JStarScript* s) {
+    if(s->prev != NULL) s->prev->next = s->next;
+    else vm->scripts = s->next;
+    if(s->next != NULL) s->next->prev = s->prev;
+}
+
+static void freeScript(JStarScript* s) {
+    free(s->bindings);
+    free(s);
+}
+
+void reachScripts(JStarVM* vm) {
+    for(JStarScript* s = vm->scripts; s != NULL; s = s->next) {
+        for(size_t i = 0; i < s->count; i++) {
+            reachObject(vm, (Obj*)s->bindings[i].module);
+            reachObject(vm, (Obj*)s->bindings[i].closure);
+        }
+    }
+}
+
+void freeScripts(JStarVM* vm) {
+    JStarScript* s = vm->scripts;
+    while(s != NULL) {
+        JStarScript* next = s->next;
+        freeScript(s);
+        s = next;
+    }
+    vm->scripts = NULL;
+}
+
+// -----------------------------------------------------------------------------
+// MODULE BINDING
+// -----------------------------------------------------------------------------
+
+static void copyCommon(FnCommon* copy, FnCommon* fn) {
+    copy->name = fn->name;
+    for(int i = 0; i < fn->defaultc; i++) {
+        copy->defaults[i] = fn->defaults[i];
+    }
+}
+
+static ObjFunction* bindFunction(JStarVM* vm, ObjFunction* fn, ObjModule* module);
+
+static Value bindConstant(JStarVM* vm, Value c, ObjModule* module) {
+    if(IS_FUNC(c)) {
+        return OBJ_VAL(bindFunction(vm, AS_FUNC(c), module));
+    }
+    if(IS_NATIVE(c)) {
+        // Native declarations get resolved in the module that executes them
+        ObjNative* nat = AS_NATIVE(c);
+        ObjNative* copy = newNative(vm, module, nat->c.argsCount, nat->c.defaultc, nat->c.vararg);
+        copyCommon(&copy->c, &nat->c);
+        return OBJ_VAL(copy);
+    }
+    return c;
+}
+
+// Copy `fn`, and all the functions it defines, binding them to `module`
+static ObjFunction* bindFunction(JStarVM* vm, ObjFunction* fn, ObjModule* module) {
+    ObjFunction* copy = newFunction(vm, module, fn->c.argsCount, fn->c.defaultc, fn->c.vararg);
+    copyCommon(&copy->c, &fn->c);
+    copy->upvalueCount = fn->upvalueCount;
+    shareCode(&copy->code, &fn->code);
+
+    push(vm, OBJ_VAL(copy));
+    for(int i = 0; i < fn->code.consts.count; i++) {
+        valueArrayAppend(&copy->code.consts, NULL_VAL);
+        copy->code.consts.arr[i] = bindConstant(vm, fn->code.consts.arr[i], module);
+    }
+    pop(vm);
+
+    return copy;
+}
+
+static ObjClosure* getClosure(JStarVM* vm, JStarScript* s, ObjModule* module) {
+    ObjClosure* closure = findBinding(s, module);
+    if(closure != NULL) return closure;
+
+    // The code compiled in the main module is always the first binding
+    ObjFunction* fn = bindFunction(vm, s->bindings[0].closure->fn, module);
+    push(vm, OBJ_VAL(fn));
+    closure = newClosure(vm, fn);
+    pop(vm);
+
+    addBinding(s, module, closure);
+    return closure;
+}
+
+// -----------------------------------------------------------------------------
+// API
+// -----------------------------------------------------------------------------
+
+JStarScript* jsrCompile(JStarVM* vm, const char* path, const char* src) {
+    JStarStmt* program = jsrParse(path, src, vm->errorCallback);
+    if(program == NULL) return NULL;
+
+    ObjString* name = copyString(vm, JSR_MAIN_MODULE, strlen(JSR_MAIN_MODULE));
+    ObjFunction* fn = compileWithModule(vm, path, name, program);
+    jsrStmtFree(program);
+
+    if(fn == NULL) return NULL;
+
+    push(vm, OBJ_VAL(fn));
+    ObjClosure* closure = newClosure(vm, fn);
+    pop(vm);
+
+    JStarScript* s = calloc(1, sizeof(*s));
+    addBinding(s, fn->c.module, closure);
+    linkScript(vm, s);
+
+    return s;
+}
+
+JStarResult jsrExecute(JStarVM* vm, JStarScript* script, const char* module) {
+    ObjString* name = copyString(vm, module, strlen(module));
+    ObjModule* mod = getOrCreateModule(vm, name);
+
+    push(vm, OBJ_VAL(getClosure(vm, script, mod)));
+
+    JStarResult res;
+    if((res = jsrCall(vm, 0)) != JSR_EVAL_SUCCESS) {
+        jsrPrintStacktrace(vm, -1);
+    }
+
+    pop(vm);
+    return res;
+}
+
+void jsrFreeScript(JStarVM* vm, JStarScript* script) {
+    unlinkScript(vm, script);
+    freeScript(script);
+}
@@ -0,0 +1,11 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include "jstar.h"
+
+// Reach the code of the scripts compiled with jsrCompile, that stay pinned until jsrFreeScript
+void reachScripts(JStarVM* vm);
+// Free all the scripts compiled by `vm`
+void freeScripts(JStarVM* vm);
+
+#endif
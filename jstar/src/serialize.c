@@ -0,0 +1,503 @@
+#include "serialize.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "code.h"
+#include "value.h"
+#include "vm.h"
+
+// Serialized code layout:
+//  header:   magic (4 bytes), SERIALIZATION_VERSION, J* major, minor and patch (1 byte each)
+//  function: common fields, upvalue count, bytecode, run-length encoded lines, constants
+//  constant: a tag byte followed by the value's payload
+static const char MAGIC[] = {0x1b, 'J', 'S', 'C'};
+
+#define HEADER_SIZE (sizeof(MAGIC) + 4)
+
+typedef enum SerializedType {
+    SER_NULL,
+    SER_TRUE,
+    SER_FALSE,
+    SER_NUM,
+    SER_STRING,
+    SER_FUNCTION,
+    SER_NATIVE,
+    SER_HANDLE,
+} SerializedType;
+
+// -----------------------------------------------------------------------------
+// SERIALIZATION
+// -----------------------------------------------------------------------------
+
+static void writeUint8(JStarBuffer* buf, uint8_t b) {
+    jsrBufferAppendChar(buf, (char)b);
+}
+
+static void writeUint32(JStarBuffer* buf, uint32_t n) {
+    char bytes[4];
+    for(int i = 0; i < 4; i++) {
+        bytes[i] = (char)(n >> (24 - i * 8));
+    }
+    jsrBufferAppend(buf, bytes, sizeof(bytes));
+}
+
+static void writeUint64(JStarBuffer* buf, uint64_t n) {
+    writeUint32(buf, (uint32_t)(n >> 32));
+    writeUint32(buf, (uint32_t)n);
+}
+
+static void writeDouble(JStarBuffer* buf, double num) {
+    union {
+        double d;
+        uint64_t bits;
+    } c = {.d = num};
+    writeUint64(buf, c.bits);
+}
+
+static void writeString(JStarBuffer* buf, ObjString* str) {
+    writeUint64(buf, str->length);
+    jsrBufferAppend(buf, str->data, str->length);
+}
+
+static void writeFunction(JStarBuffer* buf, ObjFunction* fn);
+static void writeNative(JStarBuffer* buf, ObjNative* nat);
+
+static void writeValue(JStarBuffer* buf, Value val) {
+    if(IS_NUM(val)) {
+        writeUint8(buf, SER_NUM);
+        writeDouble(buf, AS_NUM(val));
+    } else if(IS_BOOL(val)) {
+        writeUint8(buf, AS_BOOL(val) ? SER_TRUE : SER_FALSE);
+    } else if(IS_NULL(val)) {
+        writeUint8(buf, SER_NULL);
+    } else if(IS_STRING(val)) {
+        writeUint8(buf, SER_STRING);
+        writeString(buf, AS_STRING(val));
+    } else if(IS_FUNC(val)) {
+        writeUint8(buf, SER_FUNCTION);
+        writeFunction(buf, AS_FUNC(val));
+    } else if(IS_NATIVE(val)) {
+        writeUint8(buf, SER_NATIVE);
+        writeNative(buf, AS_NATIVE(val));
+    } else if(IS_HANDLE(val)) {
+        // Checked last, as with NaN tagging objects also look like handles. The only handle in
+        // compiled code is the placeholder for the super class of methods
+        ASSERT(AS_HANDLE(val) == NULL, "Cannot serialize non-null handle");
+        writeUint8(buf, SER_HANDLE);
+    } else {
+        UNREACHABLE();
+    }
+}
+
+static void writeCommon(JStarBuffer* buf, FnCommon* c) {
+    writeUint8(buf, c->argsCount);
+    writeUint8(buf, c->defaultc);
+    writeUint8(buf, c->vararg);
+    writeValue(buf, c->name ? OBJ_VAL(c->name) : NULL_VAL);
+    for(int i = 0; i < c->defaultc; i++) {
+        writeValue(buf, c->defaults[i]);
+    }
+}
+
+// Lines are stored one per bytecode, so they are encoded as (count, line) runs
+static void writeLines(JStarBuffer* buf, Code* code) {
+    size_t runs = 0;
+    for(size_t i = 0; i < code->linesCount; i++) {
+        if(i == 0 || code->lines[i] != code->lines[i - 1]) runs++;
+    }
+
+    writeUint64(buf, runs);
+
+    size_t i = 0;
+    while(i < code->linesCount) {
+        size_t start = i;
+        while(i < code->linesCount && code->lines[i] == code->lines[start]) i++;
+        writeUint64(buf, i - start);
+        writeUint32(buf, (uint32_t)code->lines[start]);
+    }
+}
+
+static void writeFunction(JStarBuffer* buf, ObjFunction* fn) {
+    writeCommon(buf, &fn->c);
+    writeUint8(buf, fn->upvalueCount);
+
+    writeUint64(buf, fn->code.count);
+    jsrBufferAppend(buf, (const char*)fn->code.bytecode, fn->code.count);
+    writeLines(buf, &fn->code);
+
+    writeUint32(buf, (uint32_t)fn->code.consts.count);
+    for(int i = 0; i < fn->code.consts.count; i++) {
+        writeValue(buf, fn->code.consts.arr[i]);
+    }
+}
+
+static void writeNative(JStarBuffer* buf, ObjNative* nat) {
+    // The native's C function is resolved at runtime
+    writeCommon(buf, &nat->c);
+}
+
+JStarBuffer serialize(JStarVM* vm, ObjFunction* fn) {
+    JStarBuffer buf;
+    jsrBufferInitSz(vm, &buf, 256);
+
+    jsrBufferAppend(&buf, MAGIC, sizeof(MAGIC));
+    writeUint8(&buf, SERIALIZATION_VERSION);
+    writeUint8(&buf, JSTAR_VERSION_MAJOR);
+    writeUint8(&buf, JSTAR_VERSION_MINOR);
+    writeUint8(&buf, JSTAR_VERSION_PATCH);
+
+    writeValue(&buf, OBJ_VAL(fn));
+    return buf;
+}
+
+// -----------------------------------------------------------------------------
+// DESERIALIZATION
+// -----------------------------------------------------------------------------
+
+typedef struct Deserializer {
+    JStarVM* vm;
+    ObjModule* module;
+    const uint8_t* ptr;
+    const uint8_t* end;
+    const char* error;
+    Code* shared;
+    size_t sharedCount, sharedNext;
+} Deserializer;
+
+static bool malformed(Deserializer* d) {
+    if(d->error == NULL) d->error = "Malformed compiled code";
+    return false;
+}
+
+static bool readBytes(Deserializer* d, void* out, size_t count) {
+    if((size_t)(d->end - d->ptr) < count) return malformed(d);
+    memcpy(out, d->ptr, count);
+    d->ptr += count;
+    return true;
+}
+
+static bool readUint8(Deserializer* d, uint8_t* out) {
+    return readBytes(d, out, 1);
+}
+
+static bool readUint32(Deserializer* d, uint32_t* out) {
+    uint8_t bytes[4];
+    if(!readBytes(d, bytes, sizeof(bytes))) return false;
+    *out = (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 |
+           (uint32_t)bytes[3];
+    return true;
+}
+
+static bool readUint64(Deserializer* d, uint64_t* out) {
+    uint32_t hi, lo;
+    if(!readUint32(d, &hi) || !readUint32(d, &lo)) return false;
+    *out = (uint64_t)hi << 32 | lo;
+    return true;
+}
+
+static bool readSize(Deserializer* d, size_t* out) {
+    uint64_t n;
+    if(!readUint64(d, &n)) return false;
+    if(n > SIZE_MAX) return malformed(d);
+    *out = (size_t)n;
+    return true;
+}
+
+static bool readDouble(Deserializer* d, double* out) {
+    union {
+        double d;
+        uint64_t bits;
+    } c;
+    if(!readUint64(d, &c.bits)) return false;
+    *out = c.d;
+    return true;
+}
+
+static bool readString(Deserializer* d, Value* out) {
+    uint64_t length;
+    if(!readUint64(d, &length)) return false;
+    if(length > (uint64_t)(d->end - d->ptr)) return malformed(d);
+
+    // Strings in compiled code are identifiers and constants, so intern them
+    *out = OBJ_VAL(copyString(d->vm, (const char*)d->ptr, length));
+    d->ptr += length;
+    return true;
+}
+
+static bool readFunction(Deserializer* d, Value* out);
+static bool readNative(Deserializer* d, Value* out);
+
+static bool readValue(Deserializer* d, Value* out) {
+    uint8_t type;
+    if(!readUint8(d, &type)) return false;
+
+    switch((SerializedType)type) {
+    case SER_NULL:
+        *out = NULL_VAL;
+        return true;
+    case SER_TRUE:
+        *out = TRUE_VAL;
+        return true;
+    case SER_FALSE:
+        *out = FALSE_VAL;
+        return true;
+    case SER_NUM: {
+        double num;
+        if(!readDouble(d, &num)) return false;
+        *out = NUM_VAL(num);
+        return true;
+    }
+    case SER_HANDLE:
+        *out = HANDLE_VAL(NULL);
+        return true;
+    case SER_STRING:
+        return readString(d, out);
+    case SER_FUNCTION:
+        return readFunction(d, out);
+    case SER_NATIVE:
+        return readNative(d, out);
+    }
+
+    return malformed(d);
+}
+
+typedef struct CommonHeader {
+    uint8_t argsCount, defaultc, vararg;
+} CommonHeader;
+
+static bool readCommonHeader(Deserializer* d, CommonHeader* h) {
+    return readUint8(d, &h->argsCount) && readUint8(d, &h->defaultc) && readUint8(d, &h->vararg);
+}
+
+// Read the name and default arguments of a function. The function must be reachable by the GC
+static bool readCommon(Deserializer* d, FnCommon* c) {
+    Value name;
+    if(!readValue(d, &name)) return false;
+    if(!IS_NULL(name) && !IS_STRING(name)) return malformed(d);
+    c->name = IS_NULL(name) ? NULL : AS_STRING(name);
+
+    for(int i = 0; i < c->defaultc; i++) {
+        if(!readValue(d, &c->defaults[i])) return false;
+    }
+
+    return true;
+}
+
+static bool readLines(Deserializer* d, Code* code) {
+    size_t runs;
+    if(!readSize(d, &runs)) return false;
+
+    size_t count = 0;
+    for(size_t i = 0; i < runs; i++) {
+        uint64_t runLength;
+        uint32_t line;
+        if(!readUint64(d, &runLength) || !readUint32(d, &line)) return false;
+        if(runLength > code->count - count) return malformed(d);
+
+        for(size_t j = 0; j < runLength; j++) {
+            code->lines[count++] = (int)line;
+        }
+    }
+
+    if(count != code->count) return malformed(d);
+    code->linesCount = count;
+    return true;
+}
+
+// Size of a serialized (count, line) run of the line table
+#define LINE_RUN_SIZE (sizeof(uint64_t) + sizeof(uint32_t))
+
+// Skip the bytecode and lines of a function, making it share the next Code of `d->shared`
+static bool readSharedCode(Deserializer* d, Code* code, size_t count) {
+    if(d->sharedNext == d->sharedCount) return malformed(d);
+
+    Code* shared = &d->shared[d->sharedNext++];
+    if(shared->count != count) return malformed(d);
+    d->ptr += count;
+
+    size_t runs;
+    if(!readSize(d, &runs)) return false;
+    if(runs > (size_t)(d->end - d->ptr) / LINE_RUN_SIZE) return malformed(d);
+    d->ptr += runs * LINE_RUN_SIZE;
+
+    shareCode(code, shared);
+    return true;
+}
+
+static bool readFunction(Deserializer* d, Value* out) {
+    CommonHeader h;
+    if(!readCommonHeader(d, &h)) return false;
+
+    ObjFunction* fn = newFunction(d->vm, d->module, h.argsCount, h.defaultc, h.vararg);
+
+    // Keep the function reachable while its constants are being created
+    jsrEnsureStack(d->vm, 1);
+    push(d->vm, OBJ_VAL(fn));
+
+    bool ok = false;
+    if(!readCommon(d, &fn->c) || !readUint8(d, &fn->upvalueCount)) goto end;
+
+    Code* code = &fn->code;
+
+    size_t count;
+    if(!readSize(d, &count)) goto end;
+    if(count > (size_t)(d->end - d->ptr)) {
+        malformed(d);
+        goto end;
+    }
+
+    if(d->shared != NULL) {
+        if(!readSharedCode(d, code, count)) goto end;
+    } else {
+        if(count > 0) {
+            code->bytecode = malloc(count);
+            code->lines = malloc(count * sizeof(int));
+            code->size = code->linesSize = count;
+            code->count = count;
+            memcpy(code->bytecode, d->ptr, count);
+            d->ptr += count;
+        }
+
+        if(!readLines(d, code)) goto end;
+    }
+
+    uint32_t constCount;
+    if(!readUint32(d, &constCount)) goto end;
+    if(constCount > UINT16_MAX) {
+        malformed(d);
+        goto end;
+    }
+
+    for(uint32_t i = 0; i < constCount; i++) {
+        Value c;
+        if(!readValue(d, &c)) goto end;
+        valueArrayAppend(&code->consts, c);
+    }
+
+    ok = true;
+
+end:
+    pop(d->vm);
+    *out = OBJ_VAL(fn);
+    return ok;
+}
+
+static bool readNative(Deserializer* d, Value* out) {
+    CommonHeader h;
+    if(!readCommonHeader(d, &h)) return false;
+
+    ObjNative* nat = newNative(d->vm, d->module, h.argsCount, h.defaultc, h.vararg);
+    nat->fn = NULL;
+
+    jsrEnsureStack(d->vm, 1);
+    push(d->vm, OBJ_VAL(nat));
+    bool ok = readCommon(d, &nat->c);
+    pop(d->vm);
+
+    *out = OBJ_VAL(nat);
+    return ok;
+}
+
+bool isCompiledCode(const char* code, size_t len) {
+    return len >= HEADER_SIZE && memcmp(code, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+static ObjFunction* deserializeCode(JStarVM* vm, ObjModule* module, const char* code, size_t len,
+                                    Code* shared, size_t sharedCount, const char** error) {
+    if(!isCompiledCode(code, len)) {
+        *error = "Not a compiled J* file";
+        return NULL;
+    }
+
+    const uint8_t* header = (const uint8_t*)code + sizeof(MAGIC);
+    if(header[0] != SERIALIZATION_VERSION || header[1] != JSTAR_VERSION_MAJOR ||
+       header[2] != JSTAR_VERSION_MINOR || header[3] != JSTAR_VERSION_PATCH) {
+        *error = "Compiled code was produced by an incompatible version of J*";
+        return NULL;
+    }
+
+    Deserializer d = {
+        .vm = vm,
+        .module = module,
+        .ptr = (const uint8_t*)code + HEADER_SIZE,
+        .end = (const uint8_t*)code + len,
+        .error = NULL,
+        .shared = shared,
+        .sharedCount = sharedCount,
+        .sharedNext = 0,
+    };
+
+    uint8_t type;
+    Value fn;
+    if(!readUint8(&d, &type) || type != SER_FUNCTION || !readFunction(&d, &fn)) {
+        *error = d.error ? d.error : "Malformed compiled code";
+        return NULL;
+    }
+
+    if(d.ptr != d.end || d.sharedNext != d.sharedCount) {
+        *error = "Malformed compiled code";
+        return NULL;
+    }
+
+    return AS_FUNC(fn);
+}
+
+ObjFunction* deserialize(JStarVM* vm, ObjModule* module, const char* code, size_t len,
+                         const char** error) {
+    return deserializeCode(vm, module, code, len, NULL, 0, error);
+}
+
+ObjFunction* deserializeShared(JStarVM* vm, ObjModule* module, const char* code, size_t len,
+                               Code* shared, size_t sharedCount, const char** error) {
+    return deserializeCode(vm, module, code, len, shared, sharedCount, error);
+}
+
+// -----------------------------------------------------------------------------
+// CODE SHARING
+// -----------------------------------------------------------------------------
+
+typedef struct SharedCodeArray {
+    Code* arr;
+    size_t count, size;
+} SharedCodeArray;
+
+static void shareValueCode(SharedCodeArray* a, Value val);
+
+static void shareCommonCode(SharedCodeArray* a, FnCommon* c) {
+    for(int i = 0; i < c->defaultc; i++) {
+        shareValueCode(a, c->defaults[i]);
+    }
+}
+
+// Visit functions in the same order as `writeFunction`, so that the i-th Code matches the i-th
+// function read by `deserializeShared`
+static void shareFunctionCode(SharedCodeArray* a, ObjFunction* fn) {
+    shareCommonCode(a, &fn->c);
+
+    if(a->count == a->size) {
+        a->size = a->size ? a->size * 2 : 8;
+        a->arr = realloc(a->arr, a->size * sizeof(Code));
+    }
+    shareCode(&a->arr[a->count++], &fn->code);
+
+    for(int i = 0; i < fn->code.consts.count; i++) {
+        shareValueCode(a, fn->code.consts.arr[i]);
+    }
+}
+
+static void shareValueCode(SharedCodeArray* a, Value val) {
+    if(IS_FUNC(val)) {
+        shareFunctionCode(a, AS_FUNC(val));
+    } else if(IS_NATIVE(val)) {
+        shareCommonCode(a, &AS_NATIVE(val)->c);
+    }
+}
+
+size_t shareSerializedCode(ObjFunction* fn, Code** out) {
+    SharedCodeArray a = {0};
+    shareFunctionCode(&a, fn);
+    *out = a.arr;
+    return a.count;
+}
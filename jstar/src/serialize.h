@@ -0,0 +1,40 @@
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "jstar.h"
+#include "object.h"
+
+// Version of the serialization format. Must be incremented every time the
+// format or the bytecode changes in an incompatible way
+#define SERIALIZATION_VERSION 2
+
+// Serialize a compiled function along with all of its constants (including nested functions) to
+// a compact binary format. All integers are written in big-endian byte order, so the result can
+// be loaded on any machine running the same J* version.
+// The returned buffer is owned by the caller and should be freed with jsrBufferFree.
+JStarBuffer serialize(JStarVM* vm, ObjFunction* fn);
+
+// Deserialize a function previously created by `serialize`, binding it and all of its nested
+// functions to `module`. Returns NULL and sets `error` to a descriptive message if `code` is
+// malformed or has been produced by an incompatible version of J*.
+// Note that the bytecode itself is not verified: only trusted code should be loaded.
+ObjFunction* deserialize(JStarVM* vm, ObjModule* module, const char* code, size_t len,
+                         const char** error);
+
+// Same as `deserialize`, but instead of allocating their own bytecode and lines the functions
+// share the ones of `shared` (see shareCode), that must contain the Code of the functions in the
+// same order returned by `shareSerializedCode`.
+ObjFunction* deserializeShared(JStarVM* vm, ObjModule* module, const char* code, size_t len,
+                               Code* shared, size_t sharedCount, const char** error);
+
+// Make a malloc'd array of Code sharing the bytecode of `fn` and all of its nested functions, in
+// the order they are serialized. Returns the number of elements stored in `out`.
+size_t shareSerializedCode(ObjFunction* fn, Code** out);
+
+// Returns whether `code` starts with the header of serialized J* code
+bool isCompiledCode(const char* code, size_t len);
+
+#endif
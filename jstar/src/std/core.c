@@ -12,13 +12,16 @@
 #include <string.h>
 
 #include "common.h"
+#include "frozen.h"
 #include "gc.h"
+#include "hash.h"
 #include "hashtable.h"
 #include "import.h"
 #include "modules.h"
 #include "object.h"
 #include "parse/ast.h"
 #include "parse/parser.h"
+#include "table.h"
 #include "value.h"
 #include "vm.h"
 
@@ -48,22 +51,6 @@ static void defMethod(JStarVM* vm, ObjModule* m, ObjClass* cls, JStarNative nat,
     hashTablePut(&cls->methods, strName, OBJ_VAL(native));
 }
 
-static uint64_t hash64(uint64_t x) {
-    x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
-    x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
-    x = x ^ (x >> 31);
-    return x;
-}
-
-static uint32_t hashNumber(double num) {
-    if(num == -0) num = 0;
-    union {
-        double d;
-        uint64_t r;
-    } c = {.d = num};
-    return (uint32_t)hash64(c.r);
-}
-
 static bool compareValues(JStarVM* vm, const Value* v1, const Value* v2, size_t size, bool* out) {
     *out = true;
     for(size_t i = 0; i < size; i++) {
@@ -80,7 +67,7 @@ static JSR_NATIVE(jsr_Object_string) {
     Obj* o = AS_OBJ(vm->apiStack[0]);
     JStarBuffer str;
     jsrBufferInit(vm, &str);
-    jsrBufferAppendf(&str, "<%s@%p>", o->cls->name->data, (void*)o);
+    jsrBufferAppendf(&str, "<%s@%p>", getObjClass(vm, o)->name->data, (void*)o);
     jsrBufferPush(&str);
     return true;
 }
@@ -158,8 +145,14 @@ void initCoreModule(JStarVM* vm) {
     defMethod(vm, core, vm->clsClass, &jsr_Class_getName, "getName", 0);
     defMethod(vm, core, vm->clsClass, &jsr_Class_string, "__string__", 0);
 
-    // Execute core module code
-    jsrEvaluateModule(vm, JSR_CORE_MODULE, JSR_CORE_MODULE, readBuiltInModule(JSR_CORE_MODULE));
+    // Execute core module code, loading it from the build-time snapshot if available
+    size_t codeLen;
+    const char* code = readBuiltInModuleCode(JSR_CORE_MODULE, &codeLen);
+    if(code != NULL) {
+        jsrLoadBytecodeModule(vm, JSR_CORE_MODULE, JSR_CORE_MODULE, code, codeLen);
+    } else {
+        jsrEvaluateModule(vm, JSR_CORE_MODULE, JSR_CORE_MODULE, readBuiltInModule(JSR_CORE_MODULE));
+    }
 
     // Cache builtin class objects in JStarVM
     vm->strClass = AS_CLASS(getDefinedName(vm, core, "String"));
@@ -174,6 +167,10 @@ void initCoreModule(JStarVM* vm) {
     vm->excClass = AS_CLASS(getDefinedName(vm, core, "Exception"));
     vm->tableClass = AS_CLASS(getDefinedName(vm, core, "Table"));
     vm->udataClass = AS_CLASS(getDefinedName(vm, core, "Userdata"));
+    vm->weakRefClass = AS_CLASS(getDefinedName(vm, core, "WeakRef"));
+    vm->weakTableClass = AS_CLASS(getDefinedName(vm, core, "WeakTable"));
+    vm->genClass = AS_CLASS(getDefinedName(vm, core, "Generator"));
+    vm->fiberClass = AS_CLASS(getDefinedName(vm, core, "Fiber"));
     core->base.cls = vm->modClass;
 
     // Call these after builtin class caching above, as they make use of those fields
@@ -301,6 +298,19 @@ JSR_NATIVE(jsr_eval) {
     return true;
 }
 
+JSR_NATIVE(jsr_freeze) {
+    Value frozen;
+    if(!freezeValue(vm, vm->apiStack[1], &frozen)) return false;
+    push(vm, frozen);
+    return true;
+}
+
+JSR_NATIVE(jsr_isFrozen) {
+    Value v = vm->apiStack[1];
+    jsrPushBoolean(vm, !IS_OBJ(v) || AS_OBJ(v)->frozen);
+    return true;
+}
+
 JSR_NATIVE(jsr_type) {
     push(vm, OBJ_VAL(getClass(vm, peek(vm))));
     return true;
@@ -478,6 +488,7 @@ JSR_NATIVE(jsr_List_new) {
 
 JSR_NATIVE(jsr_List_add) {
     ObjList* l = AS_LIST(vm->apiStack[0]);
+    if(!checkMutable(vm, (Obj*)l)) return false;
     listAppend(vm, l, vm->apiStack[1]);
     jsrPushNull(vm);
     return true;
@@ -485,6 +496,7 @@ JSR_NATIVE(jsr_List_add) {
 
 JSR_NATIVE(jsr_List_insert) {
     ObjList* l = AS_LIST(vm->apiStack[0]);
+    if(!checkMutable(vm, (Obj*)l)) return false;
     size_t index = jsrCheckIndex(vm, 1, l->count + 1, "i");
     if(index == SIZE_MAX) return false;
 
@@ -522,6 +534,7 @@ JSR_NATIVE(jsr_List_eq) {
 
 JSR_NATIVE(jsr_List_removeAt) {
     ObjList* l = AS_LIST(vm->apiStack[0]);
+    if(!checkMutable(vm, (Obj*)l)) return false;
     size_t index = jsrCheckIndex(vm, 1, l->count, "i");
     if(index == SIZE_MAX) return false;
 
@@ -532,7 +545,9 @@ JSR_NATIVE(jsr_List_removeAt) {
 }
 
 JSR_NATIVE(jsr_List_clear) {
-    AS_LIST(vm->apiStack[0])->count = 0;
+    ObjList* l = AS_LIST(vm->apiStack[0]);
+    if(!checkMutable(vm, (Obj*)l)) return false;
+    l->count = 0;
     jsrPushNull(vm);
     return true;
 }
@@ -625,6 +640,7 @@ static bool mergeSort(JStarVM* vm, Value* list, int64_t length, Value comp) {
 
 JSR_NATIVE(jsr_List_sort) {
     ObjList* list = AS_LIST(vm->apiStack[0]);
+    if(!checkMutable(vm, (Obj*)list)) return false;
     Value comp = vm->apiStack[1];
     if(!mergeSort(vm, list->arr, list->count, comp)) return false;
     jsrPushNull(vm);
@@ -748,19 +764,8 @@ JSR_NATIVE(jsr_Tuple_next) {
 }
 
 JSR_NATIVE(jsr_Tuple_hash) {
-    ObjTuple* tup = AS_TUPLE(vm->apiStack[0]);
-
-    uint32_t hash = 1;
-    for(size_t i = 0; i < tup->size; i++) {
-        push(vm, tup->arr[i]);
-        if(jsrCallMethod(vm, "__hash__", 0) != JSR_EVAL_SUCCESS) return false;
-        JSR_CHECK(Number, -1, "__hash__() return value");
-        uint32_t elemHash = jsrGetNumber(vm, -1);
-        pop(vm);
-
-        hash = 31 * hash + elemHash;
-    }
-
+    uint32_t hash;
+    if(!tableKeyHash(vm, vm->apiStack[0], &hash)) return false;
     jsrPushNumber(vm, hash);
     return true;
 }
@@ -1040,185 +1045,33 @@ JSR_NATIVE(jsr_String_next) {
 // end
 
 // class Table
-#define MAX_LOAD_FACTOR  0.75
-#define INITIAL_CAPACITY 8
-#define GROW_FACTOR      2
-
-static bool tableKeyHash(JStarVM* vm, Value key, uint32_t* hash) {
-    if(IS_STRING(key)) {
-        *hash = STRING_GET_HASH(AS_STRING(key));
-        return true;
-    }
-    if(IS_NUM(key)) {
-        *hash = hashNumber(AS_NUM(key));
-        return true;
-    }
-    if(IS_BOOL(key)) {
-        *hash = AS_BOOL(key);
-        return true;
-    }
-
-    push(vm, key);
-    if(jsrCallMethod(vm, "__hash__", 0) != JSR_EVAL_SUCCESS) return false;
-    JSR_CHECK(Number, -1, "__hash__() return value");
-    *hash = (uint32_t)jsrGetNumber(vm, -1);
-    pop(vm);
-    return hash;
-}
-
-static bool tableKeyEquals(JStarVM* vm, Value k1, Value k2, bool* eq) {
-    if(IS_STRING(k1) || IS_NUM(k1) || IS_BOOL(k1)) {
-        *eq = valueEquals(k1, k2);
-        return true;
-    }
-
-    push(vm, k1);
-    push(vm, k2);
-    if(jsrCallMethod(vm, "__eq__", 1) != JSR_EVAL_SUCCESS) return false;
-    *eq = isValTrue(pop(vm));
-    return true;
-}
-
-static bool findEntry(JStarVM* vm, TableEntry* entries, size_t sizeMask, Value key,
-                      TableEntry** out) {
-    uint32_t hash;
-    if(!tableKeyHash(vm, key, &hash)) return false;
-
-    size_t i = hash & sizeMask;
-    TableEntry* tomb = NULL;
-
-    for(;;) {
-        TableEntry* e = &entries[i];
-        if(IS_NULL(e->key)) {
-            if(IS_NULL(e->val)) {
-                if(tomb)
-                    *out = tomb;
-                else
-                    *out = e;
-                return true;
-            } else if(!tomb) {
-                tomb = e;
-            }
-        } else {
-            bool eq;
-            if(!tableKeyEquals(vm, key, e->key, &eq)) return false;
-            if(eq) {
-                *out = e;
-                return true;
-            }
-        }
-        i = (i + 1) & sizeMask;
-    }
-}
-
-static void growEntries(JStarVM* vm, ObjTable* t) {
-    size_t newSize = t->sizeMask ? (t->sizeMask + 1) * GROW_FACTOR : INITIAL_CAPACITY;
-    TableEntry* newEntries = GC_ALLOC(vm, sizeof(TableEntry) * newSize);
-    for(size_t i = 0; i < newSize; i++) {
-        newEntries[i].key = NULL_VAL;
-        newEntries[i].val = NULL_VAL;
-    }
-
-    t->numEntries = 0, t->count = 0;
-    if(t->sizeMask != 0) {
-        for(size_t i = 0; i <= t->sizeMask; i++) {
-            TableEntry* e = &t->entries[i];
-            if(IS_NULL(e->key)) continue;
-
-            TableEntry* dest;
-            findEntry(vm, newEntries, newSize - 1, e->key, &dest);
-            dest->key = e->key;
-            dest->val = e->val;
-            t->numEntries++, t->count++;
-        }
-        GC_FREE_ARRAY(vm, TableEntry, t->entries, t->sizeMask + 1);
-    }
-    t->entries = newEntries;
-    t->sizeMask = newSize - 1;
-}
-
 JSR_NATIVE(jsr_Table_get) {
-    if(jsrIsNull(vm, 1)) JSR_RAISE(vm, "TypeException", "Key of Table cannot be null.");
-
-    ObjTable* t = AS_TABLE(vm->apiStack[0]);
-    if(t->entries == NULL) {
-        push(vm, NULL_VAL);
-        return true;
-    }
-
-    TableEntry* e;
-    if(!findEntry(vm, t->entries, t->sizeMask, vm->apiStack[1], &e)) {
-        return false;
-    }
-
-    if(!IS_NULL(e->key))
-        push(vm, e->val);
-    else
-        push(vm, NULL_VAL);
-
+    Value res;
+    if(!tableGet(vm, AS_TABLE(vm->apiStack[0]), vm->apiStack[1], &res)) return false;
+    push(vm, res);
     return true;
 }
 
 JSR_NATIVE(jsr_Table_set) {
-    if(jsrIsNull(vm, 1)) JSR_RAISE(vm, "TypeException", "Key of Table cannot be null.");
-
-    ObjTable* t = AS_TABLE(vm->apiStack[0]);
-    if(t->numEntries + 1 > (t->sizeMask + 1) * MAX_LOAD_FACTOR) {
-        growEntries(vm, t);
-    }
-
-    TableEntry* e;
-    if(!findEntry(vm, t->entries, t->sizeMask, vm->apiStack[1], &e)) {
+    bool isNew;
+    if(!tablePut(vm, AS_TABLE(vm->apiStack[0]), vm->apiStack[1], vm->apiStack[2], &isNew)) {
         return false;
     }
-
-    bool isNew = IS_NULL(e->key);
-    if(isNew) {
-        t->count++;
-        if(IS_NULL(e->val)) t->numEntries++;
-    }
-
-    e->key = vm->apiStack[1];
-    e->val = vm->apiStack[2];
-
     push(vm, BOOL_VAL(isNew));
     return true;
 }
 
 JSR_NATIVE(jsr_Table_delete) {
-    if(jsrIsNull(vm, 1)) JSR_RAISE(vm, "TypeException", "Key of Table cannot be null.");
-    ObjTable* t = AS_TABLE(vm->apiStack[0]);
-
-    if(t->entries == NULL) {
-        push(vm, BOOL_VAL(false));
-        return true;
-    }
-
-    TableEntry* toDelete;
-    if(!findEntry(vm, t->entries, t->sizeMask, vm->apiStack[1], &toDelete)) {
-        return false;
-    }
-
-    if(IS_NULL(toDelete->key)) {
-        jsrPushBoolean(vm, false);
-        return true;
-    }
-
-    toDelete->key = NULL_VAL;
-    toDelete->val = TRUE_VAL;
-    t->count--;
-
-    push(vm, BOOL_VAL(true));
+    bool deleted;
+    if(!tableDelete(vm, AS_TABLE(vm->apiStack[0]), vm->apiStack[1], &deleted)) return false;
+    push(vm, BOOL_VAL(deleted));
     return true;
 }
 
 JSR_NATIVE(jsr_Table_clear) {
     ObjTable* t = AS_TABLE(vm->apiStack[0]);
-    t->numEntries = t->count = 0;
-    for(size_t i = 0; i < t->sizeMask + 1; i++) {
-        t->entries[i].key = NULL_VAL;
-        t->entries[i].val = NULL_VAL;
-    }
+    if(!checkMutable(vm, (Obj*)t)) return false;
+    tableClear(t);
     push(vm, NULL_VAL);
     return true;
 }
@@ -1230,81 +1083,51 @@ JSR_NATIVE(jsr_Table_len) {
 }
 
 JSR_NATIVE(jsr_Table_contains) {
-    if(jsrIsNull(vm, 0)) JSR_RAISE(vm, "TypeException", "Key of Table cannot be null.");
-
-    ObjTable* t = AS_TABLE(vm->apiStack[0]);
-    if(t->entries == NULL) {
-        push(vm, BOOL_VAL(false));
-        return true;
-    }
-
-    TableEntry* e;
-    if(!findEntry(vm, t->entries, t->sizeMask, vm->apiStack[1], &e)) {
-        return false;
-    }
-
-    push(vm, BOOL_VAL(!IS_NULL(e->key)));
+    bool contains;
+    if(!tableContains(vm, AS_TABLE(vm->apiStack[0]), vm->apiStack[1], &contains)) return false;
+    push(vm, BOOL_VAL(contains));
     return true;
 }
 
 JSR_NATIVE(jsr_Table_keys) {
     ObjTable* t = AS_TABLE(vm->apiStack[0]);
-    TableEntry* entries = t->entries;
-
-    jsrPushList(vm);
-
-    if(entries != NULL) {
-        for(size_t i = 0; i < t->sizeMask + 1; i++) {
-            if(!IS_NULL(entries[i].key)) {
-                push(vm, entries[i].key);
-                jsrListAppend(vm, -2);
-                jsrPop(vm);
-            }
+    ObjList* keys = newList(vm, t->count);
+    for(size_t i = 0; i < t->numEntries; i++) {
+        if(!IS_NULL(t->entries[i].key)) {
+            keys->arr[keys->count++] = t->entries[i].key;
         }
     }
-
+    push(vm, OBJ_VAL(keys));
     return true;
 }
 
 JSR_NATIVE(jsr_Table_values) {
     ObjTable* t = AS_TABLE(vm->apiStack[0]);
-    TableEntry* entries = t->entries;
-
-    jsrPushList(vm);
-
-    if(entries != NULL) {
-        for(size_t i = 0; i < t->sizeMask + 1; i++) {
-            if(!IS_NULL(entries[i].key)) {
-                push(vm, entries[i].val);
-                jsrListAppend(vm, -2);
-                jsrPop(vm);
-            }
+    ObjList* values = newList(vm, t->count);
+    for(size_t i = 0; i < t->numEntries; i++) {
+        if(!IS_NULL(t->entries[i].key)) {
+            values->arr[values->count++] = t->entries[i].val;
         }
     }
-
+    push(vm, OBJ_VAL(values));
     return true;
 }
 
 JSR_NATIVE(jsr_Table_iter) {
     ObjTable* t = AS_TABLE(vm->apiStack[0]);
 
-    if(IS_NULL(vm->apiStack[1]) && t->entries == NULL) {
-        push(vm, BOOL_VAL(false));
-        return true;
-    }
-
     size_t lastIdx = 0;
 
     if(IS_NUM(vm->apiStack[1])) {
         double idx = AS_NUM(vm->apiStack[1]);
-        if(idx < 0 && idx >= t->sizeMask) {
+        if(idx < 0 || idx >= t->numEntries) {
             push(vm, BOOL_VAL(false));
             return true;
         }
         lastIdx = (size_t)idx + 1;
     }
 
-    for(size_t i = lastIdx; i < t->sizeMask + 1; i++) {
+    for(size_t i = lastIdx; i < t->numEntries; i++) {
         if(!IS_NULL(t->entries[i].key)) {
             push(vm, NUM_VAL(i));
             return true;
@@ -1320,7 +1143,7 @@ JSR_NATIVE(jsr_Table_next) {
 
     if(IS_NUM(vm->apiStack[1])) {
         double idx = AS_NUM(vm->apiStack[1]);
-        if(idx >= 0 && idx <= t->sizeMask) {
+        if(idx >= 0 && idx < t->numEntries) {
             size_t i = (size_t)idx;
             push(vm, t->entries[i].key);
             return true;
@@ -1338,11 +1161,11 @@ JSR_NATIVE(jsr_Table_string) {
     jsrBufferInit(vm, &buf);
     jsrBufferAppendChar(&buf, '{');
 
-    TableEntry* entries = t->entries;
-    if(entries != NULL) {
-        for(size_t i = 0; i < t->sizeMask + 1; i++) {
-            if(!IS_NULL(entries[i].key)) {
-                push(vm, entries[i].key);
+    if(t->count != 0) {
+        for(size_t i = 0; i < t->numEntries; i++) {
+            TableEntry* e = &t->entries[i];
+            if(!IS_NULL(e->key)) {
+                push(vm, e->key);
                 if(jsrCallMethod(vm, "__string__", 0) != JSR_EVAL_SUCCESS || !jsrIsString(vm, -1)) {
                     jsrBufferFree(&buf);
                     return false;
@@ -1351,7 +1174,7 @@ JSR_NATIVE(jsr_Table_string) {
                 jsrBufferAppendstr(&buf, " : ");
                 jsrPop(vm);
 
-                push(vm, entries[i].val);
+                push(vm, t->entries[i].val);
                 if(jsrCallMethod(vm, "__string__", 0) != JSR_EVAL_SUCCESS || !jsrIsString(vm, -1)) {
                     jsrBufferFree(&buf);
                     return false;
@@ -1369,6 +1192,94 @@ JSR_NATIVE(jsr_Table_string) {
 }
 // end
 
+// class WeakTable
+JSR_NATIVE(jsr_WeakTable_new) {
+    ObjTable* t = newTable(vm);
+    t->base.cls = vm->weakTableClass;
+    t->weak = true;
+    push(vm, OBJ_VAL(t));
+    return true;
+}
+// end
+
+// class WeakRef
+JSR_NATIVE(jsr_WeakRef_new) {
+    push(vm, OBJ_VAL(newWeakRef(vm, vm->apiStack[1])));
+    return true;
+}
+
+JSR_NATIVE(jsr_WeakRef_get) {
+    push(vm, AS_WEAK_REF(vm->apiStack[0])->referent);
+    return true;
+}
+// end
+
+// class Generator
+JSR_NATIVE(jsr_Generator_isDone) {
+    push(vm, BOOL_VAL(AS_GENERATOR(vm->apiStack[0])->state == GEN_DONE));
+    return true;
+}
+
+// For-each loops over generators are executed inline by the VM, these methods are only called
+// when a generator is iterated manually or wrapped by another iterator
+JSR_NATIVE(jsr_Generator_iter) {
+    ObjGenerator* gen = AS_GENERATOR(vm->apiStack[0]);
+    if(gen->state == GEN_DONE) {
+        push(vm, BOOL_VAL(false));
+        return true;
+    }
+
+    push(vm, OBJ_VAL(gen));
+    if(jsrCall(vm, 0) != JSR_EVAL_SUCCESS) return false;
+    pop(vm);
+
+    push(vm, BOOL_VAL(gen->state != GEN_DONE));
+    return true;
+}
+
+JSR_NATIVE(jsr_Generator_next) {
+    push(vm, AS_GENERATOR(vm->apiStack[0])->lastYield);
+    return true;
+}
+// end
+
+// class Fiber
+JSR_NATIVE(jsr_Fiber_new) {
+    Value fn = vm->apiStack[1];
+    Obj* method = IS_BOUND_METHOD(fn) ? AS_BOUND_METHOD(fn)->method : NULL;
+    Obj* closure = IS_OBJ(fn) && method == NULL ? AS_OBJ(fn) : method;
+    if(closure == NULL || closure->type != OBJ_CLOSURE) {
+        JSR_RAISE(vm, "TypeException", "fn must be a Function, and not a native one.");
+    }
+
+    FnCommon* c = &((ObjClosure*)closure)->fn->c;
+    if(c->argsCount - c->defaultc > 1) {
+        JSR_RAISE(vm, "InvalidArgException", "fn must take at most 1 argument.");
+    }
+
+    push(vm, OBJ_VAL(newFiber(vm, fn)));
+    return true;
+}
+
+// The value returned by the switching natives is passed to the fiber switched to
+JSR_NATIVE(jsr_Fiber_resume) {
+    if(!resumeFiber(vm, AS_FIBER(vm->apiStack[0]), false)) return false;
+    push(vm, vm->apiStack[1]);
+    return true;
+}
+
+JSR_NATIVE(jsr_Fiber_transfer) {
+    if(!resumeFiber(vm, AS_FIBER(vm->apiStack[0]), true)) return false;
+    push(vm, vm->apiStack[1]);
+    return true;
+}
+
+JSR_NATIVE(jsr_Fiber_isDone) {
+    push(vm, BOOL_VAL(AS_FIBER(vm->apiStack[0])->state == FIBER_DONE));
+    return true;
+}
+// end
+
 // class Enum
 #define M_VALUE_NAME "__valueName"
 
@@ -1528,7 +1439,7 @@ JSR_NATIVE(jsr_Exception_getStacktrace) {
             if(record->line >= 0)
                 jsrBufferAppendf(&string, "[line %d]", record->line);
             else
-                jsrBufferAppend(&string, "[line ?]", record->line);
+                jsrBufferAppendstr(&string, "[line ?]");
             jsrBufferAppendf(&string, " module %s in %s\n", record->moduleName->data,
                              record->funcName->data);
         }
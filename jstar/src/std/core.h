@@ -11,9 +11,11 @@ void initCoreModule(JStarVM* vm);
 JSR_NATIVE(jsr_ascii);
 JSR_NATIVE(jsr_char);
 JSR_NATIVE(jsr_eval);
+JSR_NATIVE(jsr_freeze);
 JSR_NATIVE(jsr_garbageCollect);
 JSR_NATIVE(jsr_importPaths);
 JSR_NATIVE(jsr_int);
+JSR_NATIVE(jsr_isFrozen);
 JSR_NATIVE(jsr_print);
 JSR_NATIVE(jsr_type);
 
@@ -95,6 +97,28 @@ JSR_NATIVE(jsr_Table_next);
 JSR_NATIVE(jsr_Table_string);
 // end
 
+// class WeakTable
+JSR_NATIVE(jsr_WeakTable_new);
+// end
+
+// class WeakRef
+JSR_NATIVE(jsr_WeakRef_new);
+JSR_NATIVE(jsr_WeakRef_get);
+// end
+
+// class Generator
+JSR_NATIVE(jsr_Generator_isDone);
+JSR_NATIVE(jsr_Generator_iter);
+JSR_NATIVE(jsr_Generator_next);
+// end
+
+// class Fiber
+JSR_NATIVE(jsr_Fiber_new);
+JSR_NATIVE(jsr_Fiber_resume);
+JSR_NATIVE(jsr_Fiber_transfer);
+JSR_NATIVE(jsr_Fiber_isDone);
+// end
+
 // class Enum
 JSR_NATIVE(jsr_Enum_new);
 JSR_NATIVE(jsr_Enum_value);
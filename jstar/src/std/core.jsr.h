@@ -186,6 +186,24 @@ const char *core_jsr =
 "    native __next__(i)\n"
 "    native __string__()\n"
 "end\n"
+"class WeakTable is Table\n"
+"    native new()\n"
+"end\n"
+"class WeakRef\n"
+"    native new(obj)\n"
+"    native get()\n"
+"end\n"
+"class Generator is Iter\n"
+"    native isDone()\n"
+"    native __iter__(_)\n"
+"    native __next__(_)\n"
+"end\n"
+"class Fiber\n"
+"    native new(fn)\n"
+"    native resume(value=null)\n"
+"    native transfer(value=null)\n"
+"    native isDone()\n"
+"end\n"
 "class Enum\n"
 "    native new(...)\n"
 "    native value(name)\n"
@@ -250,9 +268,11 @@ const char *core_jsr =
 "native ascii(num)\n"
 "native char(c)\n"
 "native eval(source)\n"
+"native freeze(value)\n"
 "native garbageCollect()\n"
 "native importPaths()\n"
 "native int(n)\n"
+"native isFrozen(value)\n"
 "native print(s, ...)\n"
 "native type(o)\n"
 "class IReverse is Sequence\n"
@@ -375,4 +395,6 @@ const char *core_jsr =
 "class IndexOutOfBoundException is Exception end\n"
 "class AssertException is Exception end\n"
 "class NotImplementedException is Exception end\n"
+"class GeneratorException is Exception end\n"
+"class FiberException is Exception end\n"
 ;
\ No newline at end of file
@@ -0,0 +1,615 @@
+#ifdef __linux__
+    #define _GNU_SOURCE  // for accept4 and pipe2
+#endif
+
+#include "event.h"
+
+#ifdef JSTAR_EVENT
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "common.h"
+
+// Maximum number of events returned by a single `EventLoop._wait` call
+#define MAX_EVENTS 256
+
+#define JSR_READ  1
+#define JSR_WRITE 2
+#define JSR_ERROR 4
+#define JSR_HUP   8
+#define JSR_EDGE  16
+
+#define JSR_INET  0
+#define JSR_INET6 1
+#define JSR_UNIX  2
+
+static const int families[] = {AF_INET, AF_INET6, AF_UNIX};
+
+// static helper functions
+
+static bool isWouldBlock(int err) {
+    return err == EAGAIN || err == EWOULDBLOCK;
+}
+
+static bool getFd(JStarVM* vm, int slot, const char* field, int* fd) {
+    if(!jsrGetField(vm, slot, field)) return false;
+    JSR_CHECK(Int, -1, field);
+    *fd = jsrGetNumber(vm, -1);
+    jsrPop(vm);
+    if(*fd < 0) JSR_RAISE(vm, "EventException", "closed file descriptor");
+    return true;
+}
+
+static bool setFd(JStarVM* vm, int slot, int fd) {
+    jsrPushNumber(vm, fd);
+    if(!jsrSetField(vm, slot, FIELD_FD_FD)) return false;
+    jsrPop(vm);
+    return true;
+}
+
+static bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+static uint32_t toEpollEvents(int events) {
+    uint32_t epollEvents = 0;
+    if(events & JSR_READ) epollEvents |= EPOLLIN;
+    if(events & JSR_WRITE) epollEvents |= EPOLLOUT;
+    if(events & JSR_EDGE) epollEvents |= EPOLLET;
+    return epollEvents;
+}
+
+static int fromEpollEvents(uint32_t epollEvents) {
+    int events = 0;
+    if(epollEvents & EPOLLIN) events |= JSR_READ;
+    if(epollEvents & EPOLLOUT) events |= JSR_WRITE;
+    if(epollEvents & EPOLLERR) events |= JSR_ERROR;
+    if(epollEvents & (EPOLLHUP | EPOLLRDHUP)) events |= JSR_HUP;
+    return events;
+}
+
+static bool toTimespec(JStarVM* vm, int slot, const char* name, struct timespec* ts) {
+    JSR_CHECK(Number, slot, name);
+    double seconds = jsrGetNumber(vm, slot);
+    if(seconds < 0) JSR_RAISE(vm, "InvalidArgException", "%s must be >= 0", name);
+    ts->tv_sec = (time_t)seconds;
+    ts->tv_nsec = (long)((seconds - (double)ts->tv_sec) * 1e9);
+    return true;
+}
+
+static bool setTimer(JStarVM* vm, int fd) {
+    struct itimerspec spec;
+    if(!toTimespec(vm, 1, "timeout", &spec.it_value)) return false;
+    if(!toTimespec(vm, 2, "interval", &spec.it_interval)) return false;
+    if(timerfd_settime(fd, 0, &spec, NULL) == -1) {
+        JSR_RAISE(vm, "EventException", strerror(errno));
+    }
+    return true;
+}
+
+// Build the address of the socket from the `host` and `port` arguments.
+// `host` must be a numeric address, or a path for UNIX sockets
+static bool toSockaddr(JStarVM* vm, int family, struct sockaddr_storage* addr, socklen_t* len) {
+    JSR_CHECK(String, 1, "host");
+    const char* host = jsrGetString(vm, 1);
+    memset(addr, 0, sizeof(*addr));
+
+    if(family == JSR_UNIX) {
+        struct sockaddr_un* un = (struct sockaddr_un*)addr;
+        size_t pathLen = jsrGetStringSz(vm, 1);
+        if(pathLen >= sizeof(un->sun_path)) {
+            JSR_RAISE(vm, "InvalidArgException", "Socket path too long `%s`", host);
+        }
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, host, pathLen + 1);
+        *len = sizeof(*un);
+        return true;
+    }
+
+    JSR_CHECK(Int, 2, "port");
+    double port = jsrGetNumber(vm, 2);
+    if(port < 0 || port > UINT16_MAX) {
+        JSR_RAISE(vm, "InvalidArgException", "Invalid port (%g)", port);
+    }
+
+    int res = 1;
+    if(family == JSR_INET) {
+        struct sockaddr_in* in = (struct sockaddr_in*)addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons((uint16_t)port);
+        if(*host) res = inet_pton(AF_INET, host, &in->sin_addr);
+        else in->sin_addr.s_addr = htonl(INADDR_ANY);
+        *len = sizeof(*in);
+    } else {
+        struct sockaddr_in6* in6 = (struct sockaddr_in6*)addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons((uint16_t)port);
+        if(*host) res = inet_pton(AF_INET6, host, &in6->sin6_addr);
+        else in6->sin6_addr = in6addr_any;
+        *len = sizeof(*in6);
+    }
+
+    if(res != 1) JSR_RAISE(vm, "InvalidArgException", "Invalid address `%s`", host);
+    return true;
+}
+
+static bool getFamily(JStarVM* vm, int* family) {
+    if(!jsrGetField(vm, 0, FIELD_SOCKET_FAMILY)) return false;
+    JSR_CHECK(Int, -1, FIELD_SOCKET_FAMILY);
+    *family = jsrGetNumber(vm, -1);
+    jsrPop(vm);
+    return true;
+}
+
+// Construct a `Socket` wrapping `fd`, leaving it on top of the stack.
+// `fd` is closed if the construction fails
+static bool pushSocket(JStarVM* vm, int family, int fd) {
+    if(!jsrGetGlobal(vm, NULL, "Socket")) {
+        close(fd);
+        return false;
+    }
+    jsrPushNumber(vm, family);
+    jsrPushNumber(vm, fd);
+    if(jsrCall(vm, 2) != JSR_EVAL_SUCCESS) {
+        close(fd);
+        return false;
+    }
+    return true;
+}
+
+// class Fd
+JSR_NATIVE(jsr_Fd_new) {
+    JSR_CHECK(Int, 1, "fd");
+    int fd = jsrGetNumber(vm, 1);
+    if(!setNonBlocking(fd)) JSR_RAISE(vm, "EventException", strerror(errno));
+    if(!setFd(vm, 0, fd)) return false;
+    jsrPushValue(vm, 0);
+    return true;
+}
+
+JSR_NATIVE(jsr_Fd_fileno) {
+    int fd;
+    if(!getFd(vm, 0, FIELD_FD_FD, &fd)) return false;
+    jsrPushNumber(vm, fd);
+    return true;
+}
+
+JSR_NATIVE(jsr_Fd_read) {
+    int fd;
+    if(!getFd(vm, 0, FIELD_FD_FD, &fd)) return false;
+    JSR_CHECK(Int, 1, "bytes");
+
+    double bytes = jsrGetNumber(vm, 1);
+    if(bytes < 0) JSR_RAISE(vm, "InvalidArgException", "bytes must be >= 0");
+
+    JStarBuffer data;
+    jsrBufferInitSz(vm, &data, bytes + 1);
+
+    ssize_t n;
+    while((n = read(fd, data.data, bytes)) == -1 && errno == EINTR)
+        ;
+
+    if(n == -1) {
+        jsrBufferFree(&data);
+        if(!isWouldBlock(errno)) JSR_RAISE(vm, "EventException", strerror(errno));
+        jsrPushNull(vm);
+        return true;
+    }
+
+    data.len = n;
+    jsrBufferPush(&data);
+    return true;
+}
+
+static bool pushWritten(JStarVM* vm, ssize_t n) {
+    if(n == -1) {
+        if(!isWouldBlock(errno)) JSR_RAISE(vm, "EventException", strerror(errno));
+        jsrPushNull(vm);
+        return true;
+    }
+    jsrPushNumber(vm, n);
+    return true;
+}
+
+JSR_NATIVE(jsr_Fd_write) {
+    int fd;
+    if(!getFd(vm, 0, FIELD_FD_FD, &fd)) return false;
+    JSR_CHECK(String, 1, "data");
+
+    ssize_t n;
+    while((n = write(fd, jsrGetString(vm, 1), jsrGetStringSz(vm, 1))) == -1 && errno == EINTR)
+        ;
+
+    return pushWritten(vm, n);
+}
+
+JSR_NATIVE(jsr_Fd_close) {
+    int fd;
+    if(!getFd(vm, 0, FIELD_FD_FD, &fd)) return false;
+    if(!setFd(vm, 0, -1)) return false;
+    if(close(fd) == -1 && errno != EINTR) JSR_RAISE(vm, "EventException", strerror(errno));
+    jsrPushNull(vm);
+    return true;
+}
+// end
+
+// class Socket
+JSR_NATIVE(jsr_Socket_new) {
+    JSR_CHECK(Int, 1, "family");
+    int family = jsrGetNumber(vm, 1);
+    if(family < JSR_INET || family > JSR_UNIX) {
+        JSR_RAISE(vm, "InvalidArgException", "Invalid socket family (%d)", family);
+    }
+
+    int fd;
+    if(jsrIsNull(vm, 2)) {
+        fd = socket(families[family], SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(fd == -1) JSR_RAISE(vm, "EventException", strerror(errno));
+    } else {
+        JSR_CHECK(Int, 2, "fd");
+        fd = jsrGetNumber(vm, 2);
+    }
+
+    if(!setFd(vm, 0, fd)) return false;
+
+    jsrPushNumber(vm, family);
+    if(!jsrSetField(vm, 0, FIELD_SOCKET_FAMILY)) return false;
+    jsrPop(vm);
+
+    jsrPushValue(vm, 0);
+    return true;
+}
+
+JSR_NATIVE(jsr_Socket_bind) {
+    int fd, family;
+    if(!getFd(vm, 0, FIELD_FD_FD, &fd)) return false;
+    if(!getFamily(vm, &family)) return false;
+
+    struct sockaddr_storage addr;
+    socklen_t len;
+    if(!toSockaddr(vm, family, &addr, &len)) return false;
+
+    if(family != JSR_UNIX) {
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    }
+
+    if(bind(fd, (struct sockaddr*)&addr, len) == -1) {
+        JSR_RAISE(vm, "EventException", "%s: %s", jsrGetString(vm, 1), strerror(errno));
+    }
+
+    jsrPushNull(vm);
+    return true;
+}
+
+JSR_NATIVE(jsr_Socket_listen) {
+    int fd;
+    if(!getFd(vm, 0, FIELD_FD_FD, &fd)) return false;
+    JSR_CHECK(Int, 1, "backlog");
+    if(listen(fd, jsrGetNumber(vm, 1)) == -1) JSR_RAISE(vm, "EventException", strerror(errno));
+    jsrPushNull(vm);
+    return true;
+}
+
+JSR_NATIVE(jsr_Socket_accept) {
+    int fd, family;
+    if(!getFd(vm, 0, FIELD_FD_FD, &fd)) return false;
+    if(!getFamily(vm, &family)) return false;
+
+    int conn;
+    while((conn = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) == -1 && errno == EINTR)
+        ;
+
+    if(conn == -1) {
+        // A connection reset before being accepted is not an error of the listening socket
+        if(!isWouldBlock(errno) && errno != ECONNABORTED) {
+            JSR_RAISE(vm, "EventException", strerror(errno));
+        }
+        jsrPushNull(vm);
+        return true;
+    }
+
+    return pushSocket(vm, family, conn);
+}
+
+JSR_NATIVE(jsr_Socket_connect) {
+    int fd, family;
+    if(!getFd(vm, 0, FIELD_FD_FD, &fd)) return false;
+    if(!getFamily(vm, &family)) return false;
+
+    struct sockaddr_storage addr;
+    socklen_t len;
+    if(!toSockaddr(vm, family, &addr, &len)) return false;
+
+    if(connect(fd, (struct sockaddr*)&addr, len) == -1) {
+        // The connection completes asynchronously, signaled by the socket becoming writable
+        if(errno != EINPROGRESS && errno != EINTR) {
+            JSR_RAISE(vm, "EventException", "%s: %s", jsrGetString(vm, 1), strerror(errno));
+        }
+        jsrPushBoolean(vm, false);
+        return true;
+    }
+
+    jsrPushBoolean(vm, true);
+    return true;
+}
+
+JSR_NATIVE(jsr_Socket_error) {
+    int fd;
+    if(!getFd(vm, 0, FIELD_FD_FD, &fd)) return false;
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if(getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+        JSR_RAISE(vm, "EventException", strerror(errno));
+    }
+
+    if(err == 0) {
+        jsrPushNull(vm);
+    } else {
+        jsrPushString(vm, strerror(err));
+    }
+    return true;
+}
+
+JSR_NATIVE(jsr_Socket_address) {
+    int fd;
+    if(!getFd(vm, 0, FIELD_FD_FD, &fd)) return false;
+
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if(getsockname(fd, (struct sockaddr*)&addr, &len) == -1) {
+        JSR_RAISE(vm, "EventException", strerror(errno));
+    }
+
+    char host[INET6_ADDRSTRLEN];
+    switch(addr.ss_family) {
+    case AF_INET: {
+        struct sockaddr_in* in = (struct sockaddr_in*)&addr;
+        inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+        jsrPushString(vm, host);
+        jsrPushNumber(vm, ntohs(in->sin_port));
+        jsrPushTuple(vm, 2);
+        break;
+    }
+    case AF_INET6: {
+        struct sockaddr_in6* in6 = (struct sockaddr_in6*)&addr;
+        inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+        jsrPushString(vm, host);
+        jsrPushNumber(vm, ntohs(in6->sin6_port));
+        jsrPushTuple(vm, 2);
+        break;
+    }
+    case AF_UNIX: {
+        struct sockaddr_un* un = (struct sockaddr_un*)&addr;
+        size_t pathLen = len > offsetof(struct sockaddr_un, sun_path)
+                             ? strnlen(un->sun_path, len - offsetof(struct sockaddr_un, sun_path))
+                             : 0;
+        jsrPushStringSz(vm, un->sun_path, pathLen);
+        break;
+    }
+    default:
+        jsrPushNull(vm);
+        break;
+    }
+
+    return true;
+}
+
+JSR_NATIVE(jsr_Socket_shutdown) {
+    int fd;
+    if(!getFd(vm, 0, FIELD_FD_FD, &fd)) return false;
+    JSR_CHECK(Int, 1, "how");
+
+    int how = jsrGetNumber(vm, 1);
+    if(how < SHUT_RD || how > SHUT_RDWR) {
+        JSR_RAISE(vm, "InvalidArgException", "Invalid shutdown mode (%d)", how);
+    }
+
+    if(shutdown(fd, how) == -1) JSR_RAISE(vm, "EventException", strerror(errno));
+    jsrPushNull(vm);
+    return true;
+}
+
+JSR_NATIVE(jsr_Socket_write) {
+    int fd;
+    if(!getFd(vm, 0, FIELD_FD_FD, &fd)) return false;
+    JSR_CHECK(String, 1, "data");
+
+    // MSG_NOSIGNAL: writing to a socket closed by the peer must raise, not kill the process
+    ssize_t n;
+    while((n = send(fd, jsrGetString(vm, 1), jsrGetStringSz(vm, 1), MSG_NOSIGNAL)) == -1 &&
+          errno == EINTR)
+        ;
+
+    return pushWritten(vm, n);
+}
+// end
+
+// class Timer
+JSR_NATIVE(jsr_Timer_new) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(fd == -1) JSR_RAISE(vm, "EventException", strerror(errno));
+
+    if(!setTimer(vm, fd) || !setFd(vm, 0, fd)) {
+        close(fd);
+        return false;
+    }
+
+    jsrPushValue(vm, 0);
+    return true;
+}
+
+JSR_NATIVE(jsr_Timer_set) {
+    int fd;
+    if(!getFd(vm, 0, FIELD_FD_FD, &fd)) return false;
+    if(!setTimer(vm, fd)) return false;
+    jsrPushNull(vm);
+    return true;
+}
+
+JSR_NATIVE(jsr_Timer_read) {
+    int fd;
+    if(!getFd(vm, 0, FIELD_FD_FD, &fd)) return false;
+
+    uint64_t expirations;
+    ssize_t n;
+    while((n = read(fd, &expirations, sizeof(expirations))) == -1 && errno == EINTR)
+        ;
+
+    if(n == -1) {
+        if(!isWouldBlock(errno)) JSR_RAISE(vm, "EventException", strerror(errno));
+        jsrPushNull(vm);
+        return true;
+    }
+
+    jsrPushNumber(vm, (double)expirations);
+    return true;
+}
+// end
+
+// class EventLoop
+JSR_NATIVE(jsr_EventLoop_open) {
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(epfd == -1) JSR_RAISE(vm, "EventException", strerror(errno));
+
+    jsrPushNumber(vm, epfd);
+    if(!jsrSetField(vm, 0, FIELD_LOOP_EPFD)) {
+        close(epfd);
+        return false;
+    }
+
+    jsrPushNull(vm);
+    return true;
+}
+
+JSR_NATIVE(jsr_EventLoop_control) {
+    int epfd;
+    if(!getFd(vm, 0, FIELD_LOOP_EPFD, &epfd)) return false;
+    JSR_CHECK(Int, 1, "fd");
+    JSR_CHECK(Boolean, 3, "watched");
+
+    int fd = jsrGetNumber(vm, 1);
+    bool watched = jsrGetBoolean(vm, 3);
+
+    if(jsrIsNull(vm, 2)) {
+        // The descriptor may have already been closed, implicitly removing it from the set
+        if(epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL) == -1 && errno != EBADF && errno != ENOENT) {
+            JSR_RAISE(vm, "EventException", strerror(errno));
+        }
+    } else {
+        JSR_CHECK(Int, 2, "events");
+        struct epoll_event event = {.events = toEpollEvents(jsrGetNumber(vm, 2))};
+        event.data.fd = fd;
+        int res = epoll_ctl(epfd, watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event);
+        // A watched descriptor closed without unwatching it is gone from the set, and its number
+        // may have been reused by a new one
+        if(res == -1 && watched && errno == ENOENT) {
+            res = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event);
+        }
+        if(res == -1) JSR_RAISE(vm, "EventException", strerror(errno));
+    }
+
+    jsrPushNull(vm);
+    return true;
+}
+
+JSR_NATIVE(jsr_EventLoop_wait) {
+    int epfd;
+    if(!getFd(vm, 0, FIELD_LOOP_EPFD, &epfd)) return false;
+
+    // A null timeout waits indefinitely
+    int timeoutMs = -1;
+    if(!jsrIsNull(vm, 1)) {
+        JSR_CHECK(Number, 1, "timeout");
+        double timeout = jsrGetNumber(vm, 1);
+        if(timeout >= 0) timeoutMs = (int)ceil(timeout * 1000);
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(epfd, events, MAX_EVENTS, timeoutMs);
+    if(count == -1) {
+        if(errno != EINTR) JSR_RAISE(vm, "EventException", strerror(errno));
+        count = 0;
+    }
+
+    // Flattened as [fd1, events1, fd2, events2, ...] to avoid allocating a tuple per event
+    jsrPushList(vm);
+    for(int i = 0; i < count; i++) {
+        jsrPushNumber(vm, events[i].data.fd);
+        jsrListAppend(vm, -2);
+        jsrPop(vm);
+        jsrPushNumber(vm, fromEpollEvents(events[i].events));
+        jsrListAppend(vm, -2);
+        jsrPop(vm);
+    }
+
+    return true;
+}
+
+JSR_NATIVE(jsr_EventLoop_close) {
+    int epfd;
+    if(!getFd(vm, 0, FIELD_LOOP_EPFD, &epfd)) return false;
+
+    jsrPushNumber(vm, -1);
+    if(!jsrSetField(vm, 0, FIELD_LOOP_EPFD)) return false;
+    jsrPop(vm);
+
+    if(close(epfd) == -1 && errno != EINTR) JSR_RAISE(vm, "EventException", strerror(errno));
+    jsrPushNull(vm);
+    return true;
+}
+// end
+
+// Functions
+
+JSR_NATIVE(jsr_pipe) {
+    int fds[2];
+    if(pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1) JSR_RAISE(vm, "EventException", strerror(errno));
+
+    for(int i = 0; i < 2; i++) {
+        if(!jsrGetGlobal(vm, NULL, "Fd")) goto error;
+        jsrPushNumber(vm, fds[i]);
+        if(jsrCall(vm, 1) != JSR_EVAL_SUCCESS) goto error;
+    }
+
+    jsrPushTuple(vm, 2);
+    return true;
+
+error:
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+}
+
+JSR_NATIVE(jsr_socketpair) {
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == -1) {
+        JSR_RAISE(vm, "EventException", strerror(errno));
+    }
+
+    if(!pushSocket(vm, JSR_UNIX, fds[0])) {
+        close(fds[1]);
+        return false;
+    }
+
+    if(!pushSocket(vm, JSR_UNIX, fds[1])) return false;
+
+    jsrPushTuple(vm, 2);
+    return true;
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include "jstar.h"
+
+// class Fd {
+#define FIELD_FD_FD "_fd"
+
+JSR_NATIVE(jsr_Fd_new);
+JSR_NATIVE(jsr_Fd_fileno);
+JSR_NATIVE(jsr_Fd_read);
+JSR_NATIVE(jsr_Fd_write);
+JSR_NATIVE(jsr_Fd_close);
+// } class Fd
+
+// class Socket {
+#define FIELD_SOCKET_FAMILY "_family"
+
+JSR_NATIVE(jsr_Socket_new);
+JSR_NATIVE(jsr_Socket_bind);
+JSR_NATIVE(jsr_Socket_listen);
+JSR_NATIVE(jsr_Socket_accept);
+JSR_NATIVE(jsr_Socket_connect);
+JSR_NATIVE(jsr_Socket_error);
+JSR_NATIVE(jsr_Socket_address);
+JSR_NATIVE(jsr_Socket_shutdown);
+JSR_NATIVE(jsr_Socket_write);
+// } class Socket
+
+// class Timer {
+JSR_NATIVE(jsr_Timer_new);
+JSR_NATIVE(jsr_Timer_set);
+JSR_NATIVE(jsr_Timer_read);
+// } class Timer
+
+// class EventLoop {
+#define FIELD_LOOP_EPFD "_epfd"
+
+JSR_NATIVE(jsr_EventLoop_open);
+JSR_NATIVE(jsr_EventLoop_control);
+JSR_NATIVE(jsr_EventLoop_wait);
+JSR_NATIVE(jsr_EventLoop_close);
+// } class EventLoop
+
+// prototypes
+
+JSR_NATIVE(jsr_pipe);
+JSR_NATIVE(jsr_socketpair);
+
+#endif
@@ -0,0 +1,129 @@
+// WARNING: this is a file generated automatically by the build process. Do not modify.
+const char *event_jsr =
+"class EventException is Exception end\n"
+"// Readiness events\n"
+"var READ, WRITE, ERROR, HUP, EDGE = 1, 2, 4, 8, 16\n"
+"// Socket families\n"
+"var INET, INET6, UNIX = 0, 1, 2\n"
+"// Socket shutdown modes\n"
+"var SHUT_RD, SHUT_WR, SHUT_RDWR = 0, 1, 2\n"
+"// Event loops watching each file descriptor number. Closing a descriptor silently removes it from\n"
+"// the epoll sets, so Fd.close() unwatches it from its loops first\n"
+"var _watching = {}\n"
+"fun _addWatching(fd, loop)\n"
+"    var loops = _watching[fd]\n"
+"    if !loops then\n"
+"        loops = []\n"
+"        _watching[fd] = loops\n"
+"    end\n"
+"    loops.add(loop)\n"
+"end\n"
+"fun _removeWatching(fd, loop)\n"
+"    var loops = _watching[fd]\n"
+"    if loops and loops.remove(loop) and #loops == 0 then\n"
+"        _watching.delete(fd)\n"
+"    end\n"
+"end\n"
+"class Fd\n"
+"    native new(fd)\n"
+"    native fileno()\n"
+"    native read(bytes=4096)\n"
+"    native write(data)\n"
+"    native _close()\n"
+"    fun close()\n"
+"        var fd = this.fileno()\n"
+"        var loops = _watching[fd]\n"
+"        while loops and #loops > 0 do\n"
+"            loops[#loops - 1].unwatch(fd)\n"
+"        end\n"
+"        this._close()\n"
+"    end\n"
+"    fun isClosed()\n"
+"        return this._fd < 0\n"
+"    end\n"
+"    fun __string__()\n"
+"        return \"<\" + (\"closed \" if this.isClosed() else \"open \") + super() + \">\"\n"
+"    end\n"
+"end\n"
+"class Socket is Fd\n"
+"    native new(family=0, fd=null)\n"
+"    native bind(host, port=0)\n"
+"    native listen(backlog=128)\n"
+"    native accept()\n"
+"    native connect(host, port=0)\n"
+"    native error()\n"
+"    native address()\n"
+"    native shutdown(how=1)\n"
+"    native write(data)\n"
+"end\n"
+"class Timer is Fd\n"
+"    native new(timeout, interval=0)\n"
+"    native set(timeout, interval=0)\n"
+"    native read()\n"
+"end\n"
+"class EventLoop\n"
+"    fun new()\n"
+"        this._watchers = {}\n"
+"        this._running = false\n"
+"        this._open()\n"
+"    end\n"
+"    native _open()\n"
+"    native _control(fd, events, watched)\n"
+"    native _wait(timeout)\n"
+"    native _close()\n"
+"    fun watch(fd, events, callback)\n"
+"        if fd is Fd then fd = fd.fileno() end\n"
+"        var watched = this._watchers.contains(fd)\n"
+"        this._control(fd, events, watched)\n"
+"        this._watchers[fd] = callback\n"
+"        if !watched then _addWatching(fd, this) end\n"
+"    end\n"
+"    fun unwatch(fd)\n"
+"        if fd is Fd then fd = fd.fileno() end\n"
+"        if this._watchers.delete(fd) then\n"
+"            _removeWatching(fd, this)\n"
+"            this._control(fd, null, true)\n"
+"        end\n"
+"    end\n"
+"    fun timer(timeout, callback, interval=0)\n"
+"        var loop, timer = this, Timer(timeout, interval)\n"
+"        fun expired(_)\n"
+"            var expirations = timer.read()\n"
+"            if expirations == null then return end\n"
+"            if interval == 0 then\n"
+"                timer.close()\n"
+"            end\n"
+"            callback(expirations)\n"
+"        end\n"
+"        this.watch(timer, READ, expired)\n"
+"        return timer\n"
+"    end\n"
+"    fun poll(timeout=null)\n"
+"        var ready, watchers = this._wait(timeout), this._watchers\n"
+"        for var i = 0; i < #ready; i += 2 do\n"
+"            var callback = watchers[ready[i]]\n"
+"            if callback then callback(ready[i + 1]) end\n"
+"        end\n"
+"        return #ready / 2\n"
+"    end\n"
+"    fun run()\n"
+"        this._running = true\n"
+"        while this._running and #this._watchers > 0 do\n"
+"            this.poll()\n"
+"        end\n"
+"        this._running = false\n"
+"    end\n"
+"    fun stop()\n"
+"        this._running = false\n"
+"    end\n"
+"    fun close()\n"
+"        for var fd in this._watchers.keys() do\n"
+"            _removeWatching(fd, this)\n"
+"        end\n"
+"        this._watchers.clear()\n"
+"        this._close()\n"
+"    end\n"
+"end\n"
+"native pipe()\n"
+"native socketpair()\n"
+;
\ No newline at end of file
@@ -3,8 +3,8 @@
 #include <math.h>
 #include <stdbool.h>
 #include <stdlib.h>
-#include <time.h>
 
+#include "hash.h"
 #include "object.h"
 #include "value.h"
 #include "vm.h"
@@ -109,14 +109,21 @@ JSR_NATIVE(jsr_modf) {
     return true;
 }
 
+// SplitMix64 generator. Unlike rand(), its state lives in the VM, so it is safe to use from VMs
+// running concurrently and each VM can be seeded independently
+static uint64_t nextRandom(JStarVM* vm) {
+    return hash64(vm->randState += UINT64_C(0x9e3779b97f4a7c15));
+}
+
 JSR_NATIVE(jsr_random) {
-    jsrPushNumber(vm, (double)rand() / ((unsigned)RAND_MAX + 1));
+    // Use the top 53 bits, the precision of a double
+    jsrPushNumber(vm, (double)(nextRandom(vm) >> 11) * (1.0 / (UINT64_C(1) << 53)));
     return true;
 }
 
 JSR_NATIVE(jsr_seed) {
     JSR_CHECK(Int, 1, "s");
-    srand(jsrGetNumber(vm, 1));
+    vm->randState = (uint64_t)(int64_t)jsrGetNumber(vm, 1);
     jsrPushNull(vm);
     return true;
 }
@@ -132,7 +139,5 @@ JSR_NATIVE(jsr_math_init) {
     jsrPushNumber(vm, JSR_E);
     jsrSetGlobal(vm, NULL, "e");
     jsrPushNull(vm);
-    // Init rand seed
-    srand(time(NULL));
     return true;
 }
\ No newline at end of file
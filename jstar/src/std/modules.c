@@ -1,35 +1,104 @@
 #include "modules.h"
 
+// The bootstrap build, used to create the snapshot itself, compiles builtin modules from source
+#if defined(JSTAR_SNAPSHOT) && !defined(JSTAR_BOOTSTRAP)
+    #define USE_SNAPSHOT
+#endif
+
 #include "core.h"
-#include "core.jsr.h"
+#ifdef USE_SNAPSHOT
+    #include "core.jsc.h"
+#else
+    #include "core.jsr.h"
+#endif
 
 #ifdef JSTAR_SYS
     #include "sys.h"
-    #include "sys.jsr.h"
+    #ifdef USE_SNAPSHOT
+        #include "sys.jsc.h"
+    #else
+        #include "sys.jsr.h"
+    #endif
 #endif
 
 #ifdef JSTAR_IO
     #include "io.h"
-    #include "io.jsr.h"
+    #ifdef USE_SNAPSHOT
+        #include "io.jsc.h"
+    #else
+        #include "io.jsr.h"
+    #endif
 #endif
 
 #ifdef JSTAR_MATH
     #include "math.h"
-    #include "math.jsr.h"
+    #ifdef USE_SNAPSHOT
+        #include "math.jsc.h"
+    #else
+        #include "math.jsr.h"
+    #endif
+#endif
+
+#ifdef JSTAR_SCHED
+    #include "sched.h"
+    #ifdef USE_SNAPSHOT
+        #include "sched.jsc.h"
+    #else
+        #include "sched.jsr.h"
+    #endif
+#endif
+
+#ifdef JSTAR_EVENT
+    #include "event.h"
+    #ifdef USE_SNAPSHOT
+        #include "event.jsc.h"
+    #else
+        #include "event.jsr.h"
+    #endif
+#endif
+
+#ifdef JSTAR_THREAD
+    #include "thread.h"
+    #ifdef USE_SNAPSHOT
+        #include "thread.jsc.h"
+    #else
+        #include "thread.jsr.h"
+    #endif
+#endif
+
+#ifdef JSTAR_PARALLEL
+    #include "parallel.h"
+    #ifdef USE_SNAPSHOT
+        #include "parallel.jsc.h"
+    #else
+        #include "parallel.jsr.h"
+    #endif
 #endif
 
 #ifdef JSTAR_DEBUG
     #include "debug.h"
-    #include "debug.jsr.h"
+    #ifdef USE_SNAPSHOT
+        #include "debug.jsc.h"
+    #else
+        #include "debug.jsr.h"
+    #endif
 #endif
 
 #ifdef JSTAR_RE
     #include "re.h"
-    #include "re.jsr.h"
+    #ifdef USE_SNAPSHOT
+        #include "re.jsc.h"
+    #else
+        #include "re.jsr.h"
+    #endif
 #endif
 
+#include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "nativeindex.h"
+
 typedef enum { TYPE_FUNC, TYPE_CLASS } Type;
 
 typedef struct {
@@ -52,20 +121,28 @@ typedef struct {
 
 typedef struct {
     const char* name;
-    const char** src;
+    const char** src;           // Source of the module, NULL if using the snapshot
+    const unsigned char* code;  // Serialized bytecode of the module, NULL if using the source
+    const size_t* codeLen;
     ModuleElem elems[31];
 } Module;
 
 // clang-format off
 
+#ifdef USE_SNAPSHOT
+    #define MODULE_CODE(name) NULL, name##_jsc, &name##_jsc_len
+#else
+    #define MODULE_CODE(name) &name##_jsr, NULL, NULL
+#endif
+
 #define ELEMS_END        {TYPE_FUNC, .as = { .function = METHODS_END } },
-#define MODULES_END      {NULL, NULL, { ELEMS_END }}
+#define MODULES_END      {NULL, NULL, NULL, NULL, { ELEMS_END }}
 #define METHODS_END      {NULL, NULL}
 
-#define MODULE(name)     { #name, &name##_jsr, {
+#define MODULE(name)     { #name, MODULE_CODE(name), {
 #define ENDMODULE        ELEMS_END } },
 
-#define COREMODULE       {"__core__", &core_jsr, {
+#define COREMODULE       {"__core__", MODULE_CODE(core), {
 
 #define CLASS(name)      { TYPE_CLASS, .as = { .class = { #name, {
 #define METHOD(name, fn) { #name, fn },
@@ -83,6 +160,8 @@ Module builtInModules[] = {
         FUNCTION(type,           jsr_type)
         FUNCTION(garbageCollect, jsr_garbageCollect)
         FUNCTION(importPaths, jsr_importPaths)
+        FUNCTION(freeze,         jsr_freeze)
+        FUNCTION(isFrozen,       jsr_isFrozen)
         CLASS(Number)
             METHOD(new,        jsr_Number_new)
             METHOD(isInt,      jsr_Number_isInt)
@@ -152,6 +231,24 @@ Module builtInModules[] = {
             METHOD(__next__,   jsr_Table_next)
             METHOD(__string__, jsr_Table_string)
         ENDCLASS
+        CLASS(WeakTable)
+            METHOD(new, jsr_WeakTable_new)
+        ENDCLASS
+        CLASS(WeakRef)
+            METHOD(new, jsr_WeakRef_new)
+            METHOD(get, jsr_WeakRef_get)
+        ENDCLASS
+        CLASS(Generator)
+            METHOD(isDone,   jsr_Generator_isDone)
+            METHOD(__iter__, jsr_Generator_iter)
+            METHOD(__next__, jsr_Generator_next)
+        ENDCLASS
+        CLASS(Fiber)
+            METHOD(new,      jsr_Fiber_new)
+            METHOD(resume,   jsr_Fiber_resume)
+            METHOD(transfer, jsr_Fiber_transfer)
+            METHOD(isDone,   jsr_Fiber_isDone)
+        ENDCLASS
         CLASS(Enum)
             METHOD(new,   jsr_Enum_new)
             METHOD(value, jsr_Enum_value)
@@ -236,6 +333,71 @@ Module builtInModules[] = {
         FUNCTION(gsub,   jsr_re_gsub)
     ENDMODULE
 #endif
+#ifdef JSTAR_SCHED
+    MODULE(sched)
+        FUNCTION(current, jsr_sched_current)
+        FUNCTION(suspend, jsr_sched_suspend)
+    ENDMODULE
+#endif
+#ifdef JSTAR_EVENT
+    MODULE(event)
+        CLASS(Fd)
+            METHOD(new,    jsr_Fd_new)
+            METHOD(fileno, jsr_Fd_fileno)
+            METHOD(read,   jsr_Fd_read)
+            METHOD(write,  jsr_Fd_write)
+            METHOD(_close, jsr_Fd_close)
+        ENDCLASS
+        CLASS(Socket)
+            METHOD(new,      jsr_Socket_new)
+            METHOD(bind,     jsr_Socket_bind)
+            METHOD(listen,   jsr_Socket_listen)
+            METHOD(accept,   jsr_Socket_accept)
+            METHOD(connect,  jsr_Socket_connect)
+            METHOD(error,    jsr_Socket_error)
+            METHOD(address,  jsr_Socket_address)
+            METHOD(shutdown, jsr_Socket_shutdown)
+            METHOD(write,    jsr_Socket_write)
+        ENDCLASS
+        CLASS(Timer)
+            METHOD(new,  jsr_Timer_new)
+            METHOD(set,  jsr_Timer_set)
+            METHOD(read, jsr_Timer_read)
+        ENDCLASS
+        CLASS(EventLoop)
+            METHOD(_open,    jsr_EventLoop_open)
+            METHOD(_control, jsr_EventLoop_control)
+            METHOD(_wait,    jsr_EventLoop_wait)
+            METHOD(_close,   jsr_EventLoop_close)
+        ENDCLASS
+        FUNCTION(pipe,       jsr_pipe)
+        FUNCTION(socketpair, jsr_socketpair)
+    ENDMODULE
+#endif
+#ifdef JSTAR_THREAD
+    MODULE(thread)
+        CLASS(Channel)
+            METHOD(new,      jsr_Channel_new)
+            METHOD(send,     jsr_Channel_send)
+            METHOD(receive,  jsr_Channel_receive)
+            METHOD(close,    jsr_Channel_close)
+            METHOD(isClosed, jsr_Channel_isClosed)
+            METHOD(__iter__, jsr_Channel_iter)
+        ENDCLASS
+        CLASS(Thread)
+            METHOD(new,  jsr_Thread_new)
+            METHOD(join, jsr_Thread_join)
+        ENDCLASS
+        FUNCTION(cpus, jsr_cpus)
+    ENDMODULE
+#endif
+#ifdef JSTAR_PARALLEL
+    MODULE(parallel)
+        FUNCTION(map,       jsr_parallel_map)
+        FUNCTION(reduce,    jsr_parallel_reduce)
+        FUNCTION(_runChunk, jsr_parallel_runChunk)
+    ENDMODULE
+#endif
 #ifdef JSTAR_DEBUG
     MODULE(debug)
         FUNCTION(printStack,  jsr_printStack)
@@ -256,58 +418,81 @@ static Module* getModule(const char* name) {
     return NULL;
 }
 
-static Class* getClass(Module* module, const char* name) {
-    for(int i = 0;; i++) {
-        ModuleElem* e = &module->elems[i];
-        if(e->type == TYPE_FUNC && e->as.function.name == NULL) return NULL;
+static bool isElemsEnd(ModuleElem* e) {
+    return e->type == TYPE_FUNC && e->as.function.name == NULL;
+}
 
-        if(e->type == TYPE_CLASS) {
-            if(strcmp(module->elems[i].as.class.name, name) == 0) {
-                return &module->elems[i].as.class;
+// Visit all natives of the builtin modules, adding them to `idx` or counting them if NULL
+static size_t indexBuiltIns(NativeIndex* idx) {
+    size_t count = 0;
+    for(Module* m = builtInModules; m->name != NULL; m++) {
+        for(ModuleElem* e = m->elems; !isElemsEnd(e); e++) {
+            if(e->type == TYPE_FUNC) {
+                Func* fn = &e->as.function;
+                if(idx) nativeIndexAdd(idx, m->name, NULL, fn->name, fn->func);
+                count++;
+                continue;
             }
-        }
-    }
-}
 
-static JStarNative getNativeMethod(Class* cls, const char* name) {
-    for(int i = 0; cls->methods[i].name != NULL; i++) {
-        if(strcmp(cls->methods[i].name, name) == 0) {
-            return cls->methods[i].func;
+            Class* cls = &e->as.class;
+            for(Func* meth = cls->methods; meth->name != NULL; meth++) {
+                if(idx) nativeIndexAdd(idx, m->name, cls->name, meth->name, meth->func);
+                count++;
+            }
         }
     }
-    return NULL;
+    return count;
 }
 
-static JStarNative getNativeFunc(Module* module, const char* name) {
-    for(int i = 0;; i++) {
-        if(module->elems[i].type == TYPE_FUNC) {
-            if(module->elems[i].as.function.name == NULL) return NULL;
+// Index of all builtin natives. It's built on first use and then shared by all VMs, as its hashes
+// depend only on the per-process hash seed
+static NativeIndex* builtInIndex;
 
-            if(strcmp(module->elems[i].as.function.name, name) == 0) {
-                return module->elems[i].as.function.func;
-            }
-        }
-    }
-}
+static const NativeIndex* getBuiltInIndex(void) {
+#if defined(__GNUC__)
+    NativeIndex* idx = __atomic_load_n(&builtInIndex, __ATOMIC_ACQUIRE);
+#else
+    NativeIndex* idx = builtInIndex;
+#endif
+    if(idx != NULL) return idx;
 
-JStarNative resolveBuiltIn(const char* module, const char* cls, const char* name) {
-    Module* m = getModule(module);
-    if(m == NULL) return NULL;
+    idx = malloc(sizeof(*idx));
+    initNativeIndex(idx, indexBuiltIns(NULL));
+    indexBuiltIns(idx);
 
-    if(cls == NULL) {
-        return getNativeFunc(m, name);
+#if defined(__GNUC__)
+    NativeIndex* expected = NULL;
+    if(!__atomic_compare_exchange_n(&builtInIndex, &expected, idx, false, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE)) {
+        // Another thread won the race, use its index
+        freeNativeIndex(idx);
+        free(idx);
+        return expected;
     }
+#else
+    builtInIndex = idx;
+#endif
 
-    Class* c = getClass(m, cls);
-    if(c == NULL) return NULL;
+    return idx;
+}
 
-    return getNativeMethod(c, name);
+JStarNative resolveBuiltIn(const char* module, const char* cls, const char* name) {
+    return nativeIndexGet(getBuiltInIndex(), module, cls, name);
 }
 
 const char* readBuiltInModule(const char* name) {
     Module* m = getModule(name);
-    if(m != NULL) {
+    if(m != NULL && m->src != NULL) {
         return *m->src;
     }
     return NULL;
 }
+
+const char* readBuiltInModuleCode(const char* name, size_t* len) {
+    Module* m = getModule(name);
+    if(m != NULL && m->code != NULL) {
+        *len = *m->codeLen;
+        return (const char*)m->code;
+    }
+    return NULL;
+}
@@ -5,5 +5,8 @@
 
 JStarNative resolveBuiltIn(const char* module, const char* cls, const char* name);
 const char* readBuiltInModule(const char* name);
+// Returns the serialized bytecode of a builtin module, or NULL if it wasn't included in the
+// build-time snapshot. In that case the module should be compiled from `readBuiltInModule`
+const char* readBuiltInModuleCode(const char* name, size_t* len);
 
 #endif
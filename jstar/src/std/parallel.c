@@ -0,0 +1,908 @@
+#include "parallel.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "code.h"
+#include "common.h"
+#include "hashtable.h"
+#include "import.h"
+#include "object.h"
+#include "opcode.h"
+#include "serialize.h"
+#include "sync.h"
+#include "thread.h"
+#include "value.h"
+#include "vm.h"
+
+/**
+ * Data parallel map and reduce, running on a process wide pool of worker VMs.
+ * Functions can't be shared between VMs, so the function passed to map or reduce is turned into a
+ * Program: its serialized bytecode (that the workers load sharing the original code, see
+ * deserializeShared) along with a snapshot of what it uses of its environment:
+ *  - The values of its upvalues, that must be immutable and never assigned by the function.
+ *  - The globals it reads from its module. Functions of the same module are shipped along in the
+ *    same way, modules and the functions of other modules are imported by name by the workers,
+ *    and all other values must be immutable.
+ * The input is split in chunks, each sent to the pool as a job that runs the Program over it.
+ * A worker VM loads a Program once, and reuses it for all the chunks of the same call it runs.
+ * Reduce folds every chunk starting from `init`, then merges the partial results in order with
+ * `combine` (`fn` if not given), so `init` must be an identity for them and they must be
+ * associative for the result to match a sequential fold.
+ */
+
+// Chunks created for each worker of the pool when no chunk size is given, so that a worker that
+// finishes early can steal the work left to the others
+#define CHUNKS_PER_WORKER 4
+
+// Globals of the `parallel` module of the worker VMs caching the last loaded Program
+#define GLOBAL_PROGRAM    "_program"
+#define GLOBAL_PROGRAM_ID "_programId"
+
+typedef enum GlobalKind {
+    GLOBAL_VALUE,     // An immutable value, copied from the snapshot
+    GLOBAL_FUNCTION,  // A function of the Program
+    GLOBAL_IMPORT,    // A module, or a function of another module, imported by name
+} GlobalKind;
+
+typedef struct ProgramGlobal {
+    char* name;
+    GlobalKind kind;
+    size_t function;     // Index of the function, for GLOBAL_FUNCTION
+    char *module, *attr; // For GLOBAL_IMPORT. `attr` is NULL if the global is the module itself
+} ProgramGlobal;
+
+typedef struct ProgramFunction {
+    char* code;
+    size_t len;
+    Code* shared;
+    size_t sharedCount;
+    Message upvalues;  // Tuple of the values of the upvalues
+} ProgramFunction;
+
+typedef struct Program {
+    uint64_t id;
+    char* module;
+    ProgramFunction* functions;  // The first one is the function passed to map or reduce
+    size_t functionCount, functionCapacity;
+    ProgramGlobal* globals;
+    size_t globalCount, globalCapacity;
+    Message values;  // List of the values of the GLOBAL_VALUE globals, in order
+    char** importPaths;
+    size_t importPathCount;
+} Program;
+
+struct Batch;
+
+// A chunk of the input, processed by a job of the pool
+typedef struct Task {
+    struct Batch* batch;
+    size_t start, end;  // Range of the chunk in the input
+    bool sliced;        // Whether `input` holds just the chunk, or the whole (frozen) input
+    Message input, output;
+    char* error;  // Stacktrace of the exception raised by the job, NULL if successful
+} Task;
+
+// The tasks of a single call to map or reduce
+typedef struct Batch {
+    Program* program;
+    bool reduce;
+    Message init;  // The initial value of the fold of every chunk, for reduce
+    Mutex lock;
+    CondVar done;
+    size_t pending;
+} Batch;
+
+static uint64_t lastProgramId;
+static JStarVMPool* workerPool;
+
+static char* copyCString(const char* str) {
+    size_t len = strlen(str);
+    char* copy = malloc(len + 1);
+    memcpy(copy, str, len + 1);
+    return copy;
+}
+
+static uint16_t readShortAt(const uint8_t* code, size_t i) {
+    return ((uint16_t)code[i] << 8) | code[i + 1];
+}
+
+static const char* functionName(ObjFunction* fn) {
+    return fn->c.name ? fn->c.name->data : "<anonymous>";
+}
+
+static bool isImmutable(Value v) {
+    return IS_NULL(v) || IS_BOOL(v) || IS_NUM(v) || IS_STRING(v) ||
+           (IS_OBJ(v) && AS_OBJ(v)->frozen);
+}
+
+static size_t sequenceLength(Value seq) {
+    return IS_LIST(seq) ? AS_LIST(seq)->count : AS_TUPLE(seq)->size;
+}
+
+static Value sequenceItem(Value seq, size_t i) {
+    return IS_LIST(seq) ? AS_LIST(seq)->arr[i] : AS_TUPLE(seq)->arr[i];
+}
+
+// -----------------------------------------------------------------------------
+// PROGRAM BUILDING
+// -----------------------------------------------------------------------------
+
+typedef struct Builder {
+    JStarVM* vm;
+    Program* program;
+    ObjClosure* entry;
+    ObjModule* module;
+    ObjClosure** closures;  // The closures of the functions of the Program
+    ObjList* values;        // The values of the GLOBAL_VALUE globals
+} Builder;
+
+static void freeProgram(Program* p) {
+    for(size_t i = 0; i < p->functionCount; i++) {
+        ProgramFunction* f = &p->functions[i];
+        for(size_t j = 0; j < f->sharedCount; j++) {
+            freeCode(&f->shared[j]);
+        }
+        free(f->shared);
+        free(f->code);
+        freeMessage(&f->upvalues);
+    }
+    free(p->functions);
+
+    for(size_t i = 0; i < p->globalCount; i++) {
+        ProgramGlobal* g = &p->globals[i];
+        free(g->name);
+        free(g->module);
+        free(g->attr);
+    }
+    free(p->globals);
+
+    for(size_t i = 0; i < p->importPathCount; i++) {
+        free(p->importPaths[i]);
+    }
+    free(p->importPaths);
+
+    freeMessage(&p->values);
+    free(p->module);
+}
+
+static size_t addFunction(Builder* b, ObjClosure* closure) {
+    Program* p = b->program;
+    for(size_t i = 0; i < p->functionCount; i++) {
+        if(b->closures[i] == closure) return i;
+    }
+
+    if(p->functionCount == p->functionCapacity) {
+        p->functionCapacity = p->functionCapacity ? p->functionCapacity * 2 : 4;
+        p->functions = realloc(p->functions, sizeof(ProgramFunction) * p->functionCapacity);
+        b->closures = realloc(b->closures, sizeof(ObjClosure*) * p->functionCapacity);
+    }
+
+    p->functions[p->functionCount] = (ProgramFunction){0};
+    b->closures[p->functionCount] = closure;
+    return p->functionCount++;
+}
+
+static void addGlobal(Builder* b, const ProgramGlobal* g) {
+    Program* p = b->program;
+    if(p->globalCount == p->globalCapacity) {
+        p->globalCapacity = p->globalCapacity ? p->globalCapacity * 2 : 8;
+        p->globals = realloc(p->globals, sizeof(ProgramGlobal) * p->globalCapacity);
+    }
+    p->globals[p->globalCount++] = *g;
+}
+
+// Returns whether `fn`, or one of the functions nested in it, assigns the upvalue `idx` of `fn`
+static bool assignsUpvalue(ObjFunction* fn, int idx) {
+    Code* code = &fn->code;
+    for(size_t i = 0; i < code->count; i += opcodeArgsNumber(code->bytecode[i]) + 1) {
+        Opcode op = code->bytecode[i];
+        if(op == OP_SET_UPVALUE && code->bytecode[i + 1] == idx) return true;
+
+        if(op == OP_CLOSURE) {
+            ObjFunction* nested = AS_FUNC(code->consts.arr[readShortAt(code->bytecode, i + 1)]);
+            for(int j = 0; j < nested->upvalueCount; j++) {
+                bool isLocal = code->bytecode[i + 3 + j * 2];
+                int index = code->bytecode[i + 4 + j * 2];
+                if(!isLocal && index == idx && assignsUpvalue(nested, j)) return true;
+            }
+            i += nested->upvalueCount * 2;
+        }
+    }
+    return false;
+}
+
+// Raise an error for the value `v` of the global `name`, or of a captured variable if NULL
+static bool unshareableValue(Builder* b, const char* name, Value v) {
+    JStarVM* vm = b->vm;
+    const char* fnName = functionName(b->entry->fn);
+    const char* cls = getClass(vm, v)->name->data;
+
+    JStarBuffer what;
+    jsrBufferInit(vm, &what);
+    if(name != NULL) {
+        jsrBufferAppendf(&what, "global `%s`", name);
+    } else {
+        jsrBufferAppendstr(&what, "a captured variable");
+    }
+
+    if(IS_LIST(v) || IS_TUPLE(v) || IS_TABLE(v)) {
+        jsrRaise(vm, "TypeException",
+                 "Cannot run `%s` in a worker: %s is a mutable %s, freeze() it to share it.",
+                 fnName, what.data, cls);
+    } else if(IS_CLASS(v)) {
+        jsrRaise(vm, "TypeException",
+                 "Cannot run `%s` in a worker: %s is a Class, import it inside the function.",
+                 fnName, what.data);
+    } else {
+        jsrRaise(vm, "TypeException",
+                 "Cannot run `%s` in a worker: %s is a %s, that can't be shared between VMs.",
+                 fnName, what.data, cls);
+    }
+
+    jsrBufferFree(&what);
+    return false;
+}
+
+static bool addGlobalName(Builder* b, ObjString* name) {
+    JStarVM* vm = b->vm;
+    Program* p = b->program;
+
+    for(size_t i = 0; i < p->globalCount; i++) {
+        if(strcmp(p->globals[i].name, name->data) == 0) return true;
+    }
+
+    // Undefined globals raise a NameException in the worker, just as they would here
+    Value v;
+    if(!hashTableGet(&b->module->globals, name, &v)) return true;
+
+    // Names imported from core are already defined in the module of the Program
+    Value coreValue;
+    if(name->data[0] != '_' && hashTableGet(&vm->core->globals, name, &coreValue) &&
+       valueEquals(coreValue, v)) {
+        return true;
+    }
+
+    ProgramGlobal g = {0};
+
+    if(isImmutable(v)) {
+        g.kind = GLOBAL_VALUE;
+        listAppend(vm, b->values, v);
+    } else if(IS_CLOSURE(v) && AS_CLOSURE(v)->fn->c.module == b->module) {
+        g.kind = GLOBAL_FUNCTION;
+        g.function = addFunction(b, AS_CLOSURE(v));
+    } else if(IS_MODULE(v)) {
+        g.kind = GLOBAL_IMPORT;
+        g.module = copyCString(AS_MODULE(v)->name->data);
+    } else if(IS_CLOSURE(v) || IS_NATIVE(v)) {
+        FnCommon* c = IS_CLOSURE(v) ? &AS_CLOSURE(v)->fn->c : &AS_NATIVE(v)->c;
+
+        // The function must be importable by name from its module
+        Value exported;
+        if(c->name == NULL || strcmp(c->module->name->data, JSR_MAIN_MODULE) == 0 ||
+           !hashTableGet(&c->module->globals, c->name, &exported) || !valueEquals(exported, v)) {
+            JSR_RAISE(vm, "TypeException",
+                      "Cannot run `%s` in a worker: global `%s` is a function that can't be "
+                      "imported by name from its module.",
+                      functionName(b->entry->fn), name->data);
+        }
+
+        g.kind = GLOBAL_IMPORT;
+        g.module = copyCString(c->module->name->data);
+        g.attr = copyCString(c->name->data);
+    } else {
+        return unshareableValue(b, name->data, v);
+    }
+
+    g.name = copyCString(name->data);
+    addGlobal(b, &g);
+    return true;
+}
+
+// Add the globals read by `fn` and by the functions nested in it
+static bool addGlobalsOf(Builder* b, ObjFunction* fn) {
+    Code* code = &fn->code;
+    for(size_t i = 0; i < code->count; i += opcodeArgsNumber(code->bytecode[i]) + 1) {
+        Opcode op = code->bytecode[i];
+        if(op == OP_GET_GLOBAL || op == OP_SET_GLOBAL) {
+            ObjString* name = AS_STRING(code->consts.arr[readShortAt(code->bytecode, i + 1)]);
+            if(op == OP_SET_GLOBAL) {
+                JSR_RAISE(b->vm, "TypeException",
+                          "Cannot run `%s` in a worker: it assigns the global `%s`.",
+                          functionName(b->entry->fn), name->data);
+            }
+            if(!addGlobalName(b, name)) return false;
+        } else if(op == OP_CLOSURE) {
+            ObjFunction* nested = AS_FUNC(code->consts.arr[readShortAt(code->bytecode, i + 1)]);
+            i += nested->upvalueCount * 2;
+        }
+    }
+
+    for(int i = 0; i < code->consts.count; i++) {
+        Value c = code->consts.arr[i];
+        if(IS_FUNC(c) && !addGlobalsOf(b, AS_FUNC(c))) return false;
+    }
+
+    return true;
+}
+
+static bool buildFunction(Builder* b, size_t idx) {
+    JStarVM* vm = b->vm;
+    ObjClosure* closure = b->closures[idx];
+    ObjFunction* fn = closure->fn;
+    ProgramFunction* f = &b->program->functions[idx];
+
+    if(fn->upvalueCount > 0) {
+        ObjTuple* upvalues = newTuple(vm, fn->upvalueCount);
+        push(vm, OBJ_VAL(upvalues));
+
+        for(int i = 0; i < fn->upvalueCount; i++) {
+            Value v = *closure->upvalues[i]->addr;
+            if(!isImmutable(v)) {
+                return unshareableValue(b, NULL, v);
+            }
+            if(assignsUpvalue(fn, i)) {
+                JSR_RAISE(vm, "TypeException",
+                          "Cannot run `%s` in a worker: it assigns a captured variable.",
+                          functionName(b->entry->fn));
+            }
+            upvalues->arr[i] = v;
+        }
+
+        if(!encodeMessage(vm, &f->upvalues, OBJ_VAL(upvalues))) return false;
+        pop(vm);
+    }
+
+    JStarBuffer code = serialize(vm, fn);
+    f->code = malloc(code.len);
+    f->len = code.len;
+    memcpy(f->code, code.data, code.len);
+    jsrBufferFree(&code);
+
+    f->sharedCount = shareSerializedCode(fn, &f->shared);
+
+    return addGlobalsOf(b, fn);
+}
+
+// Build the Program of `closure`. Returns false, leaving an exception on top of the stack, if
+// the closure or one of the functions it uses can't be run by a worker
+static bool buildProgram(JStarVM* vm, ObjClosure* closure, Program* p) {
+    *p = (Program){0};
+
+#if defined(__GNUC__)
+    p->id = __atomic_add_fetch(&lastProgramId, 1, __ATOMIC_RELAXED);
+#else
+    p->id = ++lastProgramId;
+#endif
+
+    ObjModule* module = closure->fn->c.module;
+    p->module = copyCString(module->name->data);
+
+    ObjList* paths = vm->importpaths;
+    p->importPaths = malloc(sizeof(char*) * paths->count);
+    for(size_t i = 0; i < paths->count; i++) {
+        if(IS_STRING(paths->arr[i])) {
+            p->importPaths[p->importPathCount++] = copyCString(AS_STRING(paths->arr[i])->data);
+        }
+    }
+
+    Builder b = {vm, p, closure, module, NULL, newList(vm, 0)};
+    push(vm, OBJ_VAL(b.values));
+
+    // Functions added while building are built in turn
+    bool ok = true;
+    addFunction(&b, closure);
+    for(size_t i = 0; ok && i < p->functionCount; i++) {
+        ok = buildFunction(&b, i);
+    }
+
+    if(ok) {
+        ok = encodeMessage(vm, &p->values, OBJ_VAL(b.values));
+    }
+
+    free(b.closures);
+
+    if(!ok) {
+        freeProgram(p);
+        return false;
+    }
+
+    pop(vm);
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// PROGRAM LOADING
+// -----------------------------------------------------------------------------
+
+static void addImportPath(JStarVM* vm, const char* path) {
+    ObjList* paths = vm->importpaths;
+    for(size_t i = 0; i < paths->count; i++) {
+        if(IS_STRING(paths->arr[i]) && strcmp(AS_STRING(paths->arr[i])->data, path) == 0) return;
+    }
+    jsrAddImportPath(vm, path);
+}
+
+static bool loadFunction(JStarVM* vm, ObjModule* module, ProgramFunction* f) {
+    const char* error = NULL;
+    ObjFunction* fn = deserializeShared(vm, module, f->code, f->len, f->shared, f->sharedCount,
+                                        &error);
+    if(fn == NULL) {
+        JSR_RAISE(vm, "ParallelException", "Cannot load function: %s.", error);
+    }
+
+    push(vm, OBJ_VAL(fn));
+    ObjClosure* closure = newClosure(vm, fn);
+    vm->sp[-1] = OBJ_VAL(closure);
+
+    if(fn->upvalueCount > 0) {
+        if(!decodeSharedMessage(vm, &f->upvalues)) return false;
+        ObjTuple* values = AS_TUPLE(peek(vm));
+
+        // The upvalues are created already closed, as nothing else references the variables
+        for(int i = 0; i < fn->upvalueCount; i++) {
+            ObjUpvalue* upvalue = newUpvalue(vm, NULL);
+            upvalue->closed = values->arr[i];
+            upvalue->addr = &upvalue->closed;
+            closure->upvalues[i] = upvalue;
+        }
+
+        pop(vm);
+    }
+
+    return true;
+}
+
+// Push the value of an imported global, importing its module if needed
+static bool importGlobal(JStarVM* vm, ProgramGlobal* g) {
+    ObjString* name = copyString(vm, g->module, strlen(g->module));
+    ObjModule* module = getModule(vm, name);
+
+    if(module == NULL) {
+        push(vm, OBJ_VAL(name));
+        if(!importModule(vm, name)) {
+            JSR_RAISE(vm, "ImportException", "Cannot load module `%s`.", g->module);
+        }
+
+        // Run the module's main if it was freshly loaded
+        if(!IS_NULL(peek(vm))) {
+            vm->sp[-1] = OBJ_VAL(newClosure(vm, AS_FUNC(peek(vm))));
+            if(jsrCall(vm, 0) != JSR_EVAL_SUCCESS) return false;
+        }
+
+        module = getModule(vm, name);
+        vm->sp -= 2;
+    }
+
+    if(g->attr == NULL) {
+        push(vm, OBJ_VAL(module));
+        return true;
+    }
+
+    Value v;
+    if(!hashTableGet(&module->globals, copyString(vm, g->attr, strlen(g->attr)), &v)) {
+        JSR_RAISE(vm, "NameException", "Name `%s` is not defined in module `%s`.", g->attr,
+                  g->module);
+    }
+
+    push(vm, v);
+    return true;
+}
+
+// Recreate `p` in `vm`, leaving the closure of its main function on top of the stack
+static bool instantiateProgram(JStarVM* vm, Program* p) {
+    for(size_t i = 0; i < p->importPathCount; i++) {
+        addImportPath(vm, p->importPaths[i]);
+    }
+
+    ptrdiff_t base = vm->sp - vm->stack;
+    jsrEnsureStack(vm, 4);
+
+    // The module isn't registered in the VM, it just holds the globals of the Program
+    ObjString* name = copyString(vm, p->module, strlen(p->module));
+    push(vm, OBJ_VAL(name));
+    ObjModule* module = newModule(vm, name);
+    vm->sp[-1] = OBJ_VAL(module);
+    hashTableImportNames(&module->globals, &vm->core->globals);
+    hashTablePut(&module->globals, copyString(vm, "__name__", 8), OBJ_VAL(name));
+
+    ObjList* closures = newList(vm, p->functionCount);
+    push(vm, OBJ_VAL(closures));
+
+    for(size_t i = 0; i < p->functionCount; i++) {
+        if(!loadFunction(vm, module, &p->functions[i])) return false;
+        listAppend(vm, closures, peek(vm));
+        pop(vm);
+    }
+
+    if(!decodeSharedMessage(vm, &p->values)) return false;
+    ObjList* values = AS_LIST(peek(vm));
+    size_t nextValue = 0;
+
+    for(size_t i = 0; i < p->globalCount; i++) {
+        ProgramGlobal* g = &p->globals[i];
+        switch(g->kind) {
+        case GLOBAL_VALUE:
+            push(vm, values->arr[nextValue++]);
+            break;
+        case GLOBAL_FUNCTION:
+            push(vm, closures->arr[g->function]);
+            break;
+        case GLOBAL_IMPORT:
+            if(!importGlobal(vm, g)) return false;
+            break;
+        }
+
+        hashTablePut(&module->globals, copyString(vm, g->name, strlen(g->name)), peek(vm));
+        pop(vm);
+    }
+
+    Value main = closures->arr[0];
+    vm->sp = vm->stack + base;
+    push(vm, main);
+    return true;
+}
+
+// Push the closure of `p`, reusing the one created for the previous chunk if possible
+static bool loadProgram(JStarVM* vm, Program* p) {
+    ObjModule* parallel = vm->module;
+
+    Value id, cached;
+    if(hashTableGet(&parallel->globals,
+                    copyString(vm, GLOBAL_PROGRAM_ID, strlen(GLOBAL_PROGRAM_ID)), &id) &&
+       IS_NUM(id) && AS_NUM(id) == (double)p->id &&
+       hashTableGet(&parallel->globals, copyString(vm, GLOBAL_PROGRAM, strlen(GLOBAL_PROGRAM)),
+                    &cached)) {
+        push(vm, cached);
+        return true;
+    }
+
+    if(!instantiateProgram(vm, p)) return false;
+
+    hashTablePut(&parallel->globals, copyString(vm, GLOBAL_PROGRAM, strlen(GLOBAL_PROGRAM)),
+                 peek(vm));
+    hashTablePut(&parallel->globals,
+                 copyString(vm, GLOBAL_PROGRAM_ID, strlen(GLOBAL_PROGRAM_ID)),
+                 NUM_VAL((double)p->id));
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// WORKER POOL
+// -----------------------------------------------------------------------------
+
+static bool initWorkerVM(JStarVM* vm, void* userData) {
+    if(jsrEvaluate(vm, "<parallel>", "import parallel") != JSR_EVAL_SUCCESS) return false;
+    jsrPushBoolean(vm, true);
+    jsrSetGlobal(vm, "parallel", GLOBAL_WORKER);
+    jsrPop(vm);
+    return true;
+}
+
+// The pool is created on first use and lives as long as the process
+static JStarVMPool* getWorkerPool(void) {
+#if defined(__GNUC__)
+    JStarVMPool* pool = __atomic_load_n(&workerPool, __ATOMIC_ACQUIRE);
+#else
+    JStarVMPool* pool = workerPool;
+#endif
+    if(pool != NULL) return pool;
+
+    JStarPoolConf conf = jsrGetPoolConf();
+    conf.initVM = &initWorkerVM;
+    pool = jsrNewVMPool(&conf);
+    if(pool == NULL) return NULL;
+
+#if defined(__GNUC__)
+    JStarVMPool* expected = NULL;
+    if(!__atomic_compare_exchange_n(&workerPool, &expected, pool, false, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE)) {
+        // Another thread won the race, use its pool
+        jsrFreeVMPool(pool);
+        return expected;
+    }
+#else
+    workerPool = pool;
+#endif
+
+    return pool;
+}
+
+// Calls to map and reduce from a worker run sequentially, as waiting for other jobs of the pool
+// could deadlock it
+static bool isWorker(JStarVM* vm) {
+    Value worker;
+    return hashTableGet(&vm->module->globals, copyString(vm, GLOBAL_WORKER, strlen(GLOBAL_WORKER)),
+                        &worker) &&
+           IS_BOOL(worker) && AS_BOOL(worker);
+}
+
+static int pushTask(JStarVM* vm, void* data) {
+    Task** udata = jsrPushUserdata(vm, sizeof(Task*), NULL);
+    *udata = data;
+    return 1;
+}
+
+static void setTaskError(JStarVM* vm, Task* task) {
+    jsrEnsureStack(vm, 1);
+    push(vm, vm->sp[-1]);
+    if(jsrCallMethod(vm, "getStacktrace", 0) == JSR_EVAL_SUCCESS && IS_STRING(peek(vm))) {
+        task->error = copyCString(AS_STRING(peek(vm))->data);
+    } else {
+        task->error = copyCString("Unknown error.");
+    }
+}
+
+static void taskDone(JStarVM* vm, JStarResult res, void* data) {
+    Task* task = data;
+    if(res != JSR_EVAL_SUCCESS || !encodeMessage(vm, &task->output, vm->sp[-1])) {
+        setTaskError(vm, task);
+    }
+
+    Batch* batch = task->batch;
+    lockMutex(&batch->lock);
+    if(--batch->pending == 0) signalCondVar(&batch->done);
+    unlockMutex(&batch->lock);
+}
+
+// -----------------------------------------------------------------------------
+// MAP AND REDUCE
+// -----------------------------------------------------------------------------
+
+// Encode the input of `task`. Frozen inputs are shared by all tasks, others are copied chunk by
+// chunk
+static bool encodeInput(JStarVM* vm, Task* task, Value seq) {
+    if(AS_OBJ(seq)->frozen) {
+        task->sliced = false;
+        return encodeMessage(vm, &task->input, seq);
+    }
+
+    ObjTuple* slice = newTuple(vm, task->end - task->start);
+    for(size_t i = task->start; i < task->end; i++) {
+        slice->arr[i - task->start] = sequenceItem(seq, i);
+    }
+
+    jsrEnsureStack(vm, 1);
+    push(vm, OBJ_VAL(slice));
+    task->sliced = true;
+    if(!encodeMessage(vm, &task->input, OBJ_VAL(slice))) return false;
+    pop(vm);
+    return true;
+}
+
+static bool collectResults(JStarVM* vm, Task* tasks, size_t taskCount, bool reduce) {
+    for(size_t i = 0; i < taskCount; i++) {
+        if(tasks[i].error != NULL) {
+            JSR_RAISE(vm, "ParallelException", "Failed to process items %lu to %lu:\n%s",
+                      (unsigned long)tasks[i].start, (unsigned long)tasks[i].end - 1,
+                      tasks[i].error);
+        }
+    }
+
+    jsrEnsureStack(vm, 3);
+
+    if(reduce) {
+        // Merge the partial results in order, starting from `init`
+        Value combine = IS_NULL(vm->apiStack[5]) ? vm->apiStack[1] : vm->apiStack[5];
+        push(vm, vm->apiStack[3]);
+        for(size_t i = 0; i < taskCount; i++) {
+            Value acc = pop(vm);
+            push(vm, combine);
+            push(vm, acc);
+            if(!decodeMessage(vm, &tasks[i].output)) return false;
+            if(jsrCall(vm, 2) != JSR_EVAL_SUCCESS) return false;
+        }
+        return true;
+    }
+
+    ObjList* results = newList(vm, tasks[taskCount - 1].end);
+    push(vm, OBJ_VAL(results));
+    for(size_t i = 0; i < taskCount; i++) {
+        if(!decodeMessage(vm, &tasks[i].output)) return false;
+        ObjList* part = AS_LIST(peek(vm));
+        for(size_t j = 0; j < part->count; j++) {
+            listAppend(vm, results, part->arr[j]);
+        }
+        pop(vm);
+    }
+    return true;
+}
+
+static bool runTasks(JStarVM* vm, JStarVMPool* pool, Program* program, bool reduce,
+                     size_t chunk) {
+    Value seq = vm->apiStack[2];
+    size_t count = sequenceLength(seq);
+    if(chunk == 0) {
+        size_t chunks = (size_t)processorCount() * CHUNKS_PER_WORKER;
+        chunk = (count + chunks - 1) / chunks;
+    }
+
+    size_t taskCount = (count + chunk - 1) / chunk;
+    Task* tasks = calloc(taskCount, sizeof(Task));
+
+    Batch batch = {0};
+    batch.program = program;
+    batch.reduce = reduce;
+    initMutex(&batch.lock);
+    initCondVar(&batch.done);
+
+    // Tasks are submitted as soon as they are encoded, so that workers can start early
+    bool ok = !reduce || encodeMessage(vm, &batch.init, vm->apiStack[3]);
+    for(size_t i = 0; ok && i < taskCount; i++) {
+        Task* task = &tasks[i];
+        task->batch = &batch;
+        task->start = i * chunk;
+        task->end = task->start + chunk < count ? task->start + chunk : count;
+
+        if(!encodeInput(vm, task, seq)) {
+            ok = false;
+            break;
+        }
+
+        lockMutex(&batch.lock);
+        batch.pending++;
+        unlockMutex(&batch.lock);
+
+        JStarJob job = {"parallel", "_runChunk", &pushTask, &taskDone, task};
+        jsrPoolSubmit(pool, &job);
+    }
+
+    lockMutex(&batch.lock);
+    while(batch.pending > 0) {
+        waitCondVar(&batch.done, &batch.lock);
+    }
+    unlockMutex(&batch.lock);
+
+    if(ok) {
+        ok = collectResults(vm, tasks, taskCount, reduce);
+    }
+
+    for(size_t i = 0; i < taskCount; i++) {
+        freeMessage(&tasks[i].input);
+        freeMessage(&tasks[i].output);
+        free(tasks[i].error);
+    }
+    free(tasks);
+    freeMessage(&batch.init);
+    freeCondVar(&batch.done);
+    freeMutex(&batch.lock);
+    return ok;
+}
+
+// Run the call in the current VM, as if by a single worker
+static bool runSequential(JStarVM* vm, bool reduce) {
+    jsrEnsureStack(vm, 3);
+
+    if(reduce) {
+        push(vm, vm->apiStack[3]);
+        for(size_t i = 0; i < sequenceLength(vm->apiStack[2]); i++) {
+            Value acc = pop(vm);
+            push(vm, vm->apiStack[1]);
+            push(vm, acc);
+            push(vm, sequenceItem(vm->apiStack[2], i));
+            if(jsrCall(vm, 2) != JSR_EVAL_SUCCESS) return false;
+        }
+        return true;
+    }
+
+    ObjList* results = newList(vm, sequenceLength(vm->apiStack[2]));
+    push(vm, OBJ_VAL(results));
+    for(size_t i = 0; i < sequenceLength(vm->apiStack[2]); i++) {
+        push(vm, vm->apiStack[1]);
+        push(vm, sequenceItem(vm->apiStack[2], i));
+        if(jsrCall(vm, 1) != JSR_EVAL_SUCCESS) return false;
+        listAppend(vm, results, peek(vm));
+        pop(vm);
+    }
+    return true;
+}
+
+// Without `combine` the partial results are merged with `fn`, which is only correct if it folds
+// items into an accumulator of their same type. Reject the folds that change it, such as the
+// summing of the lengths of Strings
+static bool checkFoldTypes(JStarVM* vm) {
+    Value init = vm->apiStack[3], seq = vm->apiStack[2];
+    ObjClass* initCls = getClass(vm, init);
+    for(size_t i = 0; i < sequenceLength(seq); i++) {
+        ObjClass* cls = getClass(vm, sequenceItem(seq, i));
+        if(cls != initCls) {
+            JSR_RAISE(vm, "TypeException",
+                      "Cannot fold %s items into a %s init without a combine function.",
+                      cls->name->data, initCls->name->data);
+        }
+    }
+    return true;
+}
+
+static bool runParallel(JStarVM* vm, bool reduce) {
+    Value fn = vm->apiStack[1], seq = vm->apiStack[2];
+    if(IS_NATIVE(fn) || IS_BOUND_METHOD(fn)) {
+        JSR_RAISE(vm, "TypeException", "fn must be a Function defined in J*, not a %s.",
+                  IS_NATIVE(fn) ? "native" : "bound method");
+    }
+    if(!IS_CLOSURE(fn)) {
+        JSR_RAISE(vm, "TypeException", "fn must be a Function, got %s.",
+                  getClass(vm, fn)->name->data);
+    }
+    if(!IS_LIST(seq) && !IS_TUPLE(seq)) {
+        JSR_RAISE(vm, "TypeException", "list must be a List or a Tuple, got %s.",
+                  getClass(vm, seq)->name->data);
+    }
+
+    if(reduce && !IS_NULL(vm->apiStack[5])) {
+        JSR_CHECK(Function, 5, "combine");
+    } else if(reduce && !checkFoldTypes(vm)) {
+        return false;
+    }
+
+    int chunkSlot = reduce ? 4 : 3;
+    size_t chunk = 0;
+    if(!jsrIsNull(vm, chunkSlot)) {
+        JSR_CHECK(Int, chunkSlot, "chunk");
+        double size = jsrGetNumber(vm, chunkSlot);
+        if(size < 1) JSR_RAISE(vm, "InvalidArgException", "chunk must be >= 1");
+        chunk = (size_t)size;
+    }
+
+    // Always build the Program, so that functions that can't run in a worker are reported even
+    // when the call ends up running sequentially
+    Program program;
+    if(!buildProgram(vm, AS_CLOSURE(fn), &program)) return false;
+
+    JStarVMPool* pool = NULL;
+    if(sequenceLength(seq) > 0 && !isWorker(vm)) {
+        pool = getWorkerPool();
+    }
+
+    bool ok = pool ? runTasks(vm, pool, &program, reduce, chunk) : runSequential(vm, reduce);
+    freeProgram(&program);
+    return ok;
+}
+
+JSR_NATIVE(jsr_parallel_map) {
+    return runParallel(vm, false);
+}
+
+JSR_NATIVE(jsr_parallel_reduce) {
+    return runParallel(vm, true);
+}
+
+JSR_NATIVE(jsr_parallel_runChunk) {
+    JSR_CHECK(Userdata, 1, "task");
+    Task* task = *(Task**)jsrGetUserdata(vm, 1);
+
+    // Slot 2: the function, slot 3: the input
+    if(!loadProgram(vm, task->batch->program)) return false;
+    if(!decodeMessage(vm, &task->input)) return false;
+
+    size_t first = task->sliced ? 0 : task->start;
+    size_t last = first + (task->end - task->start);
+
+    jsrEnsureStack(vm, 3);
+
+    if(task->batch->reduce) {
+        if(!decodeSharedMessage(vm, &task->batch->init)) return false;
+        for(size_t i = first; i < last; i++) {
+            Value acc = pop(vm);
+            push(vm, vm->apiStack[2]);
+            push(vm, acc);
+            push(vm, sequenceItem(vm->apiStack[3], i));
+            if(jsrCall(vm, 2) != JSR_EVAL_SUCCESS) return false;
+        }
+        return true;
+    }
+
+    ObjList* results = newList(vm, last - first);
+    push(vm, OBJ_VAL(results));
+    for(size_t i = first; i < last; i++) {
+        push(vm, vm->apiStack[2]);
+        push(vm, sequenceItem(vm->apiStack[3], i));
+        if(jsrCall(vm, 1) != JSR_EVAL_SUCCESS) return false;
+        listAppend(vm, results, peek(vm));
+        pop(vm);
+    }
+    return true;
+}
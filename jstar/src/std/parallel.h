@@ -0,0 +1,13 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "jstar.h"
+
+// Global of the `parallel` module set to true in the VMs of the worker pool
+#define GLOBAL_WORKER "_worker"
+
+JSR_NATIVE(jsr_parallel_map);
+JSR_NATIVE(jsr_parallel_reduce);
+JSR_NATIVE(jsr_parallel_runChunk);
+
+#endif
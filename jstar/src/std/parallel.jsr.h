@@ -0,0 +1,12 @@
+// WARNING: this is a file generated automatically by the build process. Do not modify.
+const char *parallel_jsr =
+"class ParallelException is Exception end\n"
+"var _worker = false\n"
+"native map(fn, list, chunk=null)\n"
+"// Folds every chunk with `fn` starting from `init`, then merges the partial results in order with\n"
+"// `combine` (`fn` by default). For the result to match a sequential fold `fn` and `combine` must\n"
+"// be associative, and `init` an identity for them (e.g. 0 for a sum, 1 for a product). A `fn` that\n"
+"// folds items into an accumulator of a different type needs a `combine` function\n"
+"native reduce(fn, list, init, chunk=null, combine=null)\n"
+"native _runChunk(task)\n"
+;
\ No newline at end of file
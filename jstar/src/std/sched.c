@@ -0,0 +1,18 @@
+#include "sched.h"
+
+#include <stdbool.h>
+
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+JSR_NATIVE(jsr_sched_current) {
+    push(vm, OBJ_VAL(vm->fiber));
+    return true;
+}
+
+JSR_NATIVE(jsr_sched_suspend) {
+    if(!yieldFiber(vm)) return false;
+    push(vm, vm->apiStack[1]);
+    return true;
+}
@@ -0,0 +1,9 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "jstar.h"
+
+JSR_NATIVE(jsr_sched_current);
+JSR_NATIVE(jsr_sched_suspend);
+
+#endif
@@ -0,0 +1,26 @@
+// WARNING: this is a file generated automatically by the build process. Do not modify.
+const char *sched_jsr =
+"native current()\n"
+"native suspend(value=null)\n"
+"var _ready = []\n"
+"fun spawn(fn)\n"
+"    var fiber = Fiber(fn)\n"
+"    _ready.add(fiber)\n"
+"    return fiber\n"
+"end\n"
+"fun pass()\n"
+"    _ready.add(current())\n"
+"    suspend()\n"
+"end\n"
+"fun run()\n"
+"    while #_ready > 0 do\n"
+"        var ready = _ready\n"
+"        _ready = []\n"
+"        for var fiber in ready do\n"
+"            if !fiber.isDone() then\n"
+"                fiber.resume()\n"
+"            end\n"
+"        end\n"
+"    end\n"
+"end\n"
+;
\ No newline at end of file
@@ -0,0 +1,734 @@
+#include "thread.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "frozen.h"
+#include "hashtable.h"
+#include "import.h"
+#include "object.h"
+#include "sync.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+
+// Maximum nesting of a value sent to another VM. Also stops the encoding of cyclic values
+#define MAX_MESSAGE_DEPTH 256
+
+typedef enum MessageTag {
+    MSG_NULL,
+    MSG_TRUE,
+    MSG_FALSE,
+    MSG_NUM,
+    MSG_STRING,
+    MSG_LIST,
+    MSG_TUPLE,
+    MSG_TABLE,
+    MSG_CHANNEL,
+    MSG_FROZEN,
+} MessageTag;
+
+// A bounded FIFO queue of messages, shared by all the VMs holding a reference to it
+typedef struct Channel {
+    Mutex lock;
+    CondVar notEmpty, notFull;
+    int refs;
+    bool closed;
+    size_t capacity, head, count;
+    Message* queue;
+} Channel;
+
+// State of a worker VM, shared between the Thread object that started it and its OS thread
+typedef struct Worker {
+    Mutex lock;
+    int refs;
+    Thread thread;
+    bool joined;
+    JStarConf conf;
+    char *module, *function;
+    char** importPaths;
+    size_t importPathCount;
+    Message arg, result;
+    char* error;  // Error message if the worker failed, NULL otherwise
+} Worker;
+
+static void releaseChannel(Channel* ch);
+
+// -----------------------------------------------------------------------------
+// MESSAGE ENCODING
+// -----------------------------------------------------------------------------
+
+void freeMessage(Message* msg) {
+    for(size_t i = 0; i < msg->channelCount; i++) {
+        if(msg->channels[i] != NULL) releaseChannel(msg->channels[i]);
+    }
+    free(msg->channels);
+    for(size_t i = 0; i < msg->regionCount; i++) {
+        releaseRegion(msg->regions[i]);
+    }
+    free(msg->regions);
+    free(msg->data);
+    *msg = (Message){0};
+}
+
+static void writeBytes(Message* msg, const void* bytes, size_t len) {
+    if(msg->len + len > msg->capacity) {
+        msg->capacity = msg->capacity ? msg->capacity : 64;
+        while(msg->len + len > msg->capacity) msg->capacity *= 2;
+        msg->data = realloc(msg->data, msg->capacity);
+    }
+    memcpy(msg->data + msg->len, bytes, len);
+    msg->len += len;
+}
+
+static void writeTag(Message* msg, MessageTag tag) {
+    uint8_t b = tag;
+    writeBytes(msg, &b, 1);
+}
+
+static void writeSize(Message* msg, size_t size) {
+    uint64_t n = size;
+    writeBytes(msg, &n, sizeof(n));
+}
+
+static void writeChannel(Message* msg, Channel* ch) {
+    if(msg->channelCount + 1 > msg->channelCapacity) {
+        msg->channelCapacity = msg->channelCapacity ? msg->channelCapacity * 2 : 4;
+        msg->channels = realloc(msg->channels, sizeof(Channel*) * msg->channelCapacity);
+    }
+
+    lockMutex(&ch->lock);
+    ch->refs++;
+    unlockMutex(&ch->lock);
+
+    writeTag(msg, MSG_CHANNEL);
+    writeSize(msg, msg->channelCount);
+    msg->channels[msg->channelCount++] = ch;
+}
+
+static void writeFrozen(Message* msg, Obj* o) {
+    FrozenRegion* region = frozenRegion(o);
+
+    bool found = false;
+    for(size_t i = 0; i < msg->regionCount && !found; i++) {
+        found = msg->regions[i] == region;
+    }
+
+    if(!found) {
+        if(msg->regionCount + 1 > msg->regionCapacity) {
+            msg->regionCapacity = msg->regionCapacity ? msg->regionCapacity * 2 : 4;
+            msg->regions = realloc(msg->regions, sizeof(FrozenRegion*) * msg->regionCapacity);
+        }
+        retainRegion(region);
+        msg->regions[msg->regionCount++] = region;
+    }
+
+    writeTag(msg, MSG_FROZEN);
+    writeBytes(msg, &o, sizeof(o));
+}
+
+static void finalizeChannel(void* data) {
+    releaseChannel(*(Channel**)data);
+}
+
+// Returns the Channel wrapped by `v` if it is a Channel instance, NULL otherwise
+static Channel* asChannel(Value v, ObjString* field) {
+    if(!IS_INSTANCE(v)) return NULL;
+    Value udata;
+    if(!hashTableGet(&AS_INSTANCE(v)->fields, field, &udata) || !IS_USERDATA(udata)) return NULL;
+    if(AS_USERDATA(udata)->finalize != &finalizeChannel) return NULL;
+    return *(Channel**)AS_USERDATA(udata)->data;
+}
+
+static bool encodeValue(JStarVM* vm, Message* msg, Value v, ObjString* chanField, int depth) {
+    if(depth > MAX_MESSAGE_DEPTH) {
+        jsrRaise(vm, "TypeException", "Value is too deeply nested (or cyclic) to be sent.");
+        return false;
+    }
+
+    if(IS_NULL(v)) {
+        writeTag(msg, MSG_NULL);
+        return true;
+    }
+
+    if(IS_BOOL(v)) {
+        writeTag(msg, AS_BOOL(v) ? MSG_TRUE : MSG_FALSE);
+        return true;
+    }
+
+    if(IS_NUM(v)) {
+        double num = AS_NUM(v);
+        writeTag(msg, MSG_NUM);
+        writeBytes(msg, &num, sizeof(num));
+        return true;
+    }
+
+    // Frozen values are shared between VMs, and are sent by reference
+    if(IS_OBJ(v) && AS_OBJ(v)->frozen) {
+        writeFrozen(msg, AS_OBJ(v));
+        return true;
+    }
+
+    if(IS_STRING(v)) {
+        writeTag(msg, MSG_STRING);
+        writeSize(msg, AS_STRING(v)->length);
+        writeBytes(msg, AS_STRING(v)->data, AS_STRING(v)->length);
+        return true;
+    }
+
+    if(IS_LIST(v) || IS_TUPLE(v)) {
+        bool isList = IS_LIST(v);
+        size_t size = isList ? AS_LIST(v)->count : AS_TUPLE(v)->size;
+        Value* arr = isList ? AS_LIST(v)->arr : AS_TUPLE(v)->arr;
+
+        writeTag(msg, isList ? MSG_LIST : MSG_TUPLE);
+        writeSize(msg, size);
+        for(size_t i = 0; i < size; i++) {
+            if(!encodeValue(vm, msg, arr[i], chanField, depth + 1)) return false;
+        }
+        return true;
+    }
+
+    if(IS_TABLE(v) && !AS_TABLE(v)->weak) {
+        ObjTable* t = AS_TABLE(v);
+        writeTag(msg, MSG_TABLE);
+        writeSize(msg, t->count);
+        for(size_t i = 0; i < t->numEntries; i++) {
+            TableEntry* e = &t->entries[i];
+            if(IS_NULL(e->key)) continue;
+            if(!encodeValue(vm, msg, e->key, chanField, depth + 1)) return false;
+            if(!encodeValue(vm, msg, e->val, chanField, depth + 1)) return false;
+        }
+        return true;
+    }
+
+    Channel* ch = asChannel(v, chanField);
+    if(ch != NULL) {
+        writeChannel(msg, ch);
+        return true;
+    }
+
+    ObjClass* cls = getClass(vm, v);
+    jsrRaise(vm, "TypeException", "Cannot send a value of type %s to another thread.",
+             cls->name->data);
+    return false;
+}
+
+bool encodeMessage(JStarVM* vm, Message* msg, Value v) {
+    *msg = (Message){0};
+
+    ObjString* chanField = copyString(vm, FIELD_CHANNEL_CHAN, strlen(FIELD_CHANNEL_CHAN));
+    push(vm, OBJ_VAL(chanField));
+
+    if(!encodeValue(vm, msg, v, chanField, 0)) {
+        Value exc = pop(vm);
+        pop(vm);
+        push(vm, exc);
+        freeMessage(msg);
+        return false;
+    }
+
+    pop(vm);
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// MESSAGE DECODING
+// -----------------------------------------------------------------------------
+
+typedef struct Reader {
+    Message* msg;
+    size_t pos;
+    ObjClass* channelCls;
+    bool shared;  // Whether the message is left untouched, to be decoded again
+} Reader;
+
+static uint8_t readTag(Reader* r) {
+    return r->msg->data[r->pos++];
+}
+
+static size_t readSize(Reader* r) {
+    uint64_t n;
+    memcpy(&n, r->msg->data + r->pos, sizeof(n));
+    r->pos += sizeof(n);
+    return (size_t)n;
+}
+
+// Wrap `ch` in a new Channel instance, taking ownership of the reference held by the message
+// unless the message is shared, in which case a new reference is acquired
+static void pushChannel(JStarVM* vm, Reader* r, size_t idx) {
+    push(vm, OBJ_VAL(newInstance(vm, r->channelCls)));
+    Channel** udata = jsrPushUserdata(vm, sizeof(Channel*), &finalizeChannel);
+    Channel* ch = r->msg->channels[idx];
+    if(r->shared) {
+        lockMutex(&ch->lock);
+        ch->refs++;
+        unlockMutex(&ch->lock);
+    } else {
+        r->msg->channels[idx] = NULL;
+    }
+    *udata = ch;
+    jsrSetField(vm, -2, FIELD_CHANNEL_CHAN);
+    pop(vm);
+}
+
+// Recreate the encoded value in `vm`, leaving it on top of the stack
+static bool decodeValue(JStarVM* vm, Reader* r) {
+    jsrEnsureStack(vm, 3);
+
+    switch((MessageTag)readTag(r)) {
+    case MSG_NULL:
+        push(vm, NULL_VAL);
+        return true;
+    case MSG_TRUE:
+        push(vm, TRUE_VAL);
+        return true;
+    case MSG_FALSE:
+        push(vm, FALSE_VAL);
+        return true;
+    case MSG_NUM: {
+        double num;
+        memcpy(&num, r->msg->data + r->pos, sizeof(num));
+        r->pos += sizeof(num);
+        push(vm, NUM_VAL(num));
+        return true;
+    }
+    case MSG_STRING: {
+        size_t len = readSize(r);
+        push(vm, OBJ_VAL(copyString(vm, (const char*)r->msg->data + r->pos, len)));
+        r->pos += len;
+        return true;
+    }
+    case MSG_LIST: {
+        size_t size = readSize(r);
+        ObjList* lst = newList(vm, size);
+        push(vm, OBJ_VAL(lst));
+        for(size_t i = 0; i < size; i++) {
+            if(!decodeValue(vm, r)) return false;
+            listAppend(vm, lst, pop(vm));
+        }
+        return true;
+    }
+    case MSG_TUPLE: {
+        size_t size = readSize(r);
+        ObjTuple* tup = newTuple(vm, size);
+        push(vm, OBJ_VAL(tup));
+        for(size_t i = 0; i < size; i++) {
+            if(!decodeValue(vm, r)) return false;
+            tup->arr[i] = pop(vm);
+        }
+        return true;
+    }
+    case MSG_TABLE: {
+        size_t count = readSize(r);
+        ObjTable* t = newTable(vm);
+        push(vm, OBJ_VAL(t));
+        for(size_t i = 0; i < count; i++) {
+            if(!decodeValue(vm, r) || !decodeValue(vm, r)) return false;
+            bool isNew;
+            if(!tablePut(vm, t, vm->sp[-2], vm->sp[-1], &isNew)) return false;
+            vm->sp -= 2;
+        }
+        return true;
+    }
+    case MSG_CHANNEL:
+        pushChannel(vm, r, readSize(r));
+        return true;
+    case MSG_FROZEN: {
+        Obj* o;
+        memcpy(&o, r->msg->data + r->pos, sizeof(o));
+        r->pos += sizeof(o);
+        frozenSetAdd(&vm->frozen, frozenRegion(o));
+        push(vm, OBJ_VAL(o));
+        return true;
+    }
+    }
+
+    UNREACHABLE();
+    return false;
+}
+
+static bool readMessage(JStarVM* vm, Message* msg, bool shared) {
+    Reader r = {msg, 0, NULL, shared};
+
+    if(msg->channelCount > 0) {
+        ObjModule* thread = getModule(vm, copyString(vm, "thread", 6));
+        Value cls;
+        if(thread == NULL || !hashTableGet(&thread->globals, copyString(vm, "Channel", 7), &cls) ||
+           !IS_CLASS(cls)) {
+            jsrRaise(vm, "ImportException",
+                     "Module `thread` must be imported to receive Channels.");
+            return false;
+        }
+        r.channelCls = AS_CLASS(cls);
+    }
+
+    // The stack may be reallocated while decoding, so save an offset
+    ptrdiff_t top = vm->sp - vm->stack;
+    bool ok = decodeValue(vm, &r);
+    if(!ok) {
+        Value exc = pop(vm);
+        vm->sp = vm->stack + top;
+        push(vm, exc);
+    }
+
+    return ok;
+}
+
+bool decodeMessage(JStarVM* vm, Message* msg) {
+    bool ok = readMessage(vm, msg, false);
+    freeMessage(msg);
+    return ok;
+}
+
+bool decodeSharedMessage(JStarVM* vm, Message* msg) {
+    return readMessage(vm, msg, true);
+}
+
+// -----------------------------------------------------------------------------
+// CHANNEL
+// -----------------------------------------------------------------------------
+
+static Channel* newChannel(size_t capacity) {
+    Channel* ch = malloc(sizeof(*ch));
+    initMutex(&ch->lock);
+    initCondVar(&ch->notEmpty);
+    initCondVar(&ch->notFull);
+    ch->refs = 1;
+    ch->closed = false;
+    ch->capacity = capacity;
+    ch->head = ch->count = 0;
+    ch->queue = malloc(sizeof(Message) * capacity);
+    return ch;
+}
+
+static void releaseChannel(Channel* ch) {
+    lockMutex(&ch->lock);
+    bool dead = --ch->refs == 0;
+    unlockMutex(&ch->lock);
+
+    if(!dead) return;
+
+    // Undelivered messages may reference other channels, so release them outside the lock
+    for(size_t i = 0; i < ch->count; i++) {
+        freeMessage(&ch->queue[(ch->head + i) % ch->capacity]);
+    }
+
+    free(ch->queue);
+    freeCondVar(&ch->notEmpty);
+    freeCondVar(&ch->notFull);
+    freeMutex(&ch->lock);
+    free(ch);
+}
+
+static bool getChannel(JStarVM* vm, Channel** ch) {
+    if(!jsrGetField(vm, 0, FIELD_CHANNEL_CHAN)) return false;
+    JSR_CHECK(Userdata, -1, FIELD_CHANNEL_CHAN);
+    *ch = *(Channel**)jsrGetUserdata(vm, -1);
+    jsrPop(vm);
+    return true;
+}
+
+// Blocks until a message is available. Returns false if the channel is closed and empty
+static bool receiveMessage(Channel* ch, Message* msg) {
+    lockMutex(&ch->lock);
+    while(ch->count == 0 && !ch->closed) {
+        waitCondVar(&ch->notEmpty, &ch->lock);
+    }
+
+    if(ch->count == 0) {
+        unlockMutex(&ch->lock);
+        return false;
+    }
+
+    *msg = ch->queue[ch->head];
+    ch->head = (ch->head + 1) % ch->capacity;
+    ch->count--;
+    signalCondVar(&ch->notFull);
+    unlockMutex(&ch->lock);
+    return true;
+}
+
+JSR_NATIVE(jsr_Channel_new) {
+    JSR_CHECK(Int, 1, "capacity");
+    double capacity = jsrGetNumber(vm, 1);
+    if(capacity < 1) JSR_RAISE(vm, "InvalidArgException", "capacity must be >= 1");
+
+    Channel** udata = jsrPushUserdata(vm, sizeof(Channel*), &finalizeChannel);
+    *udata = newChannel((size_t)capacity);
+    jsrSetField(vm, 0, FIELD_CHANNEL_CHAN);
+
+    jsrPushValue(vm, 0);
+    return true;
+}
+
+JSR_NATIVE(jsr_Channel_send) {
+    Channel* ch;
+    if(!getChannel(vm, &ch)) return false;
+
+    // Encode before locking, so that a copy in progress never blocks the other end
+    Message msg;
+    if(!encodeMessage(vm, &msg, vm->apiStack[1])) return false;
+
+    lockMutex(&ch->lock);
+    while(ch->count == ch->capacity && !ch->closed) {
+        waitCondVar(&ch->notFull, &ch->lock);
+    }
+
+    if(ch->closed) {
+        unlockMutex(&ch->lock);
+        freeMessage(&msg);
+        JSR_RAISE(vm, "ChannelException", "Cannot send on a closed Channel.");
+    }
+
+    ch->queue[(ch->head + ch->count) % ch->capacity] = msg;
+    ch->count++;
+    signalCondVar(&ch->notEmpty);
+    unlockMutex(&ch->lock);
+
+    jsrPushNull(vm);
+    return true;
+}
+
+JSR_NATIVE(jsr_Channel_receive) {
+    Channel* ch;
+    if(!getChannel(vm, &ch)) return false;
+
+    Message msg;
+    if(!receiveMessage(ch, &msg)) {
+        JSR_RAISE(vm, "ChannelException", "Channel is closed.");
+    }
+
+    return decodeMessage(vm, &msg);
+}
+
+JSR_NATIVE(jsr_Channel_close) {
+    Channel* ch;
+    if(!getChannel(vm, &ch)) return false;
+
+    lockMutex(&ch->lock);
+    ch->closed = true;
+    broadcastCondVar(&ch->notEmpty);
+    broadcastCondVar(&ch->notFull);
+    unlockMutex(&ch->lock);
+
+    jsrPushNull(vm);
+    return true;
+}
+
+JSR_NATIVE(jsr_Channel_isClosed) {
+    Channel* ch;
+    if(!getChannel(vm, &ch)) return false;
+
+    lockMutex(&ch->lock);
+    bool closed = ch->closed;
+    unlockMutex(&ch->lock);
+
+    jsrPushBoolean(vm, closed);
+    return true;
+}
+
+// Iterating a Channel receives messages until it is closed. Messages are wrapped in a 1-tuple,
+// so that falsy ones don't end the iteration
+JSR_NATIVE(jsr_Channel_iter) {
+    Channel* ch;
+    if(!getChannel(vm, &ch)) return false;
+
+    Message msg;
+    if(!receiveMessage(ch, &msg)) {
+        jsrPushBoolean(vm, false);
+        return true;
+    }
+
+    if(!decodeMessage(vm, &msg)) return false;
+    jsrPushTuple(vm, 1);
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// THREAD
+// -----------------------------------------------------------------------------
+
+static void releaseWorker(Worker* w) {
+    lockMutex(&w->lock);
+    bool dead = --w->refs == 0;
+    unlockMutex(&w->lock);
+
+    if(!dead) return;
+
+    for(size_t i = 0; i < w->importPathCount; i++) {
+        free(w->importPaths[i]);
+    }
+    free(w->importPaths);
+    free(w->module);
+    free(w->function);
+    free(w->error);
+    freeMessage(&w->arg);
+    freeMessage(&w->result);
+    freeMutex(&w->lock);
+    free(w);
+}
+
+static void finalizeWorker(void* data) {
+    Worker* w = *(Worker**)data;
+    if(!w->joined) detachThread(w->thread);
+    releaseWorker(w);
+}
+
+static char* copyCString(const char* str) {
+    size_t len = strlen(str);
+    char* copy = malloc(len + 1);
+    memcpy(copy, str, len + 1);
+    return copy;
+}
+
+// Record the exception on top of the stack as the error of the worker
+static void setWorkerError(JStarVM* vm, Worker* w) {
+    Value exc = vm->sp[-1];
+
+    JStarBuffer error;
+    jsrBufferInit(vm, &error);
+    jsrBufferAppendstr(&error, getClass(vm, exc)->name->data);
+
+    Value err;
+    if(IS_INSTANCE(exc) && hashTableGet(&AS_INSTANCE(exc)->fields, vm->excError, &err) &&
+       IS_STRING(err) && AS_STRING(err)->length > 0) {
+        jsrBufferAppendf(&error, ": %s", AS_STRING(err)->data);
+    }
+
+    w->error = copyCString(error.data);
+    jsrBufferFree(&error);
+}
+
+static void runWorker(JStarVM* vm, Worker* w) {
+    for(size_t i = 0; i < w->importPathCount; i++) {
+        jsrAddImportPath(vm, w->importPaths[i]);
+    }
+
+    // The thread module is always imported, so that the worker can receive Channels
+    JStarBuffer src;
+    jsrBufferInit(vm, &src);
+    jsrBufferAppendf(&src, "import thread\nimport %s", w->module);
+    JStarResult res = jsrEvaluate(vm, "<thread>", src.data);
+    jsrBufferFree(&src);
+
+    if(res != JSR_EVAL_SUCCESS) {
+        JStarBuffer error;
+        jsrBufferInit(vm, &error);
+        jsrBufferAppendf(&error, "Cannot load module `%s`", w->module);
+        w->error = copyCString(error.data);
+        jsrBufferFree(&error);
+        return;
+    }
+
+    if(!jsrGetGlobal(vm, w->module, w->function) || !decodeMessage(vm, &w->arg)) {
+        setWorkerError(vm, w);
+        return;
+    }
+
+    if(jsrCall(vm, 1) != JSR_EVAL_SUCCESS) {
+        jsrPrintStacktrace(vm, -1);
+        setWorkerError(vm, w);
+        return;
+    }
+
+    if(!encodeMessage(vm, &w->result, vm->sp[-1])) {
+        setWorkerError(vm, w);
+    }
+}
+
+static void workerMain(void* arg) {
+    Worker* w = arg;
+    JStarVM* vm = jsrNewVM(&w->conf);
+    runWorker(vm, w);
+    jsrFreeVM(vm);
+    releaseWorker(w);
+}
+
+// Module names are passed to an import statement, so make sure they are just dotted names
+static bool isModuleName(const char* name) {
+    bool start = true;
+    for(const char* c = name; *c; c++) {
+        bool alpha = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || *c == '_';
+        bool digit = *c >= '0' && *c <= '9';
+        if(*c == '.' && !start) {
+            start = true;
+        } else if(alpha || (digit && !start)) {
+            start = false;
+        } else {
+            return false;
+        }
+    }
+    return !start;
+}
+
+JSR_NATIVE(jsr_Thread_new) {
+    JSR_CHECK(String, 1, "module");
+    JSR_CHECK(String, 2, "function");
+
+    const char* module = jsrGetString(vm, 1);
+    if(!isModuleName(module)) {
+        JSR_RAISE(vm, "InvalidArgException", "Invalid module name `%s`", module);
+    }
+
+    Worker* w = calloc(1, sizeof(*w));
+    if(!encodeMessage(vm, &w->arg, vm->apiStack[3])) {
+        free(w);
+        return false;
+    }
+
+    initMutex(&w->lock);
+    w->refs = 2;
+    w->module = copyCString(module);
+    w->function = copyCString(jsrGetString(vm, 2));
+
+    w->conf = jsrGetConf();
+    w->conf.errorCallback = vm->errorCallback;
+    w->conf.heapGrowRate = vm->heapGrowRate;
+    w->conf.moduleCache = vm->moduleCache;
+    w->conf.shareCode = vm->shareCode;
+
+    ObjList* paths = vm->importpaths;
+    w->importPaths = malloc(sizeof(char*) * paths->count);
+    for(size_t i = 0; i < paths->count; i++) {
+        if(IS_STRING(paths->arr[i])) {
+            w->importPaths[w->importPathCount++] = copyCString(AS_STRING(paths->arr[i])->data);
+        }
+    }
+
+    Worker** udata = jsrPushUserdata(vm, sizeof(Worker*), &finalizeWorker);
+    *udata = w;
+    w->joined = true;  // Nothing to detach until the thread is started
+    jsrSetField(vm, 0, FIELD_THREAD_WORKER);
+
+    if(!startThread(&w->thread, &workerMain, w)) {
+        w->refs--;
+        JSR_RAISE(vm, "ThreadException", "Cannot start thread.");
+    }
+    w->joined = false;
+
+    jsrPushValue(vm, 0);
+    return true;
+}
+
+JSR_NATIVE(jsr_Thread_join) {
+    if(!jsrGetField(vm, 0, FIELD_THREAD_WORKER)) return false;
+    JSR_CHECK(Userdata, -1, FIELD_THREAD_WORKER);
+    Worker* w = *(Worker**)jsrGetUserdata(vm, -1);
+
+    if(w->joined) JSR_RAISE(vm, "ThreadException", "Thread has already been joined.");
+    joinThread(w->thread);
+    w->joined = true;
+
+    if(w->error != NULL) JSR_RAISE(vm, "ThreadException", "%s", w->error);
+    return decodeMessage(vm, &w->result);
+}
+
+JSR_NATIVE(jsr_cpus) {
+    jsrPushNumber(vm, processorCount());
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frozen.h"
+#include "jstar.h"
+#include "value.h"
+
+struct Channel;
+
+// A value serialized in a VM independent format, so that it can be recreated in another VM.
+// Channels and frozen values are not copied: the message holds a reference to each Channel and
+// to each region of frozen objects it contains
+typedef struct Message {
+    uint8_t* data;
+    size_t len, capacity;
+    struct Channel** channels;
+    size_t channelCount, channelCapacity;
+    FrozenRegion** regions;
+    size_t regionCount, regionCapacity;
+} Message;
+
+// Encode `v` in `msg`, leaving an exception on top of the stack on failure
+bool encodeMessage(JStarVM* vm, Message* msg, Value v);
+// Recreate the value encoded in `msg` in `vm`, leaving it on top of the stack.
+// Consumes the message, which is freed even on failure
+bool decodeMessage(JStarVM* vm, Message* msg);
+// Same as `decodeMessage`, but leaves the message untouched so that it can be decoded again, even
+// by multiple VMs at the same time
+bool decodeSharedMessage(JStarVM* vm, Message* msg);
+void freeMessage(Message* msg);
+
+// class Channel {
+#define FIELD_CHANNEL_CHAN "_chan"
+
+JSR_NATIVE(jsr_Channel_new);
+JSR_NATIVE(jsr_Channel_send);
+JSR_NATIVE(jsr_Channel_receive);
+JSR_NATIVE(jsr_Channel_close);
+JSR_NATIVE(jsr_Channel_isClosed);
+JSR_NATIVE(jsr_Channel_iter);
+// } class Channel
+
+// class Thread {
+#define FIELD_THREAD_WORKER "_worker"
+
+JSR_NATIVE(jsr_Thread_new);
+JSR_NATIVE(jsr_Thread_join);
+// } class Thread
+
+// prototypes
+
+JSR_NATIVE(jsr_cpus);
+
+#endif
@@ -0,0 +1,21 @@
+// WARNING: this is a file generated automatically by the build process. Do not modify.
+const char *thread_jsr =
+"class ThreadException is Exception end\n"
+"class ChannelException is Exception end\n"
+"class Channel\n"
+"    native new(capacity=16)\n"
+"    native send(value)\n"
+"    native receive()\n"
+"    native close()\n"
+"    native isClosed()\n"
+"    native __iter__(_)\n"
+"    fun __next__(message)\n"
+"        return message[0]\n"
+"    end\n"
+"end\n"
+"class Thread\n"
+"    native new(module, function, arg=null)\n"
+"    native join()\n"
+"end\n"
+"native cpus()\n"
+;
\ No newline at end of file
@@ -0,0 +1,178 @@
+#include "sync.h"
+
+#include <stdlib.h>
+
+#if defined(JSTAR_POSIX)
+    #include <unistd.h>
+#endif
+
+typedef struct ThreadStart {
+    ThreadFn fn;
+    void* arg;
+} ThreadStart;
+
+#if defined(JSTAR_POSIX)
+
+static void* threadMain(void* arg) {
+    ThreadStart start = *(ThreadStart*)arg;
+    free(arg);
+    start.fn(start.arg);
+    return NULL;
+}
+
+bool startThread(Thread* t, ThreadFn fn, void* arg) {
+    ThreadStart* start = malloc(sizeof(*start));
+    start->fn = fn;
+    start->arg = arg;
+    if(pthread_create(t, NULL, &threadMain, start) != 0) {
+        free(start);
+        return false;
+    }
+    return true;
+}
+
+void joinThread(Thread t) {
+    pthread_join(t, NULL);
+}
+
+void detachThread(Thread t) {
+    pthread_detach(t);
+}
+
+void initMutex(Mutex* m) {
+    pthread_mutex_init(m, NULL);
+}
+
+void freeMutex(Mutex* m) {
+    pthread_mutex_destroy(m);
+}
+
+void lockMutex(Mutex* m) {
+    pthread_mutex_lock(m);
+}
+
+void unlockMutex(Mutex* m) {
+    pthread_mutex_unlock(m);
+}
+
+void initCondVar(CondVar* c) {
+    pthread_cond_init(c, NULL);
+}
+
+void freeCondVar(CondVar* c) {
+    pthread_cond_destroy(c);
+}
+
+void waitCondVar(CondVar* c, Mutex* m) {
+    pthread_cond_wait(c, m);
+}
+
+void signalCondVar(CondVar* c) {
+    pthread_cond_signal(c);
+}
+
+void broadcastCondVar(CondVar* c) {
+    pthread_cond_broadcast(c);
+}
+
+int processorCount(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+#elif defined(JSTAR_WINDOWS)
+
+static DWORD WINAPI threadMain(LPVOID arg) {
+    ThreadStart start = *(ThreadStart*)arg;
+    free(arg);
+    start.fn(start.arg);
+    return 0;
+}
+
+bool startThread(Thread* t, ThreadFn fn, void* arg) {
+    ThreadStart* start = malloc(sizeof(*start));
+    start->fn = fn;
+    start->arg = arg;
+    *t = CreateThread(NULL, 0, &threadMain, start, 0, NULL);
+    if(*t == NULL) {
+        free(start);
+        return false;
+    }
+    return true;
+}
+
+void joinThread(Thread t) {
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+
+void detachThread(Thread t) {
+    CloseHandle(t);
+}
+
+void initMutex(Mutex* m) {
+    InitializeSRWLock(m);
+}
+
+void freeMutex(Mutex* m) {
+    // SRW locks don't need to be destroyed
+}
+
+void lockMutex(Mutex* m) {
+    AcquireSRWLockExclusive(m);
+}
+
+void unlockMutex(Mutex* m) {
+    ReleaseSRWLockExclusive(m);
+}
+
+void initCondVar(CondVar* c) {
+    InitializeConditionVariable(c);
+}
+
+void freeCondVar(CondVar* c) {
+    // Condition variables don't need to be destroyed
+}
+
+void waitCondVar(CondVar* c, Mutex* m) {
+    SleepConditionVariableSRW(c, m, INFINITE, 0);
+}
+
+void signalCondVar(CondVar* c) {
+    WakeConditionVariable(c);
+}
+
+void broadcastCondVar(CondVar* c) {
+    WakeAllConditionVariable(c);
+}
+
+int processorCount(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+#else
+
+bool startThread(Thread* t, ThreadFn fn, void* arg) {
+    // Threads not supported
+    return false;
+}
+
+void joinThread(Thread t) {}
+void detachThread(Thread t) {}
+void initMutex(Mutex* m) {}
+void freeMutex(Mutex* m) {}
+void lockMutex(Mutex* m) {}
+void unlockMutex(Mutex* m) {}
+void initCondVar(CondVar* c) {}
+void freeCondVar(CondVar* c) {}
+void waitCondVar(CondVar* c, Mutex* m) {}
+void signalCondVar(CondVar* c) {}
+void broadcastCondVar(CondVar* c) {}
+
+int processorCount(void) {
+    return 1;
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stdbool.h>
+
+#include "jstarconf.h"
+
+// Portable threads, mutexes and condition variables.
+// On platforms without threading support JSTAR_THREADS is not defined, `startThread` always fails
+// and all other operations are no-ops, so callers should be prepared to do the work inline.
+
+#if defined(JSTAR_POSIX)
+    #define JSTAR_THREADS
+    #include <pthread.h>
+
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t CondVar;
+
+#elif defined(JSTAR_WINDOWS)
+    #define JSTAR_THREADS
+    #include <Windows.h>
+
+typedef HANDLE Thread;
+typedef SRWLOCK Mutex;
+typedef CONDITION_VARIABLE CondVar;
+
+#else
+
+typedef int Thread;
+typedef int Mutex;
+typedef int CondVar;
+
+#endif
+
+typedef void (*ThreadFn)(void* arg);
+
+// Start a thread running `fn(arg)`. Returns false if the thread couldn't be created
+bool startThread(Thread* t, ThreadFn fn, void* arg);
+void joinThread(Thread t);
+// Let the thread release its resources on termination, without anyone joining it
+void detachThread(Thread t);
+
+void initMutex(Mutex* m);
+void freeMutex(Mutex* m);
+void lockMutex(Mutex* m);
+void unlockMutex(Mutex* m);
+
+void initCondVar(CondVar* c);
+void freeCondVar(CondVar* c);
+void waitCondVar(CondVar* c, Mutex* m);
+void signalCondVar(CondVar* c);
+void broadcastCondVar(CondVar* c);
+
+// Number of processors available to the process, at least 1
+int processorCount(void);
+
+#endif
@@ -0,0 +1,381 @@
+#include "table.h"
+
+#include <string.h>
+
+#include "frozen.h"
+#include "gc.h"
+#include "hash.h"
+#include "vm.h"
+
+#define INITIAL_CAPACITY 8
+#define GROW_FACTOR      2
+#define INDEX_EMPTY      (-1)
+
+// Max number of entries for an index of size `n`, i.e. a 2/3 max load factor
+#define USABLE_SIZE(n) (((n) << 1) / 3)
+
+// -----------------------------------------------------------------------------
+// KEY HASHING AND EQUALITY
+// -----------------------------------------------------------------------------
+
+static bool callKeyMethod(JStarVM* vm, Overload method, uint8_t argc) {
+    return callMethodByName(vm, vm->overloads[method], argc) == JSR_EVAL_SUCCESS;
+}
+
+// Tuples are hashed natively by combining the hashes of their elements. The hash is memoized in
+// the tuple only if all the elements are immutable, as their hash will never change
+static bool hashTuple(JStarVM* vm, ObjTuple* tup, uint32_t* hash) {
+    if(tup->hash != 0) {
+        *hash = tup->hash;
+        return true;
+    }
+
+    uint32_t h = 1;
+    bool memoize = true;
+
+    for(size_t i = 0; i < tup->size; i++) {
+        Value e = tup->arr[i];
+
+        uint32_t elemHash;
+        if(!tableKeyHash(vm, e, &elemHash)) return false;
+
+        memoize = memoize && (IS_STRING(e) || IS_NUM(e) || IS_BOOL(e) ||
+                              (IS_TUPLE(e) && AS_TUPLE(e)->hash != 0));
+        h = 31 * h + elemHash;
+    }
+
+    if(memoize) tup->hash = h;
+    *hash = h;
+    return true;
+}
+
+bool tableKeyHash(JStarVM* vm, Value key, uint32_t* hash) {
+    if(IS_STRING(key)) {
+        *hash = STRING_GET_HASH(AS_STRING(key));
+        return true;
+    }
+    if(IS_NUM(key)) {
+        *hash = hashNumber(AS_NUM(key));
+        return true;
+    }
+    if(IS_BOOL(key)) {
+        *hash = AS_BOOL(key);
+        return true;
+    }
+    if(IS_TUPLE(key)) {
+        return hashTuple(vm, AS_TUPLE(key), hash);
+    }
+
+    jsrEnsureStack(vm, 1);
+    push(vm, key);
+    if(!callKeyMethod(vm, HASH_OVERLOAD, 0)) return false;
+    JSR_CHECK(Number, -1, "__hash__() return value");
+    *hash = (uint32_t)AS_NUM(pop(vm));
+    return true;
+}
+
+static bool tupleEquals(JStarVM* vm, ObjTuple* t1, ObjTuple* t2, bool* eq) {
+    if(t1->size != t2->size) {
+        *eq = false;
+        return true;
+    }
+
+    for(size_t i = 0; i < t1->size; i++) {
+        if(!tableKeyEquals(vm, t1->arr[i], t2->arr[i], eq)) return false;
+        if(!*eq) return true;
+    }
+
+    *eq = true;
+    return true;
+}
+
+bool tableKeyEquals(JStarVM* vm, Value k1, Value k2, bool* eq) {
+    if(IS_STRING(k1)) {
+        // Strings resulting from operations (concatenations, ...) are not interned
+        *eq = IS_STRING(k2) && STRING_EQUALS(AS_STRING(k1), AS_STRING(k2));
+        return true;
+    }
+    if(IS_NUM(k1) || IS_BOOL(k1)) {
+        *eq = valueEquals(k1, k2);
+        return true;
+    }
+    if(IS_TUPLE(k1)) {
+        if(!IS_TUPLE(k2)) {
+            *eq = false;
+            return true;
+        }
+        return tupleEquals(vm, AS_TUPLE(k1), AS_TUPLE(k2), eq);
+    }
+
+    jsrEnsureStack(vm, 2);
+    push(vm, k1);
+    push(vm, k2);
+    if(!callKeyMethod(vm, EQ_OVERLOAD, 1)) return false;
+    *eq = isValTrue(pop(vm));
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// INDEX AND ENTRIES
+// -----------------------------------------------------------------------------
+
+static int64_t getIndex(ObjTable* t, size_t i) {
+    switch(tableIndexWidth(t->sizeMask + 1)) {
+    case sizeof(int8_t):
+        return ((int8_t*)t->index)[i];
+    case sizeof(int16_t):
+        return ((int16_t*)t->index)[i];
+    case sizeof(int32_t):
+        return ((int32_t*)t->index)[i];
+    default:
+        return ((int64_t*)t->index)[i];
+    }
+}
+
+static void setIndex(ObjTable* t, size_t i, int64_t idx) {
+    switch(tableIndexWidth(t->sizeMask + 1)) {
+    case sizeof(int8_t):
+        ((int8_t*)t->index)[i] = (int8_t)idx;
+        break;
+    case sizeof(int16_t):
+        ((int16_t*)t->index)[i] = (int16_t)idx;
+        break;
+    case sizeof(int32_t):
+        ((int32_t*)t->index)[i] = (int32_t)idx;
+        break;
+    default:
+        ((int64_t*)t->index)[i] = idx;
+        break;
+    }
+}
+
+static size_t findEmptySlot(ObjTable* t, uint32_t hash) {
+    size_t slot = hash & t->sizeMask;
+    while(getIndex(t, slot) != INDEX_EMPTY) {
+        slot = (slot + 1) & t->sizeMask;
+    }
+    return slot;
+}
+
+// Find the entry of `key` in the Table. `out` is set to the entry, or to NULL if the key is not
+// present. `slot` is set to the index slot of the entry, or to the one where it should be inserted.
+// Index slots pointing to deleted entries are treated as tombstones, and are reused on insertion
+static bool findEntry(JStarVM* vm, ObjTable* t, Value key, uint32_t hash, TableEntry** out,
+                      size_t* slot) {
+    // String keys are compared inline, without going through `tableKeyEquals`
+    ObjString* str = IS_STRING(key) ? AS_STRING(key) : NULL;
+
+restart:;
+    TableEntry* entries = t->entries;
+    size_t numEntries = t->numEntries;
+    size_t tomb = SIZE_MAX;
+    size_t i = hash & t->sizeMask;
+
+    for(;;) {
+        int64_t idx = getIndex(t, i);
+        if(idx == INDEX_EMPTY) {
+            *out = NULL;
+            *slot = tomb != SIZE_MAX ? tomb : i;
+            return true;
+        }
+
+        TableEntry* e = &entries[idx];
+        if(IS_NULL(e->key)) {
+            if(tomb == SIZE_MAX) tomb = i;
+        } else if(e->hash == hash) {
+            bool eq;
+            if(str != NULL) {
+                eq = IS_STRING(e->key) && (AS_STRING(e->key) == str ||
+                                           (AS_STRING(e->key)->length == str->length &&
+                                            memcmp(AS_STRING(e->key)->data, str->data,
+                                                   str->length) == 0));
+            } else {
+                if(!tableKeyEquals(vm, key, e->key, &eq)) return false;
+                // A user defined `__eq__` modified the table, start over
+                if(t->entries != entries || t->numEntries != numEntries) goto restart;
+            }
+
+            if(eq) {
+                *out = e;
+                *slot = i;
+                return true;
+            }
+        }
+
+        i = (i + 1) & t->sizeMask;
+    }
+}
+
+// Rebuild the Table in a new block, compacting the entries and leaving
+// room for at least as many new entries as the current ones
+static void resizeTable(JStarVM* vm, ObjTable* t) {
+    size_t indexSize = INITIAL_CAPACITY;
+    while(USABLE_SIZE(indexSize) < t->count * GROW_FACTOR + 1) {
+        indexSize *= GROW_FACTOR;
+    }
+
+    size_t capacity = USABLE_SIZE(indexSize);
+    void* block = GC_ALLOC(vm, tableBlockSize(indexSize, capacity));
+    size_t indexBytes = indexSize * tableIndexWidth(indexSize);
+
+    void* oldBlock = t->index;
+    size_t oldSize = tableBlockSize(t->sizeMask + 1, t->capacity);
+    TableEntry* oldEntries = t->entries;
+    size_t oldNumEntries = t->numEntries;
+
+    t->index = block;
+    t->entries = (TableEntry*)((char*)block + indexBytes);
+    t->sizeMask = indexSize - 1;
+    t->capacity = capacity;
+    t->numEntries = 0;
+    t->count = 0;
+
+    // All bits set is INDEX_EMPTY for any index width
+    memset(t->index, 0xff, indexBytes);
+
+    for(size_t i = 0; i < oldNumEntries; i++) {
+        TableEntry* e = &oldEntries[i];
+        if(IS_NULL(e->key)) continue;
+        setIndex(t, findEmptySlot(t, e->hash), t->numEntries);
+        t->entries[t->numEntries++] = *e;
+        t->count++;
+    }
+
+    if(oldBlock != NULL) {
+        GC_FREE_ARRAY(vm, uint8_t, oldBlock, oldSize);
+    }
+}
+
+static bool checkKey(JStarVM* vm, Value key) {
+    if(IS_NULL(key)) JSR_RAISE(vm, "TypeException", "Key of Table cannot be null.");
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// API
+// -----------------------------------------------------------------------------
+
+bool tableGet(JStarVM* vm, ObjTable* t, Value key, Value* res) {
+    if(!checkKey(vm, key)) return false;
+
+    *res = NULL_VAL;
+    if(t->count == 0) return true;
+
+    uint32_t hash;
+    if(!tableKeyHash(vm, key, &hash)) return false;
+
+    TableEntry* e;
+    size_t slot;
+    if(!findEntry(vm, t, key, hash, &e, &slot)) return false;
+
+    if(e != NULL) *res = e->val;
+    return true;
+}
+
+bool tablePut(JStarVM* vm, ObjTable* t, Value key, Value val, bool* isNew) {
+    if(!checkMutable(vm, (Obj*)t)) return false;
+    if(!checkKey(vm, key)) return false;
+
+    uint32_t hash;
+    if(!tableKeyHash(vm, key, &hash)) return false;
+
+    if(t->entries == NULL) {
+        resizeTable(vm, t);
+    }
+
+    TableEntry* e;
+    size_t slot;
+    if(!findEntry(vm, t, key, hash, &e, &slot)) return false;
+
+    if(e != NULL) {
+        e->val = val;
+        *isNew = false;
+        return true;
+    }
+
+    if(t->numEntries == t->capacity) {
+        resizeTable(vm, t);
+        // Compacted table has no deleted entries, the key goes in the first empty index slot
+        slot = findEmptySlot(t, hash);
+    }
+
+    setIndex(t, slot, t->numEntries);
+    e = &t->entries[t->numEntries++];
+    e->key = key;
+    e->val = val;
+    e->hash = hash;
+    t->count++;
+
+    *isNew = true;
+    return true;
+}
+
+bool tableDelete(JStarVM* vm, ObjTable* t, Value key, bool* deleted) {
+    if(!checkMutable(vm, (Obj*)t)) return false;
+    if(!checkKey(vm, key)) return false;
+
+    *deleted = false;
+    if(t->count == 0) return true;
+
+    uint32_t hash;
+    if(!tableKeyHash(vm, key, &hash)) return false;
+
+    TableEntry* e;
+    size_t slot;
+    if(!findEntry(vm, t, key, hash, &e, &slot)) return false;
+    if(e == NULL) return true;
+
+    // The index slot keeps pointing to the deleted entry, acting as a tombstone
+    e->key = NULL_VAL;
+    e->val = NULL_VAL;
+    t->count--;
+
+    *deleted = true;
+    return true;
+}
+
+bool tableContains(JStarVM* vm, ObjTable* t, Value key, bool* contains) {
+    if(!checkKey(vm, key)) return false;
+
+    *contains = false;
+    if(t->count == 0) return true;
+
+    uint32_t hash;
+    if(!tableKeyHash(vm, key, &hash)) return false;
+
+    TableEntry* e;
+    size_t slot;
+    if(!findEntry(vm, t, key, hash, &e, &slot)) return false;
+
+    *contains = e != NULL;
+    return true;
+}
+
+bool tableRehash(JStarVM* vm, ObjTable* t) {
+    if(t->entries == NULL) return true;
+
+    for(size_t i = 0; i < t->numEntries; i++) {
+        Value key = t->entries[i].key;
+        if(IS_NULL(key)) continue;
+
+        uint32_t hash;
+        if(!tableKeyHash(vm, key, &hash)) return false;
+        // A user defined `__hash__` could have modified the table
+        if(i < t->numEntries) t->entries[i].hash = hash;
+    }
+
+    memset(t->index, 0xff, (t->sizeMask + 1) * tableIndexWidth(t->sizeMask + 1));
+    for(size_t i = 0; i < t->numEntries; i++) {
+        TableEntry* e = &t->entries[i];
+        if(IS_NULL(e->key)) continue;
+        setIndex(t, findEmptySlot(t, e->hash), i);
+    }
+
+    return true;
+}
+
+void tableClear(ObjTable* t) {
+    if(t->entries == NULL) return;
+    t->numEntries = t->count = 0;
+    memset(t->index, 0xff, (t->sizeMask + 1) * tableIndexWidth(t->sizeMask + 1));
+}
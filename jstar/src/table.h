@@ -0,0 +1,37 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "jstar.h"
+#include "object.h"
+#include "value.h"
+
+// Operations on ObjTable, shared by the Table natives and the subscript fast paths of the vm.
+// All functions returning a bool return false if an exception has been raised while hashing or
+// comparing keys, or by an attempt to modify a frozen Table, leaving the exception on top of the
+// stack.
+// Keys and tables passed to these functions must be reachable by the GC (i.e. on the stack),
+// since user defined `__hash__` and `__eq__` methods can trigger a collection.
+
+// Hash a key. Strings, Numbers, Booleans and Tuples are hashed natively, the rest by calling
+// their `__hash__` method
+bool tableKeyHash(JStarVM* vm, Value key, uint32_t* hash);
+// Compare two keys. Strings, Numbers, Booleans and Tuples are compared natively, the rest by
+// calling the `__eq__` method of `k1`
+bool tableKeyEquals(JStarVM* vm, Value k1, Value k2, bool* eq);
+
+// Set `res` to the value associated with `key`, or to null if the key is not present
+bool tableGet(JStarVM* vm, ObjTable* t, Value key, Value* res);
+// Associate `val` with `key`. `isNew` is set to true if the key wasn't present
+bool tablePut(JStarVM* vm, ObjTable* t, Value key, Value val, bool* isNew);
+// Delete `key` from the table. `deleted` is set to true if the key was present
+bool tableDelete(JStarVM* vm, ObjTable* t, Value key, bool* deleted);
+bool tableContains(JStarVM* vm, ObjTable* t, Value key, bool* contains);
+void tableClear(ObjTable* t);
+// Recompute the hashes of all the keys and rebuild the index of the table.
+// Needed when the hashes of its keys may have changed, e.g. after copying them to another VM
+bool tableRehash(JStarVM* vm, ObjTable* t);
+
+#endif
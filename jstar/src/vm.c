@@ -4,11 +4,17 @@
 #include <string.h>
 
 #include "code.h"
+#include "frozen.h"
 #include "gc.h"
+#include "hash.h"
 #include "import.h"
+#include "nativeindex.h"
 #include "opcode.h"
+#include "ref.h"
+#include "script.h"
 #include "std/core.h"
 #include "std/modules.h"
+#include "table.h"
 
 // Method names of overloadable operators
 static const char* overloadNames[OVERLOAD_SENTINEL] = {
@@ -18,6 +24,7 @@ static const char* overloadNames[OVERLOAD_SENTINEL] = {
     [RMOD_OVERLOAD] = "__rmod__", [GET_OVERLOAD] = "__get__",   [SET_OVERLOAD] = "__set__",
     [EQ_OVERLOAD] = "__eq__",     [LT_OVERLOAD] = "__lt__",     [LE_OVERLOAD] = "__le__",
     [GT_OVERLOAD] = "__gt__",     [GE_OVERLOAD] = "__ge__",     [NEG_OVERLOAD] = "__neg__",
+    [HASH_OVERLOAD] = "__hash__",
 };
 
 // -----------------------------------------------------------------------------
@@ -48,9 +55,11 @@ static void initMainModule(JStarVM* vm) {
     compileWithModule(vm, "<main>", mainModuleName, NULL);
 }
 
-JStarVM* jsrNewVM(JStarConf* conf) {
+JStarVM* allocateVM(JStarConf* conf) {
     JStarVM* vm = calloc(1, sizeof(*vm));
     vm->errorCallback = conf->errorCallback;
+    vm->moduleCache = conf->moduleCache;
+    vm->shareCode = conf->shareCode;
 
     // VM program stack
     vm->stackSz = roundUp(conf->stackSize, MAX_LOCALS + 1);
@@ -62,10 +71,27 @@ JStarVM* jsrNewVM(JStarConf* conf) {
     // GC Values
     vm->nextGC = conf->initGC;
     vm->heapGrowRate = conf->heapGrowRate;
+    initLargeObjSpace(&vm->los, INIT_LARGE_GC);
+
+    // Seed of the string and number hash functions
+    initHashSeed();
+
+    // Seed of the `math` module random generator, different for every VM of the process
+    vm->randState = uniqueSeed();
 
     // Module and String caches
     initHashTable(&vm->modules);
     initHashTable(&vm->strings);
+    initHashTable(&vm->names);
+    initImportCache(&vm->importCache);
+    initPrefetchCache(&vm->prefetched);
+    initFrozenSet(&vm->frozen);
+
+    return vm;
+}
+
+JStarVM* jsrNewVM(JStarConf* conf) {
+    JStarVM* vm = allocateVM(conf);
 
     initConstStrings(vm);
 
@@ -78,6 +104,10 @@ JStarVM* jsrNewVM(JStarConf* conf) {
     vm->importpaths = newList(vm, 0);
     vm->emptyTup = newTuple(vm, 0);
 
+    // The main fiber runs on the stacks allocated with the VM
+    vm->mainFiber = vm->fiber = newFiber(vm, NULL_VAL);
+    vm->mainFiber->state = FIBER_RUNNING;
+
     return vm;
 }
 
@@ -88,10 +118,18 @@ void jsrFreeVM(JStarVM* vm) {
     free(vm->frames);
     freeHashTable(&vm->strings);
     freeHashTable(&vm->modules);
+    freeHashTable(&vm->names);
+    freeImportCache(&vm->importCache);
+    freePrefetchCache(&vm->prefetched);
+    freeScripts(vm);
+    freeRefs(vm);
     freeObjects(vm);
+    freeFrozenSet(&vm->frozen);
+    freeLargeObjSpace(&vm->los);
 
 #ifdef JSTAR_DBG_PRINT_GC
     printf("Allocated at exit: %lu bytes.\n", vm->allocated);
+    printf("Large allocated at exit: %lu bytes.\n", vm->los.allocated);
 #endif
 
     free(vm);
@@ -101,18 +139,23 @@ void jsrFreeVM(JStarVM* vm) {
 // VM IMPLEMENTATION
 // -----------------------------------------------------------------------------
 
-static Frame* getFrame(JStarVM* vm, FnCommon* c) {
+static Frame* pushFrame(JStarVM* vm, Value* stack) {
     if(vm->frameCount + 1 == vm->frameSz) {
         vm->frameSz *= 2;
         vm->frames = realloc(vm->frames, sizeof(Frame) * vm->frameSz);
     }
 
     Frame* callFrame = &vm->frames[vm->frameCount++];
-    callFrame->stack = vm->sp - (c->argsCount + 1) - (int)c->vararg;
+    callFrame->stack = stack;
     callFrame->handlerc = 0;
+    callFrame->gen = NULL;
     return callFrame;
 }
 
+static Frame* getFrame(JStarVM* vm, FnCommon* c) {
+    return pushFrame(vm, vm->sp - (c->argsCount + 1) - (int)c->vararg);
+}
+
 static void appendCallFrame(JStarVM* vm, ObjClosure* closure) {
     Frame* callFrame = getFrame(vm, &closure->fn->c);
     callFrame->fn = (Obj*)closure;
@@ -128,12 +171,13 @@ static void appendNativeFrame(JStarVM* vm, ObjNative* native) {
 static bool isNonInstantiableBuiltin(JStarVM* vm, ObjClass* cls) {
     return cls == vm->nullClass || cls == vm->funClass || cls == vm->modClass ||
            cls == vm->stClass || cls == vm->clsClass || cls == vm->tableClass ||
-           cls == vm->udataClass;
+           cls == vm->udataClass || cls == vm->genClass;
 }
 
 static bool isInstatiableBuiltin(JStarVM* vm, ObjClass* cls) {
     return cls == vm->lstClass || cls == vm->tupClass || cls == vm->numClass ||
-           cls == vm->boolClass || cls == vm->strClass;
+           cls == vm->boolClass || cls == vm->strClass || cls == vm->weakRefClass ||
+           cls == vm->weakTableClass || cls == vm->fiberClass;
 }
 
 static bool isBuiltinClass(JStarVM* vm, ObjClass* cls) {
@@ -254,6 +298,156 @@ static bool callFunction(JStarVM* vm, ObjClosure* closure, uint8_t argc) {
     return true;
 }
 
+// Save the state of the running fiber in it, and make `fiber` the running one.
+// Only the pointers to the stacks get exchanged, so switching takes constant time
+static void switchFiber(JStarVM* vm, ObjFiber* fiber) {
+    ObjFiber* curr = vm->fiber;
+    curr->stackSz = vm->stackSz;
+    curr->stack = vm->stack;
+    curr->sp = vm->sp;
+    curr->apiStack = vm->apiStack;
+    curr->frames = vm->frames;
+    curr->frameSz = vm->frameSz;
+    curr->frameCount = vm->frameCount;
+    curr->upvalues = vm->upvalues;
+    curr->module = vm->module;
+
+    vm->stackSz = fiber->stackSz;
+    vm->stack = fiber->stack;
+    vm->sp = fiber->sp;
+    vm->apiStack = fiber->apiStack;
+    vm->frames = fiber->frames;
+    vm->frameSz = fiber->frameSz;
+    vm->frameCount = fiber->frameCount;
+    vm->upvalues = fiber->upvalues;
+    vm->module = fiber->module;
+
+    vm->fiber = fiber;
+    fiber->state = FIBER_RUNNING;
+    fiber->evalDepth = vm->evalDepth;
+}
+
+// Switch to `fiber`, making `value` the result of the yield or transfer it is suspended at.
+// A new fiber gets its stacks allocated, and its function called with `value` as argument
+static void enterFiber(JStarVM* vm, ObjFiber* fiber, Value value) {
+    if(fiber->state != FIBER_NEW) {
+        switchFiber(vm, fiber);
+        vm->sp[-1] = value;
+        return;
+    }
+
+    fiber->stackSz = FIBER_STACK_SZ;
+    fiber->stack = fiber->sp = fiber->apiStack = malloc(sizeof(Value) * FIBER_STACK_SZ);
+    fiber->frameSz = FIBER_FRAME_SZ;
+    fiber->frames = malloc(sizeof(Frame) * FIBER_FRAME_SZ);
+    fiber->frameCount = 0;
+    fiber->upvalues = NULL;
+    fiber->next = vm->fibers;
+    vm->fibers = fiber;
+
+    switchFiber(vm, fiber);
+
+    Obj* fn = AS_OBJ(fiber->fn);
+    if(fn->type == OBJ_BOUND_METHOD) fn = ((ObjBoundMethod*)fn)->method;
+    FnCommon* c = &((ObjClosure*)fn)->fn->c;
+    uint8_t argc = c->argsCount > 0 || c->vararg;
+
+    push(vm, fiber->fn);
+    if(argc == 1) push(vm, value);
+
+    // Cannot fail, as the function's arity has already been checked by `Fiber.new`
+    callValue(vm, fiber->fn, argc);
+}
+
+// Terminate the running fiber, switching back to the fiber that resumed it (or to the main fiber
+// if it was transferred to) with `value` as the result of the resume
+static void finishFiber(JStarVM* vm, Value value) {
+    ObjFiber* fiber = vm->fiber;
+    ObjFiber* next = fiber->caller != NULL ? fiber->caller : vm->mainFiber;
+    fiber->caller = NULL;
+
+    switchFiber(vm, next);
+    vm->sp[-1] = value;
+
+    // The fiber's frames have all returned, so none of its upvalues is still open
+    free(fiber->stack);
+    free(fiber->frames);
+    fiber->state = FIBER_DONE;
+    fiber->stackSz = 0;
+    fiber->stack = fiber->sp = fiber->apiStack = NULL;
+    fiber->frames = NULL;
+    fiber->frameSz = fiber->frameCount = 0;
+    fiber->upvalues = NULL;
+}
+
+// A switch suspends the frames of the running fiber, that are resumed later by an eval loop.
+// This is possible only if they are all executed by the innermost eval loop: i.e. if the switch
+// has been requested directly from it, and not from an eval loop nested in a native call of the
+// fiber. The main fiber is the exception, as it can only be switched back in the same eval loop
+static bool checkFiberSwitch(JStarVM* vm) {
+    ObjFiber* curr = vm->fiber;
+    if(vm->callDepth != vm->evalDepth ||
+       (curr != vm->mainFiber && curr->evalDepth != vm->evalDepth)) {
+        jsrRaise(vm, "FiberException", "Cannot switch fiber across a native call.");
+        return false;
+    }
+    return true;
+}
+
+bool resumeFiber(JStarVM* vm, ObjFiber* fiber, bool transfer) {
+    switch(fiber->state) {
+    case FIBER_RUNNING:
+        jsrRaise(vm, "FiberException", "Fiber is already running.");
+        return false;
+    case FIBER_WAITING:
+        jsrRaise(vm, "FiberException", "Fiber is waiting for another fiber.");
+        return false;
+    case FIBER_DONE:
+        jsrRaise(vm, "FiberException", "Fiber has already completed.");
+        return false;
+    case FIBER_NEW:
+    case FIBER_SUSPENDED:
+        break;
+    }
+
+    if(!transfer && fiber->caller != NULL) {
+        jsrRaise(vm, "FiberException", "Fiber has already been resumed by another fiber.");
+        return false;
+    }
+
+    if(!checkFiberSwitch(vm)) {
+        return false;
+    }
+
+    ObjFiber* curr = vm->fiber;
+    if(transfer) {
+        curr->state = FIBER_SUSPENDED;
+    } else {
+        curr->state = FIBER_WAITING;
+        fiber->caller = curr;
+    }
+
+    vm->nextFiber = fiber;
+    return true;
+}
+
+bool yieldFiber(JStarVM* vm) {
+    ObjFiber* curr = vm->fiber;
+    if(curr->caller == NULL) {
+        jsrRaise(vm, "FiberException", "Cannot yield from a fiber that has not been resumed.");
+        return false;
+    }
+
+    if(!checkFiberSwitch(vm)) {
+        return false;
+    }
+
+    curr->state = FIBER_SUSPENDED;
+    vm->nextFiber = curr->caller;
+    curr->caller = NULL;
+    return true;
+}
+
 static bool callNative(JStarVM* vm, ObjNative* native, uint8_t argc) {
     if(vm->frameCount + 1 == RECURSION_LIMIT) {
         jsrRaise(vm, "StackOverflowException", NULL);
@@ -286,6 +480,122 @@ static bool callNative(JStarVM* vm, ObjNative* native, uint8_t argc) {
     vm->apiStack = vm->stack + apiStackOff;
     push(vm, ret);
 
+    // A fiber switch requested by the native can only happen now that its frame is gone
+    if(vm->nextFiber != NULL) {
+        ObjFiber* fiber = vm->nextFiber;
+        vm->nextFiber = NULL;
+        enterFiber(vm, fiber, ret);
+    }
+
+    return true;
+}
+
+// Save the frame of the generator executing in `frame`, whose stack window ends at `top`.
+// Upvalues open in the frame get closed, and are reopened when the generator is resumed
+static void saveGenerator(JStarVM* vm, ObjGenerator* gen, Frame* frame, Value* top) {
+    size_t stackCount = top - frame->stack;
+    if(stackCount > gen->stackSize) {
+        size_t oldSize = gen->stackSize;
+        gen->stackSize = powerOf2Ceil(stackCount);
+        gen->stack = GCallocate(vm, gen->stack, sizeof(Value) * oldSize,
+                                sizeof(Value) * gen->stackSize);
+    }
+
+    size_t upvalueCount = 0;
+    for(ObjUpvalue* u = vm->upvalues; u != NULL && u->addr >= frame->stack; u = u->next) {
+        upvalueCount++;
+    }
+
+    if(upvalueCount > gen->upvalueSize) {
+        size_t oldSize = gen->upvalueSize;
+        gen->upvalueSize = powerOf2Ceil(upvalueCount);
+        gen->upvalues = GCallocate(vm, gen->upvalues, sizeof(SavedUpvalue) * oldSize,
+                                   sizeof(SavedUpvalue) * gen->upvalueSize);
+    }
+
+    memcpy(gen->stack, frame->stack, sizeof(Value) * stackCount);
+    gen->stackCount = stackCount;
+
+    for(size_t i = 0; i < upvalueCount; i++) {
+        ObjUpvalue* upvalue = vm->upvalues;
+        gen->upvalues[i].upvalue = upvalue;
+        gen->upvalues[i].slot = upvalue->addr - frame->stack;
+        upvalue->closed = *upvalue->addr;
+        upvalue->addr = &upvalue->closed;
+        vm->upvalues = upvalue->next;
+    }
+    gen->upvalueCount = upvalueCount;
+
+    for(uint8_t i = 0; i < frame->handlerc; i++) {
+        Handler* h = &frame->handlers[i];
+        gen->handlers[i].type = h->type;
+        gen->handlers[i].address = h->address;
+        gen->handlers[i].savesp = h->savesp - frame->stack;
+    }
+    gen->handlerc = frame->handlerc;
+    gen->ip = frame->ip;
+}
+
+static void finishGenerator(ObjGenerator* gen, Value ret) {
+    gen->state = GEN_DONE;
+    gen->lastYield = ret;
+    gen->stackCount = 0;
+}
+
+// Resume `gen`, that sits on the stack below its `argc` arguments. The optional argument becomes
+// the result of the `yield` expression the generator is suspended at
+static bool resumeGenerator(JStarVM* vm, ObjGenerator* gen, uint8_t argc) {
+    if(gen->state == GEN_RUNNING) {
+        jsrRaise(vm, "GeneratorException", "Generator is already running.");
+        return false;
+    }
+    if(gen->state == GEN_DONE) {
+        jsrRaise(vm, "GeneratorException", "Generator has already completed.");
+        return false;
+    }
+    if(argc > 1) {
+        jsrRaise(vm, "TypeException", "Generator takes at most 1 argument, %d supplied.", argc);
+        return false;
+    }
+    if(vm->frameCount + 1 == RECURSION_LIMIT) {
+        jsrRaise(vm, "StackOverflowException", NULL);
+        return false;
+    }
+
+    Value arg = argc == 1 ? pop(vm) : NULL_VAL;
+    jsrEnsureStack(vm, gen->stackCount + UINT8_MAX);
+
+    // The generator's frame takes the place of the generator on the stack
+    Value* base = vm->sp - 1;
+    memcpy(base, gen->stack, sizeof(Value) * gen->stackCount);
+    vm->sp = base + gen->stackCount;
+    push(vm, arg);
+
+    Frame* frame = pushFrame(vm, base);
+    frame->fn = (Obj*)gen->closure;
+    frame->ip = gen->ip;
+    frame->gen = gen;
+
+    for(uint8_t i = 0; i < gen->handlerc; i++) {
+        Handler* h = &frame->handlers[i];
+        h->type = gen->handlers[i].type;
+        h->address = gen->handlers[i].address;
+        h->savesp = base + gen->handlers[i].savesp;
+    }
+    frame->handlerc = gen->handlerc;
+
+    // The generator's frame is the topmost, so its upvalues go at the head of the list
+    for(size_t i = gen->upvalueCount; i > 0; i--) {
+        ObjUpvalue* upvalue = gen->upvalues[i - 1].upvalue;
+        upvalue->addr = base + gen->upvalues[i - 1].slot;
+        *upvalue->addr = upvalue->closed;
+        upvalue->next = vm->upvalues;
+        vm->upvalues = upvalue;
+    }
+    gen->upvalueCount = 0;
+
+    gen->state = GEN_RUNNING;
+    vm->module = gen->closure->fn->c.module;
     return true;
 }
 
@@ -296,6 +606,8 @@ bool callValue(JStarVM* vm, Value callee, uint8_t argc) {
             return callFunction(vm, AS_CLOSURE(callee), argc);
         case OBJ_NATIVE:
             return callNative(vm, AS_NATIVE(callee), argc);
+        case OBJ_GENERATOR:
+            return resumeGenerator(vm, AS_GENERATOR(callee), argc);
         case OBJ_BOUND_METHOD: {
             ObjBoundMethod* m = AS_BOUND_METHOD(callee);
             vm->sp[-argc - 1] = m->bound;
@@ -563,7 +875,7 @@ static bool getStringSubscript(JStarVM* vm) {
     if(IS_INT(arg)) {
         size_t idx = jsrCheckIndexNum(vm, AS_NUM(arg), str->length);
         if(idx == SIZE_MAX) return false;
-        ObjString* ret = copyString(vm, str->data + idx, 1);
+        ObjString* ret = newString(vm, str->data + idx, 1);
 
         pop(vm), pop(vm);
         push(vm, OBJ_VAL(ret));
@@ -572,7 +884,7 @@ static bool getStringSubscript(JStarVM* vm) {
     if(IS_TUPLE(arg)) {
         size_t low = 0, high = 0;
         if(!checkSliceIndex(vm, AS_TUPLE(arg), str->length, &low, &high)) return false;
-        ObjString* ret = copyString(vm, str->data + low, high - low);
+        ObjString* ret = newString(vm, str->data + low, high - low);
 
         pop(vm), pop(vm);
         push(vm, OBJ_VAL(ret));
@@ -581,6 +893,23 @@ static bool getStringSubscript(JStarVM* vm) {
     JSR_RAISE(vm, "TypeException", "Index of String subscript must be an integer or a Tuple");
 }
 
+// Table subscripts are executed inline, without calling the native `__get__` and `__set__` methods.
+// This is safe since Table's methods cannot be overridden, as it cannot be subclassed
+static bool getTableSubscript(JStarVM* vm) {
+    Value res;
+    if(!tableGet(vm, AS_TABLE(peek2(vm)), peek(vm), &res)) return false;
+    pop(vm), pop(vm);
+    push(vm, res);
+    return true;
+}
+
+static bool setTableSubscript(JStarVM* vm) {
+    bool isNew;
+    if(!tablePut(vm, AS_TABLE(peek(vm)), peek2(vm), peekn(vm, 2), &isNew)) return false;
+    pop(vm), pop(vm);
+    return true;
+}
+
 static bool getSubscriptOfValue(JStarVM* vm) {
     if(IS_OBJ(peek2(vm))) {
         Value operand = peek2(vm);
@@ -591,6 +920,8 @@ static bool getSubscriptOfValue(JStarVM* vm) {
             return getTupleSubscript(vm);
         case OBJ_STRING:
             return getStringSubscript(vm);
+        case OBJ_TABLE:
+            return getTableSubscript(vm);
         default:
             break;
         }
@@ -612,6 +943,8 @@ static bool setSubscriptOfValue(JStarVM* vm) {
         }
 
         ObjList* list = AS_LIST(operand);
+        if(!checkMutable(vm, (Obj*)list)) return false;
+
         size_t index = jsrCheckIndexNum(vm, AS_NUM(arg), list->count);
         if(index == SIZE_MAX) return false;
 
@@ -619,6 +952,10 @@ static bool setSubscriptOfValue(JStarVM* vm) {
         return true;
     }
 
+    if(IS_TABLE(peek(vm))) {
+        return setTableSubscript(vm);
+    }
+
     // swap the operand with value to prepare function call
     swapValues(vm->sp, -1, -3);
     if(!invokeMethod(vm, getClass(vm, peekn(vm, 2)), vm->overloads[SET_OVERLOAD], 2)) {
@@ -695,24 +1032,15 @@ static JStarNative resolveNative(ObjModule* m, const char* cls, const char* name
         return n;
     }
 
-    JStarNativeReg* reg = m->natives.registry;
-    if(reg != NULL) {
-        for(int i = 0; reg[i].type != REG_SENTINEL; i++) {
-            if(reg[i].type == REG_METHOD && cls != NULL) {
-                const char* clsName = reg[i].as.method.cls;
-                const char* methName = reg[i].as.method.name;
-                if(strcmp(cls, clsName) == 0 && strcmp(name, methName) == 0) {
-                    return reg[i].as.method.meth;
-                }
-            } else if(reg[i].type == REG_FUNCTION && cls == NULL) {
-                const char* funName = reg[i].as.function.name;
-                if(strcmp(name, funName) == 0) {
-                    return reg[i].as.function.fun;
-                }
-            }
-        }
+    if(m->natives.registry == NULL) {
+        return NULL;
+    }
+
+    if(m->natives.index == NULL) {
+        m->natives.index = indexNativeRegistry(m->natives.registry);
     }
-    return NULL;
+
+    return nativeIndexGet(m->natives.index, NULL, cls, name);
 }
 
 // -----------------------------------------------------------------------------
@@ -727,7 +1055,25 @@ typedef enum UnwindCause {
     CAUSE_RETURN,
 } UnwindCause;
 
+// Unwind the stack of the running fiber. An exception escaping a fiber other than the one the
+// eval loop started in terminates it, and is raised again in the fiber that resumed it
+static bool unwindFibers(JStarVM* vm, ObjFiber* evalFiber, int depth) {
+    while(!unwindStack(vm, vm->fiber == evalFiber ? depth : 0)) {
+        if(vm->fiber == evalFiber) return false;
+
+        Value exc = pop(vm), stackTrace = NULL_VAL;
+        finishFiber(vm, exc);
+
+        // Frame depths start over in the stack of the resumer
+        hashTableGet(&AS_INSTANCE(exc)->fields, vm->stacktrace, &stackTrace);
+        AS_STACK_TRACE(stackTrace)->lastTracedFrame = -1;
+    }
+    return true;
+}
+
 bool runEval(JStarVM* vm, int depth) {
+    // Fibers switched in by this eval loop return to their resumer when their last frame returns
+    ObjFiber* evalFiber = vm->fiber;
     register Frame* frame;
     register Value* frameStack;
     register ObjClosure* closure;
@@ -782,14 +1128,28 @@ bool runEval(JStarVM* vm, int depth) {
         push(vm, NUM_VAL(cause));                \
     } while(0)
 
-#define UNWIND_STACK(vm)              \
-    do {                              \
-        SAVE_STATE();                 \
-        if(!unwindStack(vm, depth)) { \
-            return false;             \
-        }                             \
-        LOAD_STATE();                 \
-        DISPATCH();                   \
+#define UNWIND_STACK(vm)                          \
+    do {                                          \
+        SAVE_STATE();                             \
+        if(!unwindFibers(vm, evalFiber, depth)) { \
+            return false;                         \
+        }                                         \
+        LOAD_STATE();                             \
+        DISPATCH();                               \
+    } while(0)
+
+// Return from the current frame, whose return value is on top of the stack
+#define RETURN_FROM_FRAME()                                       \
+    do {                                                          \
+        if(--vm->frameCount == depth && vm->fiber == evalFiber) { \
+            return true;                                          \
+        }                                                         \
+        if(vm->frameCount == 0) {                                 \
+            finishFiber(vm, pop(vm));                             \
+        }                                                         \
+        LOAD_STATE();                                             \
+        vm->module = fn->c.module;                                \
+        DISPATCH();                                               \
     } while(0)
 
 #ifdef JSTAR_DBG_PRINT_EXEC
@@ -996,6 +1356,21 @@ bool runEval(JStarVM* vm, int depth) {
     }
 
     TARGET(OP_FOR_ITER): {
+        // Generators are resumed in place, without going through `__iter__`
+        if(IS_GENERATOR(vm->sp[-2])) {
+            ObjGenerator* gen = AS_GENERATOR(vm->sp[-2]);
+            if(gen->state == GEN_DONE) {
+                push(vm, NULL_VAL);
+                DISPATCH();
+            }
+            push(vm, OBJ_VAL(gen));
+            SAVE_STATE();
+            bool res = resumeGenerator(vm, gen, 0);
+            LOAD_STATE();
+            if(!res) UNWIND_STACK(vm);
+            DISPATCH();
+        }
+
         vm->sp[0] = vm->sp[-2];
         vm->sp[1] = vm->sp[-1];
         vm->sp += 2;
@@ -1007,8 +1382,18 @@ bool runEval(JStarVM* vm, int depth) {
     }
 
     TARGET(OP_FOR_NEXT): {
-        vm->sp[-2] = vm->sp[-1];
         int16_t off = NEXT_SHORT();
+
+        // The value yielded by a generator already is the next element
+        if(IS_GENERATOR(vm->sp[-3])) {
+            if(AS_GENERATOR(vm->sp[-3])->state == GEN_DONE) {
+                pop(vm);
+                ip += off;
+            }
+            DISPATCH();
+        }
+
+        vm->sp[-2] = vm->sp[-1];
         if(isValTrue(pop(vm))) {
             vm->sp[0] = vm->sp[-2];
             vm->sp[1] = vm->sp[-1];
@@ -1142,16 +1527,39 @@ op_return:
         }
 
         closeUpvalues(vm, frameStack);
+        if(frame->gen != NULL) finishGenerator(frame->gen, ret);
+
         vm->sp = frameStack;
         push(vm, ret);
 
-        if(--vm->frameCount == depth) {
-            return true;
-        }
+        RETURN_FROM_FRAME();
+    }
 
-        LOAD_STATE();
-        vm->module = fn->c.module;
-        DISPATCH();
+    TARGET(OP_GENERATOR): {
+        // Save the frame, with the arguments already set up, in a new generator and return it
+        // to the caller. The function's body will start executing on the first resume
+        ObjGenerator* gen = newGenerator(vm, closure);
+        push(vm, OBJ_VAL(gen));
+        SAVE_STATE();
+        saveGenerator(vm, gen, frame, vm->sp - 1);
+
+        vm->sp = frameStack;
+        push(vm, OBJ_VAL(gen));
+
+        RETURN_FROM_FRAME();
+    }
+
+    TARGET(OP_YIELD): {
+        ObjGenerator* gen = frame->gen;
+        SAVE_STATE();
+        saveGenerator(vm, gen, frame, vm->sp - 1);
+        gen->state = GEN_SUSPENDED;
+        gen->lastYield = pop(vm);
+
+        vm->sp = frameStack;
+        push(vm, gen->lastYield);
+
+        RETURN_FROM_FRAME();
     }
 
     TARGET(OP_IMPORT): 
@@ -1465,6 +1873,7 @@ bool unwindStack(JStarVM* vm, int depth) {
         }
 
         closeUpvalues(vm, frame->stack);
+        if(frame->gen != NULL) finishGenerator(frame->gen, NULL_VAL);
     }
 
     // we have reached the end of the stack or a native/function boundary,
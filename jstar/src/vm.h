@@ -7,10 +7,14 @@
 
 #include "common.h"
 #include "compiler.h"
+#include "frozen.h"
 #include "hashtable.h"
+#include "importcache.h"
 #include "jstar.h"
+#include "los.h"
 #include "object.h"
 #include "opcode.h"
+#include "prefetch.h"
 #include "value.h"
 
 // This stores the info needed to jump
@@ -30,6 +34,7 @@ typedef struct Frame {
     uint8_t* ip;                    // Instruction pointer
     Value* stack;                   // Base of stack for current frame
     Obj* fn;                        // Function associated with the frame (ObjClosure or ObjNative)
+    ObjGenerator* gen;              // Generator executing in the frame (NULL if none)
     Handler handlers[HANDLER_MAX];  // Exception handlers
     uint8_t handlerc;               // Exception handlers count
 } Frame;
@@ -59,6 +64,8 @@ typedef enum Overload {
     GT_OVERLOAD,
     GE_OVERLOAD,
     NEG_OVERLOAD,
+    // Hashing overload, used by Table
+    HASH_OVERLOAD,
     // Sentinel
     OVERLOAD_SENTINEL
 } Overload;
@@ -69,6 +76,22 @@ struct JStarVM {
     // Paths searched for import
     ObjList* importpaths;
 
+    // Listings of the directories searched for import
+    ImportCache importCache;
+
+    // Modules parsed ahead of their import by jsrPrefetchImports
+    PrefetchCache prefetched;
+
+    // Regions of frozen objects referenced by the VM
+    FrozenSet frozen;
+
+    // Scripts compiled with jsrCompile, pinned until they're freed
+    JStarScript* scripts;
+
+    // Values referenced with jsrRef, and names interned with jsrInternName
+    JStarRef* refs;
+    HashTable names;
+
     // Built in classes
     ObjClass* clsClass;
     ObjClass* objClass;
@@ -84,6 +107,10 @@ struct JStarVM {
     ObjClass* excClass;
     ObjClass* tableClass;
     ObjClass* udataClass;
+    ObjClass* weakRefClass;
+    ObjClass* weakTableClass;
+    ObjClass* genClass;
+    ObjClass* fiberClass;
 
     // Script arguments
     ObjList* argv;
@@ -121,9 +148,32 @@ struct JStarVM {
     // Linked list of all open upvalues
     ObjUpvalue* upvalues;
 
+    // The running fiber, whose stacks are the ones above, and the main fiber of the VM
+    ObjFiber *fiber, *mainFiber;
+
+    // Fiber to switch to once the running native returns (see resumeFiber)
+    ObjFiber* nextFiber;
+
+    // Fibers that have been started, released by the GC when unreachable
+    ObjFiber* fibers;
+
+    // Number of calls from C into the VM in progress, and its value when the innermost eval loop
+    // started. Fibers can only be switched from the frames of the innermost eval loop
+    int callDepth, evalDepth;
+
     // Callback function to report errors
     JStarErrorCB errorCallback;
 
+    // Whether compiled modules are cached on disk
+    bool moduleCache;
+
+    // Whether compiled module code is shared with the other VMs of the process
+    bool shareCode;
+
+    // State of the `math` module pseudo random number generator, per-VM so that VMs running on
+    // different threads never share it
+    uint64_t randState;
+
     // ---- Memory management ----
 
     // Linked list of all allocated objects (used in
@@ -135,11 +185,21 @@ struct JStarVM {
     size_t nextGC;     // Bytes at which the next GC will be triggered
     int heapGrowRate;  // Rate at which the heap will grow after a GC
 
+    // Large object space, used for allocations above LOS_THRESHOLD
+    LargeObjSpace los;
+
     // Stack used to recursevely reach all the fields of reached objects
     Obj** reachedStack;
     size_t reachedCapacity, reachedCount;
+
+    // Weak references and weak tables found during a GC, cleared after marking
+    Obj** weakObjs;
+    size_t weakCapacity, weakCount;
 };
 
+// Allocate a VM with an empty heap, without creating the core module and the runtime objects
+JStarVM* allocateVM(JStarConf* conf);
+
 bool runEval(JStarVM* vm, int depth);
 
 bool getFieldFromValue(JStarVM* vm, ObjString* name);
@@ -147,9 +207,20 @@ bool setFieldOfValue(JStarVM* vm, ObjString* name);
 
 bool callValue(JStarVM* vm, Value callee, uint8_t argc);
 bool invokeValue(JStarVM* vm, ObjString* name, uint8_t argc);
+// Same as jsrCallMethod, but takes an already created method name (implemented in jstar.c)
+JStarResult callMethodByName(JStarVM* vm, ObjString* name, uint8_t argc);
 
 bool unwindStack(JStarVM* vm, int depth);
 
+// Request a switch to `fiber`, to be carried out by the VM once the calling native returns.
+// The value returned by the native becomes the result of the yield or transfer the fiber is
+// suspended at (or the argument of its function, on the first resume).
+// When `transfer` is false the running fiber waits for `fiber` to yield or return, otherwise it
+// simply gets suspended. Returns false raising an exception if the switch is not possible
+bool resumeFiber(JStarVM* vm, ObjFiber* fiber, bool transfer);
+// Request to switch back to the fiber that resumed the running one, as with resumeFiber
+bool yieldFiber(JStarVM* vm);
+
 static inline void push(JStarVM* vm, Value v) {
     *vm->sp++ = v;
 }
@@ -175,10 +246,26 @@ static inline bool isValTrue(Value val) {
     return !IS_NULL(val);
 }
 
+// Frozen objects are shared between VMs, so their class is the built-in one of the current VM
+static inline ObjClass* getObjClass(JStarVM* vm, Obj* o) {
+    if(!o->frozen) return o->cls;
+
+    switch(o->type) {
+    case OBJ_STRING:
+        return vm->strClass;
+    case OBJ_LIST:
+        return vm->lstClass;
+    case OBJ_TUPLE:
+        return vm->tupClass;
+    default:
+        return vm->tableClass;
+    }
+}
+
 static inline ObjClass* getClass(JStarVM* vm, Value v) {
 #ifdef JSTAR_NAN_TAGGING
     if(IS_NUM(v)) return vm->numClass;
-    if(IS_OBJ(v)) return AS_OBJ(v)->cls;
+    if(IS_OBJ(v)) return getObjClass(vm, AS_OBJ(v));
 
     switch(GET_TAG(v)) {
     case TRUE_TAG:
@@ -195,7 +282,7 @@ static inline ObjClass* getClass(JStarVM* vm, Value v) {
     case VAL_BOOL:
         return vm->boolClass;
     case VAL_OBJ:
-        return AS_OBJ(v)->cls;
+        return getObjClass(vm, AS_OBJ(v));
     case VAL_HANDLE:
     case VAL_NULL:
     default:
@@ -220,6 +307,11 @@ static inline int apiStackIndex(JStarVM* vm, int slot) {
     return slot;
 }
 
+// Check that the API stack has room for a push
+static inline void validateStack(JStarVM* vm) {
+    ASSERT((size_t)(vm->sp - vm->stack) < vm->stackSz, "Stack overflow");
+}
+
 // Get the value at API stack slot "slot"
 static inline Value apiStackSlot(JStarVM* vm, int slot) {
     ASSERT(vm->sp - slot > vm->apiStack, "API stack slot would be negative");
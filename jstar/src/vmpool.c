@@ -0,0 +1,382 @@
+#ifdef __linux__
+    #define _POSIX_C_SOURCE 200112L  // for clock_gettime
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "import.h"
+#include "jstar.h"
+#include "object.h"
+#include "sync.h"
+#include "vm.h"
+
+#if defined(JSTAR_POSIX)
+    #include <time.h>
+#elif defined(JSTAR_WINDOWS)
+    #include <Windows.h>
+#else
+    #include <time.h>
+#endif
+
+/**
+ * Implementation of the JStarVMPool API.
+ * Every worker owns a VM, cloned from the template, and a queue of jobs. Submitted jobs are
+ * assigned round-robin to the queues, and a worker whose queue is empty steals from the others,
+ * so that a worker stuck on a long job doesn't hold back the ones queued after it. The owner
+ * takes the oldest job of its queue, while thieves take the newest one, so that they rarely
+ * contend for the same end. Idle workers sleep on a condition variable until jobs are submitted.
+ */
+
+typedef struct PoolJob {
+    JStarJob job;
+    double submitTime;
+} PoolJob;
+
+// Ring buffer of jobs
+typedef struct JobQueue {
+    Mutex lock;
+    PoolJob* jobs;
+    size_t head, count, size;
+} JobQueue;
+
+typedef struct Worker {
+    JStarVMPool* pool;
+    JStarVM* vm;
+    Thread thread;
+    JobQueue queue;
+    int jobsRun;
+} Worker;
+
+struct JStarVMPool {
+    JStarPoolConf conf;
+    JStarVM* template;
+    Worker* workers;
+    int workerCount;
+    bool threaded;
+    // Everything below is guarded by `lock`
+    Mutex lock;
+    CondVar jobsReady, jobsDone;
+    size_t nextWorker;
+    bool stop;
+    JStarPoolStats stats;
+    double totalWait, totalLatency;
+};
+
+static double monotonicTime(void) {
+#if defined(JSTAR_POSIX)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#elif defined(JSTAR_WINDOWS)
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / freq.QuadPart;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// JOB QUEUE
+// -----------------------------------------------------------------------------
+
+static void initJobQueue(JobQueue* q) {
+    initMutex(&q->lock);
+    q->jobs = NULL;
+    q->head = q->count = q->size = 0;
+}
+
+static void freeJobQueue(JobQueue* q) {
+    freeMutex(&q->lock);
+    free(q->jobs);
+}
+
+static void pushJob(JobQueue* q, const PoolJob* job) {
+    lockMutex(&q->lock);
+    if(q->count == q->size) {
+        size_t oldSize = q->size;
+        q->size = q->size ? q->size * 2 : 16;
+        q->jobs = realloc(q->jobs, q->size * sizeof(PoolJob));
+        // Unwrap the jobs past the end of the old buffer
+        if(q->head + q->count > oldSize) {
+            size_t wrapped = q->head + q->count - oldSize;
+            memcpy(q->jobs + oldSize, q->jobs, wrapped * sizeof(PoolJob));
+        }
+    }
+    q->jobs[(q->head + q->count++) & (q->size - 1)] = *job;
+    unlockMutex(&q->lock);
+}
+
+static bool popOldest(JobQueue* q, PoolJob* out) {
+    lockMutex(&q->lock);
+    bool found = q->count > 0;
+    if(found) {
+        *out = q->jobs[q->head];
+        q->head = (q->head + 1) & (q->size - 1);
+        q->count--;
+    }
+    unlockMutex(&q->lock);
+    return found;
+}
+
+static bool popNewest(JobQueue* q, PoolJob* out) {
+    lockMutex(&q->lock);
+    bool found = q->count > 0;
+    if(found) {
+        *out = q->jobs[(q->head + --q->count) & (q->size - 1)];
+    }
+    unlockMutex(&q->lock);
+    return found;
+}
+
+// -----------------------------------------------------------------------------
+// WORKERS
+// -----------------------------------------------------------------------------
+
+static bool takeJob(Worker* w, PoolJob* out) {
+    JStarVMPool* pool = w->pool;
+    int self = (int)(w - pool->workers);
+
+    bool stolen = false;
+    bool found = popOldest(&w->queue, out);
+    for(int i = 1; !found && i < pool->workerCount; i++) {
+        found = stolen = popNewest(&pool->workers[(self + i) % pool->workerCount].queue, out);
+    }
+    if(!found) return false;
+
+    double wait = monotonicTime() - out->submitTime;
+
+    lockMutex(&pool->lock);
+    pool->stats.queueDepth--;
+    if(stolen) pool->stats.stolen++;
+    pool->totalWait += wait;
+    if(wait > pool->stats.maxWait) pool->stats.maxWait = wait;
+    unlockMutex(&pool->lock);
+
+    return true;
+}
+
+// Set up and perform the call of the job. No code is executing on the VM, so the module of the
+// job is made current for exceptions raised before the call, that resolve their class in it
+static JStarResult callJob(JStarVM* vm, const JStarJob* job) {
+    ObjString* name = copyString(vm, job->module, strlen(job->module));
+    ObjModule* module = getModule(vm, name);
+
+    if(module == NULL) {
+        push(vm, OBJ_VAL(name));
+        if(!importModule(vm, name)) {
+            pop(vm);
+            vm->module = getModule(vm, copyString(vm, JSR_MAIN_MODULE, strlen(JSR_MAIN_MODULE)));
+            jsrRaise(vm, "ImportException", "Cannot load module `%s`.", job->module);
+            return JSR_RUNTIME_ERR;
+        }
+        vm->sp[-2] = vm->sp[-1];
+        pop(vm);
+
+        // Run the module's main if it was freshly loaded
+        if(!IS_NULL(peek(vm))) {
+            vm->sp[-1] = OBJ_VAL(newClosure(vm, AS_FUNC(peek(vm))));
+            JStarResult res = jsrCall(vm, 0);
+            if(res != JSR_EVAL_SUCCESS) return res;
+        }
+        pop(vm);
+
+        module = getModule(vm, name);
+    }
+
+    vm->module = module;
+    if(!jsrGetGlobal(vm, job->module, job->function)) return JSR_RUNTIME_ERR;
+
+    int argc = job->pushArgs ? job->pushArgs(vm, job->data) : 0;
+    return jsrCall(vm, argc);
+}
+
+static void runJob(Worker* w, const PoolJob* job) {
+    JStarVMPool* pool = w->pool;
+    JStarVM* vm = w->vm;
+
+    JStarResult res = callJob(vm, &job->job);
+    if(job->job.done) job->job.done(vm, res, job->job.data);
+    double latency = monotonicTime() - job->submitTime;
+
+    // Reset the VM for the next job
+    vm->sp = vm->stack;
+    vm->module = NULL;
+
+    if(pool->conf.jobsPerVM > 0 && ++w->jobsRun >= pool->conf.jobsPerVM) {
+        // The template is never modified, so a clone that succeeded once always does
+        JStarVM* fresh = jsrCloneVM(pool->template);
+        if(fresh != NULL) {
+            jsrFreeVM(w->vm);
+            w->vm = fresh;
+        }
+        w->jobsRun = 0;
+    }
+
+    lockMutex(&pool->lock);
+    pool->stats.completed++;
+    if(res != JSR_EVAL_SUCCESS) pool->stats.failed++;
+    pool->totalLatency += latency;
+    if(latency > pool->stats.maxLatency) pool->stats.maxLatency = latency;
+    if(pool->stats.completed == pool->stats.submitted) broadcastCondVar(&pool->jobsDone);
+    unlockMutex(&pool->lock);
+}
+
+static void workerMain(void* arg) {
+    Worker* w = arg;
+    JStarVMPool* pool = w->pool;
+
+    for(;;) {
+        PoolJob job;
+        if(takeJob(w, &job)) {
+            runJob(w, &job);
+            continue;
+        }
+
+        // A job may be counted in `queueDepth` while still being taken by another worker, in
+        // which case this loops until the other worker is done taking it
+        lockMutex(&pool->lock);
+        while(pool->stats.queueDepth == 0 && !pool->stop) {
+            waitCondVar(&pool->jobsReady, &pool->lock);
+        }
+        bool stop = pool->stats.queueDepth == 0 && pool->stop;
+        unlockMutex(&pool->lock);
+
+        if(stop) break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// API
+// -----------------------------------------------------------------------------
+
+JStarPoolConf jsrGetPoolConf(void) {
+    JStarPoolConf conf = {0};
+    conf.threads = 0;
+    conf.jobsPerVM = 0;
+    conf.vmConf = jsrGetConf();
+    conf.initVM = NULL;
+    conf.userData = NULL;
+    return conf;
+}
+
+static void freeWorkers(JStarVMPool* pool) {
+    for(int i = 0; i < pool->workerCount; i++) {
+        Worker* w = &pool->workers[i];
+        if(w->vm) jsrFreeVM(w->vm);
+        freeJobQueue(&w->queue);
+    }
+    free(pool->workers);
+}
+
+JStarVMPool* jsrNewVMPool(const JStarPoolConf* conf) {
+    JStarConf vmConf = conf->vmConf;
+    JStarVM* template = jsrNewVM(&vmConf);
+    if(conf->initVM && !conf->initVM(template, conf->userData)) {
+        jsrFreeVM(template);
+        return NULL;
+    }
+
+    JStarVMPool* pool = calloc(1, sizeof(*pool));
+    pool->conf = *conf;
+    pool->template = template;
+    pool->workerCount = conf->threads > 0 ? conf->threads : processorCount();
+    pool->workers = calloc(pool->workerCount, sizeof(Worker));
+
+    for(int i = 0; i < pool->workerCount; i++) {
+        Worker* w = &pool->workers[i];
+        w->pool = pool;
+        initJobQueue(&w->queue);
+        if((w->vm = jsrCloneVM(template)) == NULL) {
+            freeWorkers(pool);
+            free(pool);
+            jsrFreeVM(template);
+            return NULL;
+        }
+    }
+
+    initMutex(&pool->lock);
+    initCondVar(&pool->jobsReady);
+    initCondVar(&pool->jobsDone);
+
+    // Run with the workers that could be started, or inline if none could
+    int started = 0;
+    while(started < pool->workerCount) {
+        Worker* w = &pool->workers[started];
+        if(!startThread(&w->thread, &workerMain, w)) break;
+        started++;
+    }
+
+    pool->threaded = started > 0;
+    if(pool->threaded && started < pool->workerCount) {
+        for(int i = started; i < pool->workerCount; i++) {
+            Worker* w = &pool->workers[i];
+            jsrFreeVM(w->vm);
+            w->vm = NULL;
+        }
+        pool->workerCount = started;
+    }
+
+    return pool;
+}
+
+void jsrFreeVMPool(JStarVMPool* pool) {
+    lockMutex(&pool->lock);
+    pool->stop = true;
+    broadcastCondVar(&pool->jobsReady);
+    unlockMutex(&pool->lock);
+
+    if(pool->threaded) {
+        for(int i = 0; i < pool->workerCount; i++) {
+            joinThread(pool->workers[i].thread);
+        }
+    }
+
+    freeWorkers(pool);
+    freeCondVar(&pool->jobsDone);
+    freeCondVar(&pool->jobsReady);
+    freeMutex(&pool->lock);
+    jsrFreeVM(pool->template);
+    free(pool);
+}
+
+void jsrPoolSubmit(JStarVMPool* pool, const JStarJob* job) {
+    PoolJob poolJob = {*job, monotonicTime()};
+
+    lockMutex(&pool->lock);
+    Worker* w = &pool->workers[pool->nextWorker++ % pool->workerCount];
+    pool->stats.submitted++;
+    if(pool->threaded) {
+        // Pushed under the pool lock, so that waiting workers can't miss the job
+        pushJob(&w->queue, &poolJob);
+        if(++pool->stats.queueDepth > pool->stats.maxQueueDepth) {
+            pool->stats.maxQueueDepth = pool->stats.queueDepth;
+        }
+        signalCondVar(&pool->jobsReady);
+    }
+    unlockMutex(&pool->lock);
+
+    if(!pool->threaded) {
+        runJob(w, &poolJob);
+    }
+}
+
+void jsrPoolWait(JStarVMPool* pool) {
+    lockMutex(&pool->lock);
+    while(pool->stats.completed < pool->stats.submitted) {
+        waitCondVar(&pool->jobsDone, &pool->lock);
+    }
+    unlockMutex(&pool->lock);
+}
+
+void jsrPoolGetStats(JStarVMPool* pool, JStarPoolStats* stats) {
+    lockMutex(&pool->lock);
+    *stats = pool->stats;
+    size_t started = pool->stats.submitted - pool->stats.queueDepth;
+    stats->avgWait = started ? pool->totalWait / started : 0;
+    stats->avgLatency = stats->completed ? pool->totalLatency / stats->completed : 0;
+    unlockMutex(&pool->lock);
+}
@@ -0,0 +1,90 @@
+// Build time tool that compiles a builtin J* module to bytecode, and writes it as a C header
+// that gets linked into libjstar. This lets the VM deserialize the builtin modules on startup,
+// skipping parsing and compilation.
+// This program is linked against a bootstrap build of the library (JSTAR_BOOTSTRAP), which
+// compiles the builtin modules from their embedded sources.
+// Usage: snapshot input.jsr output.jsc.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jstar.h"
+
+#define BYTES_PER_LINE 16
+
+static const char* WARNING =
+    "// WARNING: this is a file generated automatically by the build process. Do not modify.\n";
+
+// Name of the C variables holding the bytecode, i.e. `name_jsc` for `path/to/name.jsr`
+static void moduleName(const char* path, char* name, size_t size) {
+    const char* fileName = strrchr(path, '/');
+    fileName = fileName ? fileName + 1 : path;
+
+    size_t len = strcspn(fileName, ".");
+    if(len >= size) len = size - 1;
+
+    memcpy(name, fileName, len);
+    name[len] = '\0';
+}
+
+static bool writeHeader(const char* path, const char* name, const JStarBuffer* code) {
+    FILE* out = fopen(path, "w");
+    if(out == NULL) return false;
+
+    fputs(WARNING, out);
+    fprintf(out, "const unsigned char %s_jsc[] = {", name);
+
+    for(size_t i = 0; i < code->len; i++) {
+        if(i % BYTES_PER_LINE == 0) fputs("\n   ", out);
+        fprintf(out, " 0x%02x,", (unsigned char)code->data[i]);
+    }
+
+    fprintf(out, "\n};\n");
+    fprintf(out, "const size_t %s_jsc_len = %zu;\n", name, code->len);
+
+    return fclose(out) == 0;
+}
+
+int main(int argc, char** argv) {
+    if(argc != 3) {
+        fprintf(stderr, "Usage: %s input.jsr output.jsc.h\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char* inPath = argv[1];
+    const char* outPath = argv[2];
+
+    char* src = jsrReadFile(inPath);
+    if(src == NULL) {
+        fprintf(stderr, "Error reading ");
+        perror(inPath);
+        return EXIT_FAILURE;
+    }
+
+    JStarConf conf = jsrGetConf();
+    conf.moduleCache = false;
+    JStarVM* vm = jsrNewVM(&conf);
+
+    JStarBuffer code;
+    JStarResult res = jsrSerialize(vm, inPath, src, &code);
+    free(src);
+
+    if(res != JSR_EVAL_SUCCESS) {
+        jsrFreeVM(vm);
+        return EXIT_FAILURE;
+    }
+
+    char name[256];
+    moduleName(inPath, name, sizeof(name));
+
+    bool written = writeHeader(outPath, name, &code);
+    if(!written) {
+        fprintf(stderr, "Error writing ");
+        perror(outPath);
+    }
+
+    jsrBufferFree(&code);
+    jsrFreeVM(vm);
+    return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}